@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Animation.h"
+#include "GLStateCache.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+namespace {
+
+// dual quaternions are read as 8 consecutive floats: real xyzw, dual xyzw
+static_assert(sizeof(glm::dualquat) == 8 * sizeof(float), "unexpected glm::dualquat layout");
+
+// nlerp of W joints starting at j between frames 'a' and 'b' (element offsets)
+template <class V>
+void sample_batch(const JointTransforms& keys, size_t a, size_t b, size_t j, float alpha, JointTransforms& pose)
+{
+    const V t(alpha);
+
+    V ra[4], rb[4];
+    for (int c = 0; c < 4; ++c) {
+        ra[c] = V::load(keys.rotation[c].data() + a + j);
+        rb[c] = V::load(keys.rotation[c].data() + b + j);
+    }
+    // shortest arc
+    const V d = ra[0] * rb[0] + ra[1] * rb[1] + ra[2] * rb[2] + ra[3] * rb[3];
+    const V sign = select(d < V(0.0f), V(-1.0f), V(1.0f));
+    V r[4];
+    for (int c = 0; c < 4; ++c)
+        r[c] = ra[c] + (rb[c] * sign - ra[c]) * t;
+    const V inv = V(1.0f) / sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3]);
+    for (int c = 0; c < 4; ++c)
+        (r[c] * inv).store(pose.rotation[c].data() + j);
+
+    for (int c = 0; c < 3; ++c) {
+        const V ta = V::load(keys.translation[c].data() + a + j);
+        const V tb = V::load(keys.translation[c].data() + b + j);
+        (ta + (tb - ta) * t).store(pose.translation[c].data() + j);
+        const V sa = V::load(keys.scale[c].data() + a + j);
+        const V sb = V::load(keys.scale[c].data() + b + j);
+        (sa + (sb - sa) * t).store(pose.scale[c].data() + j);
+    }
+}
+
+template <class V>
+void cross(V ax, V ay, V az, V bx, V by, V bz, V& x, V& y, V& z)
+{
+    x = ay * bz - az * by;
+    y = az * bx - ax * bz;
+    z = ax * by - ay * bx;
+}
+
+// dual quaternion linear blending of W vertices starting at v
+template <class V>
+void skin_batch(const SkinnedMesh& mesh, const float* dq, size_t v, glm::vec3* out_positions, glm::vec3* out_normals)
+{
+    const int W = V::width;
+    uint32_t joint[4][W], vertex[W];
+    float weight[4][W];
+    for (int l = 0; l < W; ++l) {
+        for (int k = 0; k < 4; ++k) {
+            joint[k][l] = mesh.joints[v + l][k] * 8u;
+            weight[k][l] = mesh.weights[v + l][k];
+        }
+        vertex[l] = static_cast<uint32_t>((v + l) * 3);
+    }
+
+    V r[4], d[4], first[4];
+    const V w0 = V::load(weight[0]);
+    for (int c = 0; c < 4; ++c) {
+        first[c] = V::gather(dq + c, joint[0]);
+        r[c] = first[c] * w0;
+        d[c] = V::gather(dq + 4 + c, joint[0]) * w0;
+    }
+    for (int k = 1; k < 4; ++k) {
+        V q[4];
+        for (int c = 0; c < 4; ++c)
+            q[c] = V::gather(dq + c, joint[k]);
+        // keep all influences in the hemisphere of the first one
+        const V w = V::load(weight[k]);
+        const V dot = q[0] * first[0] + q[1] * first[1] + q[2] * first[2] + q[3] * first[3];
+        const V s = select(dot < V(0.0f), V(0.0f) - w, w);
+        for (int c = 0; c < 4; ++c) {
+            r[c] = r[c] + q[c] * s;
+            d[c] = d[c] + V::gather(dq + 4 + c, joint[k]) * s;
+        }
+    }
+    const V inv = V(1.0f) / sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3]);
+    for (int c = 0; c < 4; ++c) {
+        r[c] = r[c] * inv;
+        d[c] = d[c] * inv;
+    }
+
+    // translation = 2 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz))
+    V tx, ty, tz;
+    cross(r[0], r[1], r[2], d[0], d[1], d[2], tx, ty, tz);
+    tx = (r[3] * d[0] - d[3] * r[0] + tx) * V(2.0f);
+    ty = (r[3] * d[1] - d[3] * r[1] + ty) * V(2.0f);
+    tz = (r[3] * d[2] - d[3] * r[2] + tz) * V(2.0f);
+
+    // rotate: x + 2 * cross(r.xyz, cross(r.xyz, x) + r.w * x)
+    const float* positions = &mesh.positions[0].x;
+    V px = V::gather(positions, vertex), py = V::gather(positions + 1, vertex), pz = V::gather(positions + 2, vertex);
+    V cx, cy, cz, ex, ey, ez;
+    cross(r[0], r[1], r[2], px, py, pz, cx, cy, cz);
+    cross(r[0], r[1], r[2], cx + r[3] * px, cy + r[3] * py, cz + r[3] * pz, ex, ey, ez);
+    simd::store_vec3(out_positions + v, px + ex * V(2.0f) + tx, py + ey * V(2.0f) + ty, pz + ez * V(2.0f) + tz);
+
+    if (!out_normals)
+        return;
+    const float* normals = &mesh.normals[0].x;
+    V nx = V::gather(normals, vertex), ny = V::gather(normals + 1, vertex), nz = V::gather(normals + 2, vertex);
+    cross(r[0], r[1], r[2], nx, ny, nz, cx, cy, cz);
+    cross(r[0], r[1], r[2], cx + r[3] * nx, cy + r[3] * ny, cz + r[3] * nz, ex, ey, ez);
+    simd::store_vec3(out_normals + v, nx + ex * V(2.0f), ny + ey * V(2.0f), nz + ez * V(2.0f));
+}
+
+} // namespace
+
+void JointTransforms::resize(size_t count)
+{
+    for (auto& c : rotation)
+        c.resize(count);
+    for (auto& c : translation)
+        c.resize(count);
+    for (auto& c : scale)
+        c.resize(count);
+}
+
+void AnimationClip::resize(size_t frames, size_t joints)
+{
+    frame_count = frames;
+    joint_count = joints;
+    keys.resize(frames * joints);
+}
+
+void AnimationClip::set_key(size_t frame, size_t joint, const glm::quat& rotation, const glm::vec3& translation, const glm::vec3& scale)
+{
+    const size_t i = frame * joint_count + joint;
+    keys.rotation[0][i] = rotation.x;
+    keys.rotation[1][i] = rotation.y;
+    keys.rotation[2][i] = rotation.z;
+    keys.rotation[3][i] = rotation.w;
+    for (int c = 0; c < 3; ++c) {
+        keys.translation[c][i] = translation[c];
+        keys.scale[c][i] = scale[c];
+    }
+}
+
+void sample_clip(const AnimationClip& clip, float time, JointTransforms& pose)
+{
+    const size_t joints = clip.joint_count;
+    pose.resize(joints);
+    if (clip.frame_count == 0)
+        return;
+
+    float frame = 0.0f;
+    if (clip.frame_count > 1) {
+        const float duration = clip.duration();
+        time = std::fmod(time, duration);
+        if (time < 0.0f)
+            time += duration;
+        frame = time * clip.frame_rate;
+    }
+    const size_t f0 = std::min(static_cast<size_t>(frame), clip.frame_count - 1);
+    const size_t f1 = std::min(f0 + 1, clip.frame_count - 1);
+    const float alpha = frame - static_cast<float>(f0);
+
+    const size_t W = simd::floatv::width;
+    size_t j = 0;
+    for (; j + W <= joints; j += W)
+        sample_batch<simd::floatv>(clip.keys, f0 * joints, f1 * joints, j, alpha, pose);
+    for (; j < joints; ++j)
+        sample_batch<simd::float1>(clip.keys, f0 * joints, f1 * joints, j, alpha, pose);
+}
+
+void compute_model_matrices(const Skeleton& skeleton, const JointTransforms& pose, glm::mat4* model)
+{
+    for (size_t j = 0; j < skeleton.joint_count(); ++j) {
+        const glm::quat q(pose.rotation[3][j], pose.rotation[0][j], pose.rotation[1][j], pose.rotation[2][j]);
+        glm::mat4 local = glm::mat4_cast(q);
+        local[0] *= pose.scale[0][j];
+        local[1] *= pose.scale[1][j];
+        local[2] *= pose.scale[2][j];
+        local[3] = glm::vec4(pose.translation[0][j], pose.translation[1][j], pose.translation[2][j], 1.0f);
+
+        const int parent = skeleton.parents[j];
+        model[j] = parent < 0 ? local : model[parent] * local;
+    }
+}
+
+void compute_skinning_palette(const Skeleton& skeleton, const glm::mat4* model, glm::mat4* palette, glm::dualquat* dual_palette)
+{
+    for (size_t j = 0; j < skeleton.joint_count(); ++j) {
+        palette[j] = model[j] * skeleton.inverse_bind[j];
+        if (!dual_palette)
+            continue;
+        const glm::mat3 rotation(glm::normalize(glm::vec3(palette[j][0])),
+                                 glm::normalize(glm::vec3(palette[j][1])),
+                                 glm::normalize(glm::vec3(palette[j][2])));
+        dual_palette[j] = glm::dualquat(glm::quat_cast(rotation), glm::vec3(palette[j][3]));
+    }
+}
+
+void skin_dual_quaternion(const SkinnedMesh& mesh, const glm::dualquat* palette, size_t begin, size_t end,
+                          glm::vec3* out_positions, glm::vec3* out_normals)
+{
+    const float* dq = &palette[0].real.x;
+    if (mesh.normals.empty())
+        out_normals = NULL;
+
+    const size_t W = simd::floatv::width;
+    size_t v = begin;
+    for (; v + W <= end; v += W)
+        skin_batch<simd::floatv>(mesh, dq, v, out_positions, out_normals);
+    for (; v < end; ++v)
+        skin_batch<simd::float1>(mesh, dq, v, out_positions, out_normals);
+}
+
+AnimationSystem::~AnimationSystem()
+{
+    clear();
+}
+
+void AnimationSystem::clear(void)
+{
+    if (palette_buffer_ID)
+        glDeleteBuffers(1, &palette_buffer_ID);
+    palette_buffer_ID = 0;
+    palette_buffer_size = 0;
+}
+
+uint32_t AnimationSystem::add_skeleton(const Skeleton& skeleton)
+{
+    for (size_t j = 0; j < skeleton.joint_count(); ++j) {
+        if (skeleton.parents[j] >= static_cast<int>(j))
+            throw std::runtime_error("Skeleton joints must be stored parents first");
+    }
+    if (skeleton.joint_count() > MAX_JOINTS)
+        throw std::runtime_error("Skeleton has too many joints");
+    skeletons.push_back(skeleton);
+    return static_cast<uint32_t>(skeletons.size() - 1);
+}
+
+uint32_t AnimationSystem::add_clip(const AnimationClip& clip)
+{
+    clips.push_back(clip);
+    return static_cast<uint32_t>(clips.size() - 1);
+}
+
+uint32_t AnimationSystem::add_instance(uint32_t skeleton, uint32_t clip, float start_time, float speed)
+{
+    if (clips[clip].joint_count != skeletons[skeleton].joint_count())
+        throw std::runtime_error("Animation clip does not match the skeleton");
+
+    Instance instance;
+    instance.skeleton = skeleton;
+    instance.clip = clip;
+    instance.time = start_time;
+    instance.speed = speed;
+    instance.palette_offset = palette_size;
+    instances.push_back(instance);
+
+    palette_size += skeletons[skeleton].joint_count();
+    palettes.resize(palette_size, glm::mat4(1.0f));
+    dual_palettes.resize(palette_size, glm::dualquat(glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.0f)));
+    return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void AnimationSystem::update(float dt, bool dual_quaternions)
+{
+    size_t max_joints = 0;
+    for (const auto& skeleton : skeletons)
+        max_joints = std::max(max_joints, skeleton.joint_count());
+
+    ThreadPool::global().parallel_for(0, instances.size(), 16, [&](size_t begin, size_t end) {
+        JointTransforms pose;
+        pose.resize(max_joints);
+        std::vector<glm::mat4> model(max_joints);
+
+        for (size_t i = begin; i < end; ++i) {
+            Instance& instance = instances[i];
+            const Skeleton& skeleton = skeletons[instance.skeleton];
+            const AnimationClip& clip = clips[instance.clip];
+            // wrapped, an ever growing float time would advance in ever coarser steps
+            instance.time += dt * instance.speed;
+            if (clip.duration() > 0.0f) {
+                instance.time = std::fmod(instance.time, clip.duration());
+                if (instance.time < 0.0f)
+                    instance.time += clip.duration();
+            }
+
+            sample_clip(clip, instance.time, pose);
+            compute_model_matrices(skeleton, pose, model.data());
+            compute_skinning_palette(skeleton, model.data(), &palettes[instance.palette_offset],
+                                     dual_quaternions ? &dual_palettes[instance.palette_offset] : NULL);
+        }
+    });
+}
+
+void AnimationSystem::skin_cpu(const SkinnedMesh& mesh, const std::vector<uint32_t>& ids,
+                               std::vector<glm::vec3>& out_positions, std::vector<glm::vec3>& out_normals) const
+{
+    const size_t vertex_count = mesh.positions.size();
+    out_positions.resize(vertex_count * ids.size());
+    out_normals.resize(mesh.normals.empty() ? 0 : vertex_count * ids.size());
+
+    // work items are (instance, block of vertices) pairs
+    const size_t block = 1024;
+    const size_t blocks = (vertex_count + block - 1) / block;
+    ThreadPool::global().parallel_for(0, ids.size() * blocks, 1, [&](size_t begin, size_t end) {
+        for (size_t item = begin; item < end; ++item) {
+            const size_t i = item / blocks;
+            const size_t first = (item % blocks) * block;
+            const size_t last = std::min(vertex_count, first + block);
+            // shift output so that vertex v of instance i lands at i * vertex_count + v
+            glm::vec3* positions = out_positions.data() + i * vertex_count;
+            glm::vec3* normals = out_normals.empty() ? NULL : out_normals.data() + i * vertex_count;
+            skin_dual_quaternion(mesh, dual_palette(ids[i]), first, last, positions, normals);
+        }
+    });
+}
+
+void AnimationSystem::upload_palettes(void)
+{
+    const size_t bytes = palettes.size() * sizeof(glm::mat4);
+    if (bytes == 0)
+        return;
+    if (!palette_buffer_ID)
+        glCreateBuffers(1, &palette_buffer_ID);
+
+    // storage is only specified again when it has to grow, then to twice the size
+    if (bytes > palette_buffer_size) {
+        palette_buffer_size = std::max(bytes, palette_buffer_size * 2);
+        glNamedBufferData(palette_buffer_ID, palette_buffer_size, NULL, GL_DYNAMIC_DRAW);
+    }
+    // the driver keeps the previous frame's palettes for draws still reading them
+    glNamedBufferSubData(palette_buffer_ID, 0, bytes, palettes.data());
+}
+
+void AnimationSystem::bind_palettes_ssbo(GLuint binding) const
+{
+    GLStateCache::global().bind_buffer_range(GL_SHADER_STORAGE_BUFFER, binding, palette_buffer_ID);
+}
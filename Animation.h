@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#ifndef GLM_ENABLE_EXPERIMENTAL
+#define GLM_ENABLE_EXPERIMENTAL
+#endif
+#include <glm/gtx/dual_quaternion.hpp>
+
+// Joint hierarchy in a flat array, parents are stored before their children.
+struct Skeleton {
+    std::vector<int> parents;               // -1 for roots, otherwise parents[j] < j
+    std::vector<glm::mat4> inverse_bind;    // model space -> joint space
+
+    size_t joint_count(void) const { return parents.size(); }
+};
+
+// Joint transforms in structure-of-arrays layout, one float array per component,
+// so that SIMD code processes several joints per instruction.
+struct JointTransforms {
+    std::vector<float> rotation[4];         // quaternion x, y, z, w
+    std::vector<float> translation[3];
+    std::vector<float> scale[3];
+
+    void resize(size_t count);
+};
+
+// Uniformly resampled clip: frame f of joint j is element f * joint_count + j.
+struct AnimationClip {
+    float frame_rate = 30.0f;
+    size_t frame_count = 0;
+    size_t joint_count = 0;
+    JointTransforms keys;
+
+    void resize(size_t frames, size_t joints);
+    void set_key(size_t frame, size_t joint, const glm::quat& rotation, const glm::vec3& translation, const glm::vec3& scale = glm::vec3(1.0f));
+    float duration(void) const { return frame_count > 1 ? (frame_count - 1) / frame_rate : 0.0f; }
+};
+
+// Vertex data for CPU skinning; up to 4 influences, joint indices < 256.
+struct SkinnedMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::u8vec4> joints;
+    std::vector<glm::vec4> weights;         // sum to 1
+};
+
+// looping clip sampling, nlerp between the two surrounding frames
+void sample_clip(const AnimationClip& clip, float time, JointTransforms& pose);
+// local pose -> model space matrices, one linear pass thanks to parent-first order
+void compute_model_matrices(const Skeleton& skeleton, const JointTransforms& pose, glm::mat4* model);
+// model * inverse_bind, optionally also as dual quaternions (scale is dropped)
+void compute_skinning_palette(const Skeleton& skeleton, const glm::mat4* model, glm::mat4* palette, glm::dualquat* dual_palette);
+// dual quaternion linear blending of vertices [begin, end)
+void skin_dual_quaternion(const SkinnedMesh& mesh, const glm::dualquat* palette, size_t begin, size_t end,
+                          glm::vec3* out_positions, glm::vec3* out_normals);
+
+// Owns skeletons, clips and animated instances. update() samples and evaluates
+// all instances in parallel and writes one skinning palette per instance into
+// a shared array, which is uploaded to a single GL buffer for GPU skinning
+// (resources/shaders/skinning.glsl). Palettes of consecutively added
+// instances are packed back to back, joint_count() matrices each, so one
+// instanced draw skins them all. Dual quaternion palettes feed the
+// multi-threaded CPU skinning path.
+class AnimationSystem {
+public:
+    struct Instance {
+        uint32_t skeleton;
+        uint32_t clip;
+        float time;                         // within [0, clip duration)
+        float speed;
+        size_t palette_offset;              // first joint in the palette arrays
+    };
+
+    AnimationSystem() = default;
+    ~AnimationSystem();
+
+    AnimationSystem(const AnimationSystem&) = delete;
+    AnimationSystem& operator=(const AnimationSystem&) = delete;
+
+    uint32_t add_skeleton(const Skeleton& skeleton);
+    uint32_t add_clip(const AnimationClip& clip);
+    uint32_t add_instance(uint32_t skeleton, uint32_t clip, float start_time = 0.0f, float speed = 1.0f);
+
+    size_t instance_count(void) const { return instances.size(); }
+    const Instance& instance(uint32_t id) const { return instances[id]; }
+    size_t joint_count(uint32_t id) const { return skeletons[instances[id].skeleton].joint_count(); }
+
+    // advances time, samples clips, evaluates hierarchies and palettes
+    void update(float dt, bool dual_quaternions = false);
+
+    const glm::mat4* palette(uint32_t id) const { return &palettes[instances[id].palette_offset]; }
+    const glm::dualquat* dual_palette(uint32_t id) const { return &dual_palettes[instances[id].palette_offset]; }
+
+    // headless / software path: skin one mesh for every instance in 'ids',
+    // output is ids.size() consecutive copies of the mesh vertices
+    void skin_cpu(const SkinnedMesh& mesh, const std::vector<uint32_t>& ids,
+                  std::vector<glm::vec3>& out_positions, std::vector<glm::vec3>& out_normals) const;
+
+    // GPU path: whole palette array in one buffer, which grows but is never shrunk
+    void upload_palettes(void);
+    // shader storage binding of the buffer; the shader indexes it with
+    // instance(id).palette_offset + gl_InstanceID * joint_count(id)
+    void bind_palettes_ssbo(GLuint binding) const;
+    void clear(void);
+
+    // joint indices are bytes
+    static const size_t MAX_JOINTS = 256;
+
+private:
+    std::vector<Skeleton> skeletons;
+    std::vector<AnimationClip> clips;
+    std::vector<Instance> instances;
+    std::vector<glm::mat4> palettes;
+    std::vector<glm::dualquat> dual_palettes;
+    size_t palette_size = 0;
+
+    GLuint palette_buffer_ID = 0;
+    size_t palette_buffer_size = 0;         // allocated bytes
+};
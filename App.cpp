@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <numeric>
 #include <stack>
 #include <random>
 #include <chrono>
+#include <filesystem>
 #include <windows.h>
 
 
@@ -23,6 +28,32 @@
 // OpenGL math
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Animation.h"
+#include "BVH.h"
+#include "Benchmark.h"
+#include "CascadedShadows.h"
+#include "ClusteredLighting.h"
+#include "Collision.h"
+#include "Components.h"
+#include "Culling.h"
+#include "DeferredRenderer.h"
+#include "ECS.h"
+#include "GLResources.h"
+#include "GLStateCache.h"
+#include "OcclusionCulling.h"
+#include "ParticleSystem.h"
+#include "ProgramCache.h"
+#include "ProgramInterface.h"
+#include "RenderGraph.h"
+#include "ShaderLibrary.h"
+#include "StreamBuffer.h"
+#include "UniformBlocks.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "Terrain.h"
+#include "TextureStreamer.h"
 
 bool vsyncEnabled = false;
 
@@ -37,14 +68,182 @@ std::vector<vertex> vertices = {
     {glm::vec3(-0.5f, -0.5f,  0.0f)}
 };
 
+//per-object data for instanced drawing
+struct instance {
+    glm::mat4 model;
+    glm::vec4 color;
+};
+
+//skinned mesh vertex, joint indices are bytes the shader reads as floats
+struct skinned_vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::u8vec4 joints;
+    glm::vec4 weights;
+};
+
+const int SCENE_OBJECTS = 10000;
+const float SCENE_EXTENT = 50.0f;
+const float TRIANGLE_RADIUS = 0.71f;
+const int SCENE_WALLS = 8;
+const int SCENE_LIGHTS = 2000;
+const float NEAR_PLANE = 0.1f;
+const float LIGHT_CLUSTER_FAR = 200.0f;      // depth slicing ends here, beyond it one slice
+const glm::vec3 SUN_DIRECTION(-0.4f, -1.0f, -0.3f);     // from the sun into the scene
+const glm::vec3 SUN_COLOR(0.8f, 0.76f, 0.68f);
+const float CAMERA_RADIUS = 0.3f;
+const int SCENE_FIGURES = 24;
+const int FIGURE_JOINTS = 6;                // a chain, one joint every FIGURE_SEGMENT up
+const float FIGURE_SEGMENT = 0.5f;
+const int SCENE_TEXTURES = 8;               // generated when resources/textures is missing
+const int SCENE_TEXTURE_SIZE = 2048;
+
+// render queue layers, drawn in this order
+const uint8_t LAYER_TERRAIN = 0;
+const uint8_t LAYER_SCENE = 1;
+const uint8_t LAYER_EFFECTS = 2;
+
 class App {
     GLFWwindow* window = NULL;
 public:
 
     //new stuff
     GLuint shader_prog_ID;
-    GLuint VBO_ID;
-    GLuint VAO_ID;
+    GLuint translucent_prog_ID;
+    GLuint gbuffer_prog_ID;
+    GLuint shadow_prog_ID;
+    GLuint skinned_prog_ID;
+    GLuint skinned_gbuffer_prog_ID;
+    GLuint present_prog_ID;
+    GLuint VBO_ID = 0;
+    VertexFormat scene_format;          // mesh vertices at binding 0, instances at binding 1
+    VertexFormat fullscreen_format;     // no attributes, full screen passes make their triangle from gl_VertexID
+
+    // camera
+    glm::vec3 camera_position = glm::vec3(0.0f, 0.0f, 3.0f);
+    float camera_yaw = -90.0f;
+    float camera_pitch = 0.0f;
+    float camera_speed = 2.0f;
+    glm::mat4 projection_matrix = glm::mat4(1.0f);
+    glm::mat4 view_matrix = glm::mat4(1.0f);
+    glm::ivec2 framebuffer_size = glm::ivec2(0);
+
+    Terrain terrain;
+    ParticleSystem particles;
+
+    // scene objects
+    World world;
+    SystemScheduler systems;
+    std::vector<instance> scene_instances;
+    SphereBounds scene_bounds;
+    FrustumCuller scene_culler;
+    // occlusion culling of the frustum culled objects, boxes in draw order
+    OcclusionCuller occlusion;
+    std::vector<uint32_t> scene_visible;
+    std::vector<glm::vec3> occludee_box_min;
+    std::vector<glm::vec3> occludee_box_max;
+    std::vector<glm::vec3> terrain_occluder_vertices;
+    std::vector<uint32_t> terrain_occluder_indices;
+    // spatial index for picking, object i is scene_entities[i]
+    BVH scene_bvh;
+    std::vector<Entity> scene_entities;
+    std::vector<glm::vec3> scene_box_min;
+    std::vector<glm::vec3> scene_box_max;
+    // static geometry (the walls) and the moving objects bouncing off it and each other
+    CollisionMesh scene_collision;
+    CollisionWorld scene_physics;
+    std::vector<CollisionWorld::Body> scene_bodies;
+
+    // shader files and their variants
+    ShaderLibrary shaders;
+    // reflected scene programs
+    ProgramInterface scene_program;
+    ProgramInterface translucent_program;
+    ProgramInterface gbuffer_program;
+    ProgramInterface shadow_program;
+    Uniform<glm::mat4> shadow_light_matrix;
+    ProgramInterface skinned_program;
+    ProgramInterface skinned_gbuffer_program;
+
+    // per frame data (frame block, scene instances), written once, read by the GPU up to StreamBuffer::FRAMES later
+    StreamBuffer stream;
+    // material blocks, one per scene material, at multiples of material_block_stride
+    GLuint material_UBO_ID = 0;
+    GLsizeiptr material_block_stride = 0;
+
+    // block compressed textures, mip levels resident as far as their screen size asks and the budget allows
+    TextureStreamer textures;
+    std::vector<uint32_t> albedo_textures;      // handed out to the scene objects in turn
+    std::vector<uint32_t> scene_textures;       // next to scene_instances
+    std::vector<uint32_t> scene_order;          // draw order of the visible objects
+
+    // everything drawn in a frame, sorted by state and depth
+    RenderQueue render_queue;
+    uint16_t scene_material = 0;
+    uint16_t scene_translucent_material = 0;
+
+    // the frame's passes and their render targets, rebuilt every frame
+    RenderGraph frame_graph;
+
+    // point lights, gathered every frame and assigned to view space clusters
+    ClusteredLighting lighting;
+    SphereBounds light_bounds;
+    std::vector<glm::vec3> light_colors;
+
+    // sun shadows: the walls are drawn into the cascade caches, the moving objects every frame
+    CascadedShadows shadows;
+    SphereBounds static_casters, dynamic_casters;
+    std::vector<instance> static_caster_instances, dynamic_caster_instances;
+    struct CasterRange {
+        GLuint first_instance;
+        GLsizei count;
+    };
+    CasterRange caster_ranges[CascadedShadows::CASCADES][2] = {};     // [cascade][static]
+
+    // swaying figures, posed on the CPU and skinned on the GPU, all in one instanced draw
+    AnimationSystem animation;
+    VertexFormat skinned_format;        // skinned vertices at binding 0, instances at binding 1
+    GLuint skinned_VBO_ID = 0;
+    GLsizei skinned_vertex_count = 0;
+    std::vector<uint32_t> figures;      // animation instances, their palettes follow each other
+    std::vector<instance> figure_instances;
+    // the figures stand on a turning carousel and turn on their own too
+    SceneGraph scene_graph;
+    SceneGraph::Node carousel = SceneGraph::INVALID_NODE;
+    std::vector<SceneGraph::Node> figure_nodes;
+    float carousel_angle = 0.0f;
+
+    // G key: opaque objects through the G-buffer and tiled lighting instead of forward shading
+    bool deferred_shading = false;
+    DeferredRenderer deferred;
+    RenderQueue gbuffer_queue;
+    uint16_t gbuffer_material = 0;
+
+    // GPU time of the frame graph, read StreamBuffer::FRAMES frames later so nothing waits
+    GLuint gpu_timer_IDs[StreamBuffer::FRAMES] = {};
+    bool gpu_timer_pending[StreamBuffer::FRAMES] = {};
+    uint64_t gpu_timer_frame = 0;
+    double gpu_time_ms = 0.0;
+    int gpu_time_frames = 0;
+
+    void create_textures(void);
+    void create_scene(void);
+    void create_figures(void);
+    void update_figures(float dt);
+    void queue_figures(void);
+    void update_collisions(void);
+    void move_camera(const glm::vec3& motion);
+    void queue_scene(void);
+    void update_scene_bvh(void);
+    void pick_object(void);
+    void build_frame_graph(void);
+    void update_lights(void);
+    void queue_shadow_casters(void);
+    void render_shadows(void);
+
+    void update_projection_matrix(int width, int height);
+    void update_view_matrix(void);
+    glm::vec3 camera_front(void) const;
 
     void scroll_callback(double xoffset, double yoffset);
     void key_callback(int key, int scancode, int action, int mods);
@@ -84,6 +283,30 @@ if ((action == GLFW_PRESS) || (action == GLFW_REPEAT)){
             vsyncEnabled = !vsyncEnabled;
             glfwSwapInterval(vsyncEnabled ? 1 : 0);
             break;
+        case GLFW_KEY_P:
+            if (action == GLFW_PRESS) {
+                particles.set_path(particles.path() == ParticleSystem::Path::CPU ? ParticleSystem::Path::GPU : ParticleSystem::Path::CPU);
+                std::cout << "Particles simulated on the " << (particles.path() == ParticleSystem::Path::CPU ? "CPU" : "GPU") << '\n';
+            }
+            break;
+        case GLFW_KEY_G:
+            if (action == GLFW_PRESS) {
+                deferred_shading = !deferred_shading;
+                std::cout << "Shading: " << (deferred_shading ? "deferred" : "forward") << '\n';
+            }
+            break;
+        case GLFW_KEY_W:
+            move_camera(camera_front() * camera_speed);
+            break;
+        case GLFW_KEY_S:
+            move_camera(-camera_front() * camera_speed);
+            break;
+        case GLFW_KEY_A:
+            move_camera(-glm::normalize(glm::cross(camera_front(), glm::vec3(0.0f, 1.0f, 0.0f))) * camera_speed);
+            break;
+        case GLFW_KEY_D:
+            move_camera(glm::normalize(glm::cross(camera_front(), glm::vec3(0.0f, 1.0f, 0.0f))) * camera_speed);
+            break;
         default:
             break;
         }
@@ -95,7 +318,9 @@ void App::error_callback(int error, const char* description){
 }
 
 void App::fbsize_callback(int width, int height){
-    glViewport(0, 0, width, height);
+    GLStateCache::global().viewport(0, 0, width, height);
+    framebuffer_size = glm::ivec2(width, height);
+    update_projection_matrix(width, height);
 
     //        
     
@@ -116,11 +341,549 @@ void App::cursor_position_callback(double xpos, double ypos){
 
     lastX = xpos;
     lastY = ypos;
+
+    const double sensitivity = 0.1;
+    camera_yaw += static_cast<float>(xoffset * sensitivity);
+    camera_pitch = glm::clamp(camera_pitch + static_cast<float>(yoffset * sensitivity), -89.0f, 89.0f);
+}
+
+glm::vec3 App::camera_front(void) const {
+    return glm::normalize(glm::vec3(
+        cos(glm::radians(camera_yaw)) * cos(glm::radians(camera_pitch)),
+        sin(glm::radians(camera_pitch)),
+        sin(glm::radians(camera_yaw)) * cos(glm::radians(camera_pitch))));
+}
+
+void App::update_projection_matrix(int width, int height){
+    if (height <= 0)
+        return;
+    projection_matrix = glm::perspective(glm::radians(60.0f), static_cast<float>(width) / height, NEAR_PLANE, 20000.0f);
+    lighting.set_projection(projection_matrix, width, height, NEAR_PLANE, LIGHT_CLUSTER_FAR);
+}
+
+void App::update_lights(void){
+    light_bounds.resize(world.count<Transform, PointLight>());
+    light_colors.resize(light_bounds.size());
+    size_t n = 0;
+    world.each_chunk<Transform, PointLight>([this, &n](size_t count, const Entity*, Transform* transform, PointLight* light) {
+        for (size_t i = 0; i < count; ++i, ++n) {
+            light_bounds.set(n, transform[i].position, light[i].radius);
+            light_colors[n] = light[i].color;
+        }
+    });
+    lighting.assign(view_matrix, light_bounds);
+}
+
+void App::queue_shadow_casters(void){
+    shadows.update(view_matrix, projection_matrix, NEAR_PLANE, SUN_DIRECTION);
+
+    // every moving object may cast into view, camera culling does not apply
+    const size_t count = world.count<Transform, Velocity, Bounds, Renderable>();
+    dynamic_casters.resize(count);
+    dynamic_caster_instances.resize(count);
+    size_t n = 0;
+    world.each_chunk<Transform, Velocity, Bounds, Renderable>([this, &n](size_t chunk_count, const Entity*, Transform* transform, Velocity*, Bounds* bounds, Renderable*) {
+        for (size_t i = 0; i < chunk_count; ++i, ++n) {
+            dynamic_casters.set(n, transform[i].position, bounds[i].radius * transform[i].scale);
+            dynamic_caster_instances[n] = { transform[i].matrix(), glm::vec4(1.0f) };
+        }
+    });
+
+    // per cascade instance ranges; static casters only where the cache gets redrawn
+    for (int c = 0; c < CascadedShadows::CASCADES; ++c) {
+        for (const bool is_static : { false, true }) {
+            CasterRange& range = caster_ranges[c][is_static];
+            range = { 0, 0 };
+            if (is_static && !shadows.static_stale(c))
+                continue;
+            const std::vector<instance>& instances = is_static ? static_caster_instances : dynamic_caster_instances;
+            const std::vector<uint32_t>& visible = shadows.cull(c, is_static ? static_casters : dynamic_casters);
+            if (visible.empty())
+                continue;
+            const StreamBuffer::Allocation allocation = stream.allocate(visible.size() * sizeof(instance), sizeof(instance));
+            instance* out = static_cast<instance*>(allocation.data);
+            for (size_t i = 0; i < visible.size(); ++i)
+                out[i] = instances[visible[i]];
+            range = { static_cast<GLuint>(allocation.offset / sizeof(instance)), static_cast<GLsizei>(visible.size()) };
+        }
+    }
+}
+
+void App::render_shadows(void){
+    GLStateCache& state = GLStateCache::global();
+    shadows.render([this, &state](int cascade, bool is_static) {
+        const CasterRange& range = caster_ranges[cascade][is_static];
+        if (range.count == 0)
+            return;
+        state.use_program(shadow_prog_ID);
+        shadow_program.set(shadow_light_matrix, shadows.cascade(cascade).view_projection);
+        state.bind_vertex_array(scene_format.vao());
+        scene_format.vertex_buffer(0, VBO_ID, 0, sizeof(vertex));
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, static_cast<GLsizei>(vertices.size()), range.count, range.first_instance);
+    });
+    // the receivers sample it from here on
+    state.bind_texture(SHADOW_MAP_UNIT, GL_TEXTURE_2D_ARRAY, shadows.texture());
+}
+
+void App::update_view_matrix(void){
+    view_matrix = glm::lookAt(camera_position, camera_position + camera_front(), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+void App::create_textures(void){
+    // everything in resources/textures streams in while the scene already runs,
+    // block compressed (cooked once, then read from cache/textures), with
+    // only the small mips resident until something asks for more
+    if (std::filesystem::is_directory("resources/textures"))
+        for (const auto& file : std::filesystem::directory_iterator("resources/textures"))
+            if (file.is_regular_file())
+                albedo_textures.push_back(textures.add(file.path().string(), file.path().extension() == ".png" ? BlockFormat::BC3 : BlockFormat::BC1));
+    if (!albedo_textures.empty())
+        return;
+
+    // none shipped: checkers under stripes, cooked on the streamer's workers
+    for (int i = 0; i < SCENE_TEXTURES; ++i)
+        albedo_textures.push_back(textures.add("generated " + std::to_string(i), [i]() {
+            const int size = SCENE_TEXTURE_SIZE;
+            std::vector<unsigned char> rgba(static_cast<size_t>(size) * size * 4);
+            for (int y = 0; y < size; ++y)
+                for (int x = 0; x < size; ++x) {
+                    const float u = x / static_cast<float>(size), v = y / static_cast<float>(size);
+                    const bool checker = ((x >> (5 + i % 3)) + (y >> (5 + i % 3))) % 2 != 0;
+                    const float stripe = 0.75f + 0.25f * std::sin((u * (i + 1) + v * (8 - i)) * 40.0f);
+                    unsigned char* pixel = &rgba[(static_cast<size_t>(y) * size + x) * 4];
+                    for (int c = 0; c < 3; ++c)
+                        pixel[c] = static_cast<unsigned char>(255.0f * stripe * (checker ? 1.0f : 0.55f + 0.15f * ((i + c) % 3)));
+                    pixel[3] = 255;
+                }
+            return TextureCache::cook(rgba.data(), size, size, BlockFormat::BC1, true, NULL);
+        }));
+}
+
+void App::create_scene(void){
+    // the original triangle, in front of the initial camera
+    world.create(Transform{ glm::vec3(0.0f), 1.0f, glm::quat(1.0f, 0.0f, 0.0f, 0.0f) }, Bounds{ TRIANGLE_RADIUS }, Renderable{ glm::vec4(1.0f), albedo_textures[0] });
+
+    // drifting and spinning triangles around it
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    for (int i = 0; i < SCENE_OBJECTS; ++i) {
+        const Transform transform = { glm::vec3(unit(rng), unit(rng), unit(rng)) * SCENE_EXTENT, 1.0f + 0.5f * unit(rng),
+                                      glm::angleAxis(glm::pi<float>() * unit(rng), glm::vec3(0.0f, 1.0f, 0.0f)) };
+        const Velocity velocity = { glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f, unit(rng) * 3.0f };
+        // every eighth object is see-through
+        const Renderable renderable = { glm::vec4(0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng), i % 8 ? 1.0f : 0.5f),
+                                        albedo_textures[i % albedo_textures.size()] };
+        world.create(transform, velocity, Bounds{ TRIANGLE_RADIUS }, renderable);
+    }
+
+    // big static walls facing the center, they hide the objects behind them
+    for (int i = 0; i < SCENE_WALLS; ++i) {
+        const float angle = glm::two_pi<float>() * i / SCENE_WALLS;
+        const glm::vec3 position(20.0f * std::sin(angle), 0.0f, 20.0f * std::cos(angle));
+        const Transform transform = { position, 12.0f, glm::angleAxis(std::atan2(position.x, position.z), glm::vec3(0.0f, 1.0f, 0.0f)) };
+        world.create(transform, Bounds{ TRIANGLE_RADIUS }, Renderable{ glm::vec4(0.4f, 0.4f, 0.4f, 1.0f), albedo_textures[i % albedo_textures.size()] }, Occluder{});
+    }
+
+    // drifting point lights; no Bounds, they pass through everything
+    for (int i = 0; i < SCENE_LIGHTS; ++i) {
+        const Transform transform = { glm::vec3(unit(rng), unit(rng), unit(rng)) * SCENE_EXTENT, 1.0f, glm::quat(1.0f, 0.0f, 0.0f, 0.0f) };
+        const Velocity velocity = { glm::vec3(unit(rng), unit(rng), unit(rng)) * 3.0f, 0.0f };
+        const PointLight light = { glm::vec3(0.6f + 0.4f * unit(rng), 0.6f + 0.4f * unit(rng), 0.6f + 0.4f * unit(rng)), 4.0f + 2.0f * unit(rng) };
+        world.create(transform, velocity, light);
+    }
+
+    // the walls never move, their triangles are the static collision geometry
+    const glm::vec3 triangle[3] = { vertices[0].position, vertices[1].position, vertices[2].position };
+    const uint32_t triangle_indices[3] = { 0, 1, 2 };
+    world.each<Transform, Occluder>([this, &triangle, &triangle_indices](Entity, Transform& transform, Occluder&) {
+        scene_collision.add(triangle, triangle_indices, 3, transform.matrix());
+    });
+    scene_collision.build();
+    scene_physics.set_mesh(&scene_collision);
+
+    // ... and the static shadow casters
+    world.each<Transform, Bounds, Occluder>([this](Entity, Transform& transform, Bounds& bounds, Occluder&) {
+        static_casters.resize(static_casters.size() + 1);
+        static_casters.set(static_casters.size() - 1, transform.position, bounds.radius * transform.scale);
+        static_caster_instances.push_back({ transform.matrix(), glm::vec4(1.0f) });
+    });
+    scene_physics.restitution = 1.0f;
+
+    systems.add("movement", component_mask<Velocity>(), component_mask<Transform>(), [](World& world, CommandBuffer&, float dt) {
+        world.parallel_each_chunk<Transform, Velocity>([dt](size_t count, const Entity*, Transform* transform, Velocity* velocity) {
+            for (size_t i = 0; i < count; ++i) {
+                transform[i].position += velocity[i].linear * dt;
+                transform[i].rotation = glm::angleAxis(velocity[i].angular * dt, glm::vec3(0.0f, 1.0f, 0.0f)) * transform[i].rotation;
+            }
+        });
+    });
+    // keep objects inside the scene box
+    systems.add("bounds", component_mask<Transform>(), component_mask<Velocity>(), [](World& world, CommandBuffer&, float) {
+        world.parallel_each_chunk<Transform, Velocity>([](size_t count, const Entity*, Transform* transform, Velocity* velocity) {
+            for (size_t i = 0; i < count; ++i)
+                for (int axis = 0; axis < 3; ++axis)
+                    if (std::abs(transform[i].position[axis]) > SCENE_EXTENT && transform[i].position[axis] * velocity[i].linear[axis] > 0.0f)
+                        velocity[i].linear[axis] = -velocity[i].linear[axis];
+        });
+    });
+    systems.add("collision", component_mask<Bounds>(), component_mask<Transform, Velocity>(), [this](World&, CommandBuffer&, float) {
+        update_collisions();
+    });
+    systems.add("spatial index", component_mask<Transform, Bounds>(), 0, [this](World&, CommandBuffer&, float) {
+        update_scene_bvh();
+    });
+}
+
+void App::create_figures(void){
+    // a tapering tube around a chain of joints, every ring bound to the two joints around it
+    const int rings = 21, sides = 8;
+    const float height = FIGURE_SEGMENT * (FIGURE_JOINTS - 1);
+    SkinnedMesh mesh;
+    for (int r = 0; r < rings; ++r) {
+        const float y = height * r / (rings - 1);
+        const float radius = 0.3f - 0.2f * y / height;
+        const int joint = std::min(static_cast<int>(y / FIGURE_SEGMENT), FIGURE_JOINTS - 2);
+        const float weight = y / FIGURE_SEGMENT - joint;
+        for (int s = 0; s < sides; ++s) {
+            const float angle = glm::two_pi<float>() * s / sides;
+            const glm::vec3 normal(std::cos(angle), 0.0f, std::sin(angle));
+            mesh.positions.push_back(glm::vec3(0.0f, y, 0.0f) + normal * radius);
+            mesh.normals.push_back(normal);
+            mesh.joints.emplace_back(joint, joint + 1, 0, 0);
+            mesh.weights.emplace_back(1.0f - weight, weight, 0.0f, 0.0f);
+        }
+    }
+    // drawn without an index buffer, so the triangles are spelled out
+    std::vector<skinned_vertex> triangles;
+    for (int r = 0; r + 1 < rings; ++r)
+        for (int s = 0; s < sides; ++s) {
+            const int a = r * sides + s, b = r * sides + (s + 1) % sides;
+            for (const int v : { a, a + sides, b, b, a + sides, b + sides })
+                triangles.push_back({ mesh.positions[v], mesh.normals[v], mesh.joints[v], mesh.weights[v] });
+        }
+    skinned_vertex_count = static_cast<GLsizei>(triangles.size());
+    skinned_VBO_ID = gl::create_buffer(triangles.size() * sizeof(skinned_vertex), triangles.data());
+
+    Skeleton skeleton;
+    for (int j = 0; j < FIGURE_JOINTS; ++j) {
+        skeleton.parents.push_back(j - 1);
+        skeleton.inverse_bind.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -FIGURE_SEGMENT * j, 0.0f)));
+    }
+    // one second of swaying, a wave running up the chain; the last frame repeats the first
+    AnimationClip clip;
+    clip.resize(31, FIGURE_JOINTS);
+    for (size_t f = 0; f < clip.frame_count; ++f)
+        for (int j = 0; j < FIGURE_JOINTS; ++j) {
+            const float phase = glm::two_pi<float>() * f / (clip.frame_count - 1) - 0.8f * j;
+            const glm::quat bend = glm::angleAxis(0.25f * std::sin(phase), glm::vec3(0.0f, 0.0f, 1.0f))
+                                 * glm::angleAxis(0.15f * std::cos(phase), glm::vec3(1.0f, 0.0f, 0.0f));
+            clip.set_key(f, j, bend, glm::vec3(0.0f, j == 0 ? 0.0f : FIGURE_SEGMENT, 0.0f));
+        }
+
+    // a ring on the carousel below the start view, every figure out of step with its neighbours
+    const uint32_t skeleton_id = animation.add_skeleton(skeleton);
+    const uint32_t clip_id = animation.add_clip(clip);
+    carousel = scene_graph.create_node();
+    scene_graph.set_position(carousel, glm::vec3(0.0f, -4.0f, 0.0f));
+    for (int i = 0; i < SCENE_FIGURES; ++i) {
+        figures.push_back(animation.add_instance(skeleton_id, clip_id, 0.13f * i, 0.8f + 0.1f * (i % 4)));
+        const float angle = glm::two_pi<float>() * i / SCENE_FIGURES;
+        figure_nodes.push_back(scene_graph.create_node(carousel));
+        scene_graph.set_position(figure_nodes.back(), glm::vec3(8.0f * std::sin(angle), 0.0f, 8.0f * std::cos(angle)));
+        figure_instances.push_back({ glm::mat4(1.0f), glm::vec4(0.9f, 0.5f + 0.4f * std::sin(angle), 0.3f, 1.0f) });
+    }
+
+    // one draw covers all figures, starting at the first one's palette
+    for (ProgramInterface* program : { &skinned_program, &skinned_gbuffer_program }) {
+        program->set(program->uniform<GLuint>("uPaletteOffset"), static_cast<GLuint>(animation.instance(figures[0]).palette_offset));
+        program->set(program->uniform<GLuint>("uJointCount"), static_cast<GLuint>(animation.joint_count(figures[0])));
+    }
+}
+
+void App::update_collisions(void){
+    // moving objects as spheres, solved, then written back in the same order
+    scene_bodies.resize(world.count<Transform, Velocity, Bounds>());
+    size_t n = 0;
+    world.each_chunk<Transform, Velocity, Bounds>([this, &n](size_t chunk_count, const Entity*, Transform* transform, Velocity* velocity, Bounds* bounds) {
+        for (size_t i = 0; i < chunk_count; ++i, ++n)
+            scene_bodies[n] = { transform[i].position, bounds[i].radius * transform[i].scale, velocity[i].linear, 1.0f };
+    });
+
+    scene_physics.step(scene_bodies);
+
+    n = 0;
+    world.each_chunk<Transform, Velocity, Bounds>([this, &n](size_t chunk_count, const Entity*, Transform* transform, Velocity* velocity, Bounds*) {
+        for (size_t i = 0; i < chunk_count; ++i, ++n) {
+            transform[i].position = scene_bodies[n].position;
+            velocity[i].linear = scene_bodies[n].velocity;
+        }
+    });
+}
+
+void App::move_camera(const glm::vec3& motion){
+    // swept, so large steps cannot jump through a wall
+    camera_position = scene_collision.slide_sphere(camera_position, motion, CAMERA_RADIUS);
+}
+
+void App::update_scene_bvh(void){
+    // boxes around the world space bounding spheres, in query order
+    const size_t count = world.count<Transform, Bounds>();
+    bool rebuild = count != scene_entities.size();
+    scene_entities.resize(count);
+    scene_box_min.resize(count);
+    scene_box_max.resize(count);
+    size_t n = 0;
+    world.each_chunk<Transform, Bounds>([&](size_t chunk_count, const Entity* entities, Transform* transform, Bounds* bounds) {
+        for (size_t i = 0; i < chunk_count; ++i, ++n) {
+            const glm::vec3 r(bounds[i].radius * transform[i].scale);
+            rebuild |= scene_entities[n] != entities[i];
+            scene_entities[n] = entities[i];
+            scene_box_min[n] = transform[i].position - r;
+            scene_box_max[n] = transform[i].position + r;
+        }
+    });
+
+    // moving objects only refit the tree until its quality drops
+    if (rebuild || scene_bvh.needs_rebuild())
+        scene_bvh.build(scene_box_min.data(), scene_box_max.data(), count);
+    else
+        scene_bvh.refit(scene_box_min.data(), scene_box_max.data());
+}
+
+void App::pick_object(void){
+    double xpos, ypos;
+    int width, height;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    glfwGetWindowSize(window, &width, &height);
+
+    // ray through the cursor from the near to the far plane
+    const glm::vec4 viewport(0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height));
+    const glm::vec2 cursor(static_cast<float>(xpos), static_cast<float>(height - ypos));
+    const glm::vec3 near_point = glm::unProject(glm::vec3(cursor, 0.0f), view_matrix, projection_matrix, viewport);
+    const glm::vec3 far_point = glm::unProject(glm::vec3(cursor, 1.0f), view_matrix, projection_matrix, viewport);
+    const glm::vec3 direction = glm::normalize(far_point - near_point);
+
+    float distance;
+    const uint32_t hit = scene_bvh.raycast(near_point, direction, glm::length(far_point - near_point), distance,
+        [this](uint32_t object, const glm::vec3& origin, const glm::vec3& dir) {
+            const glm::mat4 model = world.get<Transform>(scene_entities[object])->matrix();
+            return intersect_triangle(origin, dir, glm::vec3(model * glm::vec4(vertices[0].position, 1.0f)),
+                                      glm::vec3(model * glm::vec4(vertices[1].position, 1.0f)), glm::vec3(model * glm::vec4(vertices[2].position, 1.0f)));
+        });
+    if (hit == BVH::INVALID_OBJECT) {
+        std::cout << "Nothing picked" << std::endl;
+        return;
+    }
+
+    const Entity entity = scene_entities[hit];
+    std::cout << "Picked object " << entity.index << " at distance " << distance << std::endl;
+    world.get<Renderable>(entity)->color = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+}
+
+void App::queue_scene(void){
+    const glm::mat4 view_projection = projection_matrix * view_matrix;
+
+    // world space bounding spheres next to the instance data of every object
+    const size_t count = world.count<Transform, Bounds, Renderable>();
+    scene_instances.resize(count);
+    scene_textures.resize(count);
+    scene_bounds.resize(count);
+    occludee_box_min.resize(count);
+    occludee_box_max.resize(count);
+    size_t n = 0;
+    world.each_chunk<Transform, Bounds, Renderable>([this, &n](size_t chunk_count, const Entity*, Transform* transform, Bounds* bounds, Renderable* renderable) {
+        for (size_t i = 0; i < chunk_count; ++i, ++n) {
+            const float radius = bounds[i].radius * transform[i].scale;
+            scene_bounds.set(n, transform[i].position, radius);
+            occludee_box_min[n] = transform[i].position - glm::vec3(radius);
+            occludee_box_max[n] = transform[i].position + glm::vec3(radius);
+            scene_instances[n] = { transform[i].matrix(), renderable[i].color };
+            scene_textures[n] = renderable[i].texture;
+        }
+    });
+
+    scene_visible = scene_culler.cull(Frustum::from_matrix(view_projection), scene_bounds);
+
+    // walls and terrain hide whatever lies behind them
+    occlusion.begin(view_projection);
+    const glm::vec3 triangle[3] = { vertices[0].position, vertices[1].position, vertices[2].position };
+    const uint32_t triangle_indices[3] = { 0, 1, 2 };
+    world.each<Transform, Occluder>([this, &triangle, &triangle_indices](Entity, Transform& transform, Occluder&) {
+        occlusion.add_occluder(triangle, triangle_indices, 3, transform.matrix());
+    });
+    if (!terrain_occluder_indices.empty())
+        occlusion.add_occluder(terrain_occluder_vertices.data(), terrain_occluder_indices.data(), terrain_occluder_indices.size(), glm::mat4(1.0f));
+    if (occlusion.occluder_triangles() > 0) {
+        occlusion.rasterize();
+        occlusion.filter(occludee_box_min.data(), occludee_box_max.data(), scene_visible);
+    }
+
+    // the visible objects tell the streamer how large their textures appear
+    for (uint32_t object : scene_visible) {
+        const glm::vec3 center(scene_bounds.x[object], scene_bounds.y[object], scene_bounds.z[object]);
+        textures.request(scene_textures[object], TextureStreamer::screen_size(scene_bounds.radius[object], glm::distance(camera_position, center),
+                                                                              projection_matrix[1][1], framebuffer_size.y));
+    }
+
+    // keep only visible objects, indices are ascending so compaction can run in place
+    for (size_t i = 0; i < scene_visible.size(); ++i) {
+        scene_instances[i] = scene_instances[scene_visible[i]];
+        scene_textures[i] = scene_textures[scene_visible[i]];
+    }
+    scene_instances.resize(scene_visible.size());
+    scene_textures.resize(scene_visible.size());
+
+    // opaque objects first, grouped by texture: each group is one instanced draw
+    scene_order.resize(scene_instances.size());
+    std::iota(scene_order.begin(), scene_order.end(), 0u);
+    std::sort(scene_order.begin(), scene_order.end(), [this](uint32_t a, uint32_t b) {
+        const bool opaque_a = scene_instances[a].color.a >= 1.0f, opaque_b = scene_instances[b].color.a >= 1.0f;
+        if (opaque_a != opaque_b)
+            return opaque_a;
+        return scene_textures[a] < scene_textures[b];
+    });
+    const size_t opaque_count = std::count_if(scene_instances.begin(), scene_instances.end(), [](const instance& i) { return i.color.a >= 1.0f; });
+
+    if (scene_instances.empty())
+        return;
+
+    // instance data goes to the stream buffer, aligned to its stride so draws address it by base instance
+    const StreamBuffer::Allocation allocation = stream.allocate(scene_instances.size() * sizeof(instance), sizeof(instance));
+    instance* out = static_cast<instance*>(allocation.data);
+    for (size_t i = 0; i < scene_order.size(); ++i)
+        out[i] = scene_instances[scene_order[i]];
+    const GLuint first_instance = static_cast<GLuint>(allocation.offset / sizeof(instance));
+
+    DrawCommand command;
+    command.program = deferred_shading ? gbuffer_prog_ID : shader_prog_ID;
+    command.vao = scene_format.vao();
+    command.vertex_buffer = VBO_ID;
+    command.vertex_stride = sizeof(vertex);
+    command.count = static_cast<GLsizei>(vertices.size());
+    command.material = deferred_shading ? gbuffer_material : scene_material;
+    for (size_t first = 0, last; first < opaque_count; first = last) {
+        const uint32_t texture = scene_textures[scene_order[first]];
+        for (last = first + 1; last < opaque_count && scene_textures[scene_order[last]] == texture; ++last)
+            ;
+        command.texture = textures.texture(texture);
+        command.instances = static_cast<GLsizei>(last - first);
+        command.base_instance = first_instance + static_cast<GLuint>(first);
+        (deferred_shading ? gbuffer_queue : render_queue).push(command, LAYER_SCENE, false, 0.0f);
+    }
+
+    // see-through objects one by one, the queue sorts them back to front
+    command.program = translucent_prog_ID;
+    command.material = scene_translucent_material;
+    command.instances = 1;
+    for (size_t i = opaque_count; i < scene_order.size(); ++i) {
+        const uint32_t object = scene_order[i];
+        command.texture = textures.texture(scene_textures[object]);
+        command.base_instance = first_instance + static_cast<GLuint>(i);
+        render_queue.push(command, LAYER_SCENE, true, glm::distance(camera_position, glm::vec3(scene_instances[object].model[3])));
+    }
+}
+
+void App::update_figures(float dt){
+    animation.update(dt);
+
+    // only the carousel and the figures' own turns are set, the graph composes them
+    carousel_angle += 0.2f * dt;
+    scene_graph.set_rotation(carousel, glm::angleAxis(carousel_angle, glm::vec3(0.0f, 1.0f, 0.0f)));
+    for (size_t i = 0; i < figure_nodes.size(); ++i)
+        scene_graph.set_rotation(figure_nodes[i], glm::angleAxis(-3.0f * carousel_angle + static_cast<float>(i), glm::vec3(0.0f, 1.0f, 0.0f)));
+    scene_graph.update();
+    for (size_t i = 0; i < figure_nodes.size(); ++i)
+        figure_instances[i].model = scene_graph.world_matrix(figure_nodes[i]);
+}
+
+void App::queue_figures(void){
+    if (figures.empty())
+        return;
+    // this frame's poses, read by the skinned programs through their palette binding
+    animation.upload_palettes();
+    animation.bind_palettes_ssbo(PALETTE_BUFFER_BINDING);
+
+    const StreamBuffer::Allocation allocation = stream.allocate(figure_instances.size() * sizeof(instance), sizeof(instance));
+    std::memcpy(allocation.data, figure_instances.data(), figure_instances.size() * sizeof(instance));
+
+    DrawCommand command;
+    command.program = deferred_shading ? skinned_gbuffer_prog_ID : skinned_prog_ID;
+    command.vao = skinned_format.vao();
+    command.vertex_buffer = skinned_VBO_ID;
+    command.vertex_stride = sizeof(skinned_vertex);
+    command.material = deferred_shading ? gbuffer_material : scene_material;
+    command.count = skinned_vertex_count;
+    command.instances = static_cast<GLsizei>(figure_instances.size());
+    command.base_instance = static_cast<GLuint>(allocation.offset / sizeof(instance));
+    (deferred_shading ? gbuffer_queue : render_queue).push(command, LAYER_SCENE, false, 0.0f);
+}
+
+void App::build_frame_graph(void){
+    const GLsizei width = framebuffer_size.x, height = framebuffer_size.y;
+    frame_graph.reset();
+    // minimized: nothing to draw into
+    if (width <= 0 || height <= 0)
+        return;
+    const RenderGraph::Handle backbuffer = frame_graph.import_backbuffer(width, height);
+
+    // kept across frames; writing an imported target keeps the pass alive
+    const RenderGraph::Handle shadow_map = frame_graph.import_texture("shadow cascades", shadows.texture(),
+                                                                      { shadows.resolution(), shadows.resolution(), GL_DEPTH_COMPONENT32F });
+    frame_graph.add_pass("shadows", [&](RenderGraph::Builder& pass) {
+        // the cascades bind framebuffers of their own, one per layer
+        pass.write_unattached(shadow_map);
+    }, [this](const RenderGraph::Resources&) {
+        render_shadows();
+    });
+
+    // the sorted queue into an offscreen target, post processing passes go between it and present
+    RenderGraph::Handle scene_color = RenderGraph::INVALID;
+    if (deferred_shading) {
+        // opaque objects lit per tile, then the rest of the queue forward on top, depth tested against them
+        const DeferredRenderer::Targets targets = deferred.add_passes(frame_graph, width, height, shadow_map, [this]() { gbuffer_queue.submit(); });
+        scene_color = targets.color;
+        frame_graph.add_pass("forward", [&](RenderGraph::Builder& pass) {
+            pass.read(shadow_map);
+            pass.write(targets.color);
+            pass.write(targets.depth);
+        }, [this](const RenderGraph::Resources&) {
+            render_queue.submit();
+        });
+    }
+    else {
+        frame_graph.add_pass("scene", [&](RenderGraph::Builder& pass) {
+            pass.read(shadow_map);
+            scene_color = pass.create("scene color", { width, height, GL_RGBA8 });
+            pass.write(scene_color);
+            pass.write(pass.create("scene depth", { width, height, GL_DEPTH_COMPONENT32F }));
+        }, [this](const RenderGraph::Resources&) {
+            GLStateCache& state = GLStateCache::global();
+            state.depth_mask(true);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            render_queue.submit();
+        });
+    }
+
+    frame_graph.add_pass("present", [&](RenderGraph::Builder& pass) {
+        pass.read(scene_color);
+        pass.write(backbuffer);
+    }, [this, scene_color](const RenderGraph::Resources& resources) {
+        GLStateCache& state = GLStateCache::global();
+        state.set_enabled(GL_DEPTH_TEST, false);
+        state.set_enabled(GL_BLEND, false);
+        state.use_program(present_prog_ID);
+        state.bind_vertex_array(fullscreen_format.vao());
+        state.bind_texture(0, GL_TEXTURE_2D, resources.texture(scene_color));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        state.set_enabled(GL_DEPTH_TEST, true);
+    });
+    frame_graph.compile();
 }
 
 void App::mouse_button_callback(int button, int action, int mods){
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
         std::cout << "Left mouse button pressed" << std::endl;
+        pick_object();
     }
     else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
         std::cout << "Left mouse button released" << std::endl;
@@ -225,15 +988,27 @@ void App::init()
         // https://www.glfw.org/documentation.html
         glfwInit();
 
-        // open window (GL canvas) with no special properties
+        // context hints apply to the next window, so they go before it
+        // https://www.glfw.org/docs/latest/window_guide.html#window_hints_ctx
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+        // open window (GL canvas)
         // https://www.glfw.org/docs/latest/quick.html#quick_create_window
         window = glfwCreateWindow(800, 600, "OpenGL context", NULL, NULL);
+        if (!window)
+            throw std::runtime_error("OpenGL 4.5 core context not available");
         glfwMakeContextCurrent(window);
 
-        // init glew
+        // init glew, core profiles need the experimental entry point lookup
         // http://glew.sourceforge.net/basic.html
+        glewExperimental = GL_TRUE;
         glewInit();
         wglewInit();
+        // all GL objects are created through direct state access
+        if (!GLEW_VERSION_4_5 && !GLEW_ARB_direct_state_access)
+            throw std::runtime_error("Direct state access (GL 4.5) not supported");
 
         if (glfwExtensionSupported("ARB_debug_output")){
             glDebugMessageCallback(MessageCallback_tr, 0);
@@ -245,11 +1020,6 @@ void App::init()
             std::cout << "GL_DEBUG enabled." << std::endl;
         }else std::cout << "GL_DEBUG NOT SUPPORTED!" << std::endl;
 
-        // https://www.glfw.org/docs/latest/quick.html#quick_create_window
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-        
 
         GLint major, minor;
         glGetIntegerv(GL_MAJOR_VERSION, &major);
@@ -271,7 +1041,7 @@ void App::init()
             std::cout << "Pending GL error while obtaining profile: " << errorCode << std::endl;
             return;
         }
-        if (profile && GL_CONTEXT_CORE_PROFILE_BIT) {
+        if (profile & GL_CONTEXT_CORE_PROFILE_BIT) {
             std::cout << "Core profile" << std::endl;
         }
         else {
@@ -284,57 +1054,148 @@ void App::init()
         glfwSetScrollCallback(window, scroll_callback_tr);
         glfwSwapInterval(vsyncEnabled ? 1 : 0);
 
+        // all binds and fixed function state go through the state cache from here on
+        GLStateCache& state = GLStateCache::global();
+        state.set_enabled(GL_DEPTH_TEST, true);
+        {
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            framebuffer_size = glm::ivec2(width, height);
+            update_projection_matrix(width, height);
+        }
+
         // DATA FOR GPU
-        // create VAO = data description
-        glGenVertexArrays(1, &VAO_ID);
-        glBindVertexArray(VAO_ID);
+        // vertex format = data description: mesh vertices at binding 0,
+        // per-instance model matrix (4 x vec4) and color at binding 1
+        std::vector<VertexFormat::Attribute> attributes = { { 0, 3, GL_FLOAT, offsetof(vertex, position), 0 } };
+        for (GLuint column = 0; column < 4; ++column)
+            attributes.push_back({ 1 + column, 4, GL_FLOAT, static_cast<GLuint>(offsetof(instance, model) + column * sizeof(glm::vec4)), 1 });
+        attributes.push_back({ 5, 4, GL_FLOAT, offsetof(instance, color), 1 });
+        scene_format.init_gl(attributes, { 0, 1 });
+        fullscreen_format.init_gl({});
+        // the skinned format: the same instance attributes, the vertex brings its normal and joints
+        attributes[0] = { 0, 3, GL_FLOAT, offsetof(skinned_vertex, position), 0 };
+        attributes.push_back({ 6, 3, GL_FLOAT, offsetof(skinned_vertex, normal), 0 });
+        attributes.push_back({ 7, 4, GL_UNSIGNED_BYTE, offsetof(skinned_vertex, joints), 0 });
+        attributes.push_back({ 8, 4, GL_FLOAT, offsetof(skinned_vertex, weights), 0 });
+        skinned_format.init_gl(attributes, { 0, 1 });
+
+        // mesh vertices, attached to binding 0 per draw by the render queue
+        VBO_ID = gl::create_buffer(vertices.size() * sizeof(vertex), vertices.data());
+
+        // instances are streamed every frame, draws pick theirs by base instance
+        stream.init_gl();
+        scene_format.vertex_buffer(1, stream.buffer(), 0, sizeof(instance));
+        skinned_format.vertex_buffer(1, stream.buffer(), 0, sizeof(instance));
+        lighting.init_gl();
+        shadows.init_gl();
 
-        // create vertex buffer and fill with data
-        glGenBuffers(1, &VBO_ID);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_ID);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex), vertices.data(), GL_STATIC_DRAW);
+        //SHADERS
+        //linked programs are cached as driver binaries, compiled only on the first run
+        ProgramCache& programs = ProgramCache::global();
+        programs.init_gl();
+
+        const uint32_t basic_shader = shaders.add_program("Scene", { { GL_VERTEX_SHADER, "basic.vert" }, { GL_FRAGMENT_SHADER, "basic.frag" } });
+        const uint32_t present_shader = shaders.add_program("Present", { { GL_VERTEX_SHADER, "fullscreen.vert" }, { GL_FRAGMENT_SHADER, "present.frag" } });
+        const uint32_t deferred_lighting_shader = shaders.add_program("Deferred lighting", { { GL_COMPUTE_SHADER, "deferred_lighting.comp" } });
+        const uint32_t shadow_shader = shaders.add_program("Shadow", { { GL_VERTEX_SHADER, "shadow.vert" }, { GL_FRAGMENT_SHADER, "shadow.frag" } });
+        const uint32_t translucent = shaders.feature("TRANSLUCENT");
+        const uint32_t gbuffer = shaders.feature("GBUFFER");
+        const uint32_t skinned = shaders.feature("SKINNED");
+        const uint32_t textured = shaders.feature("TEXTURED");
+        shaders.precompile({ { basic_shader, textured }, { basic_shader, textured | translucent }, { basic_shader, textured | gbuffer }, { basic_shader, skinned },
+                             { basic_shader, skinned | gbuffer }, { present_shader, 0 }, { deferred_lighting_shader, 0 }, { shadow_shader, 0 } });
+        shader_prog_ID = shaders.get(basic_shader, textured);
+        translucent_prog_ID = shaders.get(basic_shader, textured | translucent);
+        gbuffer_prog_ID = shaders.get(basic_shader, textured | gbuffer);
+        skinned_prog_ID = shaders.get(basic_shader, skinned);
+        skinned_gbuffer_prog_ID = shaders.get(basic_shader, skinned | gbuffer);
+        present_prog_ID = shaders.get(present_shader);
+        shadow_prog_ID = shaders.get(shadow_shader);
+        deferred.init_gl(shaders.get(deferred_lighting_shader));
+
+        scene_program.reflect(shader_prog_ID);
+        translucent_program.reflect(translucent_prog_ID);
+        gbuffer_program.reflect(gbuffer_prog_ID);
+        shadow_program.reflect(shadow_prog_ID);
+        skinned_program.reflect(skinned_prog_ID);
+        skinned_gbuffer_program.reflect(skinned_gbuffer_prog_ID);
+        shadow_light_matrix = shadow_program.uniform<glm::mat4>("uLightViewProjection");
+        // the VAOs above feed fixed attribute locations
+        for (const auto& input : { std::make_pair("aPosition", 0), std::make_pair("aModel", 1), std::make_pair("aColor", 5) })
+            if (scene_program.attribute_location(input.first) != input.second)
+                throw std::runtime_error(std::string("Scene shader input ") + input.first + " is not at the expected location");
+        for (const auto& input : { std::make_pair("aNormal", 6), std::make_pair("aJoints", 7), std::make_pair("aWeights", 8) })
+            if (skinned_program.attribute_location(input.first) != input.second)
+                throw std::runtime_error(std::string("Skinned shader input ") + input.first + " is not at the expected location");
+        for (ProgramInterface* program : { &scene_program, &translucent_program, &gbuffer_program, &skinned_program, &skinned_gbuffer_program }) {
+            program->bind_uniform_block("Frame", FRAME_BLOCK_BINDING);
+            program->bind_uniform_block("Material", MATERIAL_BLOCK_BINDING);
+            program->bind_uniform_block("Lighting", LIGHTING_BLOCK_BINDING);
+            program->bind_storage_block("Lights", LIGHT_BUFFER_BINDING);
+            program->bind_storage_block("Clusters", CLUSTER_BUFFER_BINDING);
+            program->bind_storage_block("LightIndices", LIGHT_INDEX_BUFFER_BINDING);
+            program->bind_uniform_block("Shadows", SHADOW_BLOCK_BINDING);
+            program->bind_storage_block("Palettes", PALETTE_BUFFER_BINDING);
+            program->set(program->uniform<GLint>("uShadowMap"), static_cast<GLint>(SHADOW_MAP_UNIT));
+        }
+        // the streamed albedo maps come as the draw's texture, on unit 0
+        for (ProgramInterface* program : { &scene_program, &translucent_program, &gbuffer_program })
+            program->set(program->uniform<GLint>("uAlbedoMap"), 0);
+
+        // material blocks never change, they live in one static buffer
+        const MaterialBlock material_blocks[] = { { glm::vec4(1.0f), glm::vec2(0.5f, 0.6f) }, { glm::vec4(1.0f), glm::vec2(0.8f, 0.9f) } };
+        material_block_stride = static_cast<GLsizeiptr>(glsl::round_up(sizeof(MaterialBlock), stream.uniform_alignment()));
+        std::vector<unsigned char> material_data(std::size(material_blocks) * material_block_stride);
+        for (size_t i = 0; i < std::size(material_blocks); ++i)
+            std::memcpy(&material_data[i * material_block_stride], &material_blocks[i], sizeof(MaterialBlock));
+        material_UBO_ID = gl::create_buffer(material_data.size(), material_data.data());
+
+        // scene materials: opaque, and alpha blended drawn back to front
+        scene_material = render_queue.add_material([this]() {
+            GLStateCache& state = GLStateCache::global();
+            state.set_enabled(GL_BLEND, false);
+            state.bind_buffer_range(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, material_UBO_ID, 0, sizeof(MaterialBlock));
+        });
+        scene_translucent_material = render_queue.add_material([this]() {
+            GLStateCache& state = GLStateCache::global();
+            state.set_enabled(GL_BLEND, true);
+            state.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            state.bind_buffer_range(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, material_UBO_ID, material_block_stride, sizeof(MaterialBlock));
+        });
+        gbuffer_material = gbuffer_queue.add_material([this]() {
+            GLStateCache& state = GLStateCache::global();
+            state.set_enabled(GL_BLEND, false);
+            state.bind_buffer_range(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, material_UBO_ID, 0, sizeof(MaterialBlock));
+        });
+        glCreateQueries(GL_TIME_ELAPSED, StreamBuffer::FRAMES, gpu_timer_IDs);
+
+        // TERRAIN
+        // optional, only when a heightmap is shipped next to the executable
+        if (std::filesystem::exists("resources/heightmap.png")) {
+            terrain.load("resources/heightmap.png");
+            terrain.occluder_mesh(terrain_occluder_vertices, terrain_occluder_indices);
+            camera_position = terrain.center() + glm::vec3(0.0f, 50.0f, 0.0f);
+            camera_speed = 20.0f;
+        }
 
-        //explain GPU the memory layout of the data...
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), reinterpret_cast<void*>(0 + offsetof(vertex, position)));
-        glEnableVertexAttribArray(0);
+        // TEXTURES
+        // the scene objects sample them
+        textures.init_gl();
+        create_textures();
 
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        // SCENE
+        create_scene();
+        create_figures();
 
-        //SHADERS
-        //compile & link
-        const char* vertex_shader =
-            "#version 330\n"
-            "layout (location = 0) in vec3 aPosition;"
-            "void main() {"
-            "  gl_Position = vec4(aPosition, 1.0);"
-            "}";
-
-        const char* fragment_shader =
-            "#version 330\n"
-            "uniform vec4 uColor;"
-            "out vec4 FragColor;"
-            "void main() {"
-            "  FragColor = uColor;"
-            "}";
-
-        GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vs, 1, &vertex_shader, NULL);
-        glCompileShader(vs);
-
-        GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fs, 1, &fragment_shader, NULL);
-        glCompileShader(fs);
-
-        shader_prog_ID = glCreateProgram();
-        glAttachShader(shader_prog_ID, fs);
-        glAttachShader(shader_prog_ID, vs);
-        glLinkProgram(shader_prog_ID);
-
-        //now we can delete shader parts, we have final program
-        glDeleteShader(vs);
-        glDeleteShader(fs);
+        // PARTICLES
+        // fountain on the ground below the scene (or on the terrain)
+        particles.emitter.position = terrain.is_loaded() ? terrain.center() : glm::vec3(0.0f, -SCENE_EXTENT, 0.0f);
+        particles.forces.ground_height = particles.emitter.position.y;
+        particles.init_gl();
+
+        std::cout << "Programs: " << programs.hits() << " from cache (" << programs.load_ms() << " ms), "
+                  << programs.misses() << " compiled (" << programs.build_ms() << " ms)\n";
     }
     catch (std::exception const& e) {
         std::cerr << "Init failed : " << e.what() << std::endl;
@@ -347,8 +1208,6 @@ void App::init()
 int App::run(void)
 {
     try {
-        GLfloat r, g, b, a;
-        r = g = b = a = 1.0f;
         while (!glfwWindowShouldClose(window)){
 
             auto start = std::chrono::steady_clock::now();
@@ -361,21 +1220,73 @@ int App::run(void)
             // clear canvas
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+            GLStateCache& state = GLStateCache::global();
             //activate shader related to 3D object
-            glUseProgram(shader_prog_ID);
-            //set uniform parameter for shader         
-            glUniform4f(glGetUniformLocation(shader_prog_ID, "uColor"), r, g, b, a);
+            state.use_program(shader_prog_ID);
             //bind 3d object data
-            glBindVertexArray(VAO_ID);
-
-
-            while (true) {
-
-                // Clear OpenGL canvas, both color buffer and Z-buffer
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-                // draw all VAO data
-                glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+            state.bind_vertex_array(scene_format.vao());
+
+
+            std::chrono::steady_clock::time_point previousFrame = startTime;
+            while (!glfwWindowShouldClose(window)) {
+
+                // advance the simulation by the real frame time
+                std::chrono::steady_clock::time_point frameTime = std::chrono::steady_clock::now();
+                float dt = std::chrono::duration<float>(frameTime - previousFrame).count();
+                previousFrame = frameTime;
+                systems.run(world, dt);
+                update_figures(dt);
+                particles.update(dt);
+                // streams what the last frame's visible objects asked for
+                textures.update();
+
+                update_view_matrix();
+
+                // per frame constants, shared by all programs through one block binding
+                stream.begin_frame();
+                const StreamBuffer::Allocation frame_allocation = stream.allocate(sizeof(FrameBlock), stream.uniform_alignment());
+                FrameBlock& frame = *static_cast<FrameBlock*>(frame_allocation.data);
+                frame.view = view_matrix;
+                frame.projection = projection_matrix;
+                frame.view_projection = projection_matrix * view_matrix;
+                frame.camera_position = camera_position;
+                frame.time = static_cast<float>(glfwGetTime());
+                state.bind_buffer_range(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, stream.buffer(), frame_allocation.offset, sizeof(FrameBlock));
+                // light lists per cluster, streamed next to the frame block
+                update_lights();
+                lighting.upload(stream, light_colors, glm::vec3(0.15f));
+                // cascades fitted to this view, their casters culled per cascade
+                queue_shadow_casters();
+                const StreamBuffer::Allocation shadow_allocation = stream.allocate(sizeof(ShadowBlock), stream.uniform_alignment());
+                *static_cast<ShadowBlock*>(shadow_allocation.data) = shadows.block(view_matrix, SUN_COLOR);
+                state.bind_buffer_range(GL_UNIFORM_BUFFER, SHADOW_BLOCK_BINDING, stream.buffer(), shadow_allocation.offset, sizeof(ShadowBlock));
+
+                // collect the frame's draws, sort them by state and depth, submit
+                render_queue.clear();
+                gbuffer_queue.clear();
+                if (terrain.is_loaded())
+                    render_queue.push_custom([this]() { terrain.draw(projection_matrix * view_matrix, camera_position); }, LAYER_TERRAIN, false, 0.0f);
+                queue_scene();
+                queue_figures();
+                render_queue.push_custom([this]() { particles.draw(projection_matrix * view_matrix, view_matrix); }, LAYER_EFFECTS, true, 0.0f);
+                stream.flush();
+                render_queue.sort();
+                gbuffer_queue.sort();
+                // the scene pass clears its targets and submits the queue
+                build_frame_graph();
+                const size_t timer = gpu_timer_frame++ % StreamBuffer::FRAMES;
+                if (gpu_timer_pending[timer]) {
+                    GLuint64 ns = 0;
+                    glGetQueryObjectui64v(gpu_timer_IDs[timer], GL_QUERY_RESULT, &ns);
+                    gpu_time_ms += ns * 1e-6;
+                    ++gpu_time_frames;
+                }
+                glBeginQuery(GL_TIME_ELAPSED, gpu_timer_IDs[timer]);
+                frame_graph.execute();
+                glEndQuery(GL_TIME_ELAPSED);
+                gpu_timer_pending[timer] = true;
+                stream.end_frame();
+                state.end_frame();
 
                 // poll events, call callbacks, flip back<->front buffer
                 glfwPollEvents();
@@ -387,7 +1298,19 @@ int App::run(void)
                 std::chrono::duration<double> elapsedTime = currentTime - lastTime;
                 if (elapsedTime.count() >= 1.0) {
                     double fps = static_cast<double>(frameCount) / elapsedTime.count();
-                    std::cout << "FPS: " << fps << std::endl;
+                    std::cout << "FPS: " << fps << ", visible objects: " << scene_instances.size() << '/' << world.count<Renderable>()
+                              << ", particles: " << particles.size() << ", textures loading: " << textures.pending() << " (" << textures.resident_bytes() / (1 << 20) << '/' << textures.budget / (1 << 20) << " MB resident), draws: " << render_queue.sorted_stats().draws
+                              << ", program/VAO switches: " << render_queue.sorted_stats().program_switches << '/' << render_queue.sorted_stats().vao_switches
+                              << " (unsorted " << render_queue.unsorted_stats().program_switches << '/' << render_queue.unsorted_stats().vao_switches << ')'
+                              << ", GL calls issued/skipped: " << state.last_frame().issued << '/' << state.last_frame().skipped
+                              << ", texture binds: " << state.last_frame().texture_binds << " (sorted " << render_queue.sorted_stats().texture_switches
+                              << ", unsorted " << render_queue.unsorted_stats().texture_switches << ')'
+                              << ", render targets: " << frame_graph.pool_bytes() / (1 << 20) << " MB (" << frame_graph.stats().transient_bytes / (1 << 20) << " MB unaliased)"
+                              << ", lights: " << light_bounds.size() << " (" << lighting.indices().size() << " cluster entries, " << lighting.dropped_indices() << " dropped, max " << lighting.max_cluster_lights() << " per cluster)"
+                              << ", shadow caches redrawn: " << shadows.stats().static_renders_total << '/' << shadows.stats().frames * CascadedShadows::CASCADES << " cascades"
+                              << ", " << (deferred_shading ? "deferred" : "forward") << " shading, GPU " << gpu_time_ms / std::max(gpu_time_frames, 1) << " ms/frame" << std::endl;
+                    gpu_time_ms = 0.0;
+                    gpu_time_frames = 0;
                     frameCount = 0;
                     lastTime = currentTime;
                 }
@@ -411,9 +1334,25 @@ int App::run(void)
 
 App::~App()
 {
-    //new stuff: cleanup GL data
-    glDeleteProgram(shader_prog_ID);
-    glDeleteVertexArrays(1, &VAO_ID);
+    //new stuff: cleanup GL data (nothing was created in benchmark mode)
+    if (window) {
+        shaders.clear();
+        scene_format.clear();
+        skinned_format.clear();
+        fullscreen_format.clear();
+        frame_graph.clear();
+        shadows.clear();
+        glDeleteBuffers(1, &VBO_ID);
+        glDeleteBuffers(1, &skinned_VBO_ID);
+        animation.clear();
+        glDeleteBuffers(1, &material_UBO_ID);
+        glDeleteQueries(StreamBuffer::FRAMES, gpu_timer_IDs);
+        GLStateCache::global().invalidate();
+        stream.clear();
+        terrain.clear();
+        particles.clear();
+        textures.clear();
+    }
 
     // clean-up
     cv::destroyAllWindows();
@@ -427,7 +1366,11 @@ App::~App()
 
 
 
-int main(){
+int main(int argc, char* argv[]){
+    // benchmark mode: "PG2-Project.exe --bench [name]"
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+        return run_benchmarks(argc > 2 ? argv[2] : "");
+
     app.init();
     return app.run();
 }
\ No newline at end of file
@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "BVH.h"
+#include "ThreadPool.h"
+
+namespace {
+
+const int BINS = 16;
+const float TRAVERSAL_COST = 1.0f;
+// subtrees larger than this build their children in parallel
+const uint32_t PARALLEL_BUILD_SIZE = 16384;
+
+float half_area(const glm::vec3& box_min, const glm::vec3& box_max)
+{
+    const glm::vec3 e = glm::max(box_max - box_min, glm::vec3(0.0f));
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+// slab test, returns the entry distance or FLT_MAX on miss
+float intersect_box(const glm::vec3& box_min, const glm::vec3& box_max, const glm::vec3& origin, const glm::vec3& inv_direction, float max_t)
+{
+    const glm::vec3 t0 = (box_min - origin) * inv_direction;
+    const glm::vec3 t1 = (box_max - origin) * inv_direction;
+    const glm::vec3 near_t = glm::min(t0, t1);
+    const glm::vec3 far_t = glm::max(t0, t1);
+    const float enter = std::max(std::max(near_t.x, near_t.y), std::max(near_t.z, 0.0f));
+    const float exit = std::min(std::min(far_t.x, far_t.y), std::min(far_t.z, max_t));
+    return enter <= exit ? enter : FLT_MAX;
+}
+
+bool overlaps(const glm::vec3& a_min, const glm::vec3& a_max, const glm::vec3& b_min, const glm::vec3& b_max)
+{
+    return a_min.x <= b_max.x && a_max.x >= b_min.x && a_min.y <= b_max.y && a_max.y >= b_min.y && a_min.z <= b_max.z && a_max.z >= b_min.z;
+}
+
+} // namespace
+
+float intersect_triangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    const glm::vec3 ab = b - a;
+    const glm::vec3 ac = c - a;
+    const glm::vec3 p = glm::cross(direction, ac);
+    const float det = glm::dot(ab, p);
+    if (std::fabs(det) < 1e-12f)
+        return -1.0f;
+    const float inv_det = 1.0f / det;
+    const glm::vec3 s = origin - a;
+    const float u = glm::dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f)
+        return -1.0f;
+    const glm::vec3 q = glm::cross(s, ab);
+    const float v = glm::dot(direction, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f)
+        return -1.0f;
+    return glm::dot(ac, q) * inv_det;
+}
+
+void BVH::clear(void)
+{
+    nodes.clear();
+    objects.clear();
+    object_min.clear();
+    object_max.clear();
+    items.clear();
+    built_cost = current_cost = 0.0f;
+}
+
+void BVH::build(const glm::vec3* box_min, const glm::vec3* box_max, size_t count)
+{
+    object_min.assign(box_min, box_min + count);
+    object_max.assign(box_max, box_max + count);
+    objects.resize(count);
+    items.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        items[i] = { box_min[i], static_cast<uint32_t>(i), box_max[i], 0.0f };
+
+    nodes.resize(std::max<size_t>(1, 2 * count));
+    allocated_nodes = 1;
+    if (count == 0) {
+        nodes[0] = { glm::vec3(0.0f), 0, glm::vec3(0.0f), 0 };
+        built_cost = current_cost = 0.0f;
+        return;
+    }
+    build_node(0, 0, static_cast<uint32_t>(count));
+    nodes.resize(allocated_nodes);
+    for (size_t i = 0; i < count; ++i)
+        objects[i] = items[i].object;
+
+    built_cost = current_cost = compute_cost();
+}
+
+void BVH::build_node(uint32_t node, uint32_t first, uint32_t count)
+{
+    glm::vec3 bounds_min(FLT_MAX), bounds_max(-FLT_MAX);
+    glm::vec3 centroid_min(FLT_MAX), centroid_max(-FLT_MAX);
+    // centroids are kept doubled (min + max), which does not change any split
+    for (uint32_t i = first; i < first + count; ++i) {
+        const BuildItem& item = items[i];
+        bounds_min = glm::min(bounds_min, item.min);
+        bounds_max = glm::max(bounds_max, item.max);
+        centroid_min = glm::min(centroid_min, item.min + item.max);
+        centroid_max = glm::max(centroid_max, item.min + item.max);
+    }
+    Node& n = nodes[node];
+    n.min = bounds_min;
+    n.max = bounds_max;
+    n.first = first;
+    n.count = count;
+    if (count <= 2)
+        return;
+
+    // binned SAH over all three axes, one pass over the objects fills the bins of every axis
+    int best_axis = -1;
+    int best_bin = 0;
+    float best_cost = FLT_MAX;
+    const glm::vec3 extent = centroid_max - centroid_min;
+    // small nodes do not need many candidate planes
+    const int bins = std::min(BINS, static_cast<int>(count));
+    const glm::vec3 scale(extent.x > 0.0f ? bins / extent.x : 0.0f, extent.y > 0.0f ? bins / extent.y : 0.0f,
+                          extent.z > 0.0f ? bins / extent.z : 0.0f);
+    uint32_t bins_count[3][BINS] = {};
+    glm::vec3 bins_min[3][BINS], bins_max[3][BINS];
+    for (int axis = 0; axis < 3; ++axis) {
+        std::fill(bins_min[axis], bins_min[axis] + bins, glm::vec3(FLT_MAX));
+        std::fill(bins_max[axis], bins_max[axis] + bins, glm::vec3(-FLT_MAX));
+    }
+    for (uint32_t i = first; i < first + count; ++i) {
+        const glm::vec3 lo = items[i].min;
+        const glm::vec3 hi = items[i].max;
+        const glm::vec3 c = lo + hi;
+        for (int axis = 0; axis < 3; ++axis) {
+            const int b = std::min(bins - 1, static_cast<int>((c[axis] - centroid_min[axis]) * scale[axis]));
+            ++bins_count[axis][b];
+            bins_min[axis][b] = glm::min(bins_min[axis][b], lo);
+            bins_max[axis][b] = glm::max(bins_max[axis][b], hi);
+        }
+    }
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.0f)
+            continue;
+        const uint32_t* bin_count = bins_count[axis];
+        const glm::vec3* bin_min = bins_min[axis];
+        const glm::vec3* bin_max = bins_max[axis];
+
+        // right-to-left sweep stores the right side costs, left-to-right sweep combines
+        float right_cost[BINS];
+        glm::vec3 acc_min(FLT_MAX), acc_max(-FLT_MAX);
+        uint32_t acc_count = 0;
+        for (int b = bins - 1; b > 0; --b) {
+            acc_min = glm::min(acc_min, bin_min[b]);
+            acc_max = glm::max(acc_max, bin_max[b]);
+            acc_count += bin_count[b];
+            right_cost[b] = acc_count ? acc_count * half_area(acc_min, acc_max) : 0.0f;
+        }
+        acc_min = glm::vec3(FLT_MAX);
+        acc_max = glm::vec3(-FLT_MAX);
+        acc_count = 0;
+        for (int b = 0; b < bins - 1; ++b) {
+            acc_min = glm::min(acc_min, bin_min[b]);
+            acc_max = glm::max(acc_max, bin_max[b]);
+            acc_count += bin_count[b];
+            if (acc_count == 0 || acc_count == count)
+                continue;
+            const float cost = acc_count * half_area(acc_min, acc_max) + right_cost[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    uint32_t left_count;
+    if (best_axis < 0) {
+        // all centroids coincide, split the list in half
+        if (count <= MAX_LEAF_SIZE)
+            return;
+        left_count = count / 2;
+    }
+    else {
+        const float split_cost = TRAVERSAL_COST + best_cost / half_area(bounds_min, bounds_max);
+        if (split_cost >= count && count <= MAX_LEAF_SIZE)
+            return;
+
+        const float axis_scale = scale[best_axis];
+        const float axis_min = centroid_min[best_axis];
+        auto middle = std::partition(items.begin() + first, items.begin() + first + count, [&](const BuildItem& item) {
+            return std::min(bins - 1, static_cast<int>((item.min[best_axis] + item.max[best_axis] - axis_min) * axis_scale)) <= best_bin;
+        });
+        left_count = static_cast<uint32_t>(middle - (items.begin() + first));
+    }
+
+    const uint32_t left = allocated_nodes.fetch_add(2);
+    n.first = left;
+    n.count = 0;
+
+    const uint32_t child_first[2] = { first, first + left_count };
+    const uint32_t child_count[2] = { left_count, count - left_count };
+    if (count < PARALLEL_BUILD_SIZE) {
+        build_node(left, child_first[0], child_count[0]);
+        build_node(left + 1, child_first[1], child_count[1]);
+        return;
+    }
+    ThreadPool::global().parallel_for(0, 2, 1, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c)
+            build_node(left + static_cast<uint32_t>(c), child_first[c], child_count[c]);
+    });
+}
+
+// expected traversal cost relative to the root box
+float BVH::compute_cost(void) const
+{
+    if (nodes.empty())
+        return 0.0f;
+    float cost = 0.0f;
+    for (const Node& n : nodes)
+        cost += half_area(n.min, n.max) * (n.count ? static_cast<float>(n.count) : TRAVERSAL_COST);
+    const float root_area = half_area(nodes[0].min, nodes[0].max);
+    return root_area > 0.0f ? cost / root_area : 0.0f;
+}
+
+void BVH::refit(const glm::vec3* box_min, const glm::vec3* box_max)
+{
+    if (nodes.empty())
+        return;
+    std::copy(box_min, box_min + object_min.size(), object_min.begin());
+    std::copy(box_max, box_max + object_max.size(), object_max.begin());
+
+    // children live after their parents, so one reverse sweep is bottom-up
+    for (size_t i = nodes.size(); i-- > 0;) {
+        Node& n = nodes[i];
+        if (n.count) {
+            glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+            for (uint32_t k = n.first; k < n.first + n.count; ++k) {
+                lo = glm::min(lo, object_min[objects[k]]);
+                hi = glm::max(hi, object_max[objects[k]]);
+            }
+            n.min = lo;
+            n.max = hi;
+        }
+        else if (!object_min.empty()) {
+            n.min = glm::min(nodes[n.first].min, nodes[n.first + 1].min);
+            n.max = glm::max(nodes[n.first].max, nodes[n.first + 1].max);
+        }
+    }
+    current_cost = compute_cost();
+}
+
+uint32_t BVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float max_t, float& t, const HitFunction& hit) const
+{
+    uint32_t result = INVALID_OBJECT;
+    t = max_t;
+    if (object_min.empty())
+        return result;
+
+    const glm::vec3 inv_direction = 1.0f / direction;
+    if (intersect_box(nodes[0].min, nodes[0].max, origin, inv_direction, t) == FLT_MAX)
+        return result;
+    std::vector<uint32_t> stack(1, 0);
+    stack.reserve(64);
+
+    while (!stack.empty()) {
+        const Node& n = nodes[stack.back()];
+        stack.pop_back();
+        if (n.count) {
+            for (uint32_t k = n.first; k < n.first + n.count; ++k) {
+                const uint32_t o = objects[k];
+                float d = intersect_box(object_min[o], object_max[o], origin, inv_direction, t);
+                if (d == FLT_MAX)
+                    continue;
+                if (hit)
+                    d = hit(o, origin, direction);
+                if (d >= 0.0f && d < t) {
+                    t = d;
+                    result = o;
+                }
+            }
+            continue;
+        }
+
+        // visit the nearer child first, skip children beyond the closest hit so far
+        uint32_t near_child = n.first, far_child = n.first + 1;
+        float near_t = intersect_box(nodes[near_child].min, nodes[near_child].max, origin, inv_direction, t);
+        float far_t = intersect_box(nodes[far_child].min, nodes[far_child].max, origin, inv_direction, t);
+        if (far_t < near_t) {
+            std::swap(near_child, far_child);
+            std::swap(near_t, far_t);
+        }
+        if (far_t != FLT_MAX)
+            stack.push_back(far_child);
+        if (near_t != FLT_MAX)
+            stack.push_back(near_child);
+    }
+    return result;
+}
+
+void BVH::query(const Frustum& frustum, std::vector<uint32_t>& out) const
+{
+    if (object_min.empty())
+        return;
+
+    // planes the node is already fully inside of are dropped from the mask
+    struct Entry {
+        uint32_t node;
+        uint32_t planes;
+    };
+    std::vector<Entry> stack(1, Entry{ 0, (1u << Frustum::PLANE_COUNT) - 1 });
+    stack.reserve(64);
+
+    while (!stack.empty()) {
+        const Entry e = stack.back();
+        stack.pop_back();
+        const Node& n = nodes[e.node];
+        const glm::vec3 center = (n.min + n.max) * 0.5f;
+        const glm::vec3 extent = (n.max - n.min) * 0.5f;
+        uint32_t planes = e.planes;
+        bool outside = false;
+        for (int p = 0; p < Frustum::PLANE_COUNT && !outside; ++p) {
+            if (!(planes & (1u << p)))
+                continue;
+            const glm::vec4& plane = frustum.planes[p];
+            const float d = glm::dot(glm::vec3(plane), center) + plane.w;
+            const float r = glm::dot(glm::abs(glm::vec3(plane)), extent);
+            if (d + r < 0.0f)
+                outside = true;
+            else if (d - r >= 0.0f)
+                planes &= ~(1u << p);
+        }
+        if (outside)
+            continue;
+
+        if (n.count) {
+            for (uint32_t k = n.first; k < n.first + n.count; ++k)
+                if (!planes || frustum.intersects_aabb(object_min[objects[k]], object_max[objects[k]]))
+                    out.push_back(objects[k]);
+        }
+        else {
+            stack.push_back({ n.first + 1, planes });
+            stack.push_back({ n.first, planes });
+        }
+    }
+}
+
+void BVH::query(const glm::vec3& box_min, const glm::vec3& box_max, std::vector<uint32_t>& out) const
+{
+    if (object_min.empty())
+        return;
+
+    std::vector<uint32_t> stack(1, 0);
+    stack.reserve(64);
+    while (!stack.empty()) {
+        const Node& n = nodes[stack.back()];
+        stack.pop_back();
+        if (!overlaps(n.min, n.max, box_min, box_max))
+            continue;
+        if (n.count) {
+            for (uint32_t k = n.first; k < n.first + n.count; ++k)
+                if (overlaps(object_min[objects[k]], object_max[objects[k]], box_min, box_max))
+                    out.push_back(objects[k]);
+        }
+        else {
+            stack.push_back(n.first + 1);
+            stack.push_back(n.first);
+        }
+    }
+}
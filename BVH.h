@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+
+// ray / triangle distance (Moller-Trumbore, both faces), negative on miss
+float intersect_triangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+// Bounding volume hierarchy over object AABBs.
+//
+// build() uses binned SAH splits, large subtrees are built in parallel on
+// ThreadPool::global(). Moving objects are handled by refit(), which only
+// recomputes node boxes bottom-up; once the tree quality degraded too much
+// (needs_rebuild()) the caller rebuilds it. Children are always stored after
+// their parent and siblings next to each other.
+class BVH {
+public:
+    struct Node {
+        glm::vec3 min;
+        uint32_t first;         // leaf: first slot in the object list, inner node: left child (right child is first + 1)
+        glm::vec3 max;
+        uint32_t count;         // leaf: number of objects, inner node: 0
+    };
+
+    static const uint32_t INVALID_OBJECT = 0xFFFFFFFFu;
+    static const uint32_t MAX_LEAF_SIZE = 8;
+
+    // exact test of one object, returns the hit distance along the ray or a negative value on miss
+    typedef std::function<float(uint32_t object, const glm::vec3& origin, const glm::vec3& direction)> HitFunction;
+
+    BVH() = default;
+    BVH(const BVH&) = delete;
+    BVH& operator=(const BVH&) = delete;
+
+    void build(const glm::vec3* box_min, const glm::vec3* box_max, size_t count);
+    // same objects, new boxes
+    void refit(const glm::vec3* box_min, const glm::vec3* box_max);
+    // SAH cost grew by more than 'max_cost_ratio' since the last build
+    bool needs_rebuild(float max_cost_ratio = 1.5f) const { return current_cost > built_cost * max_cost_ratio; }
+    void clear(void);
+
+    size_t object_count(void) const { return object_min.size(); }
+    size_t node_count(void) const { return nodes.size(); }
+    float sah_cost(void) const { return current_cost; }
+
+    // nearest object hit in (0, max_t]; without 'hit' the object boxes are the exact shapes
+    uint32_t raycast(const glm::vec3& origin, const glm::vec3& direction, float max_t, float& t, const HitFunction& hit = HitFunction()) const;
+    // objects whose box intersects the frustum / overlaps the box, appended to 'out'
+    void query(const Frustum& frustum, std::vector<uint32_t>& out) const;
+    void query(const glm::vec3& box_min, const glm::vec3& box_max, std::vector<uint32_t>& out) const;
+
+private:
+    // object box copies partitioned during build(), so that the splits stream through memory
+    struct BuildItem {
+        glm::vec3 min;
+        uint32_t object;
+        glm::vec3 max;
+        float padding;
+    };
+
+    void build_node(uint32_t node, uint32_t first, uint32_t count);
+    float compute_cost(void) const;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> objects;          // object indices, leaves reference ranges of it
+    std::vector<glm::vec3> object_min;
+    std::vector<glm::vec3> object_max;
+    std::vector<BuildItem> items;
+    std::atomic<uint32_t> allocated_nodes{ 0 };
+    float built_cost = 0.0f;
+    float current_cost = 0.0f;
+};
@@ -0,0 +1,1221 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "Animation.h"
+#include "BVH.h"
+#include "Benchmark.h"
+#include "BlockCompression.h"
+#include "CascadedShadows.h"
+#include "ClusteredLighting.h"
+#include "Collision.h"
+#include "Culling.h"
+#include "DeferredRenderer.h"
+#include "ECS.h"
+#include "OcclusionCulling.h"
+#include "ParticleSystem.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "Simd.h"
+#include "TangentSpace.h"
+#include "TextureAtlas.h"
+#include "TextureLoader.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+
+namespace {
+
+// best of 'repeats' runs, in milliseconds
+double measure_ms(int repeats, const std::function<void(void)>& fn)
+{
+    double best = 1e30;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void benchmark_tangent_space(void)
+{
+    // wavy grid, ~1M triangles
+    const int N = 708;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs;
+    std::vector<uint32_t> indices;
+    positions.reserve((N + 1) * (N + 1));
+    uvs.reserve((N + 1) * (N + 1));
+    for (int y = 0; y <= N; ++y) {
+        for (int x = 0; x <= N; ++x) {
+            positions.emplace_back(x * 0.1f, std::sin(x * 0.05f) * std::cos(y * 0.07f), y * 0.1f);
+            uvs.emplace_back(static_cast<float>(x) / N, static_cast<float>(y) / N);
+        }
+    }
+    for (int y = 0; y < N; ++y) {
+        for (int x = 0; x < N; ++x) {
+            const uint32_t i = y * (N + 1) + x;
+            indices.insert(indices.end(), { i, i + N + 1, i + 1, i + 1, i + N + 1, i + N + 2 });
+        }
+    }
+
+    std::vector<glm::vec3> normals_ref(positions.size()), normals(positions.size());
+    std::vector<glm::vec4> tangents_ref(positions.size()), tangents(positions.size());
+
+    const double scalar_ms = measure_ms(3, [&]() {
+        TangentSpaceGenerator::generate_scalar(positions.data(), uvs.data(), positions.size(),
+                                               indices.data(), indices.size(), normals_ref.data(), tangents_ref.data());
+    });
+
+    TangentSpaceGenerator generator;
+    const double simd_ms = measure_ms(3, [&]() {
+        generator.generate(positions.data(), uvs.data(), positions.size(),
+                           indices.data(), indices.size(), normals.data(), tangents.data());
+    });
+
+    float max_normal_error = 0.0f, max_tangent_error = 0.0f;
+    for (size_t v = 0; v < positions.size(); ++v) {
+        max_normal_error = std::max(max_normal_error, glm::length(normals[v] - normals_ref[v]));
+        max_tangent_error = std::max(max_tangent_error, glm::length(tangents[v] - tangents_ref[v]));
+    }
+
+    std::cout << "tangent_space: " << indices.size() / 3 << " triangles, " << simd::instruction_set()
+              << ", " << ThreadPool::global().size() << " threads\n"
+              << "  naive scalar:    " << scalar_ms << " ms\n"
+              << "  simd + parallel: " << simd_ms << " ms (x" << scalar_ms / simd_ms << ")\n"
+              << "  max difference:  normal " << max_normal_error << ", tangent " << max_tangent_error << '\n';
+}
+
+void benchmark_animation(void)
+{
+    // 64 joint humanoid-like tree: 4 chains of 16 joints below a root
+    const size_t joints = 64;
+    Skeleton skeleton;
+    skeleton.parents.resize(joints);
+    skeleton.inverse_bind.resize(joints);
+    for (size_t j = 0; j < joints; ++j) {
+        skeleton.parents[j] = j == 0 ? -1 : ((j - 1) % 16 == 0 ? 0 : static_cast<int>(j) - 1);
+        skeleton.inverse_bind[j] = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.1f * j, 0.0f));
+    }
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> angle(-0.5f, 0.5f);
+    AnimationClip clip;
+    clip.resize(60, joints);
+    for (size_t f = 0; f < clip.frame_count; ++f)
+        for (size_t j = 0; j < joints; ++j)
+            clip.set_key(f, j, glm::quat(glm::vec3(angle(rng), angle(rng), angle(rng))), glm::vec3(0.0f, 0.1f, 0.0f));
+
+    AnimationSystem animation;
+    const uint32_t skeleton_id = animation.add_skeleton(skeleton);
+    const uint32_t clip_id = animation.add_clip(clip);
+    const int instances = 4000;
+    for (int i = 0; i < instances; ++i)
+        animation.add_instance(skeleton_id, clip_id, i * 0.01f, 0.5f + (i % 7) * 0.1f);
+
+    const double matrix_ms = measure_ms(10, [&]() { animation.update(1.0f / 60.0f, false); });
+    const double dual_ms = measure_ms(10, [&]() { animation.update(1.0f / 60.0f, true); });
+
+    // 8k vertex mesh, 4 influences each
+    SkinnedMesh mesh;
+    std::uniform_int_distribution<int> joint(0, static_cast<int>(joints) - 1);
+    for (int v = 0; v < 8192; ++v) {
+        mesh.positions.emplace_back(angle(rng), v * 0.001f, angle(rng));
+        mesh.normals.push_back(glm::normalize(glm::vec3(angle(rng), 1.0f, angle(rng))));
+        mesh.joints.emplace_back(joint(rng), joint(rng), joint(rng), joint(rng));
+        mesh.weights.emplace_back(0.4f, 0.3f, 0.2f, 0.1f);
+    }
+    std::vector<uint32_t> ids;
+    for (uint32_t i = 0; i < 100; ++i)
+        ids.push_back(i);
+    std::vector<glm::vec3> positions, normals;
+    const double skin_ms = measure_ms(5, [&]() { animation.skin_cpu(mesh, ids, positions, normals); });
+
+    // reference: glm dual quaternion blending, one vertex at a time
+    float max_error = 0.0f;
+    for (size_t v = 0; v < mesh.positions.size(); v += 97) {
+        const glm::dualquat* dq = animation.dual_palette(ids[0]);
+        const glm::u8vec4 j = mesh.joints[v];
+        const glm::vec4 w = mesh.weights[v];
+        glm::dualquat blend = dq[j.x] * w.x;
+        for (int k = 1; k < 4; ++k)
+            blend = blend + dq[j[k]] * (glm::dot(dq[j[k]].real, dq[j.x].real) < 0.0f ? -w[k] : w[k]);
+        blend = glm::normalize(blend);
+        const glm::vec3 expected = blend * mesh.positions[v];
+        max_error = std::max(max_error, glm::length(expected - positions[v]));
+    }
+
+    std::cout << "animation: " << instances << " instances x " << joints << " joints, " << simd::instruction_set()
+              << ", " << ThreadPool::global().size() << " threads\n"
+              << "  sample + pose + matrix palette: " << matrix_ms << " ms\n"
+              << "  sample + pose + dual palette:   " << dual_ms << " ms\n"
+              << "  CPU dual quaternion skinning:   " << skin_ms << " ms for " << ids.size() << " x "
+              << mesh.positions.size() << " vertices (max error " << max_error << ")\n";
+}
+
+void benchmark_scene_graph(void)
+{
+    // random recursive tree, created out of depth order so that the first update sorts it
+    const size_t count = 1000000;
+    std::mt19937 rng(42);
+    SceneGraph scene;
+    scene.reserve(count);
+    std::vector<SceneGraph::Node> nodes;
+    nodes.reserve(count);
+    nodes.push_back(scene.create_node());
+    for (size_t i = 1; i < count; ++i) {
+        const SceneGraph::Node parent = nodes[std::uniform_int_distribution<size_t>(0, i - 1)(rng)];
+        const SceneGraph::Node node = scene.create_node(parent);
+        scene.set_position(node, glm::vec3(0.01f * (i % 100), 0.1f, 0.0f));
+        scene.set_rotation(node, glm::quat(glm::vec3(0.0f, 0.001f * (i % 37), 0.0f)));
+        nodes.push_back(node);
+    }
+    scene.update();
+
+    const double full_ms = measure_ms(5, [&]() {
+        scene.mark_all_dirty();
+        scene.update();
+    });
+
+    std::uniform_int_distribution<size_t> pick(0, count - 1);
+    size_t updated = 0;
+    const double partial_ms = measure_ms(5, [&]() {
+        for (size_t i = 0; i < count / 100; ++i) {
+            const SceneGraph::Node node = nodes[pick(rng)];
+            scene.set_position(node, scene.position(node) + glm::vec3(0.0f, 0.001f, 0.0f));
+        }
+        updated = scene.update();
+    });
+
+    // incremental result must match a full recompute
+    std::vector<glm::mat4> incremental(scene.world_matrices(), scene.world_matrices() + count);
+    scene.mark_all_dirty();
+    scene.update();
+    float max_error = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+        for (int c = 0; c < 4; ++c)
+            max_error = std::max(max_error, glm::length(incremental[i][c] - scene.world_matrices()[i][c]));
+
+    std::cout << "scene_graph: " << count << " nodes, " << ThreadPool::global().size() << " threads\n"
+              << "  full update:       " << full_ms << " ms\n"
+              << "  1% nodes moved:    " << partial_ms << " ms (" << updated << " nodes recomputed, x"
+              << full_ms / partial_ms << ")\n"
+              << "  max difference:    " << max_error << "\n";
+}
+
+struct BenchPosition {
+    glm::vec3 value;
+};
+
+struct BenchVelocity {
+    glm::vec3 value;
+};
+
+struct BenchHealth {
+    float value;
+};
+
+// classic object-per-allocation layout the ECS replaces
+struct BenchObject {
+    virtual ~BenchObject() = default;
+    virtual void update(float dt) { position += velocity * dt; }
+    glm::vec3 position;
+    glm::vec3 velocity;
+    float health = 100.0f;
+    std::string name;
+};
+
+void benchmark_ecs(void)
+{
+    const size_t count = 1000000;
+    World world;
+    std::vector<Entity> entities;
+    entities.reserve(count);
+    const double create_ms = measure_ms(1, [&]() {
+        for (size_t i = 0; i < count; ++i) {
+            const BenchPosition position = { glm::vec3(static_cast<float>(i), 0.0f, 0.0f) };
+            const BenchVelocity velocity = { glm::vec3(1.0f, 2.0f, 3.0f) };
+            if (i % 2)
+                entities.push_back(world.create(position, velocity, BenchHealth{ 100.0f }));
+            else
+                entities.push_back(world.create(position, velocity));
+        }
+    });
+
+    const float dt = 1.0f / 60.0f;
+    const double serial_ms = measure_ms(10, [&]() {
+        world.each<BenchPosition, BenchVelocity>([dt](Entity, BenchPosition& p, const BenchVelocity& v) { p.value += v.value * dt; });
+    });
+    const double parallel_ms = measure_ms(10, [&]() {
+        world.parallel_each_chunk<BenchPosition, BenchVelocity>([dt](size_t n, const Entity*, BenchPosition* p, const BenchVelocity* v) {
+            for (size_t i = 0; i < n; ++i)
+                p[i].value += v[i].value * dt;
+        });
+    });
+
+    // same work through heap objects allocated in shuffled order
+    std::vector<std::unique_ptr<BenchObject>> objects(count);
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; ++i)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(7));
+    for (size_t i : order) {
+        objects[i].reset(new BenchObject);
+        objects[i]->velocity = glm::vec3(1.0f, 2.0f, 3.0f);
+    }
+    const double objects_ms = measure_ms(10, [&]() {
+        for (auto& object : objects)
+            object->update(dt);
+    });
+
+    // deferred structural changes: destroy 10%, add a component to 10%, create 10%
+    CommandBuffer commands;
+    const double commands_ms = measure_ms(1, [&]() {
+        world.parallel_each<BenchPosition>([&](Entity e, const BenchPosition&) {
+            if (e.index % 10 == 0)
+                commands.destroy(e);
+            else if (e.index % 10 == 1)
+                commands.add(e, BenchHealth{ 50.0f });
+        });
+        for (size_t i = 0; i < count / 10; ++i)
+            commands.create(BenchPosition{ glm::vec3(0.0f) }, BenchVelocity{ glm::vec3(1.0f) });
+        commands.apply(world);
+    });
+
+    std::cout << "ecs: " << count << " entities, " << world.archetype_count() << " archetypes, "
+              << ThreadPool::global().size() << " threads\n"
+              << "  create:                  " << create_ms << " ms\n"
+              << "  move, each():            " << serial_ms << " ms\n"
+              << "  move, parallel chunks:   " << parallel_ms << " ms\n"
+              << "  move, heap objects:      " << objects_ms << " ms\n"
+              << "  300k deferred changes:   " << commands_ms << " ms (" << world.entity_count() << " entities after)\n";
+}
+
+void benchmark_culling(void)
+{
+    // 1M objects scattered in a 2 km cube, camera in the middle looking down -Z
+    const size_t count = 1000000;
+    std::mt19937 rng(99);
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+    std::uniform_real_distribution<float> size(0.5f, 5.0f);
+    SphereBounds spheres;
+    BoxBounds boxes;
+    spheres.resize(count);
+    boxes.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const glm::vec3 c(position(rng), position(rng), position(rng));
+        const glm::vec3 e(size(rng), size(rng), size(rng));
+        spheres.set(i, c, glm::length(e));
+        boxes.set(i, c - e, c + e);
+    }
+    const glm::mat4 view_projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 800.0f)
+                                      * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const Frustum frustum = Frustum::from_matrix(view_projection);
+
+    FrustumCuller culler;
+    std::vector<uint32_t> reference;
+    std::cout << "culling: " << count << " objects, " << simd::instruction_set() << ", " << ThreadPool::global().size() << " threads\n";
+
+    const double sphere_scalar = measure_ms(5, [&]() { FrustumCuller::cull_scalar(frustum, spheres, reference); });
+    const double sphere_simd = measure_ms(5, [&]() { culler.cull(frustum, spheres, NULL); });
+    const double sphere_parallel = measure_ms(5, [&]() { culler.cull(frustum, spheres); });
+    const bool sphere_match = reference == culler.visible();
+    std::cout << "  spheres: " << culler.visible().size() << " visible" << (sphere_match ? "" : " (MISMATCH)") << "\n"
+              << "    scalar:          " << count / sphere_scalar << " objects/ms\n"
+              << "    simd:            " << count / sphere_simd << " objects/ms\n"
+              << "    simd + parallel: " << count / sphere_parallel << " objects/ms\n";
+
+    const double box_scalar = measure_ms(5, [&]() { FrustumCuller::cull_scalar(frustum, boxes, reference); });
+    const double box_simd = measure_ms(5, [&]() { culler.cull(frustum, boxes, NULL); });
+    const double box_parallel = measure_ms(5, [&]() { culler.cull(frustum, boxes); });
+    const bool box_match = reference == culler.visible();
+    std::cout << "  boxes:   " << culler.visible().size() << " visible" << (box_match ? "" : " (MISMATCH)") << "\n"
+              << "    scalar:          " << count / box_scalar << " objects/ms\n"
+              << "    simd:            " << count / box_simd << " objects/ms\n"
+              << "    simd + parallel: " << count / box_parallel << " objects/ms\n";
+}
+
+void benchmark_bvh(void)
+{
+    // 100k small boxes in a 1 km cube
+    const size_t count = 100000;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 3.0f);
+    std::vector<glm::vec3> box_min(count), box_max(count);
+    for (size_t i = 0; i < count; ++i) {
+        const glm::vec3 c(position(rng), position(rng), position(rng));
+        const glm::vec3 e(size(rng), size(rng), size(rng));
+        box_min[i] = c - e;
+        box_max[i] = c + e;
+    }
+
+    BVH bvh;
+    const double build_ms = measure_ms(5, [&]() { bvh.build(box_min.data(), box_max.data(), count); });
+    const float built_cost = bvh.sah_cost();
+
+    // rays from the center towards random points, compared with testing every box
+    const int rays = 10000;
+    std::vector<glm::vec3> directions(rays);
+    for (auto& d : directions)
+        d = glm::normalize(glm::vec3(position(rng), position(rng), position(rng)));
+    size_t hits = 0;
+    const double ray_ms = measure_ms(3, [&]() {
+        hits = 0;
+        for (const auto& d : directions) {
+            float t;
+            hits += bvh.raycast(glm::vec3(0.0f), d, 1e30f, t) != BVH::INVALID_OBJECT;
+        }
+    });
+    size_t mismatches = 0;
+    for (int r = 0; r < 100; ++r) {
+        float t;
+        const uint32_t hit = bvh.raycast(glm::vec3(0.0f), directions[r], 1e30f, t);
+        float best = 1e30f;
+        uint32_t expected = BVH::INVALID_OBJECT;
+        const glm::vec3 inv = 1.0f / directions[r];
+        for (size_t i = 0; i < count; ++i) {
+            const glm::vec3 t0 = box_min[i] * inv, t1 = box_max[i] * inv;
+            const glm::vec3 near_t = glm::min(t0, t1), far_t = glm::max(t0, t1);
+            const float enter = std::max(std::max(near_t.x, near_t.y), std::max(near_t.z, 0.0f));
+            const float exit = std::min(std::min(far_t.x, far_t.y), far_t.z);
+            if (enter <= exit && enter < best) {
+                best = enter;
+                expected = static_cast<uint32_t>(i);
+            }
+        }
+        mismatches += hit != expected;
+    }
+
+    // frustum query against the linear scan
+    const glm::mat4 view_projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f)
+                                      * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const Frustum frustum = Frustum::from_matrix(view_projection);
+    std::vector<uint32_t> visible;
+    const double frustum_ms = measure_ms(10, [&]() {
+        visible.clear();
+        bvh.query(frustum, visible);
+    });
+    size_t expected_visible = 0;
+    for (size_t i = 0; i < count; ++i)
+        expected_visible += frustum.intersects_aabb(box_min[i], box_max[i]);
+
+    // objects drift, refit until the tree asks for a rebuild
+    std::uniform_real_distribution<float> drift(-2.0f, 2.0f);
+    int refits = 0;
+    double refit_ms = 0.0;
+    while (!bvh.needs_rebuild() && refits < 100) {
+        for (size_t i = 0; i < count; ++i) {
+            const glm::vec3 d(drift(rng), drift(rng), drift(rng));
+            box_min[i] += d;
+            box_max[i] += d;
+        }
+        refit_ms += measure_ms(1, [&]() { bvh.refit(box_min.data(), box_max.data()); });
+        ++refits;
+    }
+
+    std::cout << "bvh: " << count << " objects, " << bvh.node_count() << " nodes, " << ThreadPool::global().size() << " threads\n"
+              << "  build:          " << build_ms << " ms (SAH cost " << built_cost << ")\n"
+              << "  raycast:        " << ray_ms * 1000.0 / rays << " us per ray (" << hits << '/' << rays << " hit, "
+              << mismatches << " mismatches in 100 brute force checks)\n"
+              << "  frustum query:  " << frustum_ms << " ms (" << visible.size() << " visible, linear scan " << expected_visible << ")\n"
+              << "  refit:          " << refit_ms / refits << " ms, rebuild wanted after " << refits << " drift steps (SAH cost "
+              << bvh.sah_cost() << ")\n";
+}
+
+void benchmark_occlusion(void)
+{
+    // maze: 40 x 40 cells of 4 m, each cell gets a wall on its north or west side
+    const int cells = 40;
+    const float cell = 4.0f;
+    const glm::vec3 cube[8] = { glm::vec3(0, 0, 0), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(1, 1, 0),
+                                glm::vec3(0, 0, 1), glm::vec3(1, 0, 1), glm::vec3(0, 1, 1), glm::vec3(1, 1, 1) };
+    const uint32_t cube_indices[36] = { 0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+                                        2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5 };
+    std::mt19937 rng(3);
+    std::vector<glm::mat4> walls;
+    for (int z = 0; z < cells; ++z)
+        for (int x = 0; x < cells; ++x) {
+            if (std::abs(x - cells / 2) <= 1 && std::abs(z - cells / 2) <= 1)
+                continue;   // free space around the camera
+            const glm::vec3 corner((x - cells / 2) * cell, 0.0f, (z - cells / 2) * cell);
+            const glm::vec3 size = rng() % 2 ? glm::vec3(cell, 3.0f, 0.2f) : glm::vec3(0.2f, 3.0f, cell);
+            walls.push_back(glm::scale(glm::translate(glm::mat4(1.0f), corner), size));
+        }
+
+    // 100k small objects on the floor of the maze
+    const size_t count = 100000;
+    std::uniform_real_distribution<float> position(-cells * cell * 0.5f, cells * cell * 0.5f);
+    std::vector<glm::vec3> box_min(count), box_max(count);
+    BoxBounds boxes;
+    boxes.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const glm::vec3 c(position(rng), 0.3f, position(rng));
+        box_min[i] = c - glm::vec3(0.3f);
+        box_max[i] = c + glm::vec3(0.3f);
+        boxes.set(i, box_min[i], box_max[i]);
+    }
+
+    const glm::mat4 view_projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 500.0f)
+                                      * glm::lookAt(glm::vec3(2.0f, 1.7f, 2.0f), glm::vec3(2.0f, 1.5f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    FrustumCuller frustum_culler;
+    std::vector<uint32_t> frustum_visible = frustum_culler.cull(Frustum::from_matrix(view_projection), boxes);
+
+    OcclusionCuller occlusion;
+    const double raster_ms = measure_ms(10, [&]() {
+        occlusion.begin(view_projection);
+        for (const auto& wall : walls)
+            occlusion.add_occluder(cube, cube_indices, 36, wall);
+        occlusion.rasterize();
+    });
+    const double serial_raster_ms = measure_ms(10, [&]() {
+        occlusion.begin(view_projection);
+        for (const auto& wall : walls)
+            occlusion.add_occluder(cube, cube_indices, 36, wall);
+        occlusion.rasterize(NULL);
+    });
+
+    std::vector<uint32_t> visible;
+    const double test_ms = measure_ms(10, [&]() {
+        visible = frustum_visible;
+        occlusion.filter(box_min.data(), box_max.data(), visible);
+    });
+
+    std::cout << "occlusion: " << walls.size() << " wall occluders (" << occlusion.occluder_triangles() << " clipped triangles), "
+              << occlusion.width() << 'x' << occlusion.height() << " depth, " << simd::instruction_set() << ", "
+              << ThreadPool::global().size() << " threads\n"
+              << "  rasterize:        " << raster_ms << " ms (" << serial_raster_ms << " ms single thread)\n"
+              << "  test occludees:   " << test_ms << " ms for " << frustum_visible.size() << " frustum visible boxes\n"
+              << "  visible:          " << visible.size() << " of " << frustum_visible.size() << " after occlusion ("
+              << count << " total)\n";
+}
+
+void benchmark_collision(void)
+{
+    // static maze of 20 x 20 cells with a floor, dynamic spheres bouncing inside it
+    const int cells = 20;
+    const float cell = 4.0f;
+    const float half = cells * cell * 0.5f;
+    const glm::vec3 cube[8] = { glm::vec3(0, 0, 0), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(1, 1, 0),
+                                glm::vec3(0, 0, 1), glm::vec3(1, 0, 1), glm::vec3(0, 1, 1), glm::vec3(1, 1, 1) };
+    const uint32_t cube_indices[36] = { 0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+                                        2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5 };
+    std::mt19937 rng(11);
+    CollisionMesh mesh;
+    mesh.add(cube, cube_indices, 36, glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(-half, -1.0f, -half)), glm::vec3(2.0f * half, 1.0f, 2.0f * half)));
+    for (int z = 0; z < cells; ++z)
+        for (int x = 0; x < cells; ++x) {
+            const glm::vec3 corner(x * cell - half, 0.0f, z * cell - half);
+            const glm::vec3 size = rng() % 2 ? glm::vec3(cell, 3.0f, 0.2f) : glm::vec3(0.2f, 3.0f, cell);
+            mesh.add(cube, cube_indices, 36, glm::scale(glm::translate(glm::mat4(1.0f), corner), size));
+        }
+    const double mesh_ms = measure_ms(5, [&]() { mesh.build(); });
+
+    const size_t count = 10000;
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<CollisionWorld::Body> bodies(count);
+    for (auto& body : bodies)
+        body = { glm::vec3(unit(rng) * half, 0.5f + 1.5f * (unit(rng) + 1.0f), unit(rng) * half), 0.2f,
+                 glm::vec3(unit(rng), unit(rng), unit(rng)) * 3.0f, 1.0f };
+
+    CollisionWorld world;
+    world.set_mesh(&mesh);
+    const float dt = 1.0f / 60.0f;
+    const int ticks = 60;
+    double step_ms = 0.0, worst_ms = 0.0;
+    for (int tick = 0; tick < ticks; ++tick) {
+        for (auto& body : bodies) {
+            body.velocity.y -= 9.81f * dt;
+            body.position += body.velocity * dt;
+        }
+        const double ms = measure_ms(1, [&]() { world.step(bodies); });
+        step_ms += ms;
+        worst_ms = std::max(worst_ms, ms);
+    }
+
+    // what is left overlapping after the last step
+    size_t penetrating = 0;
+    float mesh_penetration = 0.0f;
+    std::vector<Contact> contacts;
+    for (const auto& body : bodies) {
+        contacts.clear();
+        mesh.collide_sphere(body.position, body.radius, contacts);
+        for (const Contact& contact : contacts)
+            mesh_penetration = std::max(mesh_penetration, contact.depth);
+        penetrating += !contacts.empty();
+    }
+
+    // camera: long swept moves through the maze, the sphere must never end up inside a wall
+    const size_t moves = 10000;
+    std::vector<glm::vec3> starts(moves), motions(moves), ends(moves);
+    for (size_t i = 0; i < moves; ++i) {
+        starts[i] = glm::vec3(unit(rng) * half, 1.5f, unit(rng) * half);
+        motions[i] = glm::vec3(unit(rng), 0.0f, unit(rng)) * 10.0f;
+    }
+    const double slide_ms = measure_ms(3, [&]() {
+        for (size_t i = 0; i < moves; ++i)
+            ends[i] = mesh.slide_sphere(starts[i], motions[i], 0.5f);
+    });
+    // only moves starting in free space count
+    size_t free_moves = 0, stuck = 0;
+    for (size_t i = 0; i < moves; ++i) {
+        contacts.clear();
+        mesh.collide_sphere(starts[i], 0.5f, contacts);
+        if (!contacts.empty())
+            continue;
+        ++free_moves;
+        contacts.clear();
+        mesh.collide_sphere(ends[i], 0.5f - 1e-3f, contacts);
+        stuck += !contacts.empty();
+    }
+
+    // capsule whose axis pierces a triangle 0.3 above its lower end: pushed out by
+    // the contact, the lower end sits one radius above the plane and just touches
+    const glm::vec3 ta(-2.0f, 0.0f, 2.0f), tb(2.0f, 0.0f, 2.0f), tc(0.0f, 0.0f, -2.0f);
+    const float capsule_radius = 0.25f;
+    glm::vec3 c0(0.0f, -0.3f, 0.0f), c1(0.0f, 1.2f, 0.0f);
+    Contact pierce;
+    const bool pierced = capsule_triangle(c0, c1, capsule_radius, ta, tb, tc, pierce);
+    c0 += pierce.normal * pierce.depth;
+    c1 += pierce.normal * pierce.depth;
+    Contact after;
+    const bool still_inside = capsule_triangle(c0, c1, capsule_radius - 1e-3f, ta, tb, tc, after);
+
+    std::cout << "collision: " << mesh.triangle_count() << " static triangles (BVH " << mesh_ms << " ms), "
+              << count << " spheres, " << ThreadPool::global().size() << " threads\n"
+              << "  step:             " << step_ms / ticks << " ms average, " << worst_ms << " ms worst ("
+              << world.pair_count() << " pairs, " << world.island_count() << " islands)\n"
+              << "  mesh penetration: " << penetrating << " spheres touching, " << mesh_penetration << " deepest after the last step\n"
+              << "  camera slide:     " << slide_ms * 1000.0 / moves << " us per move; of " << free_moves << " moves from free space "
+              << stuck << " ended inside a wall\n"
+              << "  capsule pierce:   " << (pierced ? "contact" : "no contact") << ", depth " << pierce.depth << " (expected "
+              << capsule_radius + 0.3f << "), " << (still_inside ? "still inside" : "clear") << " after the push\n";
+}
+
+void benchmark_particles(void)
+{
+    // fountain at the steady state: 200k particles per second living 5 s
+    ParticleSystem particles;
+    const float dt = 1.0f / 60.0f;
+    for (int frame = 0; frame < 6 * 60; ++frame)
+        particles.update(dt);
+    const size_t live = particles.size();
+
+    const int frames = 30;
+    double total_ms = 0.0;
+    for (int frame = 0; frame < frames; ++frame)
+        total_ms += measure_ms(1, [&]() { particles.update(dt); });
+    double serial_ms = 0.0;
+    for (int frame = 0; frame < frames; ++frame)
+        serial_ms += measure_ms(1, [&]() { particles.update(dt, NULL); });
+
+    // nothing may fall through the ground plane
+    float lowest = 1e30f;
+    for (size_t i = 0; i < particles.size(); ++i)
+        lowest = std::min(lowest, particles.positions_y()[i]);
+
+    std::cout << "particles: " << live << " live, " << simd::instruction_set() << ", " << ThreadPool::global().size() << " threads\n"
+              << "  update:           " << total_ms / frames << " ms per frame (" << serial_ms / frames << " ms single thread)\n"
+              << "  lowest particle:  " << lowest << " (ground at " << particles.forces.ground_height << ")\n";
+}
+
+void benchmark_render_queue(void)
+{
+    // 100k draws over 64 materials with a texture each on 16 programs, 32 VAOs, 10% translucent
+    const size_t count = 100000;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> depth(0.5f, 500.0f);
+    RenderQueue queue;
+    for (int m = 0; m < 64; ++m)
+        queue.add_material([]() {});
+    for (size_t i = 0; i < count; ++i) {
+        DrawCommand command;
+        // every material belongs to one program
+        command.material = static_cast<uint16_t>(1 + rng() % 64);
+        command.program = 1 + command.material % 16;
+        command.texture = 100 + command.material;
+        command.vao = 1 + rng() % 32;
+        command.count = 36;
+        const bool translucent = rng() % 10 == 0;
+        const float d = depth(rng);
+        queue.push(command, static_cast<uint8_t>(rng() % 3), translucent, d);
+    }
+    std::vector<uint64_t> keys(count);
+    std::vector<uint32_t> values(count);
+    RadixSorter sorter;
+    std::mt19937_64 key_rng(9);
+    for (size_t i = 0; i < count; ++i) {
+        keys[i] = key_rng();
+        values[i] = static_cast<uint32_t>(i);
+    }
+    std::vector<uint64_t> sorted_keys = keys;
+    std::vector<uint32_t> sorted_values = values;
+    const double radix_ms = measure_ms(10, [&]() {
+        sorted_keys = keys;
+        sorter.sort(sorted_keys.data(), sorted_values.data(), count);
+    });
+    const double serial_radix_ms = measure_ms(10, [&]() {
+        sorted_keys = keys;
+        sorter.sort(sorted_keys.data(), sorted_values.data(), count, NULL);
+    });
+    std::vector<std::pair<uint64_t, uint32_t>> pairs(count);
+    const double std_sort_ms = measure_ms(10, [&]() {
+        for (size_t i = 0; i < count; ++i)
+            pairs[i] = std::make_pair(keys[i], values[i]);
+        std::sort(pairs.begin(), pairs.end());
+    });
+    sorted_keys = keys;
+    for (size_t i = 0; i < count; ++i)
+        sorted_values[i] = static_cast<uint32_t>(i);
+    sorter.sort(sorted_keys.data(), sorted_values.data(), count);
+    bool matches = true;
+    for (size_t i = 0; i < count; ++i)
+        matches &= sorted_keys[i] == pairs[i].first && sorted_values[i] == pairs[i].second;
+
+    const double queue_ms = measure_ms(1, [&]() { queue.sort(); });
+    const RenderStats& a = queue.unsorted_stats();
+    const RenderStats& b = queue.sorted_stats();
+
+    std::cout << "render_queue: " << count << " draws, " << ThreadPool::global().size() << " threads\n"
+              << "  radix sort:       " << radix_ms << " ms (" << serial_radix_ms << " ms single thread, std::sort "
+              << std_sort_ms << " ms), " << (matches ? "same order" : "ORDER MISMATCH") << "\n"
+              << "  queue sort:       " << queue_ms << " ms, " << queue.sort_passes() << " of 8 byte passes\n"
+              << "  switches before:  " << a.program_switches << " programs, " << a.vao_switches << " VAOs, "
+              << a.texture_switches << " textures, " << a.material_switches << " materials\n"
+              << "  switches after:   " << b.program_switches << " programs, " << b.vao_switches << " VAOs, "
+              << b.texture_switches << " textures, " << b.material_switches << " materials\n";
+}
+
+void benchmark_texture_convert(void)
+{
+    // decoded 2048x2048 BGR image -> flipped RGBA8, what a texture load worker does after imread
+    const int size = 2048;
+    cv::Mat image(size, size, CV_8UC3);
+    std::mt19937 rng(11);
+    for (int y = 0; y < size; ++y) {
+        unsigned char* row = image.ptr(y);
+        for (int x = 0; x < size * 3; ++x)
+            row[x] = static_cast<unsigned char>(rng());
+    }
+    std::vector<unsigned char> simd_rgba(static_cast<size_t>(size) * size * 4);
+    std::vector<unsigned char> scalar_rgba(simd_rgba.size());
+    const double simd_ms = measure_ms(10, [&]() { TextureLoader::convert_to_rgba(image, simd_rgba.data(), true); });
+    const double scalar_ms = measure_ms(10, [&]() { TextureLoader::convert_to_rgba_scalar(image, scalar_rgba.data(), true); });
+    cv::Mat converted;
+    const double opencv_ms = measure_ms(10, [&]() {
+        cv::cvtColor(image, converted, cv::COLOR_BGR2RGBA);
+        cv::flip(converted, converted, 0);
+    });
+
+    std::cout << "texture_convert: " << size << 'x' << size << " BGR -> RGBA, flipped\n"
+              << "  SIMD pass:        " << simd_ms << " ms (" << scalar_ms << " ms scalar, cvtColor + flip " << opencv_ms << " ms), "
+              << (simd_rgba == scalar_rgba ? "same pixels" : "PIXEL MISMATCH") << "\n";
+}
+
+void benchmark_block_compression(void)
+{
+    // 1024x1024 RGBA: smooth color gradients with blobs and a little noise,
+    // closer to a photo / painted texture than pure noise (which no BC format holds)
+    const int size = 1024;
+    std::vector<unsigned char> rgba(static_cast<size_t>(size) * size * 4);
+    std::mt19937 rng(13);
+    std::uniform_int_distribution<int> noise(-6, 6);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            const float u = x / static_cast<float>(size), v = y / static_cast<float>(size);
+            const float blob = 0.5f + 0.5f * std::sin(u * 23.0f) * std::cos(v * 17.0f);
+            const float values[4] = { 255.0f * u, 255.0f * blob, 255.0f * (1.0f - v) * blob, 255.0f * (0.5f + 0.5f * std::sin((u + v) * 9.0f)) };
+            unsigned char* pixel = &rgba[(static_cast<size_t>(y) * size + x) * 4];
+            for (int c = 0; c < 4; ++c)
+                pixel[c] = static_cast<unsigned char>(std::clamp(static_cast<int>(values[c]) + noise(rng), 0, 255));
+        }
+    }
+
+    const BlockFormat formats[] = { BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC4, BlockFormat::BC5 };
+    const int channels[] = { 3, 4, 1, 2 };
+    const double mpixels = static_cast<double>(size) * size / 1e6;
+    std::cout << "block_compression: " << size << 'x' << size << " RGBA, " << simd::instruction_set() << ", "
+              << ThreadPool::global().size() << " threads\n";
+    for (int f = 0; f < 4; ++f) {
+        std::vector<unsigned char> blocks(bc::compressed_size(formats[f], size, size));
+        const double threaded_ms = measure_ms(5, [&]() { bc::encode(formats[f], rgba.data(), size, size, blocks.data()); });
+        const double serial_ms = measure_ms(3, [&]() { bc::encode(formats[f], rgba.data(), size, size, blocks.data(), NULL); });
+
+        std::vector<unsigned char> decoded(rgba.size());
+        bc::decode(formats[f], blocks.data(), size, size, decoded.data());
+        double squared = 0.0;
+        for (size_t i = 0; i < rgba.size(); i += 4)
+            for (int c = 0; c < channels[f]; ++c) {
+                const double d = static_cast<double>(rgba[i + c]) - decoded[i + c];
+                squared += d * d;
+            }
+        const double mse = squared / (static_cast<double>(size) * size * channels[f]);
+        const double psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+
+        std::cout << "  " << bc::name(formats[f]) << ": " << mpixels / (threaded_ms / 1000.0) << " Mpixels/s ("
+                  << mpixels / (serial_ms / 1000.0) << " single thread), PSNR " << psnr << " dB\n";
+    }
+}
+
+void benchmark_texture_atlas(void)
+{
+    // 300 sprites of 16..128 texels, 20k translucent sprite draws (one program, one VAO)
+    const int sprites = 300;
+    const int sizes[] = { 16, 24, 32, 48, 64, 96, 128 };
+    std::mt19937 rng(17);
+    std::vector<glm::ivec2> extents(sprites);
+    TextureAtlas atlas;
+    TextureArrayBuilder arrays;
+    std::vector<TextureArrayBuilder::Slot> slots(sprites);
+    for (int i = 0; i < sprites; ++i) {
+        extents[i] = glm::ivec2(sizes[rng() % 7], sizes[rng() % 7]);
+        std::vector<unsigned char> rgba(static_cast<size_t>(extents[i].x) * extents[i].y * 4, static_cast<unsigned char>(i));
+        atlas.add(rgba.data(), extents[i].x, extents[i].y);
+        slots[i] = arrays.add(rgba.data(), extents[i].x, extents[i].y, true);
+    }
+    bool packed = false;
+    const double pack_ms = measure_ms(5, [&]() { packed = atlas.build(); });
+
+    // bound textures per sprite: its own, the atlas, or its array
+    auto count_binds = [&](const std::function<GLuint(int)>& texture_of) {
+        RenderQueue queue;
+        std::mt19937 draw_rng(19);
+        std::uniform_real_distribution<float> depth(0.5f, 100.0f);
+        for (int i = 0; i < 20000; ++i) {
+            DrawCommand command;
+            command.program = 1;
+            command.vao = 1;
+            command.count = 6;
+            command.texture = texture_of(static_cast<int>(draw_rng() % sprites));
+            queue.push(command, 0, true, depth(draw_rng));
+        }
+        queue.sort();
+        return queue.sorted_stats().texture_switches;
+    };
+    const uint32_t separate = count_binds([](int sprite) { return static_cast<GLuint>(1 + sprite); });
+    const uint32_t atlased = count_binds([](int) { return 1u; });
+    const uint32_t layered = count_binds([&](int sprite) { return static_cast<GLuint>(1 + slots[sprite].array); });
+
+    std::cout << "texture_atlas: " << sprites << " sprites, 20000 translucent draws\n"
+              << "  MaxRects pack:    " << pack_ms << " ms, " << (packed ? "" : "FAILED, ") << atlas.width() << 'x' << atlas.height()
+              << ", " << atlas.occupancy() * 100.0f << "% occupied, " << atlas.mip_levels() << " mip levels\n"
+              << "  texture binds:    " << separate << " separate, " << atlased << " atlas, "
+              << layered << " with " << arrays.array_count() << " arrays\n";
+}
+
+void benchmark_texture_streaming(void)
+{
+    // 24 generated 1024x1024 BC1 textures on objects along a line, a camera
+    // flying past them and back; the budget holds an eighth of the full
+    // chains, a frame uploads at most 256 KB (a level 0 alone takes a frame).
+    // No context: the streamer keeps the books without GL.
+    const int count = 24, size = 1024, frames = 800;
+    const size_t budget = 2 << 20;
+    TextureStreamer streamer(budget, 4);
+    streamer.frame_upload_budget = 256 << 10;
+    for (int i = 0; i < count; ++i)
+        streamer.add("generated " + std::to_string(i), [i]() {
+            std::vector<unsigned char> rgba(static_cast<size_t>(size) * size * 4);
+            for (int y = 0; y < size; ++y)
+                for (int x = 0; x < size; ++x) {
+                    const float u = x / static_cast<float>(size), v = y / static_cast<float>(size);
+                    unsigned char* pixel = &rgba[(static_cast<size_t>(y) * size + x) * 4];
+                    pixel[0] = static_cast<unsigned char>(128.0f + 127.0f * std::sin(u * (7.0f + i)));
+                    pixel[1] = static_cast<unsigned char>(128.0f + 127.0f * std::cos(v * (5.0f + i)));
+                    pixel[2] = static_cast<unsigned char>(((x >> 6) + (y >> 6) + i) % 2 * 200);
+                    pixel[3] = 255;
+                }
+            return TextureCache::cook(rgba.data(), size, size, BlockFormat::BC1, true, NULL);
+        });
+    std::vector<size_t> level_bytes;
+    for (int level = 0; (size >> level) > 0; ++level)
+        level_bytes.push_back(bc::compressed_size(BlockFormat::BC1, size >> level, size >> level));
+    size_t chain_bytes = 0;
+    for (size_t bytes : level_bytes)
+        chain_bytes += bytes;
+
+    const auto load_start = std::chrono::steady_clock::now();
+    while (streamer.pending() > 0) {
+        streamer.update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const std::chrono::duration<double, std::milli> load_ms = std::chrono::steady_clock::now() - load_start;
+
+    // frames from a request the texture could not meet right away until it
+    // is met; levels taken by eviction and streamed back in on the way back
+    std::vector<int> previous(count), unmet_since(count, -1);
+    std::vector<bool> evicted(count, false);
+    uint64_t uploads = 0, evictions = 0, visible_frames = 0, met_frames = 0, latency_frames = 0, late_requests = 0, restored = 0;
+    int over_budget = 0, mismatches = 0;
+    double update_ms = 0.0, worst_ms = 0.0;
+    for (int i = 0; i < count; ++i)
+        previous[i] = streamer.resident_level(i);
+    for (int f = 0; f < frames; ++f) {
+        const float t = f < frames / 2 ? f / (frames / 2.0f) : 2.0f - f / (frames / 2.0f);
+        const glm::vec3 camera(-10.0f + 210.0f * t, 3.0f, 0.0f);
+        std::vector<bool> visible(count, false);
+        for (int i = 0; i < count; ++i) {
+            const float distance = glm::length(glm::vec3(i * 8.0f, 0.0f, 0.0f) - camera);
+            visible[i] = distance < 60.0f;
+            if (visible[i])
+                streamer.request(i, TextureStreamer::screen_size(2.0f, distance, 1.732f, 1080));
+        }
+        const auto start = std::chrono::steady_clock::now();
+        streamer.update();
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        update_ms += elapsed.count();
+        worst_ms = std::max(worst_ms, elapsed.count());
+        uploads += streamer.uploads();
+        evictions += streamer.evictions();
+
+        over_budget += streamer.resident_bytes() > budget;
+        size_t resident = 0;
+        for (int i = 0; i < count; ++i) {
+            const int level = streamer.resident_level(i);
+            for (size_t l = level; l < level_bytes.size(); ++l)
+                resident += level_bytes[l];
+            if (level > previous[i])
+                evicted[i] = true;
+            else if (level < previous[i] && evicted[i]) {
+                ++restored;
+                evicted[i] = false;
+            }
+            previous[i] = level;
+
+            const bool met = level <= streamer.wanted_level(i);
+            if (!visible[i])
+                continue;
+            ++visible_frames;
+            met_frames += met;
+            if (!met && unmet_since[i] < 0)
+                unmet_since[i] = f;
+            if (met && unmet_since[i] >= 0) {
+                latency_frames += f - unmet_since[i];
+                ++late_requests;
+                unmet_since[i] = -1;
+            }
+        }
+        mismatches += resident != streamer.resident_bytes();
+    }
+
+    std::cout << "texture_streaming: " << count << ' ' << size << 'x' << size << " BC1 textures, " << count * chain_bytes / (1 << 20)
+              << " MB of full chains, budget " << budget / (1 << 20) << " MB, " << frames << " frames\n"
+              << "  generate + cook:  " << load_ms.count() << " ms, tails resident\n"
+              << "  update:           " << update_ms / frames << " ms average, " << worst_ms << " ms worst\n"
+              << "  levels:           " << uploads << " uploaded, " << evictions << " evicted, "
+              << restored << " evicted levels streamed back in\n"
+              << "  requests met:     " << 100.0 * met_frames / std::max<uint64_t>(visible_frames, 1) << "% of visible frames, "
+              << late_requests << " late by " << (late_requests ? static_cast<double>(latency_frames) / late_requests : 0.0) << " frames on average\n"
+              << "  budget:           " << over_budget << " frames over, " << mismatches << " frames with resident bytes off the level sum\n";
+}
+
+void benchmark_render_graph(void)
+{
+    // a deferred frame at 1920x1080: shadows, G-buffer, AO, lighting, a bloom
+    // chain, tone mapping, FXAA into the back buffer, and a debug view nobody reads
+    const GLsizei w = 1920, h = 1080;
+    RenderGraph graph;
+    auto build = [&]() {
+        graph.reset();
+        const RenderGraph::Handle backbuffer = graph.import_backbuffer(w, h);
+        RenderGraph::Handle shadow, albedo, normal, material, depth, ao, hdr, ldr;
+        graph.add_pass("shadow", [&](RenderGraph::Builder& b) {
+            shadow = b.create("shadow map", { 2048, 2048, GL_DEPTH_COMPONENT32F });
+            b.write(shadow);
+        }, [](const RenderGraph::Resources&) {});
+        graph.add_pass("gbuffer", [&](RenderGraph::Builder& b) {
+            albedo = b.create("albedo", { w, h, GL_RGBA8 });
+            normal = b.create("normal", { w, h, GL_RG16F });
+            material = b.create("material", { w, h, GL_RGBA8 });
+            depth = b.create("depth", { w, h, GL_DEPTH24_STENCIL8 });
+            for (RenderGraph::Handle target : { albedo, normal, material, depth })
+                b.write(target);
+        }, [](const RenderGraph::Resources&) {});
+        graph.add_pass("ssao", [&](RenderGraph::Builder& b) {
+            b.read(depth);
+            b.read(normal);
+            ao = b.create("ao", { w, h, GL_R8 });
+            b.write(ao);
+        }, [](const RenderGraph::Resources&) {});
+        graph.add_pass("lighting", [&](RenderGraph::Builder& b) {
+            for (RenderGraph::Handle target : { albedo, normal, material, depth, shadow, ao })
+                b.read(target);
+            hdr = b.create("hdr", { w, h, GL_RGBA16F });
+            b.write(hdr);
+        }, [](const RenderGraph::Resources&) {});
+        graph.add_pass("debug normals", [&](RenderGraph::Builder& b) {
+            b.read(normal);
+            b.write(b.create("debug", { w, h, GL_RGBA8 }));
+        }, [](const RenderGraph::Resources&) {});
+        RenderGraph::Handle bloom = hdr;
+        for (int level = 1; level <= 5; ++level)
+            graph.add_pass("bloom " + std::to_string(level), [&, level](RenderGraph::Builder& b) {
+                b.read(bloom);
+                bloom = b.create("bloom", { w >> level, h >> level, GL_R11F_G11F_B10F });
+                b.write(bloom);
+            }, [](const RenderGraph::Resources&) {});
+        graph.add_pass("tonemap", [&](RenderGraph::Builder& b) {
+            b.read(hdr);
+            b.read(bloom);
+            ldr = b.create("ldr", { w, h, GL_RGBA8 });
+            b.write(ldr);
+        }, [](const RenderGraph::Resources&) {});
+        graph.add_pass("fxaa", [&](RenderGraph::Builder& b) {
+            b.read(ldr);
+            b.write(backbuffer);
+        }, [](const RenderGraph::Resources&) {});
+        graph.compile();
+    };
+    const double build_ms = measure_ms(1000, build);
+    const RenderGraph::Stats& stats = graph.stats();
+
+    std::cout << "render_graph: " << stats.passes << " passes at " << w << 'x' << h << "\n"
+              << "  build + compile:  " << build_ms * 1000.0 << " us, " << stats.culled << " passes culled"
+              << (graph.is_culled("debug normals") ? " (debug normals)" : "") << "\n"
+              << "  transient memory: " << stats.transient_bytes / double(1 << 20) << " MB for " << stats.transients
+              << " targets, " << stats.aliased_bytes / double(1 << 20) << " MB aliased\n";
+}
+
+void benchmark_clustered_lighting(void)
+{
+    // lights scattered through the camera's surroundings, 1920x1080, 60 degree field of view
+    const size_t count = 4000;
+    const int w = 1920, h = 1080;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    SphereBounds lights;
+    lights.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        lights.set(i, glm::vec3(unit(rng), unit(rng) * 0.5f, unit(rng)) * 60.0f, 4.0f + 2.0f * unit(rng));
+
+    ClusteredLighting clusters;
+    clusters.set_projection(glm::perspective(glm::radians(60.0f), float(w) / h, 0.1f, 20000.0f), w, h, 0.1f, 200.0f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 10.0f), glm::vec3(0.0f, 0.0f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    const double scalar_ms = measure_ms(3, [&]() { clusters.assign_scalar(view, lights); });
+    const std::vector<glm::uvec2> reference_clusters = clusters.clusters();
+    const std::vector<uint32_t> reference_indices = clusters.indices();
+    const double single_ms = measure_ms(20, [&]() { clusters.assign(view, lights, NULL); });
+    const bool single_same = clusters.clusters() == reference_clusters && clusters.indices() == reference_indices;
+    const double threaded_ms = measure_ms(20, [&]() { clusters.assign(view, lights); });
+    const bool threaded_same = clusters.clusters() == reference_clusters && clusters.indices() == reference_indices;
+
+    size_t occupied = 0;
+    for (const glm::uvec2& cluster : clusters.clusters())
+        occupied += cluster.y > 0;
+    std::cout << "clustered_lighting: " << count << " lights, " << ClusteredLighting::CLUSTERS << " clusters at " << w << 'x' << h << ", "
+              << simd::instruction_set() << ", " << ThreadPool::global().size() << " threads\n"
+              << "  scalar, all pairs: " << scalar_ms << " ms\n"
+              << "  simd, by slice:    " << single_ms << " ms (" << scalar_ms / single_ms << "x)" << (single_same ? "" : " MISMATCH") << "\n"
+              << "  simd, threaded:    " << threaded_ms << " ms (" << scalar_ms / threaded_ms << "x)" << (threaded_same ? "" : " MISMATCH") << "\n"
+              << "  lights/cluster:    " << double(clusters.indices().size()) / std::max<size_t>(occupied, 1) << " average over " << occupied
+              << " lit clusters, max " << clusters.max_cluster_lights() << "\n";
+
+    // worst case: lights reaching every cluster, each one full
+    SphereBounds huge;
+    huge.resize(ClusteredLighting::MAX_CLUSTER_LIGHTS + 10);
+    for (size_t i = 0; i < huge.size(); ++i)
+        huge.set(i, glm::vec3(unit(rng), unit(rng), unit(rng)) * 10.0f, 1e5f);
+    clusters.assign(view, huge);
+    std::cout << "  every cluster full: " << clusters.indices().size() << " entries (cap " << ClusteredLighting::MAX_LIGHT_INDICES << ", "
+              << clusters.indices().size() * sizeof(uint32_t) / 1024 << " KB), " << clusters.dropped_indices() << " dropped\n";
+}
+
+void benchmark_deferred_shading(void)
+{
+    // a frame of overlapping screen rectangles at random depths, camera at the
+    // view space origin, lights scattered in front of it
+    const int w = 1920, h = 1080, rect_count = 300;
+    const size_t light_count = 4000;
+    const float near = 0.1f, cluster_far = 200.0f;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    struct Rect { int x0, y0, x1, y1; float depth; };
+    std::vector<Rect> rects(rect_count);
+    std::vector<float> depth(size_t(w) * h, INFINITY);
+    size_t fragments = 0;
+    for (Rect& r : rects) {
+        r.x0 = int(unit(rng) * w);
+        r.y0 = int(unit(rng) * h);
+        r.x1 = std::min(w, r.x0 + 20 + int(unit(rng) * 280));
+        r.y1 = std::min(h, r.y0 + 20 + int(unit(rng) * 280));
+        r.depth = 3.0f + unit(rng) * 147.0f;
+        fragments += size_t(r.x1 - r.x0) * (r.y1 - r.y0);
+        for (int y = r.y0; y < r.y1; ++y)
+            for (int x = r.x0; x < r.x1; ++x)
+                depth[size_t(y) * w + x] = std::min(depth[size_t(y) * w + x], r.depth);
+    }
+    size_t pixels = 0;
+    for (float d : depth)
+        pixels += std::isfinite(d);
+
+    SphereBounds lights;
+    lights.resize(light_count);
+    for (size_t i = 0; i < light_count; ++i)
+        lights.set(i, glm::vec3((unit(rng) * 2.0f - 1.0f) * 90.0f, (unit(rng) * 2.0f - 1.0f) * 50.0f, -2.0f - unit(rng) * 148.0f), 2.0f + unit(rng) * 4.0f);
+    const glm::mat4 projection = glm::perspective(glm::radians(60.0f), float(w) / h, near, 20000.0f);
+
+    // light lists: clusters for forward, depth bounded tiles for deferred
+    ClusteredLighting clusters;
+    clusters.set_projection(projection, w, h, near, cluster_far);
+    const double clustered_ms = measure_ms(10, [&]() { clusters.assign(glm::mat4(1.0f), lights, NULL); });
+    std::vector<glm::uvec2> tiles;
+    std::vector<uint32_t> tile_indices;
+    const double tiled_ms = measure_ms(10, [&]() { DeferredRenderer::cull_tiles(depth.data(), w, h, projection, lights, tiles, tile_indices); });
+
+    // light evaluations: forward shades every fragment with its cluster's
+    // lights, deferred shades every covered pixel once with its tile's
+    const float slices_per_log = ClusteredLighting::SLICES / std::log(cluster_far / near);
+    const int tw = DeferredRenderer::TILE_SIZE, tiles_x = (w + tw - 1) / tw;
+    size_t forward_evaluations = 0, deferred_evaluations = 0;
+    for (const Rect& r : rects) {
+        const int slice = std::clamp(int(std::log(r.depth / near) * slices_per_log), 0, ClusteredLighting::SLICES - 1);
+        for (int y = r.y0; y < r.y1; ++y)
+            for (int x = r.x0; x < r.x1; ++x) {
+                const int cx = x * ClusteredLighting::TILES_X / w, cy = y * ClusteredLighting::TILES_Y / h;
+                forward_evaluations += clusters.clusters()[(size_t(slice) * ClusteredLighting::TILES_Y + cy) * ClusteredLighting::TILES_X + cx].y;
+            }
+    }
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            if (std::isfinite(depth[size_t(y) * w + x]))
+                deferred_evaluations += tiles[size_t(y / tw) * tiles_x + x / tw].y;
+
+    // G-buffer encoding precision
+    float worst_degrees = 0.0f;
+    for (int i = 0; i < 100000; ++i) {
+        const glm::vec3 n = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f - 1.0f);
+        const glm::vec2 quantized = glm::round(gbuffer::octahedral_encode(n) * 65535.0f) / 65535.0f;
+        const float cosine = std::clamp(glm::dot(n, gbuffer::octahedral_decode(quantized)), -1.0f, 1.0f);
+        worst_degrees = std::max(worst_degrees, glm::degrees(std::acos(cosine)));
+    }
+
+    const DeferredRenderer::Bandwidth forward = DeferredRenderer::forward_bandwidth(fragments);
+    const DeferredRenderer::Bandwidth deferred = DeferredRenderer::deferred_bandwidth(pixels, fragments);
+    std::cout << "deferred_shading: " << w << 'x' << h << ", " << light_count << " lights, overdraw " << double(fragments) / std::max<size_t>(pixels, 1)
+              << ", G-buffer " << DeferredRenderer::gbuffer_bytes_per_pixel() << " bytes/pixel (normals within " << worst_degrees << " degrees)\n"
+              << "  light lists:      clustered " << clustered_ms << " ms, tiled (CPU reference) " << tiled_ms << " ms\n"
+              << "  light evaluations: forward " << forward_evaluations / 1e6 << " M, deferred " << deferred_evaluations / 1e6 << " M\n"
+              << "  bandwidth/frame:  forward " << forward.total() / (1 << 20) << " MB, deferred " << deferred.total() / (1 << 20)
+              << " MB (G-buffer " << deferred.geometry / (1 << 20) << " + lighting " << deferred.lighting / (1 << 20) << ")\n";
+}
+
+void benchmark_cascaded_shadows(void)
+{
+    // few moving objects among much static level geometry; the camera walks and turns for 600 frames
+    const size_t dynamic_count = 2000, static_count = 20000;
+    const int frames = 600;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    SphereBounds dynamic_casters, static_casters;
+    dynamic_casters.resize(dynamic_count);
+    static_casters.resize(static_count);
+    for (size_t i = 0; i < dynamic_count; ++i)
+        dynamic_casters.set(i, glm::vec3(unit(rng), unit(rng) * 0.2f, unit(rng)) * 150.0f, 0.7f + 0.3f * unit(rng));
+    for (size_t i = 0; i < static_count; ++i)
+        static_casters.set(i, glm::vec3(unit(rng), unit(rng) * 0.1f, unit(rng)) * 150.0f, 4.0f + 2.0f * unit(rng));
+
+    CascadedShadows shadows(2048);
+    const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 20000.0f);
+    const glm::vec3 sun(-0.4f, -1.0f, -0.3f);
+    glm::vec3 previous_origin[CascadedShadows::CASCADES];
+    size_t static_redraws = 0, dynamic_drawn = 0, static_drawn = 0, static_all = 0;
+    float worst_snap = 0.0f;
+    double total_ms = 0.0;
+    for (int frame = 0; frame < frames; ++frame) {
+        const float t = frame / 60.0f;
+        const glm::vec3 eye(t * 3.0f, 2.0f, -t * 2.0f);
+        const glm::vec3 front(std::cos(t * 0.5f), -0.1f, std::sin(t * 0.5f));
+        const glm::mat4 view = glm::lookAt(eye, eye + front, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        const auto start = std::chrono::steady_clock::now();
+        shadows.update(view, projection, 0.1f, sun);
+        for (int c = 0; c < CascadedShadows::CASCADES; ++c) {
+            dynamic_drawn += shadows.cull(c, dynamic_casters).size();
+            // the cache is redrawn whenever the cascade window moved
+            const bool moved = frame == 0 || shadows.cascade(c).origin != previous_origin[c];
+            const size_t statics = shadows.cull(c, static_casters).size();
+            static_all += statics;
+            if (moved) {
+                ++static_redraws;
+                static_drawn += statics;
+            }
+            previous_origin[c] = shadows.cascade(c).origin;
+        }
+        total_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // stable fitting: window centers sit on the texel grid
+        for (int c = 0; c < CascadedShadows::CASCADES; ++c) {
+            const glm::vec2 texels = glm::vec2(shadows.cascade(c).origin) / shadows.cascade(c).texel_size;
+            worst_snap = std::max(worst_snap, glm::length(texels - glm::round(texels)));
+        }
+    }
+
+    const size_t cascade_frames = size_t(frames) * CascadedShadows::CASCADES;
+    std::cout << "cascaded_shadows: " << CascadedShadows::CASCADES << " cascades at " << shadows.resolution() << ", " << dynamic_count << " dynamic + "
+              << static_count << " static casters, " << frames << " frames, " << ThreadPool::global().size() << " threads\n"
+              << "  fit + cull:       " << total_ms / frames << " ms/frame (static casters culled every frame here)\n"
+              << "  casters/cascade:  " << double(dynamic_drawn) / cascade_frames << " dynamic of " << dynamic_count << ", "
+              << double(static_all) / cascade_frames << " static of " << static_count << "\n"
+              << "  static caches:    redrawn " << static_redraws << " of " << cascade_frames << " cascade frames\n"
+              << "  casters drawn:    " << double(dynamic_drawn + static_drawn) / frames << " per frame cached, " << double(dynamic_drawn + static_all) / frames
+              << " uncached, " << double(dynamic_count + static_count) * CascadedShadows::CASCADES << " unculled\n"
+              << "  snapping:         window centers within " << worst_snap << " texels of the grid\n";
+}
+
+struct BenchmarkEntry {
+    const char* name;
+    void (*run)(void);
+};
+
+const BenchmarkEntry benchmarks[] = {
+    { "tangent_space", benchmark_tangent_space },
+    { "animation", benchmark_animation },
+    { "scene_graph", benchmark_scene_graph },
+    { "ecs", benchmark_ecs },
+    { "culling", benchmark_culling },
+    { "bvh", benchmark_bvh },
+    { "occlusion", benchmark_occlusion },
+    { "collision", benchmark_collision },
+    { "particles", benchmark_particles },
+    { "render_queue", benchmark_render_queue },
+    { "texture_convert", benchmark_texture_convert },
+    { "block_compression", benchmark_block_compression },
+    { "texture_atlas", benchmark_texture_atlas },
+    { "texture_streaming", benchmark_texture_streaming },
+    { "render_graph", benchmark_render_graph },
+    { "clustered_lighting", benchmark_clustered_lighting },
+    { "deferred_shading", benchmark_deferred_shading },
+    { "cascaded_shadows", benchmark_cascaded_shadows },
+};
+
+} // namespace
+
+int run_benchmarks(const char* name)
+{
+    bool found = false;
+    for (const auto& benchmark : benchmarks) {
+        if (name[0] != '\0' && std::strcmp(name, benchmark.name) != 0)
+            continue;
+        found = true;
+        benchmark.run();
+    }
+    if (!found) {
+        std::cerr << "Unknown benchmark: " << name << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
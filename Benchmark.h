@@ -0,0 +1,5 @@
+#pragma once
+
+// CPU micro-benchmarks, started with "PG2-Project.exe --bench [name]".
+// An empty name runs all of them.
+int run_benchmarks(const char* name);
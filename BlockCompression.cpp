@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <cstring>
+
+#include "BlockCompression.h"
+#include "Simd.h"
+
+namespace {
+
+const float QUANT[3] = { 31.0f, 63.0f, 31.0f };     // 5:6:5 levels
+
+// x in [0, 2^22]: adding 2^23 pushes the fraction out of the mantissa
+template <class V> inline V round_nonnegative(V x)
+{
+    const V magic(8388608.0f);
+    return (x + magic) - magic;
+}
+
+template <class V> inline V distance2(const V (&a)[3], V r, V g, V b)
+{
+    const V dr = a[0] - r, dg = a[1] - g, db = a[2] - b;
+    return dr * dr + dg * dg + db * db;
+}
+
+// one color block per lane
+template <class V>
+struct ColorBlock {
+    V q0[3], q1[3];                     // quantized endpoints, 5:6:5 levels
+    V index[16];                        // 0..3, palette order c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+    V weight[16];                       // share of c0 in the chosen palette entry
+    V error;
+};
+
+template <class V>
+void quantize(const V (&e)[3], V (&q)[3])
+{
+    for (int c = 0; c < 3; ++c)
+        q[c] = round_nonnegative(simd::clamp(e[c], V(0.0f), V(255.0f)) * V(QUANT[c] / 255.0f));
+}
+
+template <class V>
+void choose_indices(const V (&r)[16], const V (&g)[16], const V (&b)[16], ColorBlock<V>& block)
+{
+    V palette[4][3];
+    for (int c = 0; c < 3; ++c) {
+        palette[0][c] = block.q0[c] * V(255.0f / QUANT[c]);
+        palette[1][c] = block.q1[c] * V(255.0f / QUANT[c]);
+        palette[2][c] = (palette[0][c] + palette[0][c] + palette[1][c]) * V(1.0f / 3.0f);
+        palette[3][c] = (palette[0][c] + palette[1][c] + palette[1][c]) * V(1.0f / 3.0f);
+    }
+    const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+    block.error = V(0.0f);
+    for (int i = 0; i < 16; ++i) {
+        V best = distance2(palette[0], r[i], g[i], b[i]);
+        V index = V(0.0f);
+        V weight = V(1.0f);
+        for (int k = 1; k < 4; ++k) {
+            const V d = distance2(palette[k], r[i], g[i], b[i]);
+            const V closer = d < best;
+            best = simd::select(closer, d, best);
+            index = simd::select(closer, V(static_cast<float>(k)), index);
+            weight = simd::select(closer, V(weights[k]), weight);
+        }
+        block.index[i] = index;
+        block.weight[i] = weight;
+        block.error = block.error + best;
+    }
+}
+
+template <class V>
+void encode_colors(const V (&r)[16], const V (&g)[16], const V (&b)[16], ColorBlock<V>& block)
+{
+    const V* p[3] = { r, g, b };
+    V mean[3];
+    for (int c = 0; c < 3; ++c) {
+        V sum = V(0.0f);
+        for (int i = 0; i < 16; ++i)
+            sum = sum + p[c][i];
+        mean[c] = sum * V(1.0f / 16.0f);
+    }
+    V rr = V(0.0f), rg = V(0.0f), rb = V(0.0f), gg = V(0.0f), gb = V(0.0f), bb = V(0.0f);
+    for (int i = 0; i < 16; ++i) {
+        const V dr = r[i] - mean[0], dg = g[i] - mean[1], db = b[i] - mean[2];
+        rr = rr + dr * dr;
+        rg = rg + dr * dg;
+        rb = rb + dr * db;
+        gg = gg + dg * dg;
+        gb = gb + dg * db;
+        bb = bb + db * db;
+    }
+
+    // principal axis by power iteration, from the covariance column of the
+    // widest channel (never zero when the block has any variance)
+    const V r_widest = (rr >= gg) & (rr >= bb);
+    const V g_widest = gg >= bb;
+    V ax = simd::select(r_widest, rr, simd::select(g_widest, rg, rb));
+    V ay = simd::select(r_widest, rg, simd::select(g_widest, gg, gb));
+    V az = simd::select(r_widest, rb, simd::select(g_widest, gb, bb));
+    for (int iteration = 0; iteration < 4; ++iteration) {
+        const V x = rr * ax + rg * ay + rb * az;
+        const V y = rg * ax + gg * ay + gb * az;
+        const V z = rb * ax + gb * ay + bb * az;
+        const V largest = simd::max(simd::abs(x), simd::max(simd::abs(y), simd::abs(z)));
+        const V scale = simd::select(largest > V(1e-6f), V(1.0f) / simd::max(largest, V(1e-6f)), V(0.0f));
+        ax = x * scale;
+        ay = y * scale;
+        az = z * scale;
+    }
+
+    // endpoints at the extreme projections onto the axis
+    V t_min = V(1e30f), t_max = V(-1e30f);
+    for (int i = 0; i < 16; ++i) {
+        const V t = simd::dot3(r[i] - mean[0], g[i] - mean[1], b[i] - mean[2], ax, ay, az);
+        t_min = simd::min(t_min, t);
+        t_max = simd::max(t_max, t);
+    }
+    const V length2 = simd::dot3(ax, ay, az, ax, ay, az);
+    const V inverse = simd::select(length2 > V(1e-12f), V(1.0f) / simd::max(length2, V(1e-12f)), V(0.0f));
+    const V axis[3] = { ax, ay, az };
+    V e0[3], e1[3];
+    for (int c = 0; c < 3; ++c) {
+        e0[c] = mean[c] + axis[c] * (t_max * inverse);
+        e1[c] = mean[c] + axis[c] * (t_min * inverse);
+    }
+    quantize(e0, block.q0);
+    quantize(e1, block.q1);
+    choose_indices(r, g, b, block);
+
+    // least squares refit: minimize sum |w e0 + (1 - w) e1 - p|^2 for the chosen weights
+    V aa = V(0.0f), ab = V(0.0f), bb2 = V(0.0f);
+    V ap[3] = { V(0.0f), V(0.0f), V(0.0f) }, bp[3] = { V(0.0f), V(0.0f), V(0.0f) };
+    for (int i = 0; i < 16; ++i) {
+        const V w = block.weight[i];
+        const V v = V(1.0f) - w;
+        aa = aa + w * w;
+        ab = ab + w * v;
+        bb2 = bb2 + v * v;
+        for (int c = 0; c < 3; ++c) {
+            ap[c] = ap[c] + w * p[c][i];
+            bp[c] = bp[c] + v * p[c][i];
+        }
+    }
+    const V det = aa * bb2 - ab * ab;
+    const V solvable = simd::abs(det) > V(1e-3f);
+    const V inverse_det = simd::select(solvable, V(1.0f) / simd::select(solvable, det, V(1.0f)), V(0.0f));
+    for (int c = 0; c < 3; ++c) {
+        e0[c] = (bb2 * ap[c] - ab * bp[c]) * inverse_det;
+        e1[c] = (aa * bp[c] - ab * ap[c]) * inverse_det;
+    }
+    ColorBlock<V> refit;
+    quantize(e0, refit.q0);
+    quantize(e1, refit.q1);
+    choose_indices(r, g, b, refit);
+
+    const V better = solvable & (refit.error < block.error);
+    for (int c = 0; c < 3; ++c) {
+        block.q0[c] = simd::select(better, refit.q0[c], block.q0[c]);
+        block.q1[c] = simd::select(better, refit.q1[c], block.q1[c]);
+    }
+    for (int i = 0; i < 16; ++i)
+        block.index[i] = simd::select(better, refit.index[i], block.index[i]);
+    block.error = simd::select(better, refit.error, block.error);
+}
+
+// one single channel block per lane, 8 value mode (code 0 = max, 1 = min, 2..7 between)
+template <class V>
+struct ChannelBlock {
+    V high, low;
+    V code[16];
+};
+
+template <class V>
+void encode_channel(const V (&v)[16], ChannelBlock<V>& block)
+{
+    V low = v[0], high = v[0];
+    for (int i = 1; i < 16; ++i) {
+        low = simd::min(low, v[i]);
+        high = simd::max(high, v[i]);
+    }
+    const V range = high - low;
+    const V scale = simd::select(range > V(0.0f), V(7.0f) / simd::max(range, V(1.0f)), V(0.0f));
+    for (int i = 0; i < 16; ++i) {
+        // level 0..7 from low to high
+        const V level = round_nonnegative((v[i] - low) * scale);
+        block.code[i] = simd::select(level > V(6.5f), V(0.0f), simd::select(level < V(0.5f), V(1.0f), V(8.0f) - level));
+    }
+    block.high = high;
+    block.low = low;
+}
+
+void write_u16(unsigned char* out, uint32_t value)
+{
+    out[0] = static_cast<unsigned char>(value);
+    out[1] = static_cast<unsigned char>(value >> 8);
+}
+
+template <class V>
+void pack_colors(const ColorBlock<V>& block, int lanes, unsigned char* out, size_t stride)
+{
+    float q[6][V::width];
+    float index[16][V::width];
+    for (int c = 0; c < 3; ++c) {
+        block.q0[c].store(q[c]);
+        block.q1[c].store(q[3 + c]);
+    }
+    for (int i = 0; i < 16; ++i)
+        block.index[i].store(index[i]);
+
+    for (int l = 0; l < lanes; ++l, out += stride) {
+        uint32_t c0 = (static_cast<uint32_t>(q[0][l]) << 11) | (static_cast<uint32_t>(q[1][l]) << 5) | static_cast<uint32_t>(q[2][l]);
+        uint32_t c1 = (static_cast<uint32_t>(q[3][l]) << 11) | (static_cast<uint32_t>(q[4][l]) << 5) | static_cast<uint32_t>(q[5][l]);
+        // 4 color mode needs c0 > c1: swapping the endpoints swaps indices 0 <-> 1 and 2 <-> 3
+        const uint32_t flip = c0 < c1 ? 1u : 0u;
+        if (flip)
+            std::swap(c0, c1);
+        uint32_t bits = 0;
+        if (c0 != c1)
+            for (int i = 0; i < 16; ++i)
+                bits |= ((static_cast<uint32_t>(index[i][l]) ^ flip) & 3u) << (2 * i);
+        write_u16(out, c0);
+        write_u16(out + 2, c1);
+        write_u16(out + 4, bits & 0xFFFFu);
+        write_u16(out + 6, bits >> 16);
+    }
+}
+
+template <class V>
+void pack_channel(const ChannelBlock<V>& block, int lanes, unsigned char* out, size_t stride)
+{
+    float high[V::width], low[V::width];
+    float code[16][V::width];
+    block.high.store(high);
+    block.low.store(low);
+    for (int i = 0; i < 16; ++i)
+        block.code[i].store(code[i]);
+
+    for (int l = 0; l < lanes; ++l, out += stride) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 16; ++i)
+            bits |= static_cast<uint64_t>(code[i][l]) << (3 * i);
+        out[0] = static_cast<unsigned char>(high[l]);
+        out[1] = static_cast<unsigned char>(low[l]);
+        for (int k = 0; k < 6; ++k)
+            out[2 + k] = static_cast<unsigned char>(bits >> (8 * k));
+    }
+}
+
+template <class V>
+void encode_block_row(BlockFormat format, const unsigned char* rgba, int width, int height, int by, unsigned char* out)
+{
+    const int W = V::width;
+    const int blocks_x = (width + 3) / 4;
+    const size_t stride = bc::block_bytes(format);
+    const int channels = format == BlockFormat::BC4 ? 1 : (format == BlockFormat::BC5 ? 2 : (format == BlockFormat::BC1 ? 3 : 4));
+
+    float staging[4][16][W];
+    V p[4][16];
+    for (int bx0 = 0; bx0 < blocks_x; bx0 += W) {
+        // W blocks side by side, lanes past the row end repeat its last block
+        for (int l = 0; l < W; ++l) {
+            const int bx = std::min(bx0 + l, blocks_x - 1);
+            for (int i = 0; i < 16; ++i) {
+                const int x = std::min(bx * 4 + (i & 3), width - 1);
+                const int y = std::min(by * 4 + (i >> 2), height - 1);
+                const unsigned char* pixel = rgba + (static_cast<size_t>(y) * width + x) * 4;
+                for (int c = 0; c < channels; ++c)
+                    staging[c][i][l] = pixel[c];
+            }
+        }
+        for (int c = 0; c < channels; ++c)
+            for (int i = 0; i < 16; ++i)
+                p[c][i] = V::load(staging[c][i]);
+
+        const int lanes = std::min(W, blocks_x - bx0);
+        unsigned char* block_out = out + (static_cast<size_t>(by) * blocks_x + bx0) * stride;
+        ColorBlock<V> color;
+        ChannelBlock<V> channel;
+        switch (format) {
+        case BlockFormat::BC1:
+            encode_colors(p[0], p[1], p[2], color);
+            pack_colors(color, lanes, block_out, stride);
+            break;
+        case BlockFormat::BC3:
+            encode_channel(p[3], channel);
+            pack_channel(channel, lanes, block_out, stride);
+            encode_colors(p[0], p[1], p[2], color);
+            pack_colors(color, lanes, block_out + 8, stride);
+            break;
+        case BlockFormat::BC4:
+            encode_channel(p[0], channel);
+            pack_channel(channel, lanes, block_out, stride);
+            break;
+        case BlockFormat::BC5:
+            encode_channel(p[0], channel);
+            pack_channel(channel, lanes, block_out, stride);
+            encode_channel(p[1], channel);
+            pack_channel(channel, lanes, block_out + 8, stride);
+            break;
+        }
+    }
+}
+
+uint32_t read_u16(const unsigned char* in)
+{
+    return in[0] | (in[1] << 8);
+}
+
+void decode_colors(const unsigned char* block, bool four_color, unsigned char (*out)[4])
+{
+    const uint32_t c[2] = { read_u16(block), read_u16(block + 2) };
+    int palette[4][3];
+    for (int e = 0; e < 2; ++e) {
+        const int r = (c[e] >> 11) & 31, g = (c[e] >> 5) & 63, b = c[e] & 31;
+        palette[e][0] = (r << 3) | (r >> 2);
+        palette[e][1] = (g << 2) | (g >> 4);
+        palette[e][2] = (b << 3) | (b >> 2);
+    }
+    four_color = four_color || c[0] > c[1];
+    for (int k = 0; k < 3; ++k) {
+        if (four_color) {
+            palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+            palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+        }
+        else {
+            palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+            palette[3][k] = 0;
+        }
+    }
+    const uint32_t bits = read_u16(block + 4) | (read_u16(block + 6) << 16);
+    for (int i = 0; i < 16; ++i) {
+        const int index = (bits >> (2 * i)) & 3;
+        for (int k = 0; k < 3; ++k)
+            out[i][k] = static_cast<unsigned char>(palette[index][k]);
+    }
+}
+
+void decode_channel(const unsigned char* block, unsigned char (*out)[4], int channel)
+{
+    const int a0 = block[0], a1 = block[1];
+    int values[8] = { a0, a1 };
+    if (a0 > a1) {
+        for (int k = 1; k < 7; ++k)
+            values[1 + k] = ((7 - k) * a0 + k * a1) / 7;
+    }
+    else {
+        for (int k = 1; k < 5; ++k)
+            values[1 + k] = ((5 - k) * a0 + k * a1) / 5;
+        values[6] = 0;
+        values[7] = 255;
+    }
+    uint64_t bits = 0;
+    for (int k = 0; k < 6; ++k)
+        bits |= static_cast<uint64_t>(block[2 + k]) << (8 * k);
+    for (int i = 0; i < 16; ++i)
+        out[i][channel] = static_cast<unsigned char>(values[(bits >> (3 * i)) & 7]);
+}
+
+}
+
+namespace bc {
+
+size_t block_bytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+size_t compressed_size(BlockFormat format, int width, int height)
+{
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+
+GLenum gl_format(BlockFormat format, bool srgb)
+{
+    switch (format) {
+    case BlockFormat::BC1:
+        return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat::BC3:
+        return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BlockFormat::BC4:
+        return GL_COMPRESSED_RED_RGTC1;
+    case BlockFormat::BC5:
+        return GL_COMPRESSED_RG_RGTC2;
+    }
+    return GL_NONE;
+}
+
+const char* name(BlockFormat format)
+{
+    switch (format) {
+    case BlockFormat::BC1: return "BC1";
+    case BlockFormat::BC3: return "BC3";
+    case BlockFormat::BC4: return "BC4";
+    case BlockFormat::BC5: return "BC5";
+    }
+    return "?";
+}
+
+void encode(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out, ThreadPool* pool)
+{
+    const size_t blocks_y = static_cast<size_t>((height + 3) / 4);
+    auto rows = [&](size_t begin, size_t end) {
+        for (size_t by = begin; by < end; ++by)
+            encode_block_row<simd::floatv>(format, rgba, width, height, static_cast<int>(by), out);
+    };
+    if (pool)
+        pool->parallel_for(0, blocks_y, 4, rows);
+    else
+        rows(0, blocks_y);
+}
+
+void decode(BlockFormat format, const unsigned char* blocks, int width, int height, unsigned char* rgba)
+{
+    const int blocks_x = (width + 3) / 4;
+    const int blocks_y = (height + 3) / 4;
+    const size_t stride = block_bytes(format);
+    unsigned char texels[16][4];
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx, blocks += stride) {
+            std::memset(texels, 0, sizeof(texels));
+            for (auto& texel : texels)
+                texel[3] = 255;
+            switch (format) {
+            case BlockFormat::BC1:
+                decode_colors(blocks, false, texels);
+                break;
+            case BlockFormat::BC3:
+                decode_channel(blocks, texels, 3);
+                decode_colors(blocks + 8, true, texels);
+                break;
+            case BlockFormat::BC4:
+                decode_channel(blocks, texels, 0);
+                break;
+            case BlockFormat::BC5:
+                decode_channel(blocks, texels, 0);
+                decode_channel(blocks + 8, texels, 1);
+                break;
+            }
+            for (int i = 0; i < 16; ++i) {
+                const int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                if (x < width && y < height)
+                    std::memcpy(rgba + (static_cast<size_t>(y) * width + x) * 4, texels[i], 4);
+            }
+        }
+    }
+}
+
+}
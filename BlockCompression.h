@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <GL/glew.h>
+
+#include "ThreadPool.h"
+
+enum class BlockFormat : uint32_t {
+    BC1,                                // RGB, 4 bits per pixel, alpha dropped
+    BC3,                                // RGBA, 8 bpp: BC4 style alpha + BC1 color
+    BC4,                                // R, 4 bpp (masks, heights, roughness)
+    BC5,                                // RG, 8 bpp (tangent space normal maps)
+};
+
+// Block compression (S3TC / RGTC) of RGBA8 images, rows bottom to top as GL
+// expects them.
+//
+// Color blocks take their endpoints from the principal axis of the block's
+// colors (power iteration on the covariance), quantize them to 5:6:5, then
+// refit both endpoints by least squares against the chosen indices and keep
+// the refit where it lowers the error. Single channel blocks use their min
+// and max in the 8 value mode, indices by rounding along that range.
+//
+// The kernels run SoA over simd::floatv::width blocks at once, rows of blocks
+// are spread over the ThreadPool. Edge blocks of sizes that are not a
+// multiple of 4 repeat the last row / column. BC7 is not provided: its mode
+// and partition search needs a different encoder, an order of magnitude slower.
+namespace bc {
+
+size_t block_bytes(BlockFormat format);
+size_t compressed_size(BlockFormat format, int width, int height);
+// GL_COMPRESSED_* internal format; 'srgb' only affects BC1 and BC3
+GLenum gl_format(BlockFormat format, bool srgb);
+const char* name(BlockFormat format);
+
+// 'out' receives compressed_size() bytes, block rows in image row order
+void encode(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out,
+            ThreadPool* pool = &ThreadPool::global());
+
+// reference decoder (RGBA8, missing channels 0, alpha 255), to measure the encoder
+void decode(BlockFormat format, const unsigned char* blocks, int width, int height, unsigned char* rgba);
+
+}
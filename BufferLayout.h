@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+#include <glm/glm.hpp>
+
+// Compile time GLSL block layout rules, to check C++ mirrors of uniform and
+// storage blocks member by member:
+//
+//   static_assert(glsl::layout_matches<glsl::std140, glm::mat4, float>({ offsetof(Block, matrix), offsetof(Block, value) }),
+//                 "Block does not follow std140");
+//
+// Only the member types below are known; another type fails to compile.
+namespace glsl {
+
+// std140 rounds array element alignment up to a vec4, std430 does not
+struct std140 { static constexpr size_t array_alignment = 16; };
+struct std430 { static constexpr size_t array_alignment = 1; };
+
+constexpr size_t round_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+template <class Rules, class T> struct member;
+
+template <class Rules> struct member<Rules, float> { static constexpr size_t alignment = 4, size = 4; };
+template <class Rules> struct member<Rules, int32_t> { static constexpr size_t alignment = 4, size = 4; };
+template <class Rules> struct member<Rules, uint32_t> { static constexpr size_t alignment = 4, size = 4; };
+template <class Rules> struct member<Rules, glm::vec2> { static constexpr size_t alignment = 8, size = 8; };
+template <class Rules> struct member<Rules, glm::vec3> { static constexpr size_t alignment = 16, size = 12; };
+template <class Rules> struct member<Rules, glm::vec4> { static constexpr size_t alignment = 16, size = 16; };
+template <class Rules> struct member<Rules, glm::uvec4> { static constexpr size_t alignment = 16, size = 16; };
+template <class Rules> struct member<Rules, glm::mat4> { static constexpr size_t alignment = 16, size = 64; };
+
+template <class Rules, class T, size_t N> struct member<Rules, T[N]> {
+    static constexpr size_t alignment = round_up(member<Rules, T>::alignment, Rules::array_alignment);
+    static constexpr size_t stride = round_up(member<Rules, T>::size, alignment);
+    static constexpr size_t size = stride * N;
+};
+
+// true when 'offsets' are where GLSL places members of these types, in order
+template <class Rules, class... Members>
+constexpr bool layout_matches(std::initializer_list<size_t> offsets)
+{
+    const size_t alignments[] = { member<Rules, Members>::alignment... };
+    const size_t sizes[] = { member<Rules, Members>::size... };
+    if (offsets.size() != sizeof...(Members))
+        return false;
+    size_t end = 0;
+    size_t i = 0;
+    for (size_t offset : offsets) {
+        if (offset != round_up(end, alignments[i]))
+            return false;
+        end = offset + sizes[i];
+        ++i;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "CascadedShadows.h"
+#include "Frustum.h"
+#include "GLResources.h"
+#include "GLStateCache.h"
+
+CascadedShadows::~CascadedShadows()
+{
+    clear();
+}
+
+void CascadedShadows::init_gl(void)
+{
+    clear();
+    for (GLuint* texture : { &texture_ID, &static_texture_ID }) {
+        glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, texture);
+        glTextureStorage3D(*texture, 1, GL_DEPTH_COMPONENT32F, size, size, CASCADES);
+    }
+    // hardware 2x2 PCF, everything outside the map is lit
+    const GLfloat border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTextureParameteri(texture_ID, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(texture_ID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(texture_ID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTextureParameteri(texture_ID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTextureParameterfv(texture_ID, GL_TEXTURE_BORDER_COLOR, border);
+    glTextureParameteri(texture_ID, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTextureParameteri(texture_ID, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    glCreateFramebuffers(CASCADES, framebuffer_IDs);
+    glCreateFramebuffers(CASCADES, static_framebuffer_IDs);
+    for (int c = 0; c < CASCADES; ++c) {
+        glNamedFramebufferTextureLayer(framebuffer_IDs[c], GL_DEPTH_ATTACHMENT, texture_ID, 0, c);
+        glNamedFramebufferTextureLayer(static_framebuffer_IDs[c], GL_DEPTH_ATTACHMENT, static_texture_ID, 0, c);
+        glNamedFramebufferDrawBuffer(framebuffer_IDs[c], GL_NONE);
+        glNamedFramebufferDrawBuffer(static_framebuffer_IDs[c], GL_NONE);
+    }
+    cache_valid = false;
+}
+
+void CascadedShadows::clear(void)
+{
+    if (texture_ID == 0)
+        return;
+    glDeleteFramebuffers(CASCADES, framebuffer_IDs);
+    glDeleteFramebuffers(CASCADES, static_framebuffer_IDs);
+    glDeleteTextures(1, &texture_ID);
+    glDeleteTextures(1, &static_texture_ID);
+    GLStateCache::global().invalidate();
+    texture_ID = static_texture_ID = 0;
+    std::fill(std::begin(framebuffer_IDs), std::end(framebuffer_IDs), 0);
+    std::fill(std::begin(static_framebuffer_IDs), std::end(static_framebuffer_IDs), 0);
+    cache_valid = false;
+}
+
+void CascadedShadows::update(const glm::mat4& view, const glm::mat4& projection, float near, const glm::vec3& light_direction)
+{
+    const glm::vec3 light = glm::normalize(light_direction);
+    if (light != direction) {
+        const glm::vec3 up = std::abs(light.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        light_rotation = glm::mat3(glm::lookAt(glm::vec3(0.0f), light, up));
+        direction = light;
+        cache_valid = false;
+    }
+
+    // view frustum edges: near plane corners, scaled along their rays to any depth
+    const glm::mat4 inverse_projection = glm::inverse(projection);
+    const glm::mat4 inverse_view = glm::inverse(view);
+    glm::vec3 rays[4];
+    for (int i = 0; i < 4; ++i) {
+        const glm::vec4 p = inverse_projection * glm::vec4(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, -1.0f, 1.0f);
+        rays[i] = glm::vec3(p) / p.w / (-p.z / p.w);            // at view depth 1
+    }
+
+    const float far = std::max(shadow_distance, near * 2.0f);
+    float split_near = near;
+    for (int c = 0; c < CASCADES; ++c) {
+        const float t = static_cast<float>(c + 1) / CASCADES;
+        const float split_far = split_lambda * near * std::pow(far / near, t) + (1.0f - split_lambda) * (near + (far - near) * t);
+
+        // bounding sphere of the slice: the center is on the view axis, so the
+        // radius does not change as the camera turns; rounded up against float noise
+        glm::vec3 corners[8];
+        glm::vec3 center(0.0f);
+        for (int i = 0; i < 8; ++i) {
+            corners[i] = rays[i & 3] * (i < 4 ? split_near : split_far);
+            center += corners[i] / 8.0f;
+        }
+        float radius = 0.0f;
+        for (const glm::vec3& corner : corners)
+            radius = std::max(radius, glm::distance(corner, center));
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // the window keeps SNAP_TEXELS texels of slack on each side, so the
+        // sphere stays inside when the center is snapped to that grid
+        const float extent = radius * size / (size - 2.0f * SNAP_TEXELS);
+        const float texel = 2.0f * extent / size;
+        const float step = texel * SNAP_TEXELS;
+        const glm::vec3 light_center = light_rotation * glm::vec3(inverse_view * glm::vec4(center, 1.0f));
+        const glm::vec3 origin = glm::floor(light_center / step + 0.5f) * step;
+
+        Cascade& cascade = cascades[c];
+        cascade.split_far = split_far;
+        cascade.texel_size = texel;
+        cascade.origin = origin;
+        // light view space looks down -z: the volume reaches caster_reach toward the light
+        const glm::mat4 ortho = glm::ortho(origin.x - extent, origin.x + extent, origin.y - extent, origin.y + extent,
+                                           -origin.z - radius - step - caster_reach, -origin.z + radius + step);
+        cascade.view_projection = ortho * glm::mat4(light_rotation);
+
+        stale[c] = !cache_valid || origin != cached_origin[c] || texel != cached_texel[c];
+        split_near = split_far;
+    }
+}
+
+void CascadedShadows::invalidate_static(void)
+{
+    cache_valid = false;
+    std::fill(std::begin(stale), std::end(stale), true);
+}
+
+const std::vector<uint32_t>& CascadedShadows::cull(int cascade, const SphereBounds& casters, ThreadPool* pool)
+{
+    return culler.cull(Frustum::from_matrix(cascades[cascade].view_projection), casters, pool);
+}
+
+void CascadedShadows::render(const std::function<void(int, bool)>& draw)
+{
+    GLStateCache& state = GLStateCache::global();
+    state.viewport(0, 0, size, size);
+    state.set_enabled(GL_DEPTH_TEST, true);
+    state.set_enabled(GL_BLEND, false);
+    state.depth_mask(true);
+    state.set_enabled(GL_POLYGON_OFFSET_FILL, true);
+    glPolygonOffset(slope_bias, constant_bias);
+
+    frame_stats.static_renders = 0;
+    for (int c = 0; c < CASCADES; ++c) {
+        if (stale[c]) {
+            glBindFramebuffer(GL_FRAMEBUFFER, static_framebuffer_IDs[c]);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            draw(c, true);
+            cached_origin[c] = cascades[c].origin;
+            cached_texel[c] = cascades[c].texel_size;
+            stale[c] = false;
+            ++frame_stats.static_renders;
+        }
+        glCopyImageSubData(static_texture_ID, GL_TEXTURE_2D_ARRAY, 0, 0, 0, c, texture_ID, GL_TEXTURE_2D_ARRAY, 0, 0, 0, c, size, size, 1);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_IDs[c]);
+        draw(c, false);
+    }
+    cache_valid = true;
+    frame_stats.static_renders_total += frame_stats.static_renders;
+    ++frame_stats.frames;
+
+    state.set_enabled(GL_POLYGON_OFFSET_FILL, false);
+}
+
+ShadowBlock CascadedShadows::block(const glm::mat4& view, const glm::vec3& sun_color) const
+{
+    // clip space -> 0..1 texture coordinates and depth
+    const glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+    const glm::mat4 inverse_view = glm::inverse(view);
+    ShadowBlock block;
+    for (int c = 0; c < CASCADES; ++c) {
+        block.shadow_matrices[c] = bias * cascades[c].view_projection * inverse_view;
+        block.cascade_splits[c] = cascades[c].split_far;
+        block.cascade_texels[c] = cascades[c].texel_size;
+    }
+    block.sun_direction = glm::vec4(glm::normalize(glm::mat3(view) * -direction), 0.0f);
+    block.sun_color = glm::vec4(sun_color, 1.0f);
+    return block;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "ThreadPool.h"
+#include "UniformBlocks.h"
+
+// Cascaded shadow maps of one directional light.
+//
+// update() splits the view range up to 'shadow_distance' into CASCADES
+// slices (a blend of logarithmic and uniform splits) and fits each one into
+// an orthographic light view around its bounding sphere. The sphere does
+// not change size when the camera turns, and the window moves in steps of
+// SNAP_TEXELS texels (the extent keeps that much slack), so shadow edges do
+// not shimmer, and a window only changes when the camera has moved a step.
+//
+// Casters are drawn in two groups. Static casters are drawn into a cached
+// depth array, and only for cascades whose window moved (or after the light
+// turned or invalidate_static()). Every frame, render() copies the cached
+// layers into the live array and draws only the dynamic casters on top.
+// cull() is frustum culling against one cascade's light volume, which
+// reaches 'caster_reach' toward the light for casters outside the view.
+class CascadedShadows {
+public:
+    static const int CASCADES = SHADOW_CASCADES;
+    static const int SNAP_TEXELS = 64;
+
+    struct Cascade {
+        glm::mat4 view_projection = glm::mat4(1.0f);    // world -> light clip space
+        float split_far = 0.0f;                         // view depth where the cascade ends
+        float texel_size = 0.0f;                        // world units per shadow map texel
+        glm::vec3 origin = glm::vec3(0.0f);             // snapped window center, light space
+    };
+
+    struct Stats {
+        uint32_t static_renders = 0;                    // cascades whose cache was redrawn, last render()
+        uint32_t static_renders_total = 0;
+        uint32_t frames = 0;
+    };
+
+    explicit CascadedShadows(GLsizei resolution = 2048) : size(resolution) {}
+    ~CascadedShadows();
+
+    CascadedShadows(const CascadedShadows&) = delete;
+    CascadedShadows& operator=(const CascadedShadows&) = delete;
+
+    // allocates the live and cached depth arrays, must run while the context is current
+    void init_gl(void);
+    void clear(void);
+
+    // 'light_direction' points from the light into the scene
+    void update(const glm::mat4& view, const glm::mat4& projection, float near, const glm::vec3& light_direction);
+    // the static casters changed, every cache is redrawn on the next render()
+    void invalidate_static(void);
+    bool static_stale(int cascade) const { return stale[cascade]; }
+
+    // casters overlapping a cascade's light volume, ascending; valid until the next call
+    const std::vector<uint32_t>& cull(int cascade, const SphereBounds& casters, ThreadPool* pool = &ThreadPool::global());
+
+    // draw(cascade, static_casters) draws one group with cascade(c).view_projection,
+    // into a depth-only target that is already bound
+    void render(const std::function<void(int, bool)>& draw);
+
+    // what receivers read, for the camera's 'view'; the sun color goes along
+    ShadowBlock block(const glm::mat4& view, const glm::vec3& sun_color) const;
+
+    const Cascade& cascade(int c) const { return cascades[c]; }
+    GLuint texture(void) const { return texture_ID; }
+    GLsizei resolution(void) const { return size; }
+    const Stats& stats(void) const { return frame_stats; }
+
+    float shadow_distance = 120.0f;
+    float split_lambda = 0.75f;         // 1 = logarithmic splits, 0 = uniform
+    float caster_reach = 100.0f;
+    float slope_bias = 2.0f, constant_bias = 4.0f;      // glPolygonOffset while drawing casters
+
+private:
+    Cascade cascades[CASCADES];
+    bool stale[CASCADES] = {};
+    glm::vec3 cached_origin[CASCADES] = {};
+    float cached_texel[CASCADES] = {};
+    glm::vec3 direction = glm::vec3(0.0f);                  // none yet
+    glm::mat3 light_rotation = glm::mat3(1.0f);
+    bool cache_valid = false;
+
+    GLsizei size;
+    GLuint texture_ID = 0;              // live cascades, sampled with depth comparison
+    GLuint static_texture_ID = 0;       // static casters only
+    GLuint framebuffer_IDs[CASCADES] = {};
+    GLuint static_framebuffer_IDs[CASCADES] = {};
+
+    FrustumCuller culler;
+    Stats frame_stats;
+};
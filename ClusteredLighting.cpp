@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "ClusteredLighting.h"
+#include "GLStateCache.h"
+#include "Simd.h"
+
+namespace {
+
+// the last slice reaches this far, practically to infinity
+const float UNBOUNDED_DEPTH = 1e6f;
+
+}
+
+void ClusteredLighting::init_gl(void)
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    storage_alignment = static_cast<size_t>(std::max(alignment, 16));
+}
+
+void ClusteredLighting::set_projection(const glm::mat4& projection, int width, int height, float near, float far)
+{
+    box_min_x.resize(CLUSTERS);
+    box_min_y.resize(CLUSTERS);
+    box_min_z.resize(CLUSTERS);
+    box_max_x.resize(CLUSTERS);
+    box_max_y.resize(CLUSTERS);
+    box_max_z.resize(CLUSTERS);
+
+    const float log_range = std::log(far / near);
+    slice_scale = SLICES / log_range;
+    slice_bias = -SLICES * std::log(near) / log_range;
+    for (int s = 0; s <= SLICES; ++s)
+        slice_depth[s] = near * std::pow(far / near, static_cast<float>(s) / SLICES);
+    slice_depth[SLICES] = UNBOUNDED_DEPTH;
+    tile_size = glm::vec2(static_cast<float>(std::max(width, 1)) / TILES_X, static_cast<float>(std::max(height, 1)) / TILES_Y);
+
+    // tile corners on the near plane, scaled along their rays to the slice depths
+    const glm::mat4 inverse = glm::inverse(projection);
+    for (int y = 0; y < TILES_Y; ++y) {
+        for (int x = 0; x < TILES_X; ++x) {
+            glm::vec3 corners[4];
+            for (int c = 0; c < 4; ++c) {
+                const glm::vec2 ndc(-1.0f + 2.0f * (x + (c & 1)) / TILES_X, -1.0f + 2.0f * (y + (c >> 1)) / TILES_Y);
+                const glm::vec4 p = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+                corners[c] = glm::vec3(p) / p.w;
+            }
+            for (int s = 0; s < SLICES; ++s) {
+                glm::vec3 lo(1e30f), hi(-1e30f);
+                for (const float depth : { slice_depth[s], slice_depth[s + 1] })
+                    for (const glm::vec3& corner : corners) {
+                        const glm::vec3 point = corner * (depth / -corner.z);
+                        lo = glm::min(lo, point);
+                        hi = glm::max(hi, point);
+                    }
+                const size_t cluster = (static_cast<size_t>(s) * TILES_Y + y) * TILES_X + x;
+                box_min_x[cluster] = lo.x;
+                box_min_y[cluster] = lo.y;
+                box_min_z[cluster] = lo.z;
+                box_max_x[cluster] = hi.x;
+                box_max_y[cluster] = hi.y;
+                box_max_z[cluster] = hi.z;
+            }
+        }
+    }
+}
+
+void ClusteredLighting::prepare(const glm::mat4& view, const SphereBounds& lights)
+{
+    const size_t count = lights.size();
+    light_x.resize(count);
+    light_y.resize(count);
+    light_z.resize(count);
+    light_radius.resize(count);
+    for (auto& list : slice_lights)
+        list.clear();
+
+    auto slice_of = [this](float depth) {
+        return static_cast<int>(std::clamp(std::floor(std::log(std::max(depth, 1e-6f)) * slice_scale + slice_bias), 0.0f, SLICES - 1.0f));
+    };
+    for (size_t i = 0; i < count; ++i) {
+        const glm::vec4 v = view * glm::vec4(lights.x[i], lights.y[i], lights.z[i], 1.0f);
+        light_x[i] = v.x;
+        light_y[i] = v.y;
+        light_z[i] = v.z;
+        light_radius[i] = lights.radius[i];
+
+        const float nearest = -v.z - lights.radius[i], farthest = -v.z + lights.radius[i];
+        if (farthest < slice_depth[0])
+            continue;                   // behind the near plane
+        // one slice of slack on each side, the box test is the exact one
+        const int first = std::max(slice_of(nearest) - 1, 0), last = std::min(slice_of(farthest) + 1, SLICES - 1);
+        for (int s = first; s <= last; ++s)
+            slice_lights[s].push_back(static_cast<uint32_t>(i));
+    }
+
+    cluster_counts.assign(CLUSTERS, 0);
+    cluster_lights.resize(static_cast<size_t>(CLUSTERS) * MAX_CLUSTER_LIGHTS);
+}
+
+template <class V>
+void ClusteredLighting::assign_slice(int slice, const uint32_t* candidates, size_t candidate_count)
+{
+    const size_t base = static_cast<size_t>(slice) * TILES_Y * TILES_X;
+    const V zero = V::broadcast(0.0f);
+    for (size_t n = 0; n < candidate_count; ++n) {
+        const uint32_t light = candidates[n];
+        const V cx = V::broadcast(light_x[light]), cy = V::broadcast(light_y[light]), cz = V::broadcast(light_z[light]);
+        const V r2 = V::broadcast(light_radius[light] * light_radius[light]);
+        for (size_t c = base; c < base + TILES_Y * TILES_X; c += V::width) {
+            // squared distance from the sphere center to the box
+            const V dx = max(max(V::load(&box_min_x[c]) - cx, cx - V::load(&box_max_x[c])), zero);
+            const V dy = max(max(V::load(&box_min_y[c]) - cy, cy - V::load(&box_max_y[c])), zero);
+            const V dz = max(max(V::load(&box_min_z[c]) - cz, cz - V::load(&box_max_z[c])), zero);
+            int hits = movemask(dx * dx + dy * dy + dz * dz <= r2);
+            for (size_t lane = c; hits != 0; ++lane, hits >>= 1) {
+                if ((hits & 1) && cluster_counts[lane] < MAX_CLUSTER_LIGHTS)
+                    cluster_lights[lane * MAX_CLUSTER_LIGHTS + cluster_counts[lane]++] = light;
+            }
+        }
+    }
+}
+
+void ClusteredLighting::assign(const glm::mat4& view, const SphereBounds& lights, ThreadPool* pool)
+{
+    static_assert((TILES_X * TILES_Y) % simd::floatv::width == 0, "a slice must fill whole registers");
+    prepare(view, lights);
+    // slices own disjoint clusters, they run in parallel without locks
+    auto body = [this](size_t first, size_t last) {
+        for (size_t s = first; s < last; ++s)
+            assign_slice<simd::floatv>(static_cast<int>(s), slice_lights[s].data(), slice_lights[s].size());
+    };
+    if (pool)
+        pool->parallel_for(0, SLICES, 1, body);
+    else
+        body(0, SLICES);
+    compact();
+}
+
+void ClusteredLighting::assign_scalar(const glm::mat4& view, const SphereBounds& lights)
+{
+    prepare(view, lights);
+    for (size_t c = 0; c < CLUSTERS; ++c) {
+        for (size_t light = 0; light < light_x.size(); ++light) {
+            const float dx = std::max(std::max(box_min_x[c] - light_x[light], light_x[light] - box_max_x[c]), 0.0f);
+            const float dy = std::max(std::max(box_min_y[c] - light_y[light], light_y[light] - box_max_y[c]), 0.0f);
+            const float dz = std::max(std::max(box_min_z[c] - light_z[light], light_z[light] - box_max_z[c]), 0.0f);
+            if (dx * dx + dy * dy + dz * dz <= light_radius[light] * light_radius[light] && cluster_counts[c] < MAX_CLUSTER_LIGHTS)
+                cluster_lights[c * MAX_CLUSTER_LIGHTS + cluster_counts[c]++] = static_cast<uint32_t>(light);
+        }
+    }
+    compact();
+}
+
+void ClusteredLighting::compact(void)
+{
+    cluster_ranges.resize(CLUSTERS);
+    uint32_t offset = 0;
+    max_lights = 0;
+    dropped = 0;
+    for (size_t c = 0; c < CLUSTERS; ++c) {
+        // the list must fit its stream allocation, whatever the light count
+        const uint32_t count = std::min(cluster_counts[c], MAX_LIGHT_INDICES - offset);
+        dropped += cluster_counts[c] - count;
+        cluster_counts[c] = count;
+        cluster_ranges[c] = glm::uvec2(offset, count);
+        offset += count;
+        max_lights = std::max(max_lights, count);
+    }
+    light_indices.resize(offset);
+    for (size_t c = 0; c < CLUSTERS; ++c)
+        std::memcpy(light_indices.data() + cluster_ranges[c].x, &cluster_lights[c * MAX_CLUSTER_LIGHTS], cluster_counts[c] * sizeof(uint32_t));
+}
+
+void ClusteredLighting::upload(StreamBuffer& stream, const std::vector<glm::vec3>& colors, const glm::vec3& ambient)
+{
+    GLStateCache& state = GLStateCache::global();
+    gpu_lights.resize(light_x.size());
+    for (size_t i = 0; i < gpu_lights.size(); ++i)
+        gpu_lights[i] = { glm::vec4(light_x[i], light_y[i], light_z[i], light_radius[i]), glm::vec4(colors[i], 1.0f) };
+
+    // empty arrays still get a (dummy) range, size 0 would bind the whole buffer
+    auto stream_storage = [&](GLuint binding, const void* data, size_t size) {
+        const size_t bytes = std::max<size_t>(size, 16);
+        const StreamBuffer::Allocation allocation = stream.allocate(bytes, storage_alignment);
+        if (size > 0)
+            std::memcpy(allocation.data, data, size);
+        state.bind_buffer_range(GL_SHADER_STORAGE_BUFFER, binding, stream.buffer(), allocation.offset, static_cast<GLsizeiptr>(bytes));
+    };
+    stream_storage(LIGHT_BUFFER_BINDING, gpu_lights.data(), gpu_lights.size() * sizeof(GpuPointLight));
+    stream_storage(CLUSTER_BUFFER_BINDING, cluster_ranges.data(), cluster_ranges.size() * sizeof(glm::uvec2));
+    stream_storage(LIGHT_INDEX_BUFFER_BINDING, light_indices.data(), light_indices.size() * sizeof(uint32_t));
+
+    const StreamBuffer::Allocation block = stream.allocate(sizeof(LightingBlock), stream.uniform_alignment());
+    LightingBlock& lighting = *static_cast<LightingBlock*>(block.data);
+    lighting.cluster_grid = glm::uvec4(TILES_X, TILES_Y, SLICES, static_cast<uint32_t>(gpu_lights.size()));
+    lighting.cluster_slicing = glm::vec4(slice_scale, slice_bias, tile_size);
+    lighting.ambient = glm::vec4(ambient, 1.0f);
+    state.bind_buffer_range(GL_UNIFORM_BUFFER, LIGHTING_BLOCK_BINDING, stream.buffer(), block.offset, sizeof(LightingBlock));
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "StreamBuffer.h"
+#include "ThreadPool.h"
+#include "UniformBlocks.h"
+
+// Clustered forward shading: light lists per view space cluster.
+//
+// The view frustum is split into TILES_X x TILES_Y screen tiles and SLICES
+// depth slices, exponentially spaced from the near plane to 'far' (the last
+// slice reaches to infinity). Each frame assign() moves the light spheres to
+// view space, then every depth slice, on the thread pool, tests the lights
+// whose depth range touches it against all of its cluster boxes with
+// simd::floatv, several clusters per instruction. The lists are compacted
+// into one index array, in ascending light order per cluster.
+//
+// upload() streams the lights, the per cluster (offset, count) pairs and the
+// indices as shader storage blocks, and the Lighting uniform block with the
+// grid parameters; lighting.glsl finds a fragment's cluster from
+// gl_FragCoord and its view depth and loops over that cluster's lights only.
+class ClusteredLighting {
+public:
+    static const int TILES_X = 16;
+    static const int TILES_Y = 9;
+    static const int SLICES = 24;
+    static const int CLUSTERS = TILES_X * TILES_Y * SLICES;
+    static const uint32_t MAX_CLUSTER_LIGHTS = 256;     // further lights in a cluster are dropped
+    // the whole index list, 1 MB of the frame's StreamBuffer section; clusters
+    // are stored nearest slice first, the farthest lose their lights first
+    static const uint32_t MAX_LIGHT_INDICES = 256 * 1024;
+
+    // must run while the context is current (queries the storage buffer offset alignment)
+    void init_gl(void);
+
+    // cluster boxes for a perspective projection and viewport size; 'far' ends the sliced range
+    void set_projection(const glm::mat4& projection, int width, int height, float near, float far);
+
+    // world space light spheres; pool == NULL runs on the calling thread only
+    void assign(const glm::mat4& view, const SphereBounds& lights, ThreadPool* pool = &ThreadPool::global());
+    // one cluster and light at a time, for reference
+    void assign_scalar(const glm::mat4& view, const SphereBounds& lights);
+
+    // binds LIGHT_BUFFER_BINDING, CLUSTER_BUFFER_BINDING, LIGHT_INDEX_BUFFER_BINDING and LIGHTING_BLOCK_BINDING
+    void upload(StreamBuffer& stream, const std::vector<glm::vec3>& colors, const glm::vec3& ambient);
+
+    // per cluster: offset into indices(), count
+    const std::vector<glm::uvec2>& clusters(void) const { return cluster_ranges; }
+    const std::vector<uint32_t>& indices(void) const { return light_indices; }
+    uint32_t max_cluster_lights(void) const { return max_lights; }
+    // cluster entries cut by MAX_LIGHT_INDICES, last assign()
+    uint32_t dropped_indices(void) const { return dropped; }
+
+private:
+    template <class V>
+    void assign_slice(int slice, const uint32_t* candidates, size_t candidate_count);
+    // view space lights, bucketed by the depth slices they touch
+    void prepare(const glm::mat4& view, const SphereBounds& lights);
+    void compact(void);
+
+    // cluster boxes, view space, SoA; cluster = (slice * TILES_Y + y) * TILES_X + x
+    std::vector<float> box_min_x, box_min_y, box_min_z, box_max_x, box_max_y, box_max_z;
+    float slice_depth[SLICES + 1] = {};
+    float slice_scale = 0.0f, slice_bias = 0.0f;
+    glm::vec2 tile_size = glm::vec2(1.0f);
+
+    // lights of the frame, view space
+    std::vector<float> light_x, light_y, light_z, light_radius;
+    std::vector<uint32_t> slice_lights[SLICES];
+    std::vector<GpuPointLight> gpu_lights;
+
+    std::vector<uint32_t> cluster_counts;
+    std::vector<uint32_t> cluster_lights;       // MAX_CLUSTER_LIGHTS per cluster
+    std::vector<glm::uvec2> cluster_ranges;
+    std::vector<uint32_t> light_indices;
+    uint32_t max_lights = 0;
+    uint32_t dropped = 0;
+
+    size_t storage_alignment = 256;
+};
@@ -0,0 +1,584 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+
+#include "Collision.h"
+
+namespace {
+
+// gap kept between a sliding sphere and the surface it stopped at
+const float SKIN = 1e-3f;
+// bodies per broadphase block and islands per task
+const size_t PAIR_BLOCK_SIZE = 1024;
+const size_t ISLAND_GRAIN = 256;
+
+// smallest root of a * t^2 + b * t + c = 0 within [0, max_root]
+bool lowest_root(float a, float b, float c, float max_root, float& root)
+{
+    if (std::fabs(a) < 1e-12f)
+        return false;
+    const float discriminant = b * b - 4.0f * a * c;
+    if (discriminant < 0.0f)
+        return false;
+    const float s = std::sqrt(discriminant);
+    float r0 = (-b - s) / (2.0f * a);
+    float r1 = (-b + s) / (2.0f * a);
+    if (r0 > r1)
+        std::swap(r0, r1);
+    if (r0 >= 0.0f && r0 <= max_root) {
+        root = r0;
+        return true;
+    }
+    if (r1 >= 0.0f && r1 <= max_root) {
+        root = r1;
+        return true;
+    }
+    return false;
+}
+
+// interval of the triangle projected on 'axis'
+void project(const glm::vec3& axis, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& lo, float& hi)
+{
+    const float pa = glm::dot(axis, a), pb = glm::dot(axis, b), pc = glm::dot(axis, c);
+    lo = std::min(pa, std::min(pb, pc));
+    hi = std::max(pa, std::max(pb, pc));
+}
+
+} // namespace
+
+glm::vec3 closest_point_on_triangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    // Voronoi regions of the vertices, then edges, then the face
+    const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    const float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+        return a;
+
+    const glm::vec3 bp = p - b;
+    const float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+        return b;
+
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        return a + ab * (d1 / (d1 - d3));
+
+    const glm::vec3 cp = p - c;
+    const float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+        return c;
+
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        return a + ac * (d2 / (d2 - d6));
+
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    const float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+void closest_points_on_segments(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& q0, const glm::vec3& q1, glm::vec3& on_p, glm::vec3& on_q)
+{
+    const glm::vec3 d1 = p1 - p0, d2 = q1 - q0, r = p0 - q0;
+    const float a = glm::dot(d1, d1), e = glm::dot(d2, d2), f = glm::dot(d2, r);
+    float s = 0.0f, t = 0.0f;
+    if (a <= 1e-12f && e <= 1e-12f) {
+        on_p = p0;
+        on_q = q0;
+        return;
+    }
+    if (a <= 1e-12f) {
+        t = glm::clamp(f / e, 0.0f, 1.0f);
+    }
+    else {
+        const float c = glm::dot(d1, r);
+        if (e <= 1e-12f) {
+            s = glm::clamp(-c / a, 0.0f, 1.0f);
+        }
+        else {
+            const float b = glm::dot(d1, d2);
+            const float denom = a * e - b * b;
+            s = denom > 1e-12f ? glm::clamp((b * f - c * e) / denom, 0.0f, 1.0f) : 0.0f;
+            t = (b * s + f) / e;
+            if (t < 0.0f) {
+                t = 0.0f;
+                s = glm::clamp(-c / a, 0.0f, 1.0f);
+            }
+            else if (t > 1.0f) {
+                t = 1.0f;
+                s = glm::clamp((b - c) / a, 0.0f, 1.0f);
+            }
+        }
+    }
+    on_p = p0 + d1 * s;
+    on_q = q0 + d2 * t;
+}
+
+bool sphere_triangle(const glm::vec3& center, float radius, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, Contact& contact)
+{
+    const glm::vec3 closest = closest_point_on_triangle(center, a, b, c);
+    const glm::vec3 d = center - closest;
+    const float distance_squared = glm::dot(d, d);
+    if (distance_squared >= radius * radius)
+        return false;
+
+    const float distance = std::sqrt(distance_squared);
+    if (distance > 1e-6f) {
+        contact.normal = d / distance;
+    }
+    else {
+        // center on the triangle, either face will do
+        contact.normal = glm::normalize(glm::cross(b - a, c - a));
+    }
+    contact.depth = radius - distance;
+    return true;
+}
+
+bool capsule_triangle(const glm::vec3& p0, const glm::vec3& p1, float radius, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, Contact& contact)
+{
+    const glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+
+    // axis pierces the triangle: push out towards the side holding most of the axis,
+    // far enough that the end point left behind the plane clears it by the radius
+    const float hit = intersect_triangle(p0, p1 - p0, a, b, c);
+    if (hit >= 0.0f && hit <= 1.0f) {
+        const float d0 = glm::dot(p0 - a, normal), d1 = glm::dot(p1 - a, normal);
+        const float side = d0 + d1 >= 0.0f ? 1.0f : -1.0f;
+        const float behind = std::max(-d0 * side, -d1 * side);
+        contact.normal = normal * side;
+        contact.depth = radius + behind;
+        return true;
+    }
+
+    // otherwise the closest pair is at an axis end point or on a triangle edge
+    glm::vec3 best_axis = p0, best_triangle = closest_point_on_triangle(p0, a, b, c);
+    float best = glm::dot(best_axis - best_triangle, best_axis - best_triangle);
+    const auto consider = [&](const glm::vec3& on_axis, const glm::vec3& on_triangle) {
+        const float d = glm::dot(on_axis - on_triangle, on_axis - on_triangle);
+        if (d < best) {
+            best = d;
+            best_axis = on_axis;
+            best_triangle = on_triangle;
+        }
+    };
+    consider(p1, closest_point_on_triangle(p1, a, b, c));
+    const glm::vec3 corners[3] = { a, b, c };
+    for (int e = 0; e < 3; ++e) {
+        glm::vec3 on_axis, on_edge;
+        closest_points_on_segments(p0, p1, corners[e], corners[(e + 1) % 3], on_axis, on_edge);
+        consider(on_axis, on_edge);
+    }
+    if (best >= radius * radius)
+        return false;
+
+    const float distance = std::sqrt(best);
+    contact.normal = distance > 1e-6f ? (best_axis - best_triangle) / distance : normal;
+    contact.depth = radius - distance;
+    return true;
+}
+
+bool box_triangle(const glm::vec3& box_min, const glm::vec3& box_max, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, Contact& contact)
+{
+    const glm::vec3 center = (box_min + box_max) * 0.5f;
+    const glm::vec3 extent = (box_max - box_min) * 0.5f;
+    const glm::vec3 edges[3] = { b - a, c - b, a - c };
+
+    // box faces, triangle normal and the nine edge cross products
+    glm::vec3 axes[13] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::cross(edges[0], edges[1]) };
+    int axis_count = 4;
+    for (int i = 0; i < 3; ++i)
+        for (int e = 0; e < 3; ++e)
+            axes[axis_count++] = glm::cross(axes[i], edges[e]);
+
+    const glm::vec3 triangle_center = (a + b + c) / 3.0f;
+    float best_depth = FLT_MAX;
+    glm::vec3 best_normal(0.0f, 1.0f, 0.0f);
+    for (int i = 0; i < axis_count; ++i) {
+        const float length = glm::length(axes[i]);
+        if (length < 1e-6f)
+            continue;   // parallel edges, covered by the other axes
+        const glm::vec3 axis = axes[i] / length;
+        float lo, hi;
+        project(axis, a, b, c, lo, hi);
+        const float box_center = glm::dot(axis, center);
+        const float box_radius = glm::dot(glm::abs(axis), extent);
+        const float overlap = std::min(box_center + box_radius - lo, hi - (box_center - box_radius));
+        if (overlap <= 0.0f)
+            return false;
+        if (overlap < best_depth) {
+            best_depth = overlap;
+            best_normal = box_center >= glm::dot(axis, triangle_center) ? axis : -axis;
+        }
+    }
+    contact.normal = best_normal;
+    contact.depth = best_depth;
+    return true;
+}
+
+float sweep_sphere_triangle(const glm::vec3& start, const glm::vec3& motion, float radius, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, glm::vec3& normal)
+{
+    // already touching: a hit at t = 0 unless moving away
+    Contact contact;
+    if (sphere_triangle(start, radius, a, b, c, contact)) {
+        if (glm::dot(motion, contact.normal) >= 0.0f)
+            return -1.0f;
+        normal = contact.normal;
+        return 0.0f;
+    }
+
+    float t = FLT_MAX;
+
+    // face: the sphere front touches the plane inside the triangle
+    glm::vec3 plane_normal = glm::normalize(glm::cross(b - a, c - a));
+    float distance = glm::dot(start - a, plane_normal);
+    if (distance < 0.0f) {
+        plane_normal = -plane_normal;
+        distance = -distance;
+    }
+    const float approach = -glm::dot(motion, plane_normal);
+    if (approach > 1e-12f) {
+        const float plane_t = (distance - radius) / approach;
+        if (plane_t >= 0.0f && plane_t <= 1.0f) {
+            const glm::vec3 p = start + motion * plane_t - plane_normal * radius;
+            const glm::vec3 q = closest_point_on_triangle(p, a, b, c);
+            if (glm::dot(p - q, p - q) < 1e-10f) {
+                normal = plane_normal;
+                return plane_t;
+            }
+        }
+    }
+
+    // vertices: the center reaches a sphere of 'radius' around them
+    const glm::vec3 corners[3] = { a, b, c };
+    const float motion_squared = glm::dot(motion, motion);
+    for (int i = 0; i < 3; ++i) {
+        const glm::vec3 m = start - corners[i];
+        float root;
+        if (lowest_root(motion_squared, 2.0f * glm::dot(motion, m), glm::dot(m, m) - radius * radius, std::min(t, 1.0f), root))
+            t = root;
+    }
+
+    // edges: the center reaches a cylinder of 'radius' around them
+    for (int i = 0; i < 3; ++i) {
+        const glm::vec3 edge = corners[(i + 1) % 3] - corners[i];
+        const glm::vec3 m = start - corners[i];
+        const float ee = glm::dot(edge, edge), ed = glm::dot(edge, motion), em = glm::dot(edge, m);
+        float root;
+        if (!lowest_root(ee * motion_squared - ed * ed, 2.0f * (ee * glm::dot(motion, m) - ed * em), ee * (glm::dot(m, m) - radius * radius) - em * em,
+                         std::min(t, 1.0f), root))
+            continue;
+        const float f = (em + root * ed) / ee;
+        if (f >= 0.0f && f <= 1.0f)
+            t = root;
+    }
+
+    if (t > 1.0f)
+        return -1.0f;
+    const glm::vec3 center = start + motion * t;
+    normal = glm::normalize(center - closest_point_on_triangle(center, a, b, c));
+    return t;
+}
+
+void CollisionMesh::add(const glm::vec3* positions, const uint32_t* indices, size_t index_count, const glm::mat4& model)
+{
+    for (size_t i = 0; i + 2 < index_count; i += 3)
+        for (int k = 0; k < 3; ++k)
+            corners.push_back(glm::vec3(model * glm::vec4(positions[indices[i + k]], 1.0f)));
+}
+
+void CollisionMesh::build(void)
+{
+    const size_t count = triangle_count();
+    triangle_min.resize(count);
+    triangle_max.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const glm::vec3* t = &corners[3 * i];
+        triangle_min[i] = glm::min(t[0], glm::min(t[1], t[2]));
+        triangle_max[i] = glm::max(t[0], glm::max(t[1], t[2]));
+    }
+    bvh.build(triangle_min.data(), triangle_max.data(), count);
+}
+
+void CollisionMesh::clear(void)
+{
+    corners.clear();
+    triangle_min.clear();
+    triangle_max.clear();
+    bvh.clear();
+}
+
+template <class Test>
+void CollisionMesh::for_each_triangle(const glm::vec3& box_min, const glm::vec3& box_max, const Test& test) const
+{
+    thread_local std::vector<uint32_t> hits;
+    hits.clear();
+    bvh.query(box_min, box_max, hits);
+    for (uint32_t t : hits)
+        test(corners[3 * t], corners[3 * t + 1], corners[3 * t + 2]);
+}
+
+void CollisionMesh::collide_sphere(const glm::vec3& center, float radius, std::vector<Contact>& out) const
+{
+    for_each_triangle(center - glm::vec3(radius), center + glm::vec3(radius), [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        Contact contact;
+        if (sphere_triangle(center, radius, a, b, c, contact))
+            out.push_back(contact);
+    });
+}
+
+void CollisionMesh::collide_capsule(const glm::vec3& p0, const glm::vec3& p1, float radius, std::vector<Contact>& out) const
+{
+    for_each_triangle(glm::min(p0, p1) - glm::vec3(radius), glm::max(p0, p1) + glm::vec3(radius), [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        Contact contact;
+        if (capsule_triangle(p0, p1, radius, a, b, c, contact))
+            out.push_back(contact);
+    });
+}
+
+void CollisionMesh::collide_box(const glm::vec3& box_min, const glm::vec3& box_max, std::vector<Contact>& out) const
+{
+    for_each_triangle(box_min, box_max, [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        Contact contact;
+        if (box_triangle(box_min, box_max, a, b, c, contact))
+            out.push_back(contact);
+    });
+}
+
+bool CollisionMesh::sweep_sphere(const glm::vec3& start, const glm::vec3& motion, float radius, float& t, glm::vec3& normal) const
+{
+    t = FLT_MAX;
+    const glm::vec3 end = start + motion;
+    for_each_triangle(glm::min(start, end) - glm::vec3(radius), glm::max(start, end) + glm::vec3(radius), [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        glm::vec3 n;
+        const float hit = sweep_sphere_triangle(start, motion, radius, a, b, c, n);
+        if (hit >= 0.0f && hit < t) {
+            t = hit;
+            normal = n;
+        }
+    });
+    return t != FLT_MAX;
+}
+
+glm::vec3 CollisionMesh::slide_sphere(const glm::vec3& start, const glm::vec3& motion, float radius, int max_iterations) const
+{
+    // get out of anything the sphere already intersects
+    glm::vec3 position = start;
+    std::vector<Contact> contacts;
+    collide_sphere(position, radius, contacts);
+    for (const Contact& contact : contacts)
+        position += contact.normal * (contact.depth + SKIN);
+
+    glm::vec3 remaining = motion;
+    for (int i = 0; i < max_iterations && glm::dot(remaining, remaining) > 1e-12f; ++i) {
+        float t;
+        glm::vec3 normal;
+        if (!sweep_sphere(position, remaining, radius, t, normal)) {
+            position += remaining;
+            break;
+        }
+        // stop just before the contact, keep the part of the motion along the surface
+        const float length = glm::length(remaining);
+        position += remaining * (std::max(0.0f, t * length - SKIN) / length);
+        remaining *= 1.0f - t;
+        remaining -= normal * glm::dot(remaining, normal);
+    }
+    return position;
+}
+
+void CollisionWorld::step(std::vector<Body>& bodies, ThreadPool* pool)
+{
+    find_pairs(bodies, pool);
+    build_islands(bodies);
+
+    const size_t islands = island_count();
+    if (pool == NULL || islands < 2 * ISLAND_GRAIN) {
+        for (size_t i = 0; i < islands; ++i)
+            solve_island(bodies, i);
+        return;
+    }
+    pool->parallel_for(0, islands, ISLAND_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            solve_island(bodies, i);
+    });
+}
+
+void CollisionWorld::find_pairs(const std::vector<Body>& bodies, ThreadPool* pool)
+{
+    pairs.clear();
+    const size_t count = bodies.size();
+    if (count == 0)
+        return;
+
+    // sweep along the axis the centers spread most on, it has the fewest overlaps
+    glm::vec3 mean(0.0f), mean_squared(0.0f);
+    for (const Body& body : bodies) {
+        mean += body.position;
+        mean_squared += body.position * body.position;
+    }
+    const glm::vec3 variance = mean_squared / static_cast<float>(count) - (mean / static_cast<float>(count)) * (mean / static_cast<float>(count));
+    const int axis = variance.x >= variance.y && variance.x >= variance.z ? 0 : (variance.y >= variance.z ? 1 : 2);
+
+    order.resize(count);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return bodies[a].position[axis] - bodies[a].radius < bodies[b].position[axis] - bodies[b].radius;
+    });
+    sweep_min.resize(count);
+    sweep_max.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const Body& body = bodies[order[i]];
+        sweep_min[i] = body.position[axis] - body.radius;
+        sweep_max[i] = body.position[axis] + body.radius;
+    }
+
+    // each body scans forward while the intervals overlap, blocks collect their pairs separately
+    const size_t blocks = (count + PAIR_BLOCK_SIZE - 1) / PAIR_BLOCK_SIZE;
+    block_pairs.resize(blocks);
+    const auto sweep = [&](size_t first_block, size_t last_block) {
+        for (size_t block = first_block; block < last_block; ++block) {
+            std::vector<Pair>& out = block_pairs[block];
+            out.clear();
+            const size_t end = std::min(count, (block + 1) * PAIR_BLOCK_SIZE);
+            for (size_t i = block * PAIR_BLOCK_SIZE; i < end; ++i) {
+                const Body& a = bodies[order[i]];
+                for (size_t j = i + 1; j < count && sweep_min[j] <= sweep_max[i]; ++j) {
+                    const Body& b = bodies[order[j]];
+                    if (a.inverse_mass == 0.0f && b.inverse_mass == 0.0f)
+                        continue;
+                    const glm::vec3 d = glm::abs(a.position - b.position);
+                    const float r = a.radius + b.radius;
+                    if (d.x <= r && d.y <= r && d.z <= r)
+                        out.push_back(Pair{ std::min(order[i], order[j]), std::max(order[i], order[j]) });
+                }
+            }
+        }
+    };
+    if (pool == NULL || blocks == 1)
+        sweep(0, blocks);
+    else
+        pool->parallel_for(0, blocks, 1, sweep);
+
+    for (const auto& out : block_pairs)
+        pairs.insert(pairs.end(), out.begin(), out.end());
+}
+
+uint32_t CollisionWorld::find_root(uint32_t body)
+{
+    while (parent[body] != body) {
+        parent[body] = parent[parent[body]];
+        body = parent[body];
+    }
+    return body;
+}
+
+void CollisionWorld::build_islands(const std::vector<Body>& bodies)
+{
+    const uint32_t body_count = static_cast<uint32_t>(bodies.size());
+    // bodies that cannot move are shared by islands instead of joining them
+    parent.resize(body_count);
+    std::iota(parent.begin(), parent.end(), 0u);
+    const auto is_static = [&](uint32_t body) { return bodies[body].inverse_mass == 0.0f; };
+    for (const Pair& pair : pairs) {
+        if (is_static(pair.a) || is_static(pair.b))
+            continue;
+        const uint32_t a = find_root(pair.a), b = find_root(pair.b);
+        if (a != b)
+            parent[std::max(a, b)] = std::min(a, b);
+    }
+
+    // islands numbered by their root, bodies and pairs grouped by a counting sort;
+    // a pair with a static body belongs to the island of the other one
+    std::vector<uint32_t> island_of(body_count);
+    uint32_t islands = 0;
+    for (uint32_t i = 0; i < body_count; ++i) {
+        const uint32_t root = find_root(i);
+        island_of[i] = root == i ? islands++ : island_of[root];
+    }
+
+    island_first.assign(islands + 1, 0);
+    island_pair_first.assign(islands + 1, 0);
+    for (uint32_t i = 0; i < body_count; ++i)
+        ++island_first[island_of[i] + 1];
+    const auto pair_island = [&](const Pair& pair) { return island_of[is_static(pair.a) ? pair.b : pair.a]; };
+    for (const Pair& pair : pairs)
+        ++island_pair_first[pair_island(pair) + 1];
+    for (uint32_t i = 0; i < islands; ++i) {
+        island_first[i + 1] += island_first[i];
+        island_pair_first[i + 1] += island_pair_first[i];
+    }
+
+    std::vector<uint32_t> body_cursor(island_first.begin(), island_first.end() - 1);
+    std::vector<uint32_t> pair_cursor(island_pair_first.begin(), island_pair_first.end() - 1);
+    island_bodies.resize(body_count);
+    island_pairs.resize(pairs.size());
+    for (uint32_t i = 0; i < body_count; ++i)
+        island_bodies[body_cursor[island_of[i]]++] = i;
+    for (const Pair& pair : pairs)
+        island_pairs[pair_cursor[pair_island(pair)]++] = pair;
+}
+
+void CollisionWorld::solve_island(std::vector<Body>& bodies, size_t island) const
+{
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        bool touching = false;
+        for (uint32_t p = island_pair_first[island]; p < island_pair_first[island + 1]; ++p) {
+            Body& a = bodies[island_pairs[p].a];
+            Body& b = bodies[island_pairs[p].b];
+            const glm::vec3 d = b.position - a.position;
+            const float r = a.radius + b.radius;
+            const float distance_squared = glm::dot(d, d);
+            if (distance_squared >= r * r)
+                continue;
+            touching = true;
+
+            // separate by inverse mass, then remove the approaching velocity
+            const float distance = std::sqrt(distance_squared);
+            const glm::vec3 normal = distance > 1e-6f ? d / distance : glm::vec3(0.0f, 1.0f, 0.0f);
+            const float total = a.inverse_mass + b.inverse_mass;
+            const float correction = (r - distance) / total;
+            const float approach = glm::dot(b.velocity - a.velocity, normal);
+            const float impulse = approach < 0.0f ? -(1.0f + restitution) * approach / total : 0.0f;
+            // static bodies are shared between islands, they are only read
+            if (a.inverse_mass > 0.0f) {
+                a.position -= normal * (correction * a.inverse_mass);
+                a.velocity -= normal * (impulse * a.inverse_mass);
+            }
+            if (b.inverse_mass > 0.0f) {
+                b.position += normal * (correction * b.inverse_mass);
+                b.velocity += normal * (impulse * b.inverse_mass);
+            }
+        }
+        if (!touching)
+            break;
+    }
+
+    if (mesh == NULL || mesh->triangle_count() == 0)
+        return;
+
+    // static geometry last, so bodies never end up inside it
+    std::vector<Contact> contacts;
+    for (uint32_t i = island_first[island]; i < island_first[island + 1]; ++i) {
+        Body& body = bodies[island_bodies[i]];
+        if (body.inverse_mass == 0.0f)
+            continue;
+        // corners and creases push in several directions, look again after moving
+        for (int iteration = 0; iteration < iterations; ++iteration) {
+            contacts.clear();
+            mesh->collide_sphere(body.position, body.radius, contacts);
+            if (contacts.empty())
+                break;
+            const Contact* deepest = &contacts[0];
+            for (const Contact& contact : contacts)
+                if (contact.depth > deepest->depth)
+                    deepest = &contact;
+            body.position += deepest->normal * deepest->depth;
+            const float approach = glm::dot(body.velocity, deepest->normal);
+            if (approach < 0.0f)
+                body.velocity -= deepest->normal * ((1.0f + restitution) * approach);
+        }
+    }
+}
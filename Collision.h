@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BVH.h"
+#include "ThreadPool.h"
+
+// Narrowphase primitives. Triangles are double sided, contact normals point
+// from the triangle towards the shape, 'depth' is how far the shape has to
+// move along the normal to stop touching.
+
+struct Contact {
+    glm::vec3 normal;
+    float depth;
+};
+
+glm::vec3 closest_point_on_triangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+// closest points between the segments p0-p1 and q0-q1
+void closest_points_on_segments(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& q0, const glm::vec3& q1, glm::vec3& on_p, glm::vec3& on_q);
+
+bool sphere_triangle(const glm::vec3& center, float radius, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, Contact& contact);
+bool capsule_triangle(const glm::vec3& p0, const glm::vec3& p1, float radius, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, Contact& contact);
+// separating axis test, the contact is the axis of least overlap
+bool box_triangle(const glm::vec3& box_min, const glm::vec3& box_max, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, Contact& contact);
+// first time of impact in [0, 1] of a sphere moving from 'start' to 'start + motion', negative on miss
+float sweep_sphere_triangle(const glm::vec3& start, const glm::vec3& motion, float radius, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, glm::vec3& normal);
+
+// Static triangle soup in world space, indexed by a BVH over the triangle boxes.
+// Queries are const and may run from several threads at once.
+class CollisionMesh {
+public:
+    CollisionMesh() = default;
+    CollisionMesh(const CollisionMesh&) = delete;
+    CollisionMesh& operator=(const CollisionMesh&) = delete;
+
+    // triangles are collected first, build() makes them queryable
+    void add(const glm::vec3* positions, const uint32_t* indices, size_t index_count, const glm::mat4& model);
+    void build(void);
+    void clear(void);
+
+    size_t triangle_count(void) const { return corners.size() / 3; }
+
+    // all touching triangles, contacts are appended
+    void collide_sphere(const glm::vec3& center, float radius, std::vector<Contact>& out) const;
+    void collide_capsule(const glm::vec3& p0, const glm::vec3& p1, float radius, std::vector<Contact>& out) const;
+    void collide_box(const glm::vec3& box_min, const glm::vec3& box_max, std::vector<Contact>& out) const;
+
+    // continuous test, t in [0, 1] along 'motion'
+    bool sweep_sphere(const glm::vec3& start, const glm::vec3& motion, float radius, float& t, glm::vec3& normal) const;
+    // moves the sphere as far as possible, sliding along what it hits; returns the new center
+    glm::vec3 slide_sphere(const glm::vec3& start, const glm::vec3& motion, float radius, int max_iterations = 4) const;
+
+private:
+    template <class Test>
+    void for_each_triangle(const glm::vec3& box_min, const glm::vec3& box_max, const Test& test) const;
+
+    std::vector<glm::vec3> corners;         // three per triangle
+    std::vector<glm::vec3> triangle_min;
+    std::vector<glm::vec3> triangle_max;
+    BVH bvh;
+};
+
+// Dynamic spheres colliding with each other and with a static mesh.
+//
+// Every step sorts the body boxes along the axis of largest spread and
+// sweeps them for overlapping pairs (sweep and prune). Pairs link bodies into
+// islands with a union-find; islands share no moving bodies (static ones are
+// only read), so they are solved independently on the thread pool. Each island runs a few relaxation passes:
+// overlaps are separated by inverse mass, approaching velocities are
+// reflected with 'restitution'.
+class CollisionWorld {
+public:
+    struct Body {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 velocity;
+        float inverse_mass;         // 0 = does not move
+    };
+
+    // not owned, NULL for bodies only
+    void set_mesh(const CollisionMesh* static_mesh) { mesh = static_mesh; }
+
+    // pool == NULL stays on the calling thread
+    void step(std::vector<Body>& bodies, ThreadPool* pool = &ThreadPool::global());
+
+    size_t pair_count(void) const { return pairs.size(); }
+    size_t island_count(void) const { return island_first.empty() ? 0 : island_first.size() - 1; }
+
+    float restitution = 0.5f;
+    int iterations = 4;
+
+private:
+    struct Pair {
+        uint32_t a, b;
+    };
+
+    void find_pairs(const std::vector<Body>& bodies, ThreadPool* pool);
+    void build_islands(const std::vector<Body>& bodies);
+    void solve_island(std::vector<Body>& bodies, size_t island) const;
+    uint32_t find_root(uint32_t body);
+
+    const CollisionMesh* mesh = NULL;
+    std::vector<uint32_t> order;            // bodies sorted along the sweep axis
+    std::vector<float> sweep_min;           // box interval of order[i] on the sweep axis
+    std::vector<float> sweep_max;
+    std::vector<std::vector<Pair>> block_pairs;
+    std::vector<Pair> pairs;
+    std::vector<uint32_t> parent;           // union-find
+    // island i owns island_bodies[island_first[i] .. island_first[i + 1]) and
+    // island_pairs[island_pair_first[i] .. island_pair_first[i + 1])
+    std::vector<uint32_t> island_first;
+    std::vector<uint32_t> island_bodies;
+    std::vector<uint32_t> island_pair_first;
+    std::vector<Pair> island_pairs;
+};
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// ECS components of scene objects (see ECS.h), plain data only.
+
+struct Transform {
+    glm::vec3 position;
+    float scale;
+    glm::quat rotation;
+
+    glm::mat4 matrix(void) const
+    {
+        const glm::mat3 r = glm::mat3_cast(rotation);
+        return glm::mat4(glm::vec4(r[0] * scale, 0.0f), glm::vec4(r[1] * scale, 0.0f), glm::vec4(r[2] * scale, 0.0f), glm::vec4(position, 1.0f));
+    }
+};
+
+struct Velocity {
+    glm::vec3 linear;
+    float angular;          // radians per second around the Y axis
+};
+
+// bounding sphere around the object origin, in object space
+struct Bounds {
+    float radius;
+};
+
+struct Renderable {
+    glm::vec4 color;
+    uint32_t texture;       // TextureStreamer id of the albedo map
+};
+
+// light at the Transform position, reaching 'radius' (see ClusteredLighting.h)
+struct PointLight {
+    glm::vec3 color;
+    float radius;
+};
+
+// tag: the object is large and opaque, it is rendered into the occlusion buffer (see OcclusionCulling.h)
+struct Occluder {};
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cstring>
+
+#include "Culling.h"
+#include "Simd.h"
+
+namespace {
+
+template <class V>
+struct Planes {
+    V x[Frustum::PLANE_COUNT], y[Frustum::PLANE_COUNT], z[Frustum::PLANE_COUNT], w[Frustum::PLANE_COUNT];
+    V abs_x[Frustum::PLANE_COUNT], abs_y[Frustum::PLANE_COUNT], abs_z[Frustum::PLANE_COUNT];
+
+    explicit Planes(const Frustum& frustum)
+    {
+        for (int p = 0; p < Frustum::PLANE_COUNT; ++p) {
+            const glm::vec4& plane = frustum.planes[p];
+            x[p] = V::broadcast(plane.x);
+            y[p] = V::broadcast(plane.y);
+            z[p] = V::broadcast(plane.z);
+            w[p] = V::broadcast(plane.w);
+            abs_x[p] = V::broadcast(std::fabs(plane.x));
+            abs_y[p] = V::broadcast(std::fabs(plane.y));
+            abs_z[p] = V::broadcast(std::fabs(plane.z));
+        }
+    }
+};
+
+// branchless compaction: every lane is written, only visible lanes advance n
+template <class V>
+inline size_t emit(int outside_mask, size_t first, uint32_t* out, size_t n)
+{
+    for (int l = 0; l < V::width; ++l) {
+        out[n] = static_cast<uint32_t>(first + l);
+        n += ((outside_mask >> l) & 1) ^ 1;
+    }
+    return n;
+}
+
+// objects [begin, end) rounded down to a multiple of V::width; returns visible count, advances begin
+template <class V>
+size_t spheres_batch(const Frustum& frustum, const SphereBounds& s, size_t& begin, size_t end, uint32_t* out, size_t n)
+{
+    const Planes<V> planes(frustum);
+    for (; begin + V::width <= end; begin += V::width) {
+        const V x = V::load(&s.x[begin]);
+        const V y = V::load(&s.y[begin]);
+        const V z = V::load(&s.z[begin]);
+        const V neg_radius = V(0.0f) - V::load(&s.radius[begin]);
+
+        V outside = planes.x[0] * x + planes.y[0] * y + planes.z[0] * z + planes.w[0] < neg_radius;
+        for (int p = 1; p < Frustum::PLANE_COUNT; ++p)
+            outside = outside | (planes.x[p] * x + planes.y[p] * y + planes.z[p] * z + planes.w[p] < neg_radius);
+        n = emit<V>(simd::movemask(outside), begin, out, n);
+    }
+    return n;
+}
+
+// box is outside when even its corner furthest along the normal is behind the plane:
+// dot(n, c) + w + dot(|n|, e) < 0
+template <class V>
+size_t boxes_batch(const Frustum& frustum, const BoxBounds& b, size_t& begin, size_t end, uint32_t* out, size_t n)
+{
+    const Planes<V> planes(frustum);
+    for (; begin + V::width <= end; begin += V::width) {
+        const V cx = V::load(&b.center_x[begin]);
+        const V cy = V::load(&b.center_y[begin]);
+        const V cz = V::load(&b.center_z[begin]);
+        const V ex = V::load(&b.extent_x[begin]);
+        const V ey = V::load(&b.extent_y[begin]);
+        const V ez = V::load(&b.extent_z[begin]);
+
+        V outside = V(0.0f) < V(0.0f);
+        for (int p = 0; p < Frustum::PLANE_COUNT; ++p) {
+            const V d = planes.x[p] * cx + planes.y[p] * cy + planes.z[p] * cz + planes.w[p];
+            const V r = planes.abs_x[p] * ex + planes.abs_y[p] * ey + planes.abs_z[p] * ez;
+            outside = outside | (d + r < V(0.0f));
+        }
+        n = emit<V>(simd::movemask(outside), begin, out, n);
+    }
+    return n;
+}
+
+size_t cull_spheres(const Frustum& frustum, const SphereBounds& s, size_t begin, size_t end, uint32_t* out)
+{
+    size_t n = spheres_batch<simd::floatv>(frustum, s, begin, end, out, 0);
+    return spheres_batch<simd::float1>(frustum, s, begin, end, out, n);
+}
+
+size_t cull_boxes(const Frustum& frustum, const BoxBounds& b, size_t begin, size_t end, uint32_t* out)
+{
+    size_t n = boxes_batch<simd::floatv>(frustum, b, begin, end, out, 0);
+    return boxes_batch<simd::float1>(frustum, b, begin, end, out, n);
+}
+
+} // namespace
+
+void SphereBounds::resize(size_t count)
+{
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    radius.resize(count);
+}
+
+void BoxBounds::resize(size_t count)
+{
+    center_x.resize(count);
+    center_y.resize(count);
+    center_z.resize(count);
+    extent_x.resize(count);
+    extent_y.resize(count);
+    extent_z.resize(count);
+}
+
+template <class Kernel>
+void FrustumCuller::run(size_t count, ThreadPool* pool, const Kernel& kernel)
+{
+    const size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (scratch.size() < blocks * BLOCK_SIZE)
+        scratch.resize(blocks * BLOCK_SIZE);
+
+    if (!pool || blocks <= 1) {
+        const size_t n = kernel(0, count, scratch.data());
+        visible_indices.assign(scratch.begin(), scratch.begin() + n);
+        return;
+    }
+
+    block_counts.resize(blocks + 1);
+    pool->parallel_for(0, blocks, 1, [&](size_t first, size_t last) {
+        for (size_t b = first; b < last; ++b) {
+            const size_t begin = b * BLOCK_SIZE;
+            block_counts[b] = static_cast<uint32_t>(kernel(begin, std::min(count, begin + BLOCK_SIZE), &scratch[begin]));
+        }
+    });
+
+    // exclusive prefix sum gives every block its place in the compacted output
+    uint32_t total = 0;
+    for (size_t b = 0; b < blocks; ++b) {
+        const uint32_t c = block_counts[b];
+        block_counts[b] = total;
+        total += c;
+    }
+    block_counts[blocks] = total;
+
+    visible_indices.resize(total);
+    pool->parallel_for(0, blocks, 8, [&](size_t first, size_t last) {
+        for (size_t b = first; b < last; ++b)
+            std::memcpy(visible_indices.data() + block_counts[b], &scratch[b * BLOCK_SIZE],
+                        (block_counts[b + 1] - block_counts[b]) * sizeof(uint32_t));
+    });
+}
+
+const std::vector<uint32_t>& FrustumCuller::cull(const Frustum& frustum, const SphereBounds& spheres, ThreadPool* pool)
+{
+    run(spheres.size(), pool, [&](size_t begin, size_t end, uint32_t* out) {
+        return cull_spheres(frustum, spheres, begin, end, out);
+    });
+    return visible_indices;
+}
+
+const std::vector<uint32_t>& FrustumCuller::cull(const Frustum& frustum, const BoxBounds& boxes, ThreadPool* pool)
+{
+    run(boxes.size(), pool, [&](size_t begin, size_t end, uint32_t* out) {
+        return cull_boxes(frustum, boxes, begin, end, out);
+    });
+    return visible_indices;
+}
+
+void FrustumCuller::cull_scalar(const Frustum& frustum, const SphereBounds& spheres, std::vector<uint32_t>& out)
+{
+    out.clear();
+    for (size_t i = 0; i < spheres.size(); ++i)
+        if (frustum.intersects_sphere(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i]))
+            out.push_back(static_cast<uint32_t>(i));
+}
+
+void FrustumCuller::cull_scalar(const Frustum& frustum, const BoxBounds& boxes, std::vector<uint32_t>& out)
+{
+    out.clear();
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        const glm::vec3 c(boxes.center_x[i], boxes.center_y[i], boxes.center_z[i]);
+        const glm::vec3 e(boxes.extent_x[i], boxes.extent_y[i], boxes.extent_z[i]);
+        if (frustum.intersects_aabb(c - e, c + e))
+            out.push_back(static_cast<uint32_t>(i));
+    }
+}
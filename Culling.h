@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "ThreadPool.h"
+
+// Bounding spheres in structure-of-arrays layout.
+struct SphereBounds {
+    std::vector<float> x, y, z, radius;
+
+    size_t size(void) const { return x.size(); }
+    void resize(size_t count);
+    void set(size_t i, const glm::vec3& center, float r)
+    {
+        x[i] = center.x;
+        y[i] = center.y;
+        z[i] = center.z;
+        radius[i] = r;
+    }
+};
+
+// Axis aligned boxes as center + half extent, structure-of-arrays layout.
+struct BoxBounds {
+    std::vector<float> center_x, center_y, center_z;
+    std::vector<float> extent_x, extent_y, extent_z;
+
+    size_t size(void) const { return center_x.size(); }
+    void resize(size_t count);
+    void set(size_t i, const glm::vec3& box_min, const glm::vec3& box_max)
+    {
+        const glm::vec3 c = (box_min + box_max) * 0.5f;
+        const glm::vec3 e = (box_max - box_min) * 0.5f;
+        center_x[i] = c.x;
+        center_y[i] = c.y;
+        center_z[i] = c.z;
+        extent_x[i] = e.x;
+        extent_y[i] = e.y;
+        extent_z[i] = e.z;
+    }
+};
+
+// Frustum culling of many bounding volumes at once: simd::floatv tests
+// 4 (SSE2) or 8 (AVX2) objects against the six planes per instruction.
+// Blocks of objects are culled on the thread pool, each block compacts its
+// visible indices locally and the blocks are then concatenated, so the
+// result is in ascending index order.
+class FrustumCuller {
+public:
+    // pool == NULL runs on the calling thread only
+    const std::vector<uint32_t>& cull(const Frustum& frustum, const SphereBounds& spheres, ThreadPool* pool = &ThreadPool::global());
+    const std::vector<uint32_t>& cull(const Frustum& frustum, const BoxBounds& boxes, ThreadPool* pool = &ThreadPool::global());
+
+    const std::vector<uint32_t>& visible(void) const { return visible_indices; }
+
+    // one object at a time through Frustum, for reference
+    static void cull_scalar(const Frustum& frustum, const SphereBounds& spheres, std::vector<uint32_t>& out);
+    static void cull_scalar(const Frustum& frustum, const BoxBounds& boxes, std::vector<uint32_t>& out);
+
+    static const size_t BLOCK_SIZE = 4096;
+
+private:
+    template <class Kernel>
+    void run(size_t count, ThreadPool* pool, const Kernel& kernel);
+
+    std::vector<uint32_t> visible_indices;
+    std::vector<uint32_t> scratch;          // block b writes from scratch[b * BLOCK_SIZE]
+    std::vector<uint32_t> block_counts;
+};
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cmath>
+
+#include "DeferredRenderer.h"
+#include "GLStateCache.h"
+#include "UniformBlocks.h"
+
+namespace gbuffer {
+
+glm::vec2 octahedral_encode(const glm::vec3& n)
+{
+    const glm::vec3 p = n / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+    glm::vec2 e(p.x, p.y);
+    if (p.z < 0.0f)
+        e = glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    return e * 0.5f + 0.5f;
+}
+
+glm::vec3 octahedral_decode(const glm::vec2& encoded)
+{
+    const glm::vec2 e = encoded * 2.0f - 1.0f;
+    glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+    const float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+uint8_t pack_surface(float specular, float glossiness)
+{
+    const int s = static_cast<int>(std::round(std::clamp(specular, 0.0f, 1.0f) * 15.0f));
+    const int g = static_cast<int>(std::round(std::clamp(glossiness, 0.0f, 1.0f) * 15.0f));
+    return static_cast<uint8_t>(s << 4 | g);
+}
+
+glm::vec2 unpack_surface(uint8_t packed)
+{
+    return glm::vec2(packed >> 4, packed & 15) / 15.0f;
+}
+
+}
+
+void DeferredRenderer::init_gl(GLuint lighting_program)
+{
+    program_ID = lighting_program;
+    program.reflect(program_ID);
+    program.bind_uniform_block("Frame", FRAME_BLOCK_BINDING);
+    program.bind_uniform_block("Lighting", LIGHTING_BLOCK_BINDING);
+    program.bind_storage_block("Lights", LIGHT_BUFFER_BINDING);
+    program.bind_uniform_block("Shadows", SHADOW_BLOCK_BINDING);
+    // fixed units, set once
+    program.set(program.uniform<GLint>("uAlbedo"), 0);
+    program.set(program.uniform<GLint>("uNormal"), 1);
+    program.set(program.uniform<GLint>("uDepth"), 2);
+    program.set(program.uniform<GLint>("uOutput"), 0);
+    program.set(program.uniform<GLint>("uShadowMap"), static_cast<GLint>(SHADOW_MAP_UNIT));
+}
+
+DeferredRenderer::Targets DeferredRenderer::add_passes(RenderGraph& graph, GLsizei width, GLsizei height, RenderGraph::Handle shadow_map,
+                                                       std::function<void(void)> draw_geometry)
+{
+    // handles live in members, the execute callbacks are made before setup creates them
+    graph.add_pass("gbuffer", [&](RenderGraph::Builder& pass) {
+        albedo = pass.create("gbuffer albedo", { width, height, ALBEDO_FORMAT });
+        normal = pass.create("gbuffer normal", { width, height, NORMAL_FORMAT });
+        targets.depth = pass.create("scene depth", { width, height, DEPTH_FORMAT });
+        pass.write(albedo);
+        pass.write(normal);
+        pass.write(targets.depth);
+    }, [draw_geometry](const RenderGraph::Resources&) {
+        GLStateCache::global().depth_mask(true);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw_geometry();
+    });
+
+    graph.add_pass("deferred lighting", [&](RenderGraph::Builder& pass) {
+        pass.read(albedo);
+        pass.read(normal);
+        pass.read(targets.depth);
+        pass.read(shadow_map);
+        targets.color = pass.create("scene color", { width, height, COLOR_FORMAT });
+        pass.write(targets.color);
+    }, [this](const RenderGraph::Resources& resources) {
+        GLStateCache& state = GLStateCache::global();
+        state.use_program(program_ID);
+        state.bind_texture(0, GL_TEXTURE_2D, resources.texture(albedo));
+        state.bind_texture(1, GL_TEXTURE_2D, resources.texture(normal));
+        state.bind_texture(2, GL_TEXTURE_2D, resources.texture(targets.depth));
+        glBindImageTexture(0, resources.texture(targets.color), 0, GL_FALSE, 0, GL_WRITE_ONLY, COLOR_FORMAT);
+        const RenderTargetDesc& desc = resources.desc(targets.color);
+        glDispatchCompute(static_cast<GLuint>((desc.width + TILE_SIZE - 1) / TILE_SIZE), static_cast<GLuint>((desc.height + TILE_SIZE - 1) / TILE_SIZE), 1);
+        // the forward pass renders into the result, present samples it
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    });
+    return targets;
+}
+
+size_t DeferredRenderer::gbuffer_bytes_per_pixel(void)
+{
+    return RenderTargetDesc{ 1, 1, ALBEDO_FORMAT }.bytes() + RenderTargetDesc{ 1, 1, NORMAL_FORMAT }.bytes() + RenderTargetDesc{ 1, 1, DEPTH_FORMAT }.bytes();
+}
+
+DeferredRenderer::Bandwidth DeferredRenderer::forward_bandwidth(size_t fragments)
+{
+    // depth read and write, color write
+    const double depth = static_cast<double>(RenderTargetDesc{ 1, 1, DEPTH_FORMAT }.bytes());
+    Bandwidth bandwidth;
+    bandwidth.geometry = static_cast<double>(fragments) * (2.0 * depth + RenderTargetDesc{ 1, 1, COLOR_FORMAT }.bytes());
+    return bandwidth;
+}
+
+DeferredRenderer::Bandwidth DeferredRenderer::deferred_bandwidth(size_t pixels, size_t fragments)
+{
+    // depth read and write plus both color targets per fragment, then every
+    // pixel's G-buffer read once and its color written once
+    const double depth = static_cast<double>(RenderTargetDesc{ 1, 1, DEPTH_FORMAT }.bytes());
+    Bandwidth bandwidth;
+    bandwidth.geometry = static_cast<double>(fragments) * (depth + gbuffer_bytes_per_pixel());
+    bandwidth.lighting = static_cast<double>(pixels) * (gbuffer_bytes_per_pixel() + RenderTargetDesc{ 1, 1, COLOR_FORMAT }.bytes());
+    return bandwidth;
+}
+
+void DeferredRenderer::cull_tiles(const float* view_depth, int width, int height, const glm::mat4& projection, const SphereBounds& view_lights,
+                                  std::vector<glm::uvec2>& tiles, std::vector<uint32_t>& indices)
+{
+    const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE, tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    tiles.resize(static_cast<size_t>(tiles_x) * tiles_y);
+    indices.clear();
+    const glm::vec2 offset(projection[2][0], projection[2][1]), scale(projection[0][0], projection[1][1]);
+    const glm::vec2 size(static_cast<float>(width), static_cast<float>(height));
+
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            glm::uvec2& tile = tiles[static_cast<size_t>(ty) * tiles_x + tx];
+            tile = glm::uvec2(static_cast<uint32_t>(indices.size()), 0u);
+
+            float near = INFINITY, far = 0.0f;
+            for (int y = ty * TILE_SIZE; y < std::min((ty + 1) * TILE_SIZE, height); ++y)
+                for (int x = tx * TILE_SIZE; x < std::min((tx + 1) * TILE_SIZE, width); ++x) {
+                    const float depth = view_depth[static_cast<size_t>(y) * width + x];
+                    if (std::isfinite(depth)) {
+                        near = std::min(near, depth);
+                        far = std::max(far, depth);
+                    }
+                }
+            if (far <= 0.0f)
+                continue;               // nothing drawn
+
+            const glm::vec2 slope_min = (glm::vec2(tx, ty) * float(TILE_SIZE) / size * 2.0f - 1.0f + offset) / scale;
+            const glm::vec2 slope_max = (glm::vec2(tx + 1, ty + 1) * float(TILE_SIZE) / size * 2.0f - 1.0f + offset) / scale;
+            const glm::vec3 planes[4] = { glm::normalize(glm::vec3(1.0f, 0.0f, slope_min.x)), glm::normalize(glm::vec3(-1.0f, 0.0f, -slope_max.x)),
+                                          glm::normalize(glm::vec3(0.0f, 1.0f, slope_min.y)), glm::normalize(glm::vec3(0.0f, -1.0f, -slope_max.y)) };
+            for (size_t i = 0; i < view_lights.size() && tile.y < MAX_TILE_LIGHTS; ++i) {
+                const glm::vec3 center(view_lights.x[i], view_lights.y[i], view_lights.z[i]);
+                const float radius = view_lights.radius[i];
+                if (-center.z + radius < near || -center.z - radius > far)
+                    continue;
+                bool outside = false;
+                for (const glm::vec3& plane : planes)
+                    outside = outside || glm::dot(plane, center) < -radius;
+                if (outside)
+                    continue;
+                indices.push_back(static_cast<uint32_t>(i));
+                ++tile.y;
+            }
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "ProgramInterface.h"
+#include "RenderGraph.h"
+
+// CPU mirrors of the G-buffer encoding in resources/shaders/gbuffer.glsl
+namespace gbuffer {
+
+// unit vector <-> octahedron unfolded onto the 0..1 square
+glm::vec2 octahedral_encode(const glm::vec3& n);
+glm::vec3 octahedral_decode(const glm::vec2& encoded);
+
+// specular intensity and glossiness (0..1) in 4 bits each, the albedo target alpha
+uint8_t pack_surface(float specular, float glossiness);
+glm::vec2 unpack_surface(uint8_t packed);
+
+}
+
+// Tiled deferred shading on the render graph.
+//
+//   "gbuffer"            opaque geometry writes albedo + packed surface
+//                        (RGBA8), an octahedral normal (RG16) and depth:
+//                        12 bytes per pixel, the view position comes back
+//                        from depth and the projection.
+//   "deferred lighting"  deferred_lighting.comp, one work group per tile:
+//                        the tile's depth range and side planes cull the
+//                        lights once, every pixel then shades the tile's
+//                        lights only, and stores into the color target.
+//
+// The lighting reads the Frame and Lighting uniform blocks and the light
+// buffer of ClusteredLighting::upload(), so both paths light the same
+// lights. Translucent and custom draws follow as a forward pass into the
+// returned targets.
+class DeferredRenderer {
+public:
+    static const int TILE_SIZE = 16;                    // the work group size of deferred_lighting.comp
+    static const uint32_t MAX_TILE_LIGHTS = 256;        // further lights in a tile are dropped
+    static const GLenum ALBEDO_FORMAT = GL_RGBA8;
+    static const GLenum NORMAL_FORMAT = GL_RG16;
+    static const GLenum DEPTH_FORMAT = GL_DEPTH_COMPONENT32F;
+    static const GLenum COLOR_FORMAT = GL_RGBA8;
+
+    struct Targets {
+        RenderGraph::Handle color = RenderGraph::INVALID;
+        RenderGraph::Handle depth = RenderGraph::INVALID;
+    };
+
+    // attachment traffic of one frame in bytes, ignoring caches and compression
+    struct Bandwidth {
+        double geometry = 0.0;          // depth test and writes of every shaded fragment
+        double lighting = 0.0;          // deferred: G-buffer reads and the color write per pixel
+        double total(void) const { return geometry + lighting; }
+    };
+
+    // the program built from deferred_lighting.comp; must run while the context is current
+    void init_gl(GLuint lighting_program);
+
+    // 'draw_geometry' draws the opaque objects with their GBUFFER program variants;
+    // the lighting samples 'shadow_map', the cascades bound at SHADOW_MAP_UNIT
+    Targets add_passes(RenderGraph& graph, GLsizei width, GLsizei height, RenderGraph::Handle shadow_map, std::function<void(void)> draw_geometry);
+
+    // G-buffer bytes per pixel, depth included
+    static size_t gbuffer_bytes_per_pixel(void);
+    // 'fragments' shaded (overdraw included) to cover 'pixels'
+    static Bandwidth forward_bandwidth(size_t fragments);
+    static Bandwidth deferred_bandwidth(size_t pixels, size_t fragments);
+
+    // the culling of deferred_lighting.comp on the CPU: 'view_depth' per pixel,
+    // bottom row first, positive, infinite where nothing was drawn; view space
+    // lights. Per tile (offset, count) into 'indices', tile = y * tiles_x + x.
+    static void cull_tiles(const float* view_depth, int width, int height, const glm::mat4& projection, const SphereBounds& view_lights,
+                           std::vector<glm::uvec2>& tiles, std::vector<uint32_t>& indices);
+
+private:
+    GLuint program_ID = 0;
+    ProgramInterface program;
+    // of the frame being built
+    RenderGraph::Handle albedo = RenderGraph::INVALID, normal = RenderGraph::INVALID;
+    Targets targets;
+};
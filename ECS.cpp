@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "ECS.h"
+
+namespace {
+
+struct ComponentType {
+    size_t size;
+    size_t alignment;
+};
+
+std::mutex component_types_mutex;
+std::vector<ComponentType> component_types;
+
+size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+uint32_t register_component_type(size_t size, size_t alignment)
+{
+    std::lock_guard<std::mutex> lock(component_types_mutex);
+    if (component_types.size() == MAX_COMPONENT_TYPES)
+        throw std::runtime_error("ECS: too many component types");
+    component_types.push_back({ size, alignment });
+    return static_cast<uint32_t>(component_types.size() - 1);
+}
+
+void* World::component_array(Archetype& archetype, size_t chunk, uint32_t id)
+{
+    const int slot = archetype.slot[id];
+    if (slot < 0)
+        return NULL;
+    return archetype.chunks[chunk].storage->bytes + archetype.offsets[slot];
+}
+
+void* World::component_pointer(Archetype& archetype, uint32_t chunk, uint32_t row, uint32_t id)
+{
+    const int slot = archetype.slot[id];
+    if (slot < 0)
+        return NULL;
+    return archetype.chunks[chunk].storage->bytes + archetype.offsets[slot] + row * archetype.sizes[slot];
+}
+
+World::Archetype& World::find_archetype(ComponentMask mask)
+{
+    auto it = archetype_of_mask.find(mask);
+    if (it != archetype_of_mask.end())
+        return *it->second;
+
+    std::unique_ptr<Archetype> archetype(new Archetype);
+    archetype->mask = mask;
+    std::fill(archetype->slot, archetype->slot + MAX_COMPONENT_TYPES, -1);
+    size_t row_bytes = sizeof(Entity);
+    {
+        std::lock_guard<std::mutex> lock(component_types_mutex);
+        for (uint32_t id = 0; id < MAX_COMPONENT_TYPES; ++id)
+            if (mask & (ComponentMask(1) << id)) {
+                archetype->slot[id] = static_cast<int>(archetype->components.size());
+                archetype->components.push_back(id);
+                archetype->sizes.push_back(component_types[id].size);
+                row_bytes += component_types[id].size;
+            }
+    }
+
+    // largest capacity whose arrays, each aligned to 64 bytes, still fit into a chunk
+    uint32_t capacity = static_cast<uint32_t>(CHUNK_BYTES / row_bytes);
+    for (;; --capacity) {
+        if (capacity == 0)
+            throw std::runtime_error("ECS: components do not fit into a chunk");
+        size_t offset = align_up(capacity * sizeof(Entity), 64);
+        archetype->offsets.clear();
+        for (size_t size : archetype->sizes) {
+            archetype->offsets.push_back(offset);
+            offset = align_up(offset + capacity * size, 64);
+        }
+        if (offset <= CHUNK_BYTES)
+            break;
+    }
+    archetype->capacity = capacity;
+
+    Archetype* result = archetype.get();
+    archetypes.push_back(std::move(archetype));
+    archetype_of_mask[mask] = result;
+    return *result;
+}
+
+void World::allocate_row(Archetype& archetype, Entity entity)
+{
+    if (archetype.chunks.empty() || archetype.chunks.back().count == archetype.capacity) {
+        archetype.chunks.emplace_back();
+        archetype.chunks.back().storage.reset(new ChunkStorage);
+    }
+
+    Chunk& chunk = archetype.chunks.back();
+    Record& record = records[entity.index];
+    record.archetype = &archetype;
+    record.chunk = static_cast<uint32_t>(archetype.chunks.size() - 1);
+    record.row = chunk.count;
+    chunk.entities()[chunk.count++] = entity;
+    ++archetype.entity_count;
+}
+
+// swap-remove: the last entity of the archetype fills the hole, chunks stay dense
+void World::release_row(Archetype& archetype, uint32_t chunk, uint32_t row)
+{
+    Chunk& last = archetype.chunks.back();
+    const uint32_t last_chunk = static_cast<uint32_t>(archetype.chunks.size() - 1);
+    const uint32_t last_row = last.count - 1;
+
+    if (chunk != last_chunk || row != last_row) {
+        const Entity moved = last.entities()[last_row];
+        archetype.chunks[chunk].entities()[row] = moved;
+        for (size_t s = 0; s < archetype.components.size(); ++s) {
+            const uint32_t id = archetype.components[s];
+            std::memcpy(component_pointer(archetype, chunk, row, id),
+                        component_pointer(archetype, last_chunk, last_row, id), archetype.sizes[s]);
+        }
+        records[moved.index].chunk = chunk;
+        records[moved.index].row = row;
+    }
+
+    if (--last.count == 0)
+        archetype.chunks.pop_back();
+    --archetype.entity_count;
+}
+
+Entity World::create_with_mask(ComponentMask mask)
+{
+    Entity entity;
+    if (!free_indices.empty()) {
+        entity.index = free_indices.back();
+        free_indices.pop_back();
+    }
+    else {
+        entity.index = static_cast<uint32_t>(records.size());
+        records.emplace_back();
+    }
+    Record& record = records[entity.index];
+    entity.generation = record.generation;
+    record.alive = true;
+
+    allocate_row(find_archetype(mask), entity);
+    ++living;
+    return entity;
+}
+
+void World::destroy(Entity entity)
+{
+    if (!alive(entity))
+        return;
+
+    Record& record = records[entity.index];
+    release_row(*record.archetype, record.chunk, record.row);
+    record.archetype = NULL;
+    record.alive = false;
+    ++record.generation;
+    free_indices.push_back(entity.index);
+    --living;
+}
+
+bool World::alive(Entity entity) const
+{
+    return entity.index < records.size() && records[entity.index].alive && records[entity.index].generation == entity.generation;
+}
+
+void World::change_mask(Entity entity, ComponentMask mask)
+{
+    Record& record = records[entity.index];
+    Archetype& source = *record.archetype;
+    if (source.mask == mask)
+        return;
+
+    Archetype& target = find_archetype(mask);
+    const uint32_t source_chunk = record.chunk;
+    const uint32_t source_row = record.row;
+    allocate_row(target, entity);
+
+    // components present in both archetypes keep their values, new ones start zeroed
+    for (size_t s = 0; s < target.components.size(); ++s) {
+        const uint32_t id = target.components[s];
+        void* destination = component_pointer(target, record.chunk, record.row, id);
+        if (source.slot[id] >= 0)
+            std::memcpy(destination, component_pointer(source, source_chunk, source_row, id), target.sizes[s]);
+        else
+            std::memset(destination, 0, target.sizes[s]);
+    }
+    release_row(source, source_chunk, source_row);
+}
+
+void World::clear(void)
+{
+    archetypes.clear();
+    archetype_of_mask.clear();
+    records.clear();
+    free_indices.clear();
+    living = 0;
+}
+
+void CommandBuffer::record(std::function<void(World&)> command)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    commands.push_back(std::move(command));
+}
+
+void CommandBuffer::apply(World& world)
+{
+    std::vector<std::function<void(World&)>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.swap(commands);
+    }
+    for (auto& command : pending)
+        command(world);
+}
+
+void SystemScheduler::add(const std::string& name, ComponentMask reads, ComponentMask writes, SystemFunction function)
+{
+    systems.push_back({ name, reads, writes, std::move(function) });
+    const System& added = systems.back();
+
+    // join the last batch unless it conflicts with a system already there
+    bool conflict = batches.empty();
+    if (!conflict)
+        for (size_t i : batches.back()) {
+            const System& other = systems[i];
+            if ((added.writes & (other.reads | other.writes)) || (other.writes & added.reads)) {
+                conflict = true;
+                break;
+            }
+        }
+    if (conflict)
+        batches.emplace_back();
+    batches.back().push_back(systems.size() - 1);
+}
+
+void SystemScheduler::run(World& world, float dt)
+{
+    for (const auto& batch : batches) {
+        if (batch.size() == 1) {
+            systems[batch[0]].function(world, commands, dt);
+            continue;
+        }
+        ThreadPool::global().parallel_for(0, batch.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                systems[batch[i]].function(world, commands, dt);
+        });
+    }
+    commands.apply(world);
+}
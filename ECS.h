@@ -0,0 +1,286 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Archetype based entity component system.
+//
+// Entities with the same set of components share an archetype. An archetype
+// stores its entities in fixed size chunks; inside a chunk every component
+// has its own contiguous array (SoA), so queries stream through memory.
+// Components must be trivially copyable, they are moved between archetypes
+// with memcpy when components are added or removed.
+//
+// Structural changes (create / destroy / add / remove) are not allowed while
+// iterating, systems record them into a CommandBuffer applied afterwards.
+
+struct Entity {
+    uint32_t index = 0xFFFFFFFFu;
+    uint32_t generation = 0;
+
+    bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+typedef uint64_t ComponentMask;
+const uint32_t MAX_COMPONENT_TYPES = 64;
+
+// runtime id of a component type, assigned on first use
+uint32_t register_component_type(size_t size, size_t alignment);
+
+template <class T>
+uint32_t component_id(void)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+    static const uint32_t id = register_component_type(sizeof(T), alignof(T));
+    return id;
+}
+
+template <class... T>
+ComponentMask component_mask(void)
+{
+    ComponentMask mask = 0;
+    (void)std::initializer_list<int>{ (mask |= ComponentMask(1) << component_id<T>(), 0)... };
+    return mask;
+}
+
+class World {
+public:
+    static const size_t CHUNK_BYTES = 16 * 1024;
+
+    World() = default;
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    template <class... T>
+    Entity create(const T&... values)
+    {
+        const Entity entity = create_with_mask(component_mask<T...>());
+        (void)std::initializer_list<int>{ (*get<T>(entity) = values, 0)... };
+        return entity;
+    }
+
+    // no-op for entities that were already destroyed
+    void destroy(Entity entity);
+    bool alive(Entity entity) const;
+    size_t entity_count(void) const { return living; }
+    size_t archetype_count(void) const { return archetypes.size(); }
+    void clear(void);
+
+    template <class T>
+    void add(Entity entity, const T& value)
+    {
+        if (!alive(entity))
+            return;
+        change_mask(entity, records[entity.index].archetype->mask | component_mask<T>());
+        *get<T>(entity) = value;
+    }
+
+    template <class T>
+    void remove(Entity entity)
+    {
+        if (alive(entity))
+            change_mask(entity, records[entity.index].archetype->mask & ~component_mask<T>());
+    }
+
+    // NULL when the entity is dead or has no such component
+    template <class T>
+    T* get(Entity entity)
+    {
+        if (!alive(entity))
+            return NULL;
+        const Record& r = records[entity.index];
+        return static_cast<T*>(component_pointer(*r.archetype, r.chunk, r.row, component_id<T>()));
+    }
+
+    template <class T>
+    bool has(Entity entity) const
+    {
+        return alive(entity) && (records[entity.index].archetype->mask & component_mask<T>()) != 0;
+    }
+
+    // fn(count, entities, T* arrays...) for every chunk holding all of T...
+    template <class... T, class F>
+    void each_chunk(F&& fn)
+    {
+        const ComponentMask mask = component_mask<T...>();
+        for (auto& archetype : archetypes)
+            if ((archetype->mask & mask) == mask)
+                for (size_t c = 0; c < archetype->chunks.size(); ++c)
+                    call_chunk<T...>(*archetype, c, fn);
+    }
+
+    // fn(entity, T&...) for every entity holding all of T...
+    template <class... T, class F>
+    void each(F&& fn)
+    {
+        each_chunk<T...>([&fn](size_t count, const Entity* entities, T*... arrays) {
+            for (size_t i = 0; i < count; ++i)
+                fn(entities[i], arrays[i]...);
+        });
+    }
+
+    // each_chunk() with chunks spread over ThreadPool::global();
+    // fn must only touch the components of its own chunk
+    template <class... T, class F>
+    void parallel_each_chunk(F&& fn)
+    {
+        const ComponentMask mask = component_mask<T...>();
+        std::vector<std::pair<Archetype*, size_t>> work;
+        for (auto& archetype : archetypes)
+            if ((archetype->mask & mask) == mask)
+                for (size_t c = 0; c < archetype->chunks.size(); ++c)
+                    work.emplace_back(archetype.get(), c);
+
+        ThreadPool::global().parallel_for(0, work.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t w = begin; w < end; ++w)
+                call_chunk<T...>(*work[w].first, work[w].second, fn);
+        });
+    }
+
+    template <class... T, class F>
+    void parallel_each(F&& fn)
+    {
+        parallel_each_chunk<T...>([&fn](size_t count, const Entity* entities, T*... arrays) {
+            for (size_t i = 0; i < count; ++i)
+                fn(entities[i], arrays[i]...);
+        });
+    }
+
+    // number of entities matched by a query, without touching component data
+    template <class... T>
+    size_t count(void) const
+    {
+        const ComponentMask mask = component_mask<T...>();
+        size_t n = 0;
+        for (auto& archetype : archetypes)
+            if ((archetype->mask & mask) == mask)
+                n += archetype->entity_count;
+        return n;
+    }
+
+private:
+    struct alignas(64) ChunkStorage {
+        unsigned char bytes[CHUNK_BYTES];
+    };
+
+    struct Chunk {
+        std::unique_ptr<ChunkStorage> storage;
+        uint32_t count = 0;
+
+        Entity* entities(void) { return reinterpret_cast<Entity*>(storage->bytes); }
+    };
+
+    struct Archetype {
+        ComponentMask mask = 0;
+        std::vector<uint32_t> components;   // ids, ascending
+        std::vector<size_t> sizes;
+        std::vector<size_t> offsets;        // byte offset of each component array inside a chunk
+        int slot[MAX_COMPONENT_TYPES];      // component id -> index into components, -1 when absent
+        uint32_t capacity = 0;              // entities per chunk
+        size_t entity_count = 0;
+        std::vector<Chunk> chunks;          // all full except the last one
+    };
+
+    struct Record {
+        Archetype* archetype = NULL;
+        uint32_t chunk = 0;
+        uint32_t row = 0;
+        uint32_t generation = 0;
+        bool alive = false;
+    };
+
+    template <class... T, class F>
+    static void call_chunk(Archetype& archetype, size_t c, F& fn)
+    {
+        Chunk& chunk = archetype.chunks[c];
+        fn(static_cast<size_t>(chunk.count), static_cast<const Entity*>(chunk.entities()),
+           static_cast<T*>(component_array(archetype, c, component_id<T>()))...);
+    }
+
+    static void* component_array(Archetype& archetype, size_t chunk, uint32_t id);
+    static void* component_pointer(Archetype& archetype, uint32_t chunk, uint32_t row, uint32_t id);
+
+    Entity create_with_mask(ComponentMask mask);
+    Archetype& find_archetype(ComponentMask mask);
+    void allocate_row(Archetype& archetype, Entity entity);
+    void release_row(Archetype& archetype, uint32_t chunk, uint32_t row);
+    void change_mask(Entity entity, ComponentMask mask);
+
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<ComponentMask, Archetype*> archetype_of_mask;
+    std::vector<Record> records;            // indexed by Entity::index
+    std::vector<uint32_t> free_indices;
+    size_t living = 0;
+};
+
+// Deferred structural changes; recording is thread-safe so parallel systems
+// can share one buffer. Commands run in recording order in apply().
+class CommandBuffer {
+public:
+    template <class... T>
+    void create(const T&... values)
+    {
+        record([=](World& world) { world.create(values...); });
+    }
+
+    void destroy(Entity entity)
+    {
+        record([entity](World& world) { world.destroy(entity); });
+    }
+
+    template <class T>
+    void add(Entity entity, const T& value)
+    {
+        record([entity, value](World& world) { world.add(entity, value); });
+    }
+
+    template <class T>
+    void remove(Entity entity)
+    {
+        record([entity](World& world) { world.remove<T>(entity); });
+    }
+
+    void apply(World& world);
+    bool empty(void) const { return commands.empty(); }
+
+private:
+    void record(std::function<void(World&)> command);
+
+    std::mutex mutex;
+    std::vector<std::function<void(World&)>> commands;
+};
+
+// Runs systems once per tick. Each system declares the components it reads
+// and writes; consecutive systems without conflicting access form one batch
+// whose systems run in parallel on the thread pool. Structural changes
+// recorded into the shared command buffer are applied after the last batch.
+class SystemScheduler {
+public:
+    typedef std::function<void(World&, CommandBuffer&, float)> SystemFunction;
+
+    void add(const std::string& name, ComponentMask reads, ComponentMask writes, SystemFunction function);
+    void run(World& world, float dt);
+
+    size_t batch_count(void) const { return batches.size(); }
+
+private:
+    struct System {
+        std::string name;
+        ComponentMask reads;
+        ComponentMask writes;
+        SystemFunction function;
+    };
+
+    std::vector<System> systems;
+    std::vector<std::vector<size_t>> batches;
+    CommandBuffer commands;
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// View frustum as six planes (xyz = inward normal, w = distance),
+// extracted from a view-projection matrix (Gribb & Hartmann).
+struct Frustum {
+    enum { LEFT = 0, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, PLANE_COUNT };
+
+    glm::vec4 planes[PLANE_COUNT];
+
+    static Frustum from_matrix(const glm::mat4& view_projection)
+    {
+        const glm::mat4 m = glm::transpose(view_projection);
+        Frustum f;
+        f.planes[LEFT] = m[3] + m[0];
+        f.planes[RIGHT] = m[3] - m[0];
+        f.planes[BOTTOM] = m[3] + m[1];
+        f.planes[TOP] = m[3] - m[1];
+        f.planes[NEAR_PLANE] = m[3] + m[2];
+        f.planes[FAR_PLANE] = m[3] - m[2];
+        for (auto& p : f.planes)
+            p /= glm::length(glm::vec3(p));
+        return f;
+    }
+
+    // false only if the box is completely outside one of the planes
+    bool intersects_aabb(const glm::vec3& box_min, const glm::vec3& box_max) const
+    {
+        for (const auto& p : planes) {
+            // corner furthest along the plane normal
+            const glm::vec3 v(p.x > 0.0f ? box_max.x : box_min.x,
+                              p.y > 0.0f ? box_max.y : box_min.y,
+                              p.z > 0.0f ? box_max.z : box_min.z);
+            if (glm::dot(glm::vec3(p), v) + p.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool intersects_sphere(const glm::vec3& center, float radius) const
+    {
+        for (const auto& p : planes) {
+            if (glm::dot(glm::vec3(p), center) + p.w < -radius)
+                return false;
+        }
+        return true;
+    }
+};
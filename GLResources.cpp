@@ -0,0 +1,71 @@
+#include <algorithm>
+
+#include "GLResources.h"
+#include "GLStateCache.h"
+
+namespace gl {
+
+GLuint create_buffer(GLsizeiptr size, const void* data, GLbitfield flags)
+{
+    GLuint buffer = 0;
+    glCreateBuffers(1, &buffer);
+    glNamedBufferStorage(buffer, size, data, flags);
+    return buffer;
+}
+
+GLuint create_texture_2d(GLenum internal_format, GLsizei width, GLsizei height, GLsizei levels)
+{
+    GLuint texture = 0;
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureStorage2D(texture, levels, internal_format, width, height);
+    return texture;
+}
+
+GLsizei mip_levels(GLsizei width, GLsizei height)
+{
+    GLsizei levels = 1;
+    for (GLsizei size = std::max(width, height); size > 1; size /= 2)
+        ++levels;
+    return levels;
+}
+
+}
+
+VertexFormat::~VertexFormat()
+{
+    clear();
+}
+
+void VertexFormat::init_gl(const std::vector<Attribute>& attributes, const std::vector<GLuint>& divisors)
+{
+    clear();
+    glCreateVertexArrays(1, &VAO_ID);
+    for (const Attribute& a : attributes) {
+        glEnableVertexArrayAttrib(VAO_ID, a.location);
+        glVertexArrayAttribFormat(VAO_ID, a.location, a.components, a.type, a.normalized, a.offset);
+        glVertexArrayAttribBinding(VAO_ID, a.location, a.binding);
+    }
+    for (size_t binding = 0; binding < divisors.size(); ++binding)
+        if (divisors[binding] != 0)
+            glVertexArrayBindingDivisor(VAO_ID, static_cast<GLuint>(binding), divisors[binding]);
+}
+
+void VertexFormat::clear(void)
+{
+    if (VAO_ID) {
+        glDeleteVertexArrays(1, &VAO_ID);
+        // the name may come back for another VAO
+        GLStateCache::global().invalidate();
+    }
+    VAO_ID = 0;
+}
+
+void VertexFormat::vertex_buffer(GLuint binding, GLuint buffer, GLintptr offset, GLsizei stride) const
+{
+    glVertexArrayVertexBuffer(VAO_ID, binding, buffer, offset, stride);
+}
+
+void VertexFormat::index_buffer(GLuint buffer) const
+{
+    glVertexArrayElementBuffer(VAO_ID, buffer);
+}
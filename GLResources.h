@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+
+#include <GL/glew.h>
+
+// GL 4.5 direct state access creation of buffers, textures and vertex formats.
+//
+// Objects are created and filled by name, nothing is bound on the way, so
+// creation never disturbs (or goes around) the GLStateCache.
+namespace gl {
+
+// immutable storage; 'flags' as glNamedBufferStorage (0 = static, GPU only)
+GLuint create_buffer(GLsizeiptr size, const void* data, GLbitfield flags = 0);
+
+// immutable storage of 'levels' mip levels, contents undefined until uploaded
+GLuint create_texture_2d(GLenum internal_format, GLsizei width, GLsizei height, GLsizei levels = 1);
+// full mip chain length of a width x height image
+GLsizei mip_levels(GLsizei width, GLsizei height);
+
+}
+
+// Vertex layout split from the buffers feeding it (ARB_vertex_attrib_binding).
+//
+// Attributes read from numbered buffer bindings at fixed relative offsets;
+// which buffer, at which offset and stride, is attached to a binding
+// separately. One VertexFormat (one VAO) thus serves every mesh of the same
+// layout, switching meshes attaches other buffers and never binds.
+//
+// The index buffer is VAO state as well: attach it with index_buffer(), not
+// through GLStateCache::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ...).
+class VertexFormat {
+public:
+    struct Attribute {
+        GLuint location;
+        GLint components;
+        GLenum type;
+        GLuint offset;                  // relative to the binding's vertex
+        GLuint binding = 0;
+        GLboolean normalized = GL_FALSE;
+    };
+
+    VertexFormat() = default;
+    ~VertexFormat();
+
+    VertexFormat(const VertexFormat&) = delete;
+    VertexFormat& operator=(const VertexFormat&) = delete;
+
+    // 'divisors' per binding, missing ones are per vertex (0); must run while the context is current
+    void init_gl(const std::vector<Attribute>& attributes, const std::vector<GLuint>& divisors = {});
+    void clear(void);
+
+    GLuint vao(void) const { return VAO_ID; }
+
+    void vertex_buffer(GLuint binding, GLuint buffer, GLintptr offset, GLsizei stride) const;
+    void index_buffer(GLuint buffer) const;
+
+private:
+    GLuint VAO_ID = 0;
+};
@@ -0,0 +1,195 @@
+#include "GLStateCache.h"
+
+namespace {
+
+const GLenum buffer_targets[] = { GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER, GL_COPY_WRITE_BUFFER, GL_PIXEL_UNPACK_BUFFER };
+const GLenum texture_targets[] = { GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER };
+const GLenum capability_names[] = { GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_SCISSOR_TEST, GL_POLYGON_OFFSET_FILL };
+
+template <size_t N>
+int index_of(const GLenum (&list)[N], GLenum value)
+{
+    for (size_t i = 0; i < N; ++i)
+        if (list[i] == value)
+            return static_cast<int>(i);
+    return -1;
+}
+
+}
+
+GLStateCache& GLStateCache::global(void)
+{
+    static GLStateCache cache;
+    return cache;
+}
+
+void GLStateCache::invalidate(void)
+{
+    program = vertex_array = active_unit = UNKNOWN;
+    for (GLuint& buffer : buffers)
+        buffer = UNKNOWN;
+    for (auto& target : ranges)
+        for (Range& range : target)
+            range = { UNKNOWN, 0, 0 };
+    for (auto& unit : textures)
+        for (GLuint& texture : unit)
+            texture = UNKNOWN;
+    for (GLuint& sampler : samplers)
+        sampler = UNKNOWN;
+    for (int& capability : capabilities)
+        capability = -1;
+    blend_source = blend_destination = depth_function = cull_mode = UNKNOWN;
+    depth_write = -1;
+    view[0] = view[1] = view[2] = view[3] = -1;
+}
+
+void GLStateCache::use_program(GLuint name)
+{
+    if (skip(program == name))
+        return;
+    program = name;
+    glUseProgram(name);
+}
+
+void GLStateCache::bind_vertex_array(GLuint vao)
+{
+    if (skip(vertex_array == vao))
+        return;
+    vertex_array = vao;
+    buffers[1] = UNKNOWN;           // GL_ELEMENT_ARRAY_BUFFER
+    glBindVertexArray(vao);
+}
+
+void GLStateCache::bind_buffer(GLenum target, GLuint buffer)
+{
+    const int t = index_of(buffer_targets, target);
+    if (t >= 0) {
+        if (skip(buffers[t] == buffer))
+            return;
+        buffers[t] = buffer;
+    }
+    else
+        ++current.issued;
+    glBindBuffer(target, buffer);
+}
+
+void GLStateCache::bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    const int t = target == GL_UNIFORM_BUFFER ? 0 : target == GL_SHADER_STORAGE_BUFFER ? 1 : -1;
+    if (t >= 0 && index < BUFFER_BINDINGS) {
+        Range& range = ranges[t][index];
+        if (skip(range.buffer == buffer && range.offset == offset && range.size == size))
+            return;
+        range = { buffer, offset, size };
+    }
+    else
+        ++current.issued;
+
+    // indexed binds also set the generic binding point
+    const int generic = index_of(buffer_targets, target);
+    if (generic >= 0)
+        buffers[generic] = buffer;
+    if (size == 0)
+        glBindBufferBase(target, index, buffer);
+    else
+        glBindBufferRange(target, index, buffer, offset, size);
+}
+
+void GLStateCache::bind_texture(GLuint unit, GLenum target, GLuint texture)
+{
+    const int t = index_of(texture_targets, target);
+    if (t >= 0 && unit < TEXTURE_UNITS) {
+        if (skip(textures[unit][t] == texture))
+            return;
+        textures[unit][t] = texture;
+    }
+    else
+        ++current.issued;
+    ++current.texture_binds;
+
+    if (active_unit != unit) {
+        active_unit = unit;
+        ++current.issued;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    glBindTexture(target, texture);
+}
+
+void GLStateCache::bind_sampler(GLuint unit, GLuint sampler)
+{
+    if (unit < TEXTURE_UNITS) {
+        if (skip(samplers[unit] == sampler))
+            return;
+        samplers[unit] = sampler;
+    }
+    else
+        ++current.issued;
+    glBindSampler(unit, sampler);
+}
+
+void GLStateCache::set_enabled(GLenum capability, bool enabled)
+{
+    const int c = index_of(capability_names, capability);
+    if (c >= 0) {
+        if (skip(capabilities[c] == static_cast<int>(enabled)))
+            return;
+        capabilities[c] = enabled;
+    }
+    else
+        ++current.issued;
+
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+}
+
+void GLStateCache::blend_func(GLenum source, GLenum destination)
+{
+    if (skip(blend_source == source && blend_destination == destination))
+        return;
+    blend_source = source;
+    blend_destination = destination;
+    glBlendFunc(source, destination);
+}
+
+void GLStateCache::depth_mask(bool write)
+{
+    if (skip(depth_write == static_cast<int>(write)))
+        return;
+    depth_write = write;
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+}
+
+void GLStateCache::depth_func(GLenum func)
+{
+    if (skip(depth_function == func))
+        return;
+    depth_function = func;
+    glDepthFunc(func);
+}
+
+void GLStateCache::cull_face(GLenum face)
+{
+    if (skip(cull_mode == face))
+        return;
+    cull_mode = face;
+    glCullFace(face);
+}
+
+void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (skip(view[0] == x && view[1] == y && view[2] == width && view[3] == height))
+        return;
+    view[0] = x;
+    view[1] = y;
+    view[2] = width;
+    view[3] = height;
+    glViewport(x, y, width, height);
+}
+
+void GLStateCache::end_frame(void)
+{
+    previous = current;
+    current = Counters();
+}
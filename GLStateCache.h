@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+
+#include <GL/glew.h>
+
+// Shadow copy of the GL binding and fixed function state the renderers touch.
+//
+// Every setter compares with the copy and only calls GL when the value
+// changes, counting issued and skipped calls. State starts unknown, so the
+// first call of each kind always goes to GL. Code that changes tracked state
+// behind the cache's back (or deletes a bound object whose name may be
+// reused) has to call invalidate() afterwards. Element array buffers are VAO
+// state: binding another VAO forgets the element binding.
+class GLStateCache {
+public:
+    static const int TEXTURE_UNITS = 16;
+    static const int BUFFER_BINDINGS = 16;      // indexed uniform / storage binding points
+
+    struct Counters {
+        uint32_t issued = 0;
+        uint32_t skipped = 0;
+        uint32_t texture_binds = 0;             // of 'issued'
+    };
+
+    GLStateCache() { invalidate(); }
+
+    // the cache of the one GL context
+    static GLStateCache& global(void);
+
+    void invalidate(void);
+
+    void use_program(GLuint program);
+    void bind_vertex_array(GLuint vao);
+    // GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER,
+    // GL_COPY_WRITE_BUFFER, GL_PIXEL_UNPACK_BUFFER are tracked, others pass through
+    void bind_buffer(GLenum target, GLuint buffer);
+    // GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER; size 0 = whole buffer (glBindBufferBase)
+    void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset = 0, GLsizeiptr size = 0);
+    // GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER
+    void bind_texture(GLuint unit, GLenum target, GLuint texture);
+    void bind_sampler(GLuint unit, GLuint sampler);
+
+    // GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_SCISSOR_TEST, GL_POLYGON_OFFSET_FILL are tracked
+    void set_enabled(GLenum capability, bool enabled);
+    void blend_func(GLenum source, GLenum destination);
+    void depth_mask(bool write);
+    void depth_func(GLenum func);
+    void cull_face(GLenum face);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    // counters since the last end_frame(), and of the frame before
+    const Counters& counters(void) const { return current; }
+    const Counters& last_frame(void) const { return previous; }
+    void end_frame(void);
+
+private:
+    static const int BUFFER_TARGETS = 6;
+    static const int TEXTURE_TARGETS = 5;
+    static const int CAPABILITIES = 5;
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    struct Range {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    // counts the call, true when it can be skipped
+    bool skip(bool unchanged)
+    {
+        ++(unchanged ? current.skipped : current.issued);
+        return unchanged;
+    }
+
+    GLuint program;
+    GLuint vertex_array;
+    GLuint buffers[BUFFER_TARGETS];
+    Range ranges[2][BUFFER_BINDINGS];           // uniform, storage
+    GLuint active_unit;
+    GLuint textures[TEXTURE_UNITS][TEXTURE_TARGETS];
+    GLuint samplers[TEXTURE_UNITS];
+    int capabilities[CAPABILITIES];             // -1 unknown, 0 off, 1 on
+    GLenum blend_source, blend_destination;
+    int depth_write;
+    GLenum depth_function;
+    GLenum cull_mode;
+    GLint view[4];
+
+    Counters current, previous;
+};
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cmath>
+
+#include "OcclusionCulling.h"
+#include "Simd.h"
+
+namespace {
+
+// lane x offsets inside one SIMD register
+const float LANE_OFFSETS[8] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f };
+
+// near plane of GL clip space: z >= -w
+float near_distance(const glm::vec4& v)
+{
+    return v.z + v.w;
+}
+
+} // namespace
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+{
+    resize(width, height);
+}
+
+void OcclusionCuller::resize(int width, int height)
+{
+    tiles_x = std::max(1, (width + TILE_WIDTH - 1) / TILE_WIDTH);
+    tiles_y = std::max(1, (height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+    buffer_width = tiles_x * TILE_WIDTH;
+    buffer_height = tiles_y * TILE_HEIGHT;
+    depth_buffer.assign(static_cast<size_t>(buffer_width) * buffer_height, 1.0f);
+    block_max.assign(static_cast<size_t>(buffer_width / BLOCK_SIZE) * (buffer_height / BLOCK_SIZE), 1.0f);
+    tile_max.assign(static_cast<size_t>(tiles_x) * tiles_y, 1.0f);
+    tile_bins.assign(static_cast<size_t>(tiles_x) * tiles_y, std::vector<uint32_t>());
+}
+
+void OcclusionCuller::begin(const glm::mat4& vp)
+{
+    view_projection = vp;
+    triangles.clear();
+    for (auto& bin : tile_bins)
+        bin.clear();
+}
+
+void OcclusionCuller::add_occluder(const glm::vec3* positions, const uint32_t* indices, size_t index_count, const glm::mat4& model)
+{
+    const glm::mat4 mvp = view_projection * model;
+    for (size_t i = 0; i + 2 < index_count; i += 3) {
+        const glm::vec4 v[3] = { mvp * glm::vec4(positions[indices[i]], 1.0f),
+                                 mvp * glm::vec4(positions[indices[i + 1]], 1.0f),
+                                 mvp * glm::vec4(positions[indices[i + 2]], 1.0f) };
+
+        // Sutherland-Hodgman against the near plane only, x / y are limited by the tile rectangles
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int e = 0; e < 3; ++e) {
+            const glm::vec4& a = v[e];
+            const glm::vec4& b = v[(e + 1) % 3];
+            const float da = near_distance(a);
+            const float db = near_distance(b);
+            if (da >= 0.0f)
+                polygon[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                polygon[count++] = a + (b - a) * (da / (da - db));
+        }
+        for (int k = 1; k + 1 < count; ++k)
+            add_screen_triangle(polygon[0], polygon[k], polygon[k + 1]);
+    }
+}
+
+void OcclusionCuller::add_screen_triangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+{
+    const glm::vec4* clip[3] = { &a, &b, &c };
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; ++k) {
+        const glm::vec4& v = *clip[k];
+        if (v.w <= 1e-6f)
+            return;
+        p[k] = glm::vec3((v.x / v.w * 0.5f + 0.5f) * buffer_width, (v.y / v.w * 0.5f + 0.5f) * buffer_height, v.z / v.w * 0.5f + 0.5f);
+    }
+
+    // counter-clockwise winding, so that inside means all edge functions >= 0
+    float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+    if (std::fabs(area) < 1e-8f)
+        return;
+    if (area < 0.0f) {
+        std::swap(p[1], p[2]);
+        area = -area;
+    }
+
+    RasterTriangle t;
+    t.min_depth = std::min(std::min(p[0].z, p[1].z), p[2].z);
+    if (t.min_depth >= 1.0f)
+        return;
+    t.min_x = std::max(0, static_cast<int>(std::floor(std::min(std::min(p[0].x, p[1].x), p[2].x))));
+    t.min_y = std::max(0, static_cast<int>(std::floor(std::min(std::min(p[0].y, p[1].y), p[2].y))));
+    t.max_x = std::min(buffer_width - 1, static_cast<int>(std::ceil(std::max(std::max(p[0].x, p[1].x), p[2].x))));
+    t.max_y = std::min(buffer_height - 1, static_cast<int>(std::ceil(std::max(std::max(p[0].y, p[1].y), p[2].y))));
+    if (t.min_x > t.max_x || t.min_y > t.max_y)
+        return;
+
+    for (int e = 0; e < 3; ++e) {
+        const glm::vec3& p0 = p[e];
+        const glm::vec3& p1 = p[(e + 1) % 3];
+        t.edge[e][0] = p0.y - p1.y;
+        t.edge[e][1] = p1.x - p0.x;
+        t.edge[e][2] = (p1.y - p0.y) * p0.x - (p1.x - p0.x) * p0.y;
+    }
+    const float dzdx = ((p[1].z - p[0].z) * (p[2].y - p[0].y) - (p[2].z - p[0].z) * (p[1].y - p[0].y)) / area;
+    const float dzdy = ((p[2].z - p[0].z) * (p[1].x - p[0].x) - (p[1].z - p[0].z) * (p[2].x - p[0].x)) / area;
+    t.depth[0] = dzdx;
+    t.depth[1] = dzdy;
+    t.depth[2] = p[0].z - p[0].x * dzdx - p[0].y * dzdy;
+
+    const uint32_t index = static_cast<uint32_t>(triangles.size());
+    triangles.push_back(t);
+    for (int ty = t.min_y / TILE_HEIGHT; ty <= t.max_y / TILE_HEIGHT; ++ty)
+        for (int tx = t.min_x / TILE_WIDTH; tx <= t.max_x / TILE_WIDTH; ++tx)
+            tile_bins[ty * tiles_x + tx].push_back(index);
+}
+
+void OcclusionCuller::rasterize_tile(int tile)
+{
+    typedef simd::floatv V;
+    const int tile_x0 = (tile % tiles_x) * TILE_WIDTH;
+    const int tile_y0 = (tile / tiles_x) * TILE_HEIGHT;
+    const V lanes = V::load(LANE_OFFSETS);
+
+    for (int y = tile_y0; y < tile_y0 + TILE_HEIGHT; ++y)
+        std::fill(&depth_buffer[static_cast<size_t>(y) * buffer_width + tile_x0], &depth_buffer[static_cast<size_t>(y) * buffer_width + tile_x0] + TILE_WIDTH, 1.0f);
+
+    for (uint32_t index : tile_bins[tile]) {
+        const RasterTriangle& t = triangles[index];
+        // start on a register boundary of the tile, lanes outside the triangle are masked anyway
+        const int x0 = tile_x0 + (std::max(t.min_x, tile_x0) - tile_x0) / V::width * V::width;
+        const int x1 = std::min(t.max_x, tile_x0 + TILE_WIDTH - 1);
+        const int y0 = std::max(t.min_y, tile_y0);
+        const int y1 = std::min(t.max_y, tile_y0 + TILE_HEIGHT - 1);
+
+        const V a0(t.edge[0][0]), b0(t.edge[0][1]), c0(t.edge[0][2]);
+        const V a1(t.edge[1][0]), b1(t.edge[1][1]), c1(t.edge[1][2]);
+        const V a2(t.edge[2][0]), b2(t.edge[2][1]), c2(t.edge[2][2]);
+        const V za(t.depth[0]), zb(t.depth[1]), zc(t.depth[2]);
+        const V zero(0.0f);
+
+        for (int y = y0; y <= y1; ++y) {
+            const V py(y + 0.5f);
+            float* row = &depth_buffer[static_cast<size_t>(y) * buffer_width];
+            for (int x = x0; x <= x1; x += V::width) {
+                const V px = V(x + 0.5f) + lanes;
+                const V inside = (a0 * px + b0 * py + c0 >= zero) & (a1 * px + b1 * py + c1 >= zero) & (a2 * px + b2 * py + c2 >= zero);
+                if (!simd::movemask(inside))
+                    continue;
+                const V z = za * px + zb * py + zc;
+                const V d = V::load(row + x);
+                simd::select(inside, simd::min(d, z), d).store(row + x);
+            }
+        }
+    }
+
+    // depth hierarchy of this tile: 8x8 blocks, then the whole tile
+    const int blocks_per_row = buffer_width / BLOCK_SIZE;
+    float farthest_in_tile = 0.0f;
+    for (int by = tile_y0 / BLOCK_SIZE; by < (tile_y0 + TILE_HEIGHT) / BLOCK_SIZE; ++by) {
+        for (int bx = tile_x0 / BLOCK_SIZE; bx < (tile_x0 + TILE_WIDTH) / BLOCK_SIZE; ++bx) {
+            V farthest(0.0f);
+            for (int y = by * BLOCK_SIZE; y < (by + 1) * BLOCK_SIZE; ++y)
+                for (int x = bx * BLOCK_SIZE; x < (bx + 1) * BLOCK_SIZE; x += V::width)
+                    farthest = simd::max(farthest, V::load(&depth_buffer[static_cast<size_t>(y) * buffer_width + x]));
+            float lanes_max[V::width];
+            farthest.store(lanes_max);
+            const float value = *std::max_element(lanes_max, lanes_max + V::width);
+            block_max[by * blocks_per_row + bx] = value;
+            farthest_in_tile = std::max(farthest_in_tile, value);
+        }
+    }
+    tile_max[tile] = farthest_in_tile;
+}
+
+void OcclusionCuller::rasterize(ThreadPool* pool)
+{
+    const size_t tiles = tile_bins.size();
+    if (!pool) {
+        for (size_t t = 0; t < tiles; ++t)
+            rasterize_tile(static_cast<int>(t));
+        return;
+    }
+    pool->parallel_for(0, tiles, 1, [this](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t)
+            rasterize_tile(static_cast<int>(t));
+    });
+}
+
+bool OcclusionCuller::is_visible(const glm::vec3& box_min, const glm::vec3& box_max) const
+{
+    // screen rectangle and nearest depth of the eight corners
+    glm::vec2 rect_min(1e30f), rect_max(-1e30f);
+    float nearest = 1.0f;
+    // corners as one transformed corner plus transformed edge vectors
+    const glm::vec3 size = box_max - box_min;
+    const glm::vec4 origin = view_projection * glm::vec4(box_min, 1.0f);
+    const glm::vec4 edge_x = view_projection[0] * size.x;
+    const glm::vec4 edge_y = view_projection[1] * size.y;
+    const glm::vec4 edge_z = view_projection[2] * size.z;
+    for (int k = 0; k < 8; ++k) {
+        glm::vec4 clip = origin;
+        if (k & 1)
+            clip += edge_x;
+        if (k & 2)
+            clip += edge_y;
+        if (k & 4)
+            clip += edge_z;
+        // crossing the near plane, the box surrounds the camera
+        if (near_distance(clip) <= 0.0f || clip.w <= 1e-6f)
+            return true;
+        const glm::vec2 screen((clip.x / clip.w * 0.5f + 0.5f) * buffer_width, (clip.y / clip.w * 0.5f + 0.5f) * buffer_height);
+        rect_min = glm::min(rect_min, screen);
+        rect_max = glm::max(rect_max, screen);
+        nearest = std::min(nearest, clip.z / clip.w * 0.5f + 0.5f);
+    }
+
+    const int x0 = std::max(0, static_cast<int>(std::floor(rect_min.x)));
+    const int y0 = std::max(0, static_cast<int>(std::floor(rect_min.y)));
+    const int x1 = std::min(buffer_width - 1, static_cast<int>(std::floor(rect_max.x)));
+    const int y1 = std::min(buffer_height - 1, static_cast<int>(std::floor(rect_max.y)));
+    if (x0 > x1 || y0 > y1)
+        return false;
+
+    // tiles reject large areas at once, blocks refine the rest
+    const int blocks_per_row = buffer_width / BLOCK_SIZE;
+    for (int ty = y0 / TILE_HEIGHT; ty <= y1 / TILE_HEIGHT; ++ty) {
+        for (int tx = x0 / TILE_WIDTH; tx <= x1 / TILE_WIDTH; ++tx) {
+            if (nearest > tile_max[ty * tiles_x + tx])
+                continue;
+            const int bx0 = std::max(x0, tx * TILE_WIDTH) / BLOCK_SIZE;
+            const int bx1 = std::min(x1, (tx + 1) * TILE_WIDTH - 1) / BLOCK_SIZE;
+            const int by0 = std::max(y0, ty * TILE_HEIGHT) / BLOCK_SIZE;
+            const int by1 = std::min(y1, (ty + 1) * TILE_HEIGHT - 1) / BLOCK_SIZE;
+            for (int by = by0; by <= by1; ++by)
+                for (int bx = bx0; bx <= bx1; ++bx)
+                    if (nearest <= block_max[by * blocks_per_row + bx])
+                        return true;
+        }
+    }
+    return false;
+}
+
+void OcclusionCuller::filter(const glm::vec3* box_min, const glm::vec3* box_max, std::vector<uint32_t>& indices, ThreadPool* pool) const
+{
+    std::vector<uint8_t> visible(indices.size());
+    auto test = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            visible[i] = is_visible(box_min[indices[i]], box_max[indices[i]]);
+    };
+    if (pool)
+        pool->parallel_for(0, indices.size(), 256, test);
+    else
+        test(0, indices.size());
+
+    size_t n = 0;
+    for (size_t i = 0; i < indices.size(); ++i)
+        if (visible[i])
+            indices[n++] = indices[i];
+    indices.resize(n);
+}
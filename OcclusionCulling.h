@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ThreadPool.h"
+
+// CPU occlusion culling against a low resolution software depth buffer.
+//
+// Occluder triangles are transformed, clipped to the near plane and binned
+// into screen tiles; every tile is rasterized by one thread, simd::floatv
+// evaluates the edge functions and depth of 4 / 8 pixels at once. A depth
+// hierarchy keeps the farthest depth of every 8x8 block and of every tile,
+// occludee boxes are visible when their nearest depth is in front of one of
+// the blocks their screen rectangle touches. Nothing depends on the GL
+// implementation, results are identical on every driver.
+class OcclusionCuller {
+public:
+    static const int TILE_WIDTH = 64;
+    static const int TILE_HEIGHT = 32;
+    static const int BLOCK_SIZE = 8;
+
+    // sizes are rounded up to whole tiles
+    explicit OcclusionCuller(int width = 320, int height = 192);
+    void resize(int width, int height);
+    int width(void) const { return buffer_width; }
+    int height(void) const { return buffer_height; }
+
+    // starts a frame: clears depth, drops the occluders of the previous frame
+    void begin(const glm::mat4& view_projection);
+    // occluder triangles are treated as double sided
+    void add_occluder(const glm::vec3* positions, const uint32_t* indices, size_t index_count, const glm::mat4& model);
+    // rasterizes all occluders and builds the depth hierarchy; pool == NULL stays on the calling thread
+    void rasterize(ThreadPool* pool = &ThreadPool::global());
+
+    bool is_visible(const glm::vec3& box_min, const glm::vec3& box_max) const;
+    // keeps the indices whose boxes are visible, order is preserved
+    void filter(const glm::vec3* box_min, const glm::vec3* box_max, std::vector<uint32_t>& indices, ThreadPool* pool = &ThreadPool::global()) const;
+
+    size_t occluder_triangles(void) const { return triangles.size(); }
+    const float* depth(void) const { return depth_buffer.data(); }
+
+private:
+    // screen space triangle: edge functions a * x + b * y + c >= 0 inside, depth plane
+    struct RasterTriangle {
+        float edge[3][3];
+        float depth[3];
+        float min_depth;
+        int min_x, min_y, max_x, max_y;
+    };
+
+    void add_screen_triangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+    void rasterize_tile(int tile);
+
+    int buffer_width = 0;
+    int buffer_height = 0;
+    int tiles_x = 0;
+    int tiles_y = 0;
+    glm::mat4 view_projection = glm::mat4(1.0f);
+
+    std::vector<float> depth_buffer;        // NDC depth mapped to [0, 1], 1 = empty
+    std::vector<float> block_max;           // farthest depth per 8x8 block
+    std::vector<float> tile_max;            // farthest depth per tile
+    std::vector<RasterTriangle> triangles;
+    std::vector<std::vector<uint32_t>> tile_bins;
+};
@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "ParticleSystem.h"
+#include "GLStateCache.h"
+#include "ProgramCache.h"
+#include "Simd.h"
+
+namespace {
+
+const char* particle_cpu_vertex_shader =
+    "#version 330 core\n"
+    "layout (location = 0) in vec4 aParticle;\n"    // position, half size
+    "layout (location = 1) in float aAge;\n"        // 0 = born, 1 = dying
+    "uniform mat4 uViewProj;\n"
+    "uniform vec3 uRight;\n"
+    "uniform vec3 uUp;\n"
+    "uniform vec4 uStartColor;\n"
+    "uniform vec4 uEndColor;\n"
+    "out vec2 vCorner;\n"
+    "out vec4 vColor;\n"
+    "void main() {\n"
+    "  vCorner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;\n"
+    "  vColor = mix(uStartColor, uEndColor, aAge);\n"
+    "  vec3 p = aParticle.xyz + (uRight * vCorner.x + uUp * vCorner.y) * aParticle.w;\n"
+    "  gl_Position = uViewProj * vec4(p, 1.0);\n"
+    "}\n";
+
+// the GPU path reads the simulation buffer directly, dead particles are clipped away
+const char* particle_gpu_vertex_shader =
+    "#version 430 core\n"
+    "struct Particle { vec4 position; vec4 velocity; };\n"   // xyz + remaining life, xyz
+    "layout (std430, binding = 0) readonly buffer Particles { Particle particles[]; };\n"
+    "uniform mat4 uViewProj;\n"
+    "uniform vec3 uRight;\n"
+    "uniform vec3 uUp;\n"
+    "uniform vec4 uStartColor;\n"
+    "uniform vec4 uEndColor;\n"
+    "uniform float uSize;\n"
+    "uniform float uLife;\n"
+    "out vec2 vCorner;\n"
+    "out vec4 vColor;\n"
+    "void main() {\n"
+    "  vec4 particle = particles[gl_InstanceID].position;\n"
+    "  vCorner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;\n"
+    "  vColor = mix(uStartColor, uEndColor, 1.0 - particle.w / uLife);\n"
+    "  vec3 p = particle.xyz + (uRight * vCorner.x + uUp * vCorner.y) * uSize;\n"
+    "  gl_Position = particle.w > 0.0 ? uViewProj * vec4(p, 1.0) : vec4(0.0, 0.0, 2.0, 1.0);\n"
+    "}\n";
+
+const char* particle_fragment_shader =
+    "#version 330 core\n"
+    "in vec2 vCorner;\n"
+    "in vec4 vColor;\n"
+    "out vec4 FragColor;\n"
+    "void main() {\n"
+    "  float d = dot(vCorner, vCorner);\n"
+    "  if (d > 1.0) discard;\n"
+    "  FragColor = vec4(vColor.rgb, vColor.a * (1.0 - d));\n"
+    "}\n";
+
+// same integration as ParticleSystem::simulate(); dead particles respawn while the frame budget lasts
+const char* particle_compute_shader =
+    "#version 430 core\n"
+    "layout (local_size_x = 256) in;\n"
+    "struct Particle { vec4 position; vec4 velocity; };\n"
+    "layout (std430, binding = 0) buffer Particles { Particle particles[]; };\n"
+    "layout (std430, binding = 1) buffer Spawn { uint spawned; };\n"
+    "uniform uint uCount;\n"
+    "uniform uint uBudget;\n"
+    "uniform uint uFrame;\n"
+    "uniform float uDt;\n"
+    "uniform vec3 uGravity;\n"
+    "uniform float uDamping;\n"
+    "uniform float uGround;\n"
+    "uniform float uBounce;\n"
+    "uniform vec3 uEmitPosition;\n"
+    "uniform vec3 uEmitVelocity;\n"
+    "uniform float uSpread;\n"
+    "uniform float uLife;\n"
+    "uint hash(uint x) {\n"
+    "  x ^= x >> 16; x *= 0x7feb352du; x ^= x >> 15; x *= 0x846ca68bu; x ^= x >> 16;\n"
+    "  return x;\n"
+    "}\n"
+    "float random(inout uint state) {\n"
+    "  state = hash(state);\n"
+    "  return float(state) * (2.0 / 4294967295.0) - 1.0;\n"
+    "}\n"
+    "void main() {\n"
+    "  uint i = gl_GlobalInvocationID.x;\n"
+    "  if (i >= uCount) return;\n"
+    "  Particle p = particles[i];\n"
+    "  if (p.position.w > 0.0) {\n"
+    "    p.velocity.xyz = (p.velocity.xyz + uGravity * uDt) * uDamping;\n"
+    "    p.position.xyz += p.velocity.xyz * uDt;\n"
+    "    if (p.position.y < uGround) {\n"
+    "      p.position.y = uGround;\n"
+    "      if (p.velocity.y < 0.0) p.velocity.y = -p.velocity.y * uBounce;\n"
+    "    }\n"
+    "    p.position.w -= uDt;\n"
+    "  }\n"
+    "  else if (atomicAdd(spawned, 1u) < uBudget) {\n"
+    "    uint state = hash(i ^ hash(uFrame));\n"
+    "    p.position = vec4(uEmitPosition, uLife);\n"
+    "    p.velocity = vec4(uEmitVelocity + vec3(random(state), random(state), random(state)) * uSpread, 0.0);\n"
+    "  }\n"
+    "  else return;\n"
+    "  particles[i] = p;\n"
+    "}\n";
+
+struct SimulationConstants {
+    float dt, gx, gy, gz, damping, ground, bounce;
+};
+
+// particles [begin, end) rounded down to a multiple of V::width, advances begin; dead particles are appended to 'dead'
+template <class V>
+void simulate_batch(float* x, float* y, float* z, float* vx, float* vy, float* vz, float* life, size_t& begin, size_t end,
+                    const SimulationConstants& k, std::vector<uint32_t>& dead)
+{
+    const V dt(k.dt), damping(k.damping), ground(k.ground), bounce(k.bounce), zero(0.0f);
+    const V gx(k.gx * k.dt), gy(k.gy * k.dt), gz(k.gz * k.dt);
+    for (; begin + V::width <= end; begin += V::width) {
+        const size_t i = begin;
+        const V nvx = (V::load(vx + i) + gx) * damping;
+        V nvy = (V::load(vy + i) + gy) * damping;
+        const V nvz = (V::load(vz + i) + gz) * damping;
+        V ny = V::load(y + i) + nvy * dt;
+
+        // bounce off the ground plane
+        const V below = ny < ground;
+        ny = simd::select(below, ground, ny);
+        nvy = simd::select(below & (nvy < zero), (zero - nvy) * bounce, nvy);
+
+        (V::load(x + i) + nvx * dt).store(x + i);
+        ny.store(y + i);
+        (V::load(z + i) + nvz * dt).store(z + i);
+        nvx.store(vx + i);
+        nvy.store(vy + i);
+        nvz.store(vz + i);
+        const V remaining = V::load(life + i) - dt;
+        remaining.store(life + i);
+
+        // deaths are rare, a whole register usually survives
+        const int mask = simd::movemask(remaining <= zero);
+        if (mask == 0)
+            continue;
+        for (int l = 0; l < V::width; ++l)
+            if ((mask >> l) & 1)
+                dead.push_back(static_cast<uint32_t>(i + l));
+    }
+}
+
+} // namespace
+
+void ParticleSystem::Arrays::resize(size_t count)
+{
+    for (std::vector<float>* a : { &x, &y, &z, &vx, &vy, &vz, &life })
+        a->resize(count);
+}
+
+void ParticleSystem::Arrays::move(size_t from, size_t to)
+{
+    x[to] = x[from];
+    y[to] = y[from];
+    z[to] = z[from];
+    vx[to] = vx[from];
+    vy[to] = vy[from];
+    vz[to] = vz[from];
+    life[to] = life[from];
+}
+
+ParticleSystem::ParticleSystem(size_t capacity)
+    : max_particles(capacity)
+{
+    particles.resize(capacity);
+}
+
+ParticleSystem::~ParticleSystem()
+{
+    clear();
+}
+
+void ParticleSystem::init_gl(void)
+{
+    clear();
+    ProgramCache& programs = ProgramCache::global();
+    cpu_program_ID = programs.get({ { GL_VERTEX_SHADER, particle_cpu_vertex_shader }, { GL_FRAGMENT_SHADER, particle_fragment_shader } }, "Particle");
+    cpu_uniforms.reflect(cpu_program_ID);
+
+    // instances of the CPU path, BUFFER_SECTIONS frames in flight
+    format.init_gl({ { 0, 4, GL_FLOAT, offsetof(Instance, x) }, { 1, 1, GL_FLOAT, offsetof(Instance, age) } }, { 1 });
+    const GLsizeiptr buffer_size = static_cast<GLsizeiptr>(BUFFER_SECTIONS * max_particles * sizeof(Instance));
+    if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        instance_VBO_ID = gl::create_buffer(buffer_size, NULL, flags);
+        mapped = static_cast<Instance*>(glMapNamedBufferRange(instance_VBO_ID, 0, buffer_size, flags));
+    }
+    else {
+        // no persistent mapping, the buffer is orphaned and refilled every frame
+        glCreateBuffers(1, &instance_VBO_ID);
+        staging.resize(max_particles);
+    }
+    format.vertex_buffer(0, instance_VBO_ID, 0, sizeof(Instance));
+
+    if (!GLEW_VERSION_4_3)
+        return;
+    compute_program_ID = programs.get({ { GL_COMPUTE_SHADER, particle_compute_shader } }, "Particle");
+    gpu_program_ID = programs.get({ { GL_VERTEX_SHADER, particle_gpu_vertex_shader }, { GL_FRAGMENT_SHADER, particle_fragment_shader } }, "Particle");
+    compute_uniforms.reflect(compute_program_ID);
+    gpu_uniforms.reflect(gpu_program_ID);
+
+    // the whole pool starts dead
+    const std::vector<glm::vec4> zeros(2 * max_particles, glm::vec4(0.0f));
+    particle_SSBO_ID = gl::create_buffer(zeros.size() * sizeof(glm::vec4), zeros.data());
+    spawn_SSBO_ID = gl::create_buffer(sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+}
+
+void ParticleSystem::clear(void)
+{
+    for (GLsync& fence : fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = 0;
+    }
+    if (mapped) {
+        glUnmapNamedBuffer(instance_VBO_ID);
+        mapped = NULL;
+    }
+    if (cpu_program_ID)
+        glDeleteProgram(cpu_program_ID);
+    if (gpu_program_ID)
+        glDeleteProgram(gpu_program_ID);
+    if (compute_program_ID)
+        glDeleteProgram(compute_program_ID);
+    format.clear();
+    GLuint buffers[3] = { instance_VBO_ID, particle_SSBO_ID, spawn_SSBO_ID };
+    if (instance_VBO_ID)
+        glDeleteBuffers(3, buffers);
+    // the names may come back for other objects
+    GLStateCache::global().invalidate();
+    cpu_program_ID = gpu_program_ID = compute_program_ID = instance_VBO_ID = particle_SSBO_ID = spawn_SSBO_ID = 0;
+    staging.clear();
+    current_path = Path::CPU;
+}
+
+void ParticleSystem::set_path(Path path)
+{
+    if (path == Path::GPU && compute_program_ID == 0) {
+        std::cout << "Particles: compute shaders not available, staying on the CPU path\n";
+        return;
+    }
+    current_path = path;
+}
+
+size_t ParticleSystem::size(void) const
+{
+    return current_path == Path::CPU ? count : max_particles;
+}
+
+void ParticleSystem::update(float dt, ThreadPool* pool)
+{
+    if (current_path == Path::GPU) {
+        gpu_dt = dt;
+        return;
+    }
+    simulate(dt, pool);
+    remove_dead();
+    emit(dt);
+}
+
+void ParticleSystem::emit(float dt)
+{
+    const float wanted = emitter.rate * dt + emit_remainder;
+    const size_t n = std::min(static_cast<size_t>(wanted), max_particles - count);
+    emit_remainder = wanted - std::floor(wanted);
+
+    // xorshift32, the quality is plenty for velocities
+    const auto random = [this]() {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return static_cast<float>(random_state) * (2.0f / 4294967295.0f) - 1.0f;
+    };
+    for (size_t i = count; i < count + n; ++i) {
+        particles.x[i] = emitter.position.x;
+        particles.y[i] = emitter.position.y;
+        particles.z[i] = emitter.position.z;
+        particles.vx[i] = emitter.velocity.x + random() * emitter.spread;
+        particles.vy[i] = emitter.velocity.y + random() * emitter.spread;
+        particles.vz[i] = emitter.velocity.z + random() * emitter.spread;
+        particles.life[i] = emitter.life;
+    }
+    count += n;
+}
+
+void ParticleSystem::simulate(float dt, ThreadPool* pool)
+{
+    const SimulationConstants k = { dt, forces.gravity.x, forces.gravity.y, forces.gravity.z,
+                                    std::max(0.0f, 1.0f - forces.drag * dt), forces.ground_height, forces.bounce };
+    const size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    block_dead.resize(blocks);
+
+    const auto run = [&](size_t first_block, size_t last_block) {
+        for (size_t b = first_block; b < last_block; ++b) {
+            size_t begin = b * BLOCK_SIZE;
+            const size_t end = std::min(count, begin + BLOCK_SIZE);
+            Arrays& a = particles;
+            std::vector<uint32_t>& dead = block_dead[b];
+            dead.clear();
+            simulate_batch<simd::floatv>(a.x.data(), a.y.data(), a.z.data(), a.vx.data(), a.vy.data(), a.vz.data(), a.life.data(), begin, end, k, dead);
+            simulate_batch<simd::float1>(a.x.data(), a.y.data(), a.z.data(), a.vx.data(), a.vy.data(), a.vz.data(), a.life.data(), begin, end, k, dead);
+        }
+    };
+    if (pool == NULL || blocks < 2)
+        run(0, blocks);
+    else
+        pool->parallel_for(0, blocks, 1, run);
+}
+
+void ParticleSystem::remove_dead(void)
+{
+    // holes below the new end are filled with survivors from above it, walking down from the end
+    size_t deaths = 0;
+    for (const auto& dead : block_dead)
+        deaths += dead.size();
+    const size_t new_count = count - deaths;
+    size_t tail = count;
+    for (const auto& dead : block_dead) {
+        for (uint32_t hole : dead) {
+            if (hole >= new_count)
+                break;
+            do
+                --tail;
+            while (particles.life[tail] <= 0.0f);
+            particles.move(tail, hole);
+        }
+    }
+    count = new_count;
+}
+
+void ParticleSystem::write_instances(Instance* out, ThreadPool* pool) const
+{
+    const float inverse_life = 1.0f / emitter.life;
+    const float size = emitter.size;
+    const auto run = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            out[i] = { particles.x[i], particles.y[i], particles.z[i], size, std::min(1.0f, 1.0f - particles.life[i] * inverse_life) };
+    };
+    if (pool == NULL || count < 2 * BLOCK_SIZE)
+        run(0, count);
+    else
+        pool->parallel_for(0, count, BLOCK_SIZE, run);
+}
+
+void ParticleSystem::DrawUniforms::reflect(GLuint program_ID)
+{
+    program.reflect(program_ID);
+    view_projection = program.uniform<glm::mat4>("uViewProj");
+    right = program.uniform<glm::vec3>("uRight");
+    up = program.uniform<glm::vec3>("uUp");
+    start_color = program.uniform<glm::vec4>("uStartColor");
+    end_color = program.uniform<glm::vec4>("uEndColor");
+    size = program.uniform<float>("uSize");
+    life = program.uniform<float>("uLife");
+}
+
+void ParticleSystem::ComputeUniforms::reflect(GLuint program_ID)
+{
+    program.reflect(program_ID);
+    count = program.uniform<GLuint>("uCount");
+    budget = program.uniform<GLuint>("uBudget");
+    frame = program.uniform<GLuint>("uFrame");
+    dt = program.uniform<float>("uDt");
+    gravity = program.uniform<glm::vec3>("uGravity");
+    damping = program.uniform<float>("uDamping");
+    ground = program.uniform<float>("uGround");
+    bounce = program.uniform<float>("uBounce");
+    emit_position = program.uniform<glm::vec3>("uEmitPosition");
+    emit_velocity = program.uniform<glm::vec3>("uEmitVelocity");
+    spread = program.uniform<float>("uSpread");
+    life = program.uniform<float>("uLife");
+}
+
+void ParticleSystem::set_common_uniforms(DrawUniforms& uniforms, const glm::mat4& view_projection, const glm::mat4& view)
+{
+    // camera axes are the rows of the view rotation
+    GLStateCache::global().use_program(uniforms.program.program());
+    uniforms.program.set(uniforms.view_projection, view_projection);
+    uniforms.program.set(uniforms.right, glm::vec3(view[0][0], view[1][0], view[2][0]));
+    uniforms.program.set(uniforms.up, glm::vec3(view[0][1], view[1][1], view[2][1]));
+    uniforms.program.set(uniforms.start_color, emitter.start_color);
+    uniforms.program.set(uniforms.end_color, emitter.end_color);
+}
+
+void ParticleSystem::draw(const glm::mat4& view_projection, const glm::mat4& view)
+{
+    if (cpu_program_ID == 0)
+        return;
+
+    // additive, depth tested against the scene but not written
+    GLStateCache& state = GLStateCache::global();
+    state.set_enabled(GL_BLEND, true);
+    state.blend_func(GL_SRC_ALPHA, GL_ONE);
+    state.depth_mask(false);
+    if (current_path == Path::CPU) {
+        set_common_uniforms(cpu_uniforms, view_projection, view);
+        draw_cpu();
+    }
+    else {
+        set_common_uniforms(gpu_uniforms, view_projection, view);
+        gpu_uniforms.program.set(gpu_uniforms.size, emitter.size);
+        gpu_uniforms.program.set(gpu_uniforms.life, emitter.life);
+        draw_gpu();
+    }
+    state.depth_mask(true);
+    state.set_enabled(GL_BLEND, false);
+}
+
+void ParticleSystem::draw_cpu(void)
+{
+    if (count == 0)
+        return;
+    GLuint base_instance = 0;
+    if (mapped) {
+        // wait until the GPU finished reading this section three frames ago
+        GLsync& fence = fences[section];
+        if (fence) {
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+                ;
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        base_instance = static_cast<GLuint>(section * max_particles);
+        write_instances(mapped + base_instance, &ThreadPool::global());
+    }
+    else {
+        write_instances(staging.data(), &ThreadPool::global());
+        glNamedBufferData(instance_VBO_ID, max_particles * sizeof(Instance), NULL, GL_STREAM_DRAW);
+        glNamedBufferSubData(instance_VBO_ID, 0, count * sizeof(Instance), staging.data());
+    }
+
+    GLStateCache::global().bind_vertex_array(format.vao());
+    glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(count), base_instance);
+
+    if (mapped) {
+        fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        section = (section + 1) % BUFFER_SECTIONS;
+    }
+}
+
+void ParticleSystem::draw_gpu(void)
+{
+    // frame spawn budget, the counter restarts at zero
+    const float wanted = emitter.rate * gpu_dt + emit_remainder;
+    const GLuint budget = static_cast<GLuint>(wanted);
+    emit_remainder = wanted - std::floor(wanted);
+    const GLuint zero = 0;
+    glNamedBufferSubData(spawn_SSBO_ID, 0, sizeof(GLuint), &zero);
+
+    GLStateCache& state = GLStateCache::global();
+
+    ComputeUniforms& u = compute_uniforms;
+    state.use_program(compute_program_ID);
+    u.program.set(u.count, static_cast<GLuint>(max_particles));
+    u.program.set(u.budget, budget);
+    u.program.set(u.frame, ++gpu_frame);
+    u.program.set(u.dt, gpu_dt);
+    u.program.set(u.gravity, forces.gravity);
+    u.program.set(u.damping, std::max(0.0f, 1.0f - forces.drag * gpu_dt));
+    u.program.set(u.ground, forces.ground_height);
+    u.program.set(u.bounce, forces.bounce);
+    u.program.set(u.emit_position, emitter.position);
+    u.program.set(u.emit_velocity, emitter.velocity);
+    u.program.set(u.spread, emitter.spread);
+    u.program.set(u.life, emitter.life);
+    state.bind_buffer_range(GL_SHADER_STORAGE_BUFFER, 0, particle_SSBO_ID);
+    state.bind_buffer_range(GL_SHADER_STORAGE_BUFFER, 1, spawn_SSBO_ID);
+    glDispatchCompute(static_cast<GLuint>((max_particles + 255) / 256), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    state.use_program(gpu_program_ID);
+    state.bind_vertex_array(format.vao());  // attributes are unused, core profile still needs a VAO
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(max_particles));
+}
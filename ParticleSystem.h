@@ -0,0 +1,149 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "GLResources.h"
+#include "ProgramInterface.h"
+#include "ThreadPool.h"
+
+struct ParticleEmitter {
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 velocity = glm::vec3(0.0f, 12.0f, 0.0f);  // mean start velocity
+    float spread = 4.0f;                // uniform random start velocity, +- per axis
+    float life = 5.0f;                  // seconds
+    float rate = 200000.0f;             // particles per second
+    float size = 0.05f;                 // quad half size
+    glm::vec4 start_color = glm::vec4(1.0f, 0.8f, 0.3f, 1.0f);
+    glm::vec4 end_color = glm::vec4(0.8f, 0.1f, 0.0f, 0.0f);
+};
+
+struct ParticleForces {
+    glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+    float drag = 0.3f;                  // fraction of the velocity lost per second
+    float ground_height = 0.0f;         // particles bounce off the plane y = ground_height
+    float bounce = 0.4f;
+};
+
+// Particle fountain with two interchangeable simulation paths.
+//
+// CPU: particles live in structure-of-arrays float vectors. Every update
+// integrates forces and ages the particles with simd::floatv (8 particles per
+// instruction on AVX2) in blocks spread over the thread pool; the blocks also
+// record which particles died. Their slots are refilled from the end of the
+// arrays, so removal costs as much as the number of deaths (the order does
+// not matter under additive blending). draw() packs the live particles
+// straight into a persistently mapped, triple buffered instance buffer,
+// guarded by fences, and draws them as instanced quads.
+//
+// GPU: a compute shader keeps a fixed pool of particles in a storage buffer,
+// dead particles respawn at the emitter rate and the vertex shader reads the
+// pool directly, nothing goes over the bus. Meant for comparison, needs GL 4.3.
+class ParticleSystem {
+public:
+    enum class Path { CPU, GPU };
+
+    static const size_t BLOCK_SIZE = 16384;
+    static const int BUFFER_SECTIONS = 3;
+
+    explicit ParticleSystem(size_t capacity = 1 << 20);
+    ~ParticleSystem();
+
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+    // GL objects, needed only by draw(); must run while the context is current
+    void init_gl(void);
+    void clear(void);
+
+    // falls back to Path::CPU without compute shader support
+    void set_path(Path path);
+    Path path(void) const { return current_path; }
+
+    // CPU path: simulates, removes the dead and emits; GPU path: only remembers dt for draw()
+    void update(float dt, ThreadPool* pool = &ThreadPool::global());
+    void draw(const glm::mat4& view_projection, const glm::mat4& view);
+
+    // live particles of the CPU path, the pool size of the GPU path
+    size_t size(void) const;
+    size_t capacity(void) const { return max_particles; }
+
+    // CPU state, for inspection
+    const float* positions_x(void) const { return particles.x.data(); }
+    const float* positions_y(void) const { return particles.y.data(); }
+    const float* positions_z(void) const { return particles.z.data(); }
+    const float* lives(void) const { return particles.life.data(); }
+
+    ParticleEmitter emitter;
+    ParticleForces forces;
+
+private:
+    struct Arrays {
+        std::vector<float> x, y, z;
+        std::vector<float> vx, vy, vz;
+        std::vector<float> life;            // remaining seconds, <= 0 = dead
+
+        void resize(size_t count);
+        void move(size_t from, size_t to);
+    };
+
+    // one instance of the CPU path: position, half size, age in [0, 1]
+    struct Instance {
+        float x, y, z, size, age;
+    };
+
+    // reflected uniforms of the quad programs, size and life exist only in the GPU one
+    struct DrawUniforms {
+        ProgramInterface program;
+        Uniform<glm::mat4> view_projection;
+        Uniform<glm::vec3> right, up;
+        Uniform<glm::vec4> start_color, end_color;
+        Uniform<float> size, life;
+
+        void reflect(GLuint program_ID);
+    };
+
+    struct ComputeUniforms {
+        ProgramInterface program;
+        Uniform<GLuint> count, budget, frame;
+        Uniform<float> dt, damping, ground, bounce, spread, life;
+        Uniform<glm::vec3> gravity, emit_position, emit_velocity;
+
+        void reflect(GLuint program_ID);
+    };
+
+    void emit(float dt);
+    void simulate(float dt, ThreadPool* pool);
+    void remove_dead(void);
+    void write_instances(Instance* out, ThreadPool* pool) const;
+    void draw_cpu(void);
+    void draw_gpu(void);
+    void set_common_uniforms(DrawUniforms& uniforms, const glm::mat4& view_projection, const glm::mat4& view);
+
+    size_t max_particles;
+    size_t count = 0;
+    Arrays particles;
+    std::vector<std::vector<uint32_t>> block_dead;      // ascending indices of the particles that died, per block
+    float emit_remainder = 0.0f;
+    uint32_t random_state = 0x9E3779B9u;
+    float gpu_dt = 0.0f;
+    uint32_t gpu_frame = 0;
+    Path current_path = Path::CPU;
+
+    GLuint cpu_program_ID = 0;
+    GLuint gpu_program_ID = 0;
+    GLuint compute_program_ID = 0;
+    VertexFormat format;                // instances at binding 0
+    GLuint instance_VBO_ID = 0;
+    GLuint particle_SSBO_ID = 0;
+    DrawUniforms cpu_uniforms;
+    DrawUniforms gpu_uniforms;
+    ComputeUniforms compute_uniforms;
+    GLuint spawn_SSBO_ID = 0;
+    Instance* mapped = NULL;                // persistent mapping, NULL = glBufferSubData fallback
+    std::vector<Instance> staging;
+    GLsync fences[BUFFER_SECTIONS] = {};
+    int section = 0;
+};
@@ -0,0 +1,261 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "ProgramCache.h"
+
+namespace {
+
+const uint32_t BINARY_MAGIC = 0x31424750;    // "PGB1"
+
+struct BinaryHeader {
+    uint32_t magic;
+    uint32_t format;                    // glGetProgramBinary binaryFormat
+    uint64_t key;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+std::string gl_string(GLenum name)
+{
+    const GLubyte* s = glGetString(name);
+    return s ? reinterpret_cast<const char*>(s) : "";
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string shader_log(GLuint shader)
+{
+    GLchar log[1024] = "";
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    return log;
+}
+
+}
+
+ProgramCache::ProgramCache(const std::string& directory)
+    : directory(directory)
+{
+}
+
+ProgramCache& ProgramCache::global(void)
+{
+    static ProgramCache cache;
+    return cache;
+}
+
+void ProgramCache::init_gl(void)
+{
+    driver = gl_string(GL_VENDOR) + '\n' + gl_string(GL_RENDERER) + '\n' + gl_string(GL_VERSION);
+
+    // let the driver compile on as many threads as it likes
+    if (GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+    GLint formats = 0;
+    if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    enabled = formats > 0;
+    if (!enabled) {
+        std::cout << "Program binaries not supported, shaders are compiled on every start\n";
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cerr << "Program cache directory " << directory << " unusable: " << error.message() << '\n';
+        enabled = false;
+    }
+}
+
+uint64_t ProgramCache::hash(const std::vector<ShaderStage>& stages, const std::string& driver)
+{
+    uint64_t h = fnv1a(0xCBF29CE484222325ull, driver.data(), driver.size());
+    for (const ShaderStage& stage : stages) {
+        h = fnv1a(h, &stage.type, sizeof(stage.type));
+        h = fnv1a(h, stage.source.data(), stage.source.size());
+        // separates the stages, ("ab", "c") must not hash like ("a", "bc")
+        const uint64_t length = stage.source.size();
+        h = fnv1a(h, &length, sizeof(length));
+    }
+    return h;
+}
+
+std::string ProgramCache::path(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(directory) / name).string();
+}
+
+GLuint ProgramCache::get(const std::vector<ShaderStage>& stages, const std::string& name)
+{
+    Build build = begin(stages, name);
+    return finish(build, stages);
+}
+
+ProgramCache::Build ProgramCache::begin(const std::vector<ShaderStage>& stages, const std::string& name)
+{
+    const auto start = std::chrono::steady_clock::now();
+    Build build;
+    build.key = hash(stages, driver);
+    build.name = name;
+    if (enabled)
+        build.program = load(build.key);
+    if (build.program == 0)
+        compile(build, stages);
+    build.begin_ms = elapsed_ms(start);
+    return build;
+}
+
+void ProgramCache::compile(Build& build, const std::vector<ShaderStage>& stages)
+{
+    for (const ShaderStage& stage : stages) {
+        const GLuint shader = glCreateShader(stage.type);
+        const char* text = stage.source.c_str();
+        glShaderSource(shader, 1, &text, NULL);
+        glCompileShader(shader);
+        build.shaders.push_back(shader);
+    }
+    build.program = glCreateProgram();
+    for (GLuint shader : build.shaders)
+        glAttachShader(build.program, shader);
+    if (enabled)
+        glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(build.program);
+}
+
+GLuint ProgramCache::finish(Build& build, const std::vector<ShaderStage>& stages)
+{
+    const auto start = std::chrono::steady_clock::now();
+    GLint status;
+    glGetProgramiv(build.program, GL_LINK_STATUS, &status);
+
+    // a binary the driver refused: its file is gone, build from source
+    if (status != GL_TRUE && build.shaders.empty()) {
+        std::error_code error;
+        std::filesystem::remove(path(build.key), error);
+        glDeleteProgram(build.program);
+        compile(build, stages);
+        glGetProgramiv(build.program, GL_LINK_STATUS, &status);
+    }
+
+    if (build.shaders.empty()) {
+        ++hit_count;
+        load_time_ms += build.begin_ms + elapsed_ms(start);
+        return build.program;
+    }
+
+    // a failed compile explains a failed link better than the link log does
+    std::string error;
+    for (GLuint shader : build.shaders) {
+        GLint compiled;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (compiled != GL_TRUE && error.empty())
+            error = build.name + " shader compile failed: " + shader_log(shader);
+        glDeleteShader(shader);
+    }
+    build.shaders.clear();
+    if (status != GL_TRUE) {
+        if (error.empty()) {
+            GLchar log[1024] = "";
+            glGetProgramInfoLog(build.program, sizeof(log), NULL, log);
+            error = build.name + " program link failed: " + log;
+        }
+        glDeleteProgram(build.program);
+        build.program = 0;
+        throw std::runtime_error(error);
+    }
+
+    ++miss_count;
+    if (enabled)
+        store(build.key, build.program);
+    build_time_ms += build.begin_ms + elapsed_ms(start);
+    return build.program;
+}
+
+GLuint ProgramCache::load(uint64_t key)
+{
+    const std::string file = path(key);
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+        return 0;
+
+    // a corrupt length must not size the allocation, the file bounds it
+    std::error_code size_error;
+    const uintmax_t file_size = std::filesystem::file_size(file, size_error);
+    BinaryHeader header;
+    std::vector<char> binary;
+    if (in.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.magic == BINARY_MAGIC && header.key == key
+        && !size_error && header.length <= file_size - sizeof(header)) {
+        binary.resize(header.length);
+        if (!in.read(binary.data(), binary.size()))
+            binary.clear();
+    }
+    in.close();
+
+    // truncated or foreign: rebuilt and rewritten by the caller
+    if (binary.empty()) {
+        std::error_code error;
+        std::filesystem::remove(file, error);
+        return 0;
+    }
+
+    // whether the driver accepts it is known at finish()
+    const GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+    return program;
+}
+
+void ProgramCache::store(uint64_t key, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    const BinaryHeader header = { BINARY_MAGIC, format, key, static_cast<uint32_t>(length), 0 };
+
+    // written aside and renamed, a crash mid-write leaves no half file behind
+    const std::string file = path(key);
+    const std::string temporary = file + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), length);
+        if (!out)
+            return;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, file, error);
+    if (error)
+        std::filesystem::remove(temporary, error);
+}
+
+void ProgramCache::purge(void)
+{
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+        if (entry.path().extension() == ".bin")
+            std::filesystem::remove(entry.path(), error);
+}
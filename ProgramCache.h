@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+struct ShaderStage {
+    GLenum type;                        // GL_VERTEX_SHADER ...
+    std::string source;
+};
+
+// Linked programs kept on disk as driver binaries (glGetProgramBinary).
+//
+// A program is keyed by a 64-bit FNV-1a hash of its stage sources and the
+// vendor, renderer and version strings, so a driver update or another GPU
+// misses instead of loading a stale binary. A binary the driver refuses is
+// deleted and the program is compiled from source again. Without binary
+// support (GL 4.1 / ARB_get_program_binary, at least one binary format) the
+// cache only compiles.
+class ProgramCache {
+public:
+    explicit ProgramCache(const std::string& directory = "cache/programs");
+
+    // reads the driver strings, must run while the context is current
+    void init_gl(void);
+    bool is_enabled(void) const { return enabled; }
+
+    // a program on its way, between begin() and finish()
+    struct Build {
+        GLuint program = 0;
+        uint64_t key = 0;
+        std::string name;
+        std::vector<GLuint> shaders;    // empty when loaded from a binary
+        double begin_ms = 0.0;          // spent in begin(), counted by finish() as load or build time
+    };
+
+    // loaded or compiled and linked program, throws std::runtime_error with
+    // the info log on compile or link failure ('name' prefixes the message)
+    GLuint get(const std::vector<ShaderStage>& stages, const std::string& name);
+
+    // get() in two halves: begin() issues the binary load or the compiles and
+    // the link without asking for their status, finish() waits for the driver.
+    // Beginning many programs before finishing any lets drivers with
+    // ARB_parallel_shader_compile build them concurrently.
+    Build begin(const std::vector<ShaderStage>& stages, const std::string& name);
+    GLuint finish(Build& build, const std::vector<ShaderStage>& stages);
+
+    // deletes all stored binaries
+    void purge(void);
+
+    uint32_t hits(void) const { return hit_count; }
+    uint32_t misses(void) const { return miss_count; }
+    double load_ms(void) const { return load_time_ms; }
+    double build_ms(void) const { return build_time_ms; }
+
+    static uint64_t hash(const std::vector<ShaderStage>& stages, const std::string& driver);
+
+    // cache shared by all renderers, compiles only until init_gl() ran
+    static ProgramCache& global(void);
+
+private:
+    std::string path(uint64_t key) const;
+    GLuint load(uint64_t key);
+    void compile(Build& build, const std::vector<ShaderStage>& stages);
+    void store(uint64_t key, GLuint program);
+
+    std::string directory;
+    std::string driver;                 // vendor, renderer and version strings
+    bool enabled = false;
+    uint32_t hit_count = 0;
+    uint32_t miss_count = 0;
+    double load_time_ms = 0.0;
+    double build_time_ms = 0.0;
+};
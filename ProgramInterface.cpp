@@ -0,0 +1,101 @@
+#include "ProgramInterface.h"
+
+namespace {
+
+std::string strip_array_suffix(std::string name)
+{
+    if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+        name.resize(name.size() - 3);
+    return name;
+}
+
+}
+
+void ProgramInterface::reflect(GLuint program)
+{
+    program_ID = program;
+    uniform_list.clear();
+    attribute_list.clear();
+    slots.clear();
+    values.clear();
+
+    if (GLEW_VERSION_4_3 || GLEW_ARB_program_interface_query) {
+        const GLenum properties[] = { GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE, GL_NAME_LENGTH };
+        const auto read = [&](GLenum interface, std::vector<Resource>& out) {
+            GLint count = 0;
+            glGetProgramInterfaceiv(program, interface, GL_ACTIVE_RESOURCES, &count);
+            for (GLint i = 0; i < count; ++i) {
+                GLint value[4];
+                glGetProgramResourceiv(program, interface, i, 4, properties, 4, NULL, value);
+                std::string name(value[3], '\0');
+                glGetProgramResourceName(program, interface, i, value[3], NULL, &name[0]);
+                name.resize(value[3] - 1);
+                // block members and built-ins have no location
+                out.push_back({ strip_array_suffix(name), static_cast<GLenum>(value[0]), value[1], value[2] });
+            }
+        };
+        read(GL_UNIFORM, uniform_list);
+        read(GL_PROGRAM_INPUT, attribute_list);
+        return;
+    }
+
+    GLchar name[256];
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, i, sizeof(name), NULL, &size, &type, name);
+        uniform_list.push_back({ strip_array_suffix(name), type, glGetUniformLocation(program, name), size });
+    }
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    for (GLint i = 0; i < count; ++i) {
+        GLint size;
+        GLenum type;
+        glGetActiveAttrib(program, i, sizeof(name), NULL, &size, &type, name);
+        attribute_list.push_back({ strip_array_suffix(name), type, glGetAttribLocation(program, name), size });
+    }
+}
+
+const ProgramInterface::Resource* ProgramInterface::find(const std::vector<Resource>& list, const std::string& name)
+{
+    for (const Resource& resource : list)
+        if (resource.name == name)
+            return &resource;
+    return NULL;
+}
+
+GLint ProgramInterface::attribute_location(const std::string& name) const
+{
+    const Resource* resource = find(attribute_list, name);
+    return resource ? resource->location : -1;
+}
+
+bool ProgramInterface::bind_uniform_block(const std::string& name, GLuint binding) const
+{
+    const GLuint index = glGetUniformBlockIndex(program_ID, name.c_str());
+    if (index == GL_INVALID_INDEX)
+        return false;
+    glUniformBlockBinding(program_ID, index, binding);
+    return true;
+}
+
+bool ProgramInterface::bind_storage_block(const std::string& name, GLuint binding) const
+{
+    const GLuint index = glGetProgramResourceIndex(program_ID, GL_SHADER_STORAGE_BLOCK, name.c_str());
+    if (index == GL_INVALID_INDEX)
+        return false;
+    glShaderStorageBlockBinding(program_ID, index, binding);
+    return true;
+}
+
+int32_t ProgramInterface::add_slot(GLint location, size_t size)
+{
+    // handles of the same uniform share the cached value
+    for (size_t i = 0; i < slots.size(); ++i)
+        if (slots[i].location == location)
+            return static_cast<int32_t>(i);
+    slots.push_back({ location, static_cast<uint32_t>(values.size()), false });
+    values.resize(values.size() + size);
+    return static_cast<int32_t>(slots.size() - 1);
+}
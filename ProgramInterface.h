@@ -0,0 +1,157 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// how a C++ type is checked against a reflected uniform and uploaded
+template <class T> struct UniformTraits;
+
+template <> struct UniformTraits<float> {
+    static bool accepts(GLenum type) { return type == GL_FLOAT; }
+    static void upload(GLuint program, GLint location, const float& v) { glProgramUniform1f(program, location, v); }
+};
+
+template <> struct UniformTraits<GLint> {
+    static bool accepts(GLenum type)
+    {
+        switch (type) {
+        case GL_INT: case GL_BOOL:
+        case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE: case GL_SAMPLER_2D_ARRAY:
+        case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW: case GL_SAMPLER_BUFFER:
+        case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+        case GL_IMAGE_2D:
+            return true;
+        default:
+            return false;
+        }
+    }
+    static void upload(GLuint program, GLint location, const GLint& v) { glProgramUniform1i(program, location, v); }
+};
+
+template <> struct UniformTraits<GLuint> {
+    static bool accepts(GLenum type) { return type == GL_UNSIGNED_INT; }
+    static void upload(GLuint program, GLint location, const GLuint& v) { glProgramUniform1ui(program, location, v); }
+};
+
+template <> struct UniformTraits<glm::vec2> {
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC2; }
+    static void upload(GLuint program, GLint location, const glm::vec2& v) { glProgramUniform2fv(program, location, 1, glm::value_ptr(v)); }
+};
+
+template <> struct UniformTraits<glm::vec3> {
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC3; }
+    static void upload(GLuint program, GLint location, const glm::vec3& v) { glProgramUniform3fv(program, location, 1, glm::value_ptr(v)); }
+};
+
+template <> struct UniformTraits<glm::vec4> {
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC4; }
+    static void upload(GLuint program, GLint location, const glm::vec4& v) { glProgramUniform4fv(program, location, 1, glm::value_ptr(v)); }
+};
+
+template <> struct UniformTraits<glm::mat4> {
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT4; }
+    static void upload(GLuint program, GLint location, const glm::mat4& v) { glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, glm::value_ptr(v)); }
+};
+
+// typed handle of one uniform, resolved once by ProgramInterface::uniform()
+template <class T>
+struct Uniform {
+    int32_t slot = -1;                  // -1: not active in the program, setting it does nothing
+    bool is_active(void) const { return slot >= 0; }
+};
+
+// Reflected interface of a linked program.
+//
+// reflect() lists the active uniforms and vertex inputs once (program
+// interface queries on GL 4.3, glGetActiveUniform/Attrib before). Uniforms
+// are then addressed by typed handles indexing a compact slot table, never
+// by name. Every slot keeps a copy of the last uploaded value and set()
+// calls glProgramUniform* only when the value differs, so it also works
+// while another program is bound. Nothing else may change the program's
+// default block uniforms, or the copies go stale.
+class ProgramInterface {
+public:
+    struct Resource {
+        std::string name;               // "[0]" of arrays stripped
+        GLenum type;
+        GLint location;
+        GLint array_size;
+    };
+
+    ProgramInterface() = default;
+    explicit ProgramInterface(GLuint program) { reflect(program); }
+
+    void reflect(GLuint program);
+    GLuint program(void) const { return program_ID; }
+
+    const std::vector<Resource>& uniforms(void) const { return uniform_list; }
+    const std::vector<Resource>& attributes(void) const { return attribute_list; }
+
+    // -1 when the vertex input is not active
+    GLint attribute_location(const std::string& name) const;
+
+    // assigns a uniform block to a binding point, false when the program has no such block
+    bool bind_uniform_block(const std::string& name, GLuint binding) const;
+    // the same for a shader storage block
+    bool bind_storage_block(const std::string& name, GLuint binding) const;
+
+    // handle of a default block uniform, throws std::runtime_error when it
+    // exists with another type; missing ones (optimized out) give an inactive handle
+    template <class T>
+    Uniform<T> uniform(const std::string& name)
+    {
+        Uniform<T> handle;
+        const Resource* resource = find(uniform_list, name);
+        if (resource == NULL || resource->location < 0)
+            return handle;
+        if (!UniformTraits<T>::accepts(resource->type))
+            throw std::runtime_error("Uniform " + name + " has another type in the shader");
+        handle.slot = add_slot(resource->location, sizeof(T));
+        return handle;
+    }
+
+    template <class T>
+    void set(Uniform<T> handle, const T& value)
+    {
+        if (handle.slot < 0)
+            return;
+        Slot& slot = slots[handle.slot];
+        unsigned char* cached = &values[slot.offset];
+        if (slot.uploaded && std::memcmp(cached, &value, sizeof(T)) == 0) {
+            ++skipped_count;
+            return;
+        }
+        std::memcpy(cached, &value, sizeof(T));
+        slot.uploaded = true;
+        UniformTraits<T>::upload(program_ID, slot.location, value);
+        ++issued_count;
+    }
+
+    // glUniform* calls made and avoided so far
+    uint64_t issued(void) const { return issued_count; }
+    uint64_t skipped(void) const { return skipped_count; }
+
+private:
+    struct Slot {
+        GLint location;
+        uint32_t offset;                // into values
+        bool uploaded;
+    };
+
+    static const Resource* find(const std::vector<Resource>& list, const std::string& name);
+    int32_t add_slot(GLint location, size_t size);
+
+    GLuint program_ID = 0;
+    std::vector<Resource> uniform_list;
+    std::vector<Resource> attribute_list;
+    std::vector<Slot> slots;
+    std::vector<unsigned char> values;  // last uploaded value of every slot
+    uint64_t issued_count = 0;
+    uint64_t skipped_count = 0;
+};
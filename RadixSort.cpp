@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cstring>
+
+#include "RadixSort.h"
+
+void RadixSorter::sort(uint64_t* keys, uint32_t* values, size_t count, ThreadPool* pool)
+{
+    passes = 0;
+    if (count < 2)
+        return;
+
+    // bits that differ between any two keys
+    uint64_t differing = 0;
+    for (size_t i = 1; i < count; ++i)
+        differing |= keys[i] ^ keys[0];
+
+    key_scratch.resize(count);
+    value_scratch.resize(count);
+    const size_t threads = pool ? pool->size() : 1;
+    const size_t blocks = count < PARALLEL_SIZE ? 1 : std::min(threads * 4, count / (PARALLEL_SIZE / 4));
+    const size_t block_size = (count + blocks - 1) / blocks;
+    histograms.resize(blocks * 256);
+
+    uint64_t* src_keys = keys;
+    uint32_t* src_values = values;
+    uint64_t* dst_keys = key_scratch.data();
+    uint32_t* dst_values = value_scratch.data();
+
+    const auto for_blocks = [&](const std::function<void(size_t, size_t, size_t)>& body) {
+        const auto run = [&](size_t first, size_t last) {
+            for (size_t b = first; b < last; ++b)
+                body(b, b * block_size, std::min(count, (b + 1) * block_size));
+        };
+        if (blocks == 1 || pool == NULL)
+            run(0, blocks);
+        else
+            pool->parallel_for(0, blocks, 1, run);
+    };
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (((differing >> shift) & 0xFF) == 0)
+            continue;
+        ++passes;
+
+        // pointers are copied so the compiler can keep them in registers
+        const uint64_t* in_keys = src_keys;
+        const uint32_t* in_values = src_values;
+        uint64_t* out_keys = dst_keys;
+        uint32_t* out_values = dst_values;
+
+        for_blocks([&](size_t b, size_t begin, size_t end) {
+            uint32_t h[256] = {};
+            for (size_t i = begin; i < end; ++i)
+                ++h[(in_keys[i] >> shift) & 0xFF];
+            std::memcpy(&histograms[b * 256], h, sizeof(h));
+        });
+
+        // exclusive prefix over (digit, block): equal digits keep the block order
+        uint32_t sum = 0;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            for (size_t b = 0; b < blocks; ++b) {
+                const uint32_t n = histograms[b * 256 + digit];
+                histograms[b * 256 + digit] = sum;
+                sum += n;
+            }
+        }
+
+        for_blocks([&](size_t b, size_t begin, size_t end) {
+            uint32_t offsets[256];
+            std::memcpy(offsets, &histograms[b * 256], sizeof(offsets));
+            for (size_t i = begin; i < end; ++i) {
+                const uint64_t key = in_keys[i];
+                const uint32_t slot = offsets[(key >> shift) & 0xFF]++;
+                out_keys[slot] = key;
+                out_values[slot] = in_values[i];
+            }
+        });
+
+        std::swap(src_keys, dst_keys);
+        std::swap(src_values, dst_values);
+    }
+
+    // an odd number of passes leaves the result in the scratch arrays
+    if (src_keys != keys) {
+        std::copy(src_keys, src_keys + count, keys);
+        std::copy(src_values, src_values + count, values);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Stable LSD radix sort of 64-bit keys carrying 32-bit values, 8 bits per pass.
+//
+// Bytes in which all keys agree are skipped, so keys that only use a few
+// fields cost only a few passes. Every pass is split into blocks: block
+// histograms are counted in parallel, turned into per-block output offsets
+// (digit major, so the sort stays stable) and scattered in parallel.
+class RadixSorter {
+public:
+    // sorts keys[0, count) and moves values along; pool == NULL stays on the calling thread
+    void sort(uint64_t* keys, uint32_t* values, size_t count, ThreadPool* pool = &ThreadPool::global());
+
+    int last_pass_count(void) const { return passes; }
+
+    // below this the sort is a plain serial one
+    static const size_t PARALLEL_SIZE = 16384;
+
+private:
+    std::vector<uint64_t> key_scratch;
+    std::vector<uint32_t> value_scratch;
+    std::vector<uint32_t> histograms;       // block * 256 + digit
+    int passes = 0;
+};
@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+
+#include "RenderGraph.h"
+#include "GLResources.h"
+#include "GLStateCache.h"
+
+bool RenderTargetDesc::operator<(const RenderTargetDesc& other) const
+{
+    return std::tie(width, height, format) < std::tie(other.width, other.height, other.format);
+}
+
+size_t RenderTargetDesc::bytes(void) const
+{
+    size_t texel;
+    switch (format) {
+    case GL_R8:
+        texel = 1;
+        break;
+    case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16:
+        texel = 2;
+        break;
+    case GL_RGBA16F: case GL_RGBA16: case GL_RG32F: case GL_DEPTH32F_STENCIL8:
+        texel = 8;
+        break;
+    case GL_RGBA32F:
+        texel = 16;
+        break;
+    default:                            // RGBA8, RGB10_A2, R11F_G11F_B10F, RG16F, R32F, 24/32 bit depth ...
+        texel = 4;
+        break;
+    }
+    return static_cast<size_t>(width) * height * texel;
+}
+
+bool RenderTargetDesc::is_depth(void) const
+{
+    return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F
+        || format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+RenderGraph::Handle RenderGraph::Builder::create(const std::string& name, const RenderTargetDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    return graph.add_resource(resource);
+}
+
+void RenderGraph::Builder::read(Handle resource)
+{
+    graph.passes[pass].reads.push_back(resource);
+}
+
+void RenderGraph::Builder::write(Handle resource)
+{
+    write_unattached(resource);
+    graph.passes[pass].attachments.push_back(resource);
+}
+
+void RenderGraph::Builder::write_unattached(Handle resource)
+{
+    graph.passes[pass].writes.push_back(resource);
+    graph.resources[resource].writers.push_back(pass);
+}
+
+void RenderGraph::Builder::side_effect(void)
+{
+    graph.passes[pass].side_effect = true;
+}
+
+GLuint RenderGraph::Resources::texture(Handle resource) const
+{
+    return graph.resources[resource].texture;
+}
+
+const RenderTargetDesc& RenderGraph::Resources::desc(Handle resource) const
+{
+    return graph.resources[resource].desc;
+}
+
+RenderGraph::~RenderGraph()
+{
+    clear();
+}
+
+RenderGraph::Handle RenderGraph::add_resource(Resource resource)
+{
+    resources.push_back(std::move(resource));
+    return static_cast<Handle>(resources.size() - 1);
+}
+
+RenderGraph::Handle RenderGraph::import_backbuffer(GLsizei width, GLsizei height)
+{
+    Resource resource;
+    resource.name = "backbuffer";
+    resource.desc = { width, height, GL_RGBA8 };
+    resource.imported = true;
+    return add_resource(resource);
+}
+
+RenderGraph::Handle RenderGraph::import_texture(const std::string& name, GLuint texture, const RenderTargetDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resource.imported = true;
+    resource.texture = texture;
+    return add_resource(resource);
+}
+
+void RenderGraph::add_pass(const std::string& name, const std::function<void(Builder&)>& setup, std::function<void(const Resources&)> execute)
+{
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+    passes.push_back(std::move(pass));
+    Builder builder(*this, static_cast<uint32_t>(passes.size() - 1));
+    setup(builder);
+    compiled = false;
+}
+
+void RenderGraph::compile(void)
+{
+    frame_stats = Stats();
+    frame_stats.passes = static_cast<uint32_t>(passes.size());
+
+    // declaration order is the execution order: reads need an earlier writer
+    for (uint32_t p = 0; p < passes.size(); ++p)
+        for (Handle r : passes[p].reads)
+            if (!resources[r].imported && (resources[r].writers.empty() || resources[r].writers.front() >= p))
+                throw std::runtime_error("Render pass " + passes[p].name + " reads " + resources[r].name + " before any pass writes it");
+
+    // culling: a pass lives while something reads one of its targets;
+    // unread targets release their writers, culled writers release their reads
+    std::vector<uint32_t> references(passes.size());
+    std::vector<bool> roots(passes.size());
+    for (uint32_t p = 0; p < passes.size(); ++p) {
+        Pass& pass = passes[p];
+        pass.culled = false;
+        roots[p] = pass.side_effect;
+        for (Handle w : pass.writes)
+            roots[p] = roots[p] || resources[w].imported;
+        references[p] = static_cast<uint32_t>(pass.writes.size());
+    }
+    for (Resource& resource : resources) {
+        resource.readers = 0;
+        resource.first = INVALID;
+        resource.last = 0;
+        resource.slot = INVALID;
+    }
+    for (const Pass& pass : passes)
+        for (Handle r : pass.reads)
+            ++resources[r].readers;
+
+    std::vector<Handle> unread;
+    auto cull = [&](uint32_t p) {
+        passes[p].culled = true;
+        ++frame_stats.culled;
+        for (Handle r : passes[p].reads)
+            if (--resources[r].readers == 0 && !resources[r].imported)
+                unread.push_back(r);
+    };
+    for (uint32_t p = 0; p < passes.size(); ++p)
+        if (!roots[p] && references[p] == 0)
+            cull(p);
+    for (Handle r = 0; r < resources.size(); ++r)
+        if (resources[r].readers == 0 && !resources[r].imported)
+            unread.push_back(r);
+    while (!unread.empty()) {
+        const Handle r = unread.back();
+        unread.pop_back();
+        for (uint32_t w : resources[r].writers)
+            if (!roots[w] && !passes[w].culled && --references[w] == 0)
+                cull(w);
+    }
+
+    // lifetimes over the live passes
+    for (uint32_t p = 0; p < passes.size(); ++p) {
+        if (passes[p].culled)
+            continue;
+        for (const auto* list : { &passes[p].reads, &passes[p].writes })
+            for (Handle r : *list) {
+                resources[r].first = std::min(resources[r].first, p);
+                resources[r].last = std::max(resources[r].last, p);
+            }
+    }
+
+    // aliasing: a target takes a slot of its size and format whose occupant
+    // is done, the first pass that uses it is after the occupant's last
+    slots.clear();
+    for (uint32_t p = 0; p < passes.size(); ++p) {
+        if (passes[p].culled)
+            continue;
+        for (const auto* list : { &passes[p].reads, &passes[p].writes })
+            for (Handle r : *list) {
+                Resource& resource = resources[r];
+                if (resource.imported || resource.first != p || resource.slot != INVALID)
+                    continue;
+                for (uint32_t s = 0; s < slots.size() && resource.slot == INVALID; ++s)
+                    if (slots[s].desc == resource.desc && slots[s].busy_until < p)
+                        resource.slot = s;
+                if (resource.slot == INVALID) {
+                    resource.slot = static_cast<uint32_t>(slots.size());
+                    slots.push_back({ resource.desc, 0 });
+                    frame_stats.aliased_bytes += resource.desc.bytes();
+                }
+                slots[resource.slot].busy_until = resource.last;
+                ++frame_stats.transients;
+                frame_stats.transient_bytes += resource.desc.bytes();
+            }
+    }
+    compiled = true;
+}
+
+void RenderGraph::execute(void)
+{
+    if (!compiled)
+        compile();
+    ++frame;
+    frame_stats.textures_created = 0;
+    frame_stats.framebuffers_created = 0;
+
+    // slots of the same description take the pooled textures in order
+    std::map<RenderTargetDesc, size_t> taken;
+    std::vector<GLuint> slot_textures(slots.size());
+    for (size_t s = 0; s < slots.size(); ++s) {
+        const RenderTargetDesc& desc = slots[s].desc;
+        std::vector<PooledTexture>& bucket = pool[desc];
+        const size_t index = taken[desc]++;
+        if (index == bucket.size()) {
+            const GLuint texture = gl::create_texture_2d(desc.format, desc.width, desc.height);
+            glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            bucket.push_back({ texture, frame });
+            ++frame_stats.textures_created;
+        }
+        bucket[index].last_used = frame;
+        slot_textures[s] = bucket[index].texture;
+    }
+    for (Resource& resource : resources)
+        if (resource.slot != INVALID)
+            resource.texture = slot_textures[resource.slot];
+
+    GLStateCache& state = GLStateCache::global();
+    for (const Pass& pass : passes) {
+        if (pass.culled)
+            continue;
+        GLuint fbo = 0;
+        if (!pass.attachments.empty()) {
+            fbo = framebuffer(pass);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            const RenderTargetDesc& target = resources[pass.attachments.front()].desc;
+            state.viewport(0, 0, target.width, target.height);
+        }
+        pass.execute(Resources(*this, fbo));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    purge();
+}
+
+GLuint RenderGraph::framebuffer(const Pass& pass)
+{
+    // the back buffer is its own framebuffer, nothing else can be attached to it
+    std::vector<GLuint> colors;
+    GLuint depth = 0;
+    GLenum depth_attachment = GL_DEPTH_ATTACHMENT;
+    for (Handle w : pass.attachments) {
+        const Resource& resource = resources[w];
+        if (resource.imported && resource.texture == 0)
+            return 0;
+        if (resource.desc.is_depth()) {
+            depth = resource.texture;
+            const bool stencil = resource.desc.format == GL_DEPTH24_STENCIL8 || resource.desc.format == GL_DEPTH32F_STENCIL8;
+            depth_attachment = stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        }
+        else
+            colors.push_back(resource.texture);
+    }
+
+    std::vector<GLuint> key = colors;
+    key.push_back(depth);
+    const auto found = framebuffers.find(key);
+    if (found != framebuffers.end())
+        return found->second;
+
+    GLuint fbo;
+    glCreateFramebuffers(1, &fbo);
+    std::vector<GLenum> draw_buffers;
+    for (size_t i = 0; i < colors.size(); ++i) {
+        glNamedFramebufferTexture(fbo, static_cast<GLenum>(GL_COLOR_ATTACHMENT0 + i), colors[i], 0);
+        draw_buffers.push_back(static_cast<GLenum>(GL_COLOR_ATTACHMENT0 + i));
+    }
+    if (depth)
+        glNamedFramebufferTexture(fbo, depth_attachment, depth, 0);
+    if (draw_buffers.empty())
+        glNamedFramebufferDrawBuffer(fbo, GL_NONE);
+    else
+        glNamedFramebufferDrawBuffers(fbo, static_cast<GLsizei>(draw_buffers.size()), draw_buffers.data());
+    if (glCheckNamedFramebufferStatus(fbo, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        glDeleteFramebuffers(1, &fbo);
+        throw std::runtime_error("Render pass " + pass.name + " has an incomplete framebuffer");
+    }
+    framebuffers[key] = fbo;
+    ++frame_stats.framebuffers_created;
+    return fbo;
+}
+
+void RenderGraph::purge(void)
+{
+    std::vector<GLuint> deleted;
+    for (auto bucket = pool.begin(); bucket != pool.end(); ) {
+        auto& textures = bucket->second;
+        for (size_t i = 0; i < textures.size(); ) {
+            if (textures[i].last_used + frames_unused < frame) {
+                deleted.push_back(textures[i].texture);
+                textures.erase(textures.begin() + i);
+            }
+            else
+                ++i;
+        }
+        bucket = textures.empty() ? pool.erase(bucket) : std::next(bucket);
+    }
+    if (deleted.empty())
+        return;
+
+    // framebuffers with a deleted attachment go with it
+    for (auto fbo = framebuffers.begin(); fbo != framebuffers.end(); ) {
+        const bool stale = std::any_of(fbo->first.begin(), fbo->first.end(), [&deleted](GLuint texture) {
+            return texture != 0 && std::find(deleted.begin(), deleted.end(), texture) != deleted.end();
+        });
+        if (stale) {
+            glDeleteFramebuffers(1, &fbo->second);
+            fbo = framebuffers.erase(fbo);
+        }
+        else
+            ++fbo;
+    }
+    glDeleteTextures(static_cast<GLsizei>(deleted.size()), deleted.data());
+    // the names may come back for other objects
+    GLStateCache::global().invalidate();
+}
+
+void RenderGraph::reset(void)
+{
+    resources.clear();
+    passes.clear();
+    slots.clear();
+    compiled = false;
+}
+
+void RenderGraph::clear(void)
+{
+    reset();
+    bool deleted = false;
+    for (auto& bucket : pool)
+        for (const PooledTexture& pooled : bucket.second) {
+            glDeleteTextures(1, &pooled.texture);
+            deleted = true;
+        }
+    for (const auto& fbo : framebuffers)
+        glDeleteFramebuffers(1, &fbo.second);
+    pool.clear();
+    framebuffers.clear();
+    if (deleted)
+        GLStateCache::global().invalidate();
+}
+
+size_t RenderGraph::pool_bytes(void) const
+{
+    size_t bytes = 0;
+    for (const auto& bucket : pool)
+        bytes += bucket.first.bytes() * bucket.second.size();
+    return bytes;
+}
+
+bool RenderGraph::is_culled(const std::string& pass) const
+{
+    for (const Pass& p : passes)
+        if (p.name == pass)
+            return p.culled;
+    return false;
+}
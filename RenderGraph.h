@@ -0,0 +1,164 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+struct RenderTargetDesc {
+    GLsizei width = 0, height = 0;
+    GLenum format = GL_RGBA8;           // depth formats attach as depth (/ stencil)
+
+    bool operator==(const RenderTargetDesc& other) const { return width == other.width && height == other.height && format == other.format; }
+    bool operator<(const RenderTargetDesc& other) const;
+    size_t bytes(void) const;
+    bool is_depth(void) const;
+};
+
+// Frame graph: the frame's passes declare the render targets they create,
+// read and write, the graph does the rest.
+//
+//   compile()  drops passes whose results nobody reads (passes writing
+//              imported targets such as the back buffer, or marked with
+//              side_effect(), are the roots), keeps declaration order for the
+//              rest, and gives each transient target the lifetime from its
+//              first to its last use. Transient targets of the same size and
+//              format whose lifetimes do not overlap share one texture.
+//   execute()  takes the textures from a pool that lives across frames and
+//              binds one framebuffer per pass, cached by its attachments, so
+//              a steady frame creates neither textures nor FBOs. Targets a
+//              pass writes on its own (its own framebuffers, image stores)
+//              are declared with write_unattached() and get no attachment.
+//
+// The graph is rebuilt every frame: reset(), add the passes, compile(),
+// execute(). compile() only plans (no GL), so it can be measured without a
+// context. Pooled textures unused for 'frames_unused' frames are deleted.
+class RenderGraph {
+public:
+    using Handle = uint32_t;
+    static const Handle INVALID = 0xFFFFFFFFu;
+
+    class Builder {
+    public:
+        // a transient target, contents undefined until a pass writes it
+        Handle create(const std::string& name, const RenderTargetDesc& desc);
+        void read(Handle resource);
+        // attached to the pass framebuffer, colors in write order
+        void write(Handle resource);
+        // written, but not through the pass framebuffer: layered targets the
+        // pass renders with framebuffers of its own, image stores ...
+        void write_unattached(Handle resource);
+        // never culled (readbacks, queries ...)
+        void side_effect(void);
+
+    private:
+        friend class RenderGraph;
+        Builder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+        RenderGraph& graph;
+        uint32_t pass;
+    };
+
+    // what a pass sees while it executes; its framebuffer is bound and the
+    // viewport covers its first attached target (without attachments neither
+    // is touched, framebuffer() is 0)
+    class Resources {
+    public:
+        GLuint texture(Handle resource) const;
+        const RenderTargetDesc& desc(Handle resource) const;
+        GLuint framebuffer(void) const { return fbo; }
+
+    private:
+        friend class RenderGraph;
+        Resources(const RenderGraph& graph, GLuint fbo) : graph(graph), fbo(fbo) {}
+
+        const RenderGraph& graph;
+        GLuint fbo;
+    };
+
+    struct Stats {
+        uint32_t passes = 0;
+        uint32_t culled = 0;
+        uint32_t transients = 0;
+        size_t transient_bytes = 0;         // every transient target in its own texture
+        size_t aliased_bytes = 0;           // after aliasing
+        uint32_t textures_created = 0;      // by the last execute()
+        uint32_t framebuffers_created = 0;
+    };
+
+    RenderGraph() = default;
+    ~RenderGraph();
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // framebuffer 0; writing it makes a pass a root
+    Handle import_backbuffer(GLsizei width, GLsizei height);
+    // a texture owned elsewhere (kept across frames, e.g. cached shadows); writing it makes a pass a root
+    Handle import_texture(const std::string& name, GLuint texture, const RenderTargetDesc& desc);
+
+    void add_pass(const std::string& name, const std::function<void(Builder&)>& setup, std::function<void(const Resources&)> execute);
+
+    // throws std::runtime_error when a pass reads a target no earlier pass wrote
+    void compile(void);
+    void execute(void);
+    // forgets passes and targets, keeps the pool
+    void reset(void);
+    // deletes the pooled textures and framebuffers, must run while the context is current
+    void clear(void);
+
+    const Stats& stats(void) const { return frame_stats; }
+    size_t pool_bytes(void) const;
+    bool is_culled(const std::string& pass) const;
+
+    int frames_unused = 3;
+
+private:
+    struct Resource {
+        std::string name;
+        RenderTargetDesc desc;
+        bool imported = false;
+        GLuint texture = 0;                 // imported, or assigned by execute()
+        std::vector<uint32_t> writers;
+        uint32_t readers = 0;               // live passes reading it, during culling
+        uint32_t first = INVALID, last = 0; // live pass range
+        uint32_t slot = INVALID;
+    };
+
+    struct Pass {
+        std::string name;
+        std::function<void(const Resources&)> execute;
+        std::vector<Handle> reads;
+        std::vector<Handle> writes;
+        std::vector<Handle> attachments;    // the writes bound as the pass framebuffer
+        bool side_effect = false;
+        bool culled = false;
+    };
+
+    struct Slot {
+        RenderTargetDesc desc;
+        uint32_t busy_until;                // last pass of the current occupant
+    };
+
+    struct PooledTexture {
+        GLuint texture;
+        uint64_t last_used;
+    };
+
+    Handle add_resource(Resource resource);
+    GLuint framebuffer(const Pass& pass);
+    void purge(void);
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<Slot> slots;
+    bool compiled = false;
+    Stats frame_stats;
+
+    uint64_t frame = 0;
+    std::map<RenderTargetDesc, std::vector<PooledTexture>> pool;
+    std::map<std::vector<GLuint>, GLuint> framebuffers;    // attachments -> FBO
+};
@@ -0,0 +1,146 @@
+#include <cstring>
+
+#include "RenderQueue.h"
+#include "GLStateCache.h"
+
+namespace {
+
+const uint64_t DEPTH_MASK = (1u << 24) - 1;
+
+// the top 24 bits below the sign of a non-negative float order like the float
+uint64_t depth_bits(float view_depth)
+{
+    view_depth = view_depth > 0.0f ? view_depth : 0.0f;
+    uint32_t bits;
+    std::memcpy(&bits, &view_depth, sizeof(bits));
+    return (bits >> 7) & DEPTH_MASK;
+}
+
+} // namespace
+
+uint64_t RenderQueue::make_key(uint8_t layer, bool translucent, GLuint program, uint16_t material, GLuint vao, float view_depth)
+{
+    const uint64_t state = (static_cast<uint64_t>(program & 0x7FF) << 24) | (static_cast<uint64_t>(material) << 8) | (vao & 0xFF);
+    const uint64_t head = static_cast<uint64_t>(layer & 0xF) << 60;
+    if (!translucent)
+        return head | (state << 24) | depth_bits(view_depth);
+    // far first
+    return head | (1ull << 59) | ((DEPTH_MASK - depth_bits(view_depth)) << 35) | state;
+}
+
+uint16_t RenderQueue::add_material(std::function<void(void)> bind)
+{
+    if (materials.empty())
+        materials.emplace_back();       // 0 = no material
+    materials.push_back(std::move(bind));
+    return static_cast<uint16_t>(materials.size() - 1);
+}
+
+void RenderQueue::push(const DrawCommand& command, uint8_t layer, bool translucent, float view_depth)
+{
+    keys.push_back(make_key(layer, translucent, command.program, command.material, command.vao, view_depth));
+    commands.push_back(command);
+}
+
+void RenderQueue::push_custom(std::function<void(void)> draw, uint8_t layer, bool translucent, float view_depth)
+{
+    DrawCommand command;
+    command.material = CUSTOM_MATERIAL;
+    command.first = static_cast<GLint>(custom_draws.size());
+    custom_draws.push_back(std::move(draw));
+    keys.push_back(make_key(layer, translucent, 0, CUSTOM_MATERIAL, 0, view_depth));
+    commands.push_back(command);
+}
+
+void RenderQueue::clear(void)
+{
+    commands.clear();
+    keys.clear();
+    order.clear();
+    custom_draws.clear();
+}
+
+RenderStats RenderQueue::count_switches(const uint32_t* items) const
+{
+    RenderStats stats;
+    GLuint program = 0, vao = 0, texture = 0;
+    uint16_t material = 0;
+    bool known = false;                 // after a custom draw nothing is known
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const DrawCommand& c = commands[items[i]];
+        ++stats.draws;
+        if (c.material == CUSTOM_MATERIAL) {
+            known = false;
+            continue;
+        }
+        const bool program_changed = !known || c.program != program;
+        stats.program_switches += program_changed;
+        stats.vao_switches += !known || c.vao != vao;
+        stats.texture_switches += c.texture != 0 && (!known || c.texture != texture);
+        stats.material_switches += c.material != 0 && (program_changed || c.material != material);
+        program = c.program;
+        vao = c.vao;
+        texture = c.texture ? c.texture : texture;
+        material = c.material;
+        known = true;
+    }
+    return stats;
+}
+
+void RenderQueue::sort(ThreadPool* pool)
+{
+    order.resize(keys.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = static_cast<uint32_t>(i);
+    before = count_switches(order.data());
+
+    sorter.sort(keys.data(), order.data(), keys.size(), pool);
+    after = count_switches(order.data());
+}
+
+void RenderQueue::submit(void)
+{
+    // unsorted queues draw in submission order
+    if (order.size() != commands.size()) {
+        order.resize(commands.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = static_cast<uint32_t>(i);
+    }
+
+    // redundant binds are dropped by the state cache, the queue only tracks
+    // materials and the mesh attached to each vertex format
+    GLStateCache& state = GLStateCache::global();
+    GLuint program = 0;
+    uint16_t material = 0;
+    GLuint vao = 0, vertex_buffer = 0;
+    bool known = false;
+    for (uint32_t index : order) {
+        const DrawCommand& c = commands[index];
+        if (c.material == CUSTOM_MATERIAL) {
+            custom_draws[c.first]();
+            known = false;
+            continue;
+        }
+        const bool program_changed = !known || c.program != program;
+        state.use_program(c.program);
+        state.bind_vertex_array(c.vao);
+        if (c.vertex_buffer != 0 && (!known || c.vao != vao || c.vertex_buffer != vertex_buffer)) {
+            glVertexArrayVertexBuffer(c.vao, 0, c.vertex_buffer, 0, c.vertex_stride);
+            vao = c.vao;
+            vertex_buffer = c.vertex_buffer;
+        }
+        if (c.texture != 0)
+            state.bind_texture(0, c.texture_target, c.texture);
+        // uniforms belong to the program, a new program needs the material again
+        if (c.material != 0 && (program_changed || c.material != material))
+            materials[c.material]();
+        program = c.program;
+        material = c.material;
+        known = true;
+
+        if (c.instances == 1 && c.base_instance == 0)
+            glDrawArrays(c.mode, c.first, c.count);
+        else
+            glDrawArraysInstancedBaseInstance(c.mode, c.first, c.count, c.instances, c.base_instance);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "RadixSort.h"
+#include "ThreadPool.h"
+
+// One draw call and the state it needs. Names above the key field widths
+// still draw correctly, they only sort less tightly.
+struct DrawCommand {
+    GLuint program = 0;
+    GLuint vao = 0;                     // the vertex format (VertexFormat::vao())
+    GLuint vertex_buffer = 0;           // mesh attached to binding 0 of the vao, 0 = leave as is
+    GLsizei vertex_stride = 0;
+    GLuint texture = 0;                 // bound to unit 0, 0 = leave as is
+    GLenum texture_target = GL_TEXTURE_2D;      // GL_TEXTURE_2D_ARRAY for TextureArrayBuilder layers
+    uint16_t material = 0;              // RenderQueue::add_material(), 0 = none
+    GLenum mode = GL_TRIANGLES;
+    GLint first = 0;
+    GLsizei count = 0;
+    GLsizei instances = 1;
+    GLuint base_instance = 0;
+};
+
+// per frame state changes, for submission order vs sorted order
+struct RenderStats {
+    uint32_t draws = 0;
+    uint32_t program_switches = 0;
+    uint32_t vao_switches = 0;
+    uint32_t texture_switches = 0;
+    uint32_t material_switches = 0;
+};
+
+// Frame draw list sorted by packed 64-bit keys.
+//
+//   opaque:      layer:4 | 0 | program:11 | material:16 | vao:8  | depth:24
+//   translucent: layer:4 | 1 | ~depth:24  | program:11 | material:16 | vao:8
+//
+// Opaque items are grouped by state and drawn front to back inside a group,
+// translucent items follow their layer's opaque ones back to front. The depth
+// field holds the upper bits of the (non-negative) float view depth, which
+// compare like the floats themselves. Keys are radix sorted on the thread
+// pool; submit() binds through the GLStateCache, which drops unchanged binds.
+class RenderQueue {
+public:
+    static const int LAYER_COUNT = 16;
+
+    // 'bind' sets the material's uniforms and textures, its program is already current
+    uint16_t add_material(std::function<void(void)> bind);
+
+    void push(const DrawCommand& command, uint8_t layer, bool translucent, float view_depth);
+    // draws it owns state for (terrain, particles ...); the queue forgets what is bound afterwards
+    void push_custom(std::function<void(void)> draw, uint8_t layer, bool translucent, float view_depth);
+
+    // radix sort by key, records the state changes before and after
+    void sort(ThreadPool* pool = &ThreadPool::global());
+    void submit(void);
+    // drops the items, keeps the materials
+    void clear(void);
+
+    size_t size(void) const { return keys.size(); }
+    const RenderStats& unsorted_stats(void) const { return before; }
+    const RenderStats& sorted_stats(void) const { return after; }
+    int sort_passes(void) const { return sorter.last_pass_count(); }
+
+    static uint64_t make_key(uint8_t layer, bool translucent, GLuint program, uint16_t material, GLuint vao, float view_depth);
+
+private:
+    // custom items carry this material and their callback index in 'first'
+    static const uint16_t CUSTOM_MATERIAL = 0xFFFF;
+
+    RenderStats count_switches(const uint32_t* order) const;
+
+    std::vector<std::function<void(void)>> materials;
+    std::vector<std::function<void(void)>> custom_draws;
+    std::vector<DrawCommand> commands;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    RadixSorter sorter;
+    RenderStats before, after;
+};
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+#include "SceneGraph.h"
+#include "ThreadPool.h"
+
+namespace {
+
+// levels smaller than this are not worth waking the workers
+const size_t PARALLEL_LEVEL_SIZE = 8192;
+
+glm::mat4 compose(const glm::vec3& t, const glm::quat& r, const glm::vec3& s)
+{
+    const glm::mat3 m = glm::mat3_cast(r);
+    return glm::mat4(glm::vec4(m[0] * s.x, 0.0f),
+                     glm::vec4(m[1] * s.y, 0.0f),
+                     glm::vec4(m[2] * s.z, 0.0f),
+                     glm::vec4(t, 1.0f));
+}
+
+template <class T>
+void permute(std::vector<T>& data, const std::vector<uint32_t>& order)
+{
+    std::vector<T> sorted(data.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        sorted[i] = data[order[i]];
+    data.swap(sorted);
+}
+
+} // namespace
+
+SceneGraph::Node SceneGraph::create_node(Node parent)
+{
+    if (parent != INVALID_NODE && parent >= index_of.size())
+        throw std::runtime_error("SceneGraph: invalid parent node");
+
+    const uint32_t index = static_cast<uint32_t>(parents.size());
+    const uint32_t parent_index = parent == INVALID_NODE ? INVALID_NODE : index_of[parent];
+    const uint32_t depth = parent == INVALID_NODE ? 0 : depths[parent_index] + 1;
+    const Node node = static_cast<Node>(index_of.size());
+
+    // appending keeps the order only while depths do not decrease
+    if (!depths.empty() && depth < depths.back())
+        unsorted = true;
+    if (depth + 1 >= level_offsets.size())
+        level_offsets.resize(depth + 2, level_offsets.empty() ? 0 : level_offsets.back());
+    level_offsets[depth + 1] = std::max(level_offsets[depth + 1], static_cast<size_t>(index) + 1);
+
+    parents.push_back(parent_index);
+    depths.push_back(depth);
+    positions.emplace_back(0.0f);
+    rotations.emplace_back(1.0f, 0.0f, 0.0f, 0.0f);
+    scales.emplace_back(1.0f);
+    world.emplace_back(1.0f);
+    dirty.push_back(1);
+    node_of.push_back(node);
+    index_of.push_back(index);
+    any_dirty = true;
+    return node;
+}
+
+void SceneGraph::reserve(size_t count)
+{
+    parents.reserve(count);
+    depths.reserve(count);
+    positions.reserve(count);
+    rotations.reserve(count);
+    scales.reserve(count);
+    world.reserve(count);
+    dirty.reserve(count);
+    node_of.reserve(count);
+    index_of.reserve(count);
+}
+
+void SceneGraph::clear(void)
+{
+    parents.clear();
+    depths.clear();
+    positions.clear();
+    rotations.clear();
+    scales.clear();
+    world.clear();
+    dirty.clear();
+    node_of.clear();
+    index_of.clear();
+    level_offsets.clear();
+    unsorted = false;
+    any_dirty = false;
+}
+
+SceneGraph::Node SceneGraph::parent(Node node) const
+{
+    const uint32_t p = parents[index_of[node]];
+    return p == INVALID_NODE ? INVALID_NODE : node_of[p];
+}
+
+void SceneGraph::set_position(Node node, const glm::vec3& position)
+{
+    const uint32_t i = index_of[node];
+    positions[i] = position;
+    dirty[i] = 1;
+    any_dirty = true;
+}
+
+void SceneGraph::set_rotation(Node node, const glm::quat& rotation)
+{
+    const uint32_t i = index_of[node];
+    rotations[i] = rotation;
+    dirty[i] = 1;
+    any_dirty = true;
+}
+
+void SceneGraph::set_scale(Node node, const glm::vec3& scale)
+{
+    const uint32_t i = index_of[node];
+    scales[i] = scale;
+    dirty[i] = 1;
+    any_dirty = true;
+}
+
+void SceneGraph::mark_all_dirty(void)
+{
+    std::fill(dirty.begin(), dirty.end(), uint8_t(1));
+    any_dirty = !dirty.empty();
+}
+
+// breadth-first order: levels are contiguous and the children of one parent
+// are adjacent, so parent reads during update() walk memory mostly forward
+void SceneGraph::sort_by_depth(void)
+{
+    const size_t count = parents.size();
+    std::vector<uint32_t> child_offsets(count + 1, 0);
+    for (uint32_t p : parents)
+        if (p != INVALID_NODE)
+            ++child_offsets[p + 1];
+    for (size_t i = 0; i < count; ++i)
+        child_offsets[i + 1] += child_offsets[i];
+    std::vector<uint32_t> children(child_offsets[count]);
+    std::vector<uint32_t> fill(child_offsets.begin(), child_offsets.end() - 1);
+    for (uint32_t i = 0; i < count; ++i)
+        if (parents[i] != INVALID_NODE)
+            children[fill[parents[i]]++] = i;
+
+    std::vector<uint32_t> order;
+    order.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+        if (parents[i] == INVALID_NODE)
+            order.push_back(i);
+    for (size_t k = 0; k < order.size(); ++k)
+        order.insert(order.end(), children.begin() + child_offsets[order[k]], children.begin() + child_offsets[order[k] + 1]);
+
+    const size_t levels = level_offsets.size() - 1;
+    level_offsets.assign(levels + 1, 0);
+    for (uint32_t d : depths)
+        ++level_offsets[d + 1];
+    for (size_t d = 0; d < levels; ++d)
+        level_offsets[d + 1] += level_offsets[d];
+
+    // order[new] = old; rewrite handles first so parent links can be remapped
+    std::vector<uint32_t> new_index(parents.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+        new_index[order[i]] = i;
+    for (uint32_t& p : parents)
+        if (p != INVALID_NODE)
+            p = new_index[p];
+
+    permute(parents, order);
+    permute(depths, order);
+    permute(positions, order);
+    permute(rotations, order);
+    permute(scales, order);
+    permute(world, order);
+    permute(dirty, order);
+    permute(node_of, order);
+    for (uint32_t i = 0; i < node_of.size(); ++i)
+        index_of[node_of[i]] = i;
+
+    unsorted = false;
+}
+
+// nodes of one level: the parent level is final, its dirty flags already include all ancestors
+size_t SceneGraph::update_range(size_t begin, size_t end)
+{
+    size_t updated = 0;
+    for (size_t i = begin; i < end; ++i) {
+        const uint32_t p = parents[i];
+        if (p != INVALID_NODE)
+            dirty[i] |= dirty[p];
+        if (!dirty[i])
+            continue;
+
+        const glm::mat4 local = compose(positions[i], rotations[i], scales[i]);
+        world[i] = p != INVALID_NODE ? world[p] * local : local;
+        ++updated;
+    }
+    return updated;
+}
+
+size_t SceneGraph::update(void)
+{
+    if (!any_dirty)
+        return 0;
+    if (unsorted)
+        sort_by_depth();
+
+    size_t updated = 0;
+    for (size_t d = 0; d + 1 < level_offsets.size(); ++d) {
+        const size_t begin = level_offsets[d];
+        const size_t end = level_offsets[d + 1];
+        if (end - begin < PARALLEL_LEVEL_SIZE) {
+            updated += update_range(begin, end);
+            continue;
+        }
+
+        std::atomic<size_t> level_updated(0);
+        ThreadPool::global().parallel_for(begin, end, PARALLEL_LEVEL_SIZE / 2, [&](size_t b, size_t e) {
+            level_updated += update_range(b, e);
+        });
+        updated += level_updated;
+    }
+
+    std::fill(dirty.begin(), dirty.end(), uint8_t(0));
+    any_dirty = false;
+    return updated;
+}
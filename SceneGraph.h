@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Transform hierarchy stored as structure-of-arrays sorted by depth.
+//
+// Nodes are addressed by stable handles; internally they live in arrays
+// ordered level by level (all roots, then all depth-1 nodes, ...), so every
+// parent precedes its children. update() walks the levels once: a node is
+// recomputed only when it or one of its ancestors changed, and all nodes of
+// one level are independent, so each level is split over ThreadPool::global().
+class SceneGraph {
+public:
+    typedef uint32_t Node;
+    static const Node INVALID_NODE = 0xFFFFFFFFu;
+
+    Node create_node(Node parent = INVALID_NODE);
+    size_t size(void) const { return parents.size(); }
+    void reserve(size_t count);
+    void clear(void);
+
+    Node parent(Node node) const;
+    void set_position(Node node, const glm::vec3& position);
+    void set_rotation(Node node, const glm::quat& rotation);
+    void set_scale(Node node, const glm::vec3& scale);
+    const glm::vec3& position(Node node) const { return positions[index_of[node]]; }
+    const glm::quat& rotation(Node node) const { return rotations[index_of[node]]; }
+    const glm::vec3& scale(Node node) const { return scales[index_of[node]]; }
+
+    // valid after update()
+    const glm::mat4& world_matrix(Node node) const { return world[index_of[node]]; }
+
+    // recomputes world matrices of dirty subtrees, returns the number of recomputed nodes
+    size_t update(void);
+    // forces the next update() to recompute every node
+    void mark_all_dirty(void);
+
+    // depth-sorted storage, for systems that walk all nodes (valid after update())
+    const glm::mat4* world_matrices(void) const { return world.data(); }
+    Node node_at(size_t index) const { return node_of[index]; }
+
+private:
+    void sort_by_depth(void);
+    size_t update_range(size_t begin, size_t end);
+
+    // indexed by storage position
+    std::vector<uint32_t> parents;          // storage index of the parent or INVALID_NODE
+    std::vector<uint32_t> depths;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    std::vector<glm::mat4> world;
+    std::vector<uint8_t> dirty;             // local transform changed, or inherited from parent during update()
+    std::vector<Node> node_of;
+
+    std::vector<uint32_t> index_of;         // handle -> storage position
+    std::vector<size_t> level_offsets;      // level d occupies [level_offsets[d], level_offsets[d + 1])
+    bool unsorted = false;
+    bool any_dirty = false;
+};
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "ShaderLibrary.h"
+#include "GLStateCache.h"
+
+namespace {
+
+// whole identifier match, "FOG" is not found in "FOG_DENSITY"
+bool mentions(const std::string& text, const std::string& identifier)
+{
+    const auto is_identifier = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+    for (size_t at = text.find(identifier); at != std::string::npos; at = text.find(identifier, at + 1)) {
+        const size_t end = at + identifier.size();
+        if ((at == 0 || !is_identifier(text[at - 1])) && (end == text.size() || !is_identifier(text[end])))
+            return true;
+    }
+    return false;
+}
+
+// file name of an '#include "file"' line, empty for any other line
+std::string include_target(const std::string& line)
+{
+    size_t at = line.find_first_not_of(" \t");
+    if (at == std::string::npos || line.compare(at, 8, "#include") != 0)
+        return std::string();
+    const size_t open = line.find('"', at + 8);
+    const size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+    if (close == std::string::npos)
+        throw std::runtime_error("Malformed shader include: " + line);
+    return line.substr(open + 1, close - open - 1);
+}
+
+}
+
+ShaderLibrary::ShaderLibrary(const std::string& directory, ProgramCache& programs)
+    : directory(directory), programs(programs)
+{
+}
+
+ShaderLibrary::~ShaderLibrary()
+{
+    clear();
+}
+
+std::string ShaderLibrary::read(const std::string& file) const
+{
+    std::ifstream in(std::filesystem::path(directory) / file, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Shader file not found: " + (std::filesystem::path(directory) / file).string());
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+void ShaderLibrary::expand(const std::string& file, std::vector<std::string>& files, std::string& out) const
+{
+    const int number = static_cast<int>(files.size());
+    files.push_back(file);
+
+    std::istringstream in(read(file));
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        const std::string target = include_target(line);
+        if (target.empty()) {
+            out += line;
+            out += '\n';
+            continue;
+        }
+        // included once per stage, which also ends include cycles
+        if (std::find(files.begin(), files.end(), target) == files.end()) {
+            out += "#line 1 " + std::to_string(files.size()) + '\n';
+            expand(target, files, out);
+        }
+        out += "#line " + std::to_string(line_number + 1) + ' ' + std::to_string(number) + '\n';
+    }
+}
+
+uint32_t ShaderLibrary::add_program(const std::string& name, const std::vector<ShaderFile>& files)
+{
+    Program program;
+    program.name = name;
+    for (const ShaderFile& file : files) {
+        ShaderStage stage = { file.type, std::string() };
+        program.files.emplace_back();
+        expand(file.file, program.files.back(), stage.source);
+        program.stages.push_back(std::move(stage));
+    }
+    sources.push_back(std::move(program));
+    return static_cast<uint32_t>(sources.size() - 1);
+}
+
+uint32_t ShaderLibrary::feature(const std::string& define)
+{
+    auto found = std::find(features.begin(), features.end(), define);
+    if (found == features.end()) {
+        if (features.size() == MAX_FEATURES)
+            throw std::runtime_error("Too many shader features, cannot add " + define);
+        found = features.insert(features.end(), define);
+    }
+    return 1u << (found - features.begin());
+}
+
+std::vector<ShaderStage> ShaderLibrary::variant_sources(const Program& program, uint32_t features) const
+{
+    std::string defines;
+    for (size_t bit = 0; bit < this->features.size(); ++bit)
+        if (features & (1u << bit))
+            defines += "#define " + this->features[bit] + '\n';
+
+    std::vector<ShaderStage> stages = program.stages;
+    for (ShaderStage& stage : stages) {
+        // right after #version, which has to stay the first line
+        const size_t version = stage.source.find("#version");
+        const size_t at = version == std::string::npos ? 0 : stage.source.find('\n', version) + 1;
+        stage.source.insert(at, defines + "#line 2 0\n");
+    }
+    return stages;
+}
+
+std::string ShaderLibrary::source_names(const Program& program) const
+{
+    std::string names;
+    for (const std::vector<std::string>& files : program.files) {
+        names += "\n ";
+        for (size_t n = 0; n < files.size(); ++n)
+            names += ' ' + std::to_string(n) + " = " + files[n];
+    }
+    return names;
+}
+
+GLuint ShaderLibrary::build(uint32_t program, uint32_t features)
+{
+    precompile({ { program, features } });
+    return variants.at(variant_key(program, features));
+}
+
+uint32_t ShaderLibrary::used_features(const Program& program, uint32_t features) const
+{
+    uint32_t used = 0;
+    for (size_t bit = 0; bit < this->features.size(); ++bit)
+        if (features & (1u << bit))
+            for (const ShaderStage& stage : program.stages)
+                if (mentions(stage.source, this->features[bit]))
+                    used |= 1u << bit;
+    return used;
+}
+
+void ShaderLibrary::precompile(const std::vector<std::pair<uint32_t, uint32_t>>& program_features)
+{
+    struct Pending {
+        uint32_t program;
+        uint64_t source_hash;
+        std::vector<ShaderStage> stages;
+        ProgramCache::Build build;
+    };
+    std::vector<Pending> pending;
+    std::vector<std::pair<uint64_t, uint64_t>> added;      // variant key, source hash
+
+    for (const auto& variant : program_features) {
+        const uint64_t key = variant_key(variant.first, variant.second);
+        if (variants.count(key))
+            continue;
+        const Program& program = sources.at(variant.first);
+
+        // features the program never mentions make no difference
+        std::vector<ShaderStage> stages = variant_sources(program, used_features(program, variant.second));
+        const uint64_t source_hash = ProgramCache::hash(stages, std::string());
+        const auto shared = by_source.find(source_hash);
+        if (shared != by_source.end()) {
+            variants[key] = shared->second;
+            continue;
+        }
+        // the same permutation twice in this batch is built once
+        if (std::none_of(pending.begin(), pending.end(), [&](const Pending& p) { return p.source_hash == source_hash; })) {
+            Pending p = { variant.first, source_hash, std::move(stages), ProgramCache::Build() };
+            p.build = programs.begin(p.stages, program.name);
+            pending.push_back(std::move(p));
+        }
+        added.push_back(std::make_pair(key, source_hash));
+    }
+
+    std::string error;
+    for (Pending& p : pending) {
+        try {
+            by_source[p.source_hash] = programs.finish(p.build, p.stages);
+        }
+        catch (const std::exception& e) {
+            // the others still have to be waited for
+            if (error.empty())
+                error = std::string(e.what()) + "\nsources:" + source_names(sources[p.program]);
+        }
+    }
+
+    for (const auto& variant : added) {
+        const auto built = by_source.find(variant.second);
+        if (built != by_source.end())
+            variants[variant.first] = built->second;
+    }
+
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+void ShaderLibrary::clear(void)
+{
+    for (const auto& entry : by_source)
+        glDeleteProgram(entry.second);
+    by_source.clear();
+    variants.clear();
+    GLStateCache::global().invalidate();
+}
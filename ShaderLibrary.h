@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "ProgramCache.h"
+
+struct ShaderFile {
+    GLenum type;                        // GL_VERTEX_SHADER ...
+    std::string file;                   // relative to the library directory
+};
+
+// Shader programs loaded from files, with #include and feature variants.
+//
+// add_program() reads the stage files once and expands '#include "file"'
+// lines recursively (every file at most once per stage, #line directives keep
+// compiler messages pointing at the right file). A variant is the program
+// with a set of feature #defines injected after #version. Features a program
+// never mentions are dropped from the set first, and variants are built
+// through the ProgramCache, so permutations that end up with the same source
+// share one GL program. Variants are compiled on first use or up front with
+// precompile(); after that get() is one hash table lookup.
+class ShaderLibrary {
+public:
+    static const int MAX_FEATURES = 32;
+
+    explicit ShaderLibrary(const std::string& directory = "resources/shaders", ProgramCache& programs = ProgramCache::global());
+    ~ShaderLibrary();
+
+    ShaderLibrary(const ShaderLibrary&) = delete;
+    ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+    // reads and expands the files, throws std::runtime_error if one is missing
+    // or includes itself; nothing is compiled yet
+    uint32_t add_program(const std::string& name, const std::vector<ShaderFile>& files);
+
+    // bit of a feature #define, the same name always gets the same bit
+    uint32_t feature(const std::string& define);
+
+    // program with the features set, throws std::runtime_error with the
+    // compile or link log (and which file each source number is) on failure
+    GLuint get(uint32_t program, uint32_t features = 0)
+    {
+        const auto found = variants.find(variant_key(program, features));
+        return found != variants.end() ? found->second : build(program, features);
+    }
+
+    // builds variants ahead of use, all compiles are issued before any is
+    // waited for so the driver can run them in parallel
+    void precompile(const std::vector<std::pair<uint32_t, uint32_t>>& program_features);
+
+    // deletes the GL programs, must run while the context is current
+    void clear(void);
+
+    size_t variant_count(void) const { return variants.size(); }
+    size_t unique_program_count(void) const { return by_source.size(); }
+
+private:
+    struct Program {
+        std::string name;
+        std::vector<ShaderStage> stages;            // expanded sources
+        std::vector<std::vector<std::string>> files;   // source string number -> file, per stage
+    };
+
+    static uint64_t variant_key(uint32_t program, uint32_t features) { return static_cast<uint64_t>(program) << 32 | features; }
+
+    GLuint build(uint32_t program, uint32_t features);
+    uint32_t used_features(const Program& program, uint32_t features) const;
+    std::vector<ShaderStage> variant_sources(const Program& program, uint32_t features) const;
+    std::string source_names(const Program& program) const;
+    std::string read(const std::string& file) const;
+    void expand(const std::string& file, std::vector<std::string>& files, std::string& out) const;
+
+    std::string directory;
+    ProgramCache& programs;
+    std::vector<Program> sources;
+    std::vector<std::string> features;
+    std::unordered_map<uint64_t, GLuint> variants;      // variant_key -> program
+    std::unordered_map<uint64_t, GLuint> by_source;     // ProgramCache::hash of the sources -> program
+};
@@ -0,0 +1,166 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// glm/simd/platform.h defines GLM_ARCH; SIMD bits are set only when the
+// project is built with GLM_FORCE_INTRINSICS (see project settings).
+#include <glm/glm.hpp>
+
+// Thin wrappers over SSE2 / AVX2 registers so that a kernel can be written once
+// as a template and instantiated for the widest instruction set available.
+// 'floatv' is the preferred type, float1 is the scalar fallback.
+// Comparisons return lane masks (all bits set / cleared) in the same type.
+namespace simd {
+
+struct float1 {
+    static const int width = 1;
+    float v;
+
+    float1() = default;
+    float1(float x) : v(x) {}
+
+    static float1 load(const float* p) { return float1(*p); }
+    static float1 broadcast(float x) { return float1(x); }
+    static float1 gather(const float* base, const uint32_t* offsets) { return float1(base[offsets[0]]); }
+    void store(float* p) const { *p = v; }
+
+    static float1 from_bits(uint32_t b) { float f; std::memcpy(&f, &b, 4); return float1(f); }
+    uint32_t bits(void) const { uint32_t b; std::memcpy(&b, &v, 4); return b; }
+};
+
+inline float1 operator+(float1 a, float1 b) { return a.v + b.v; }
+inline float1 operator-(float1 a, float1 b) { return a.v - b.v; }
+inline float1 operator*(float1 a, float1 b) { return a.v * b.v; }
+inline float1 operator/(float1 a, float1 b) { return a.v / b.v; }
+inline float1 operator<(float1 a, float1 b) { return float1::from_bits(a.v < b.v ? 0xFFFFFFFFu : 0u); }
+inline float1 operator<=(float1 a, float1 b) { return float1::from_bits(a.v <= b.v ? 0xFFFFFFFFu : 0u); }
+inline float1 operator>(float1 a, float1 b) { return float1::from_bits(a.v > b.v ? 0xFFFFFFFFu : 0u); }
+inline float1 operator>=(float1 a, float1 b) { return float1::from_bits(a.v >= b.v ? 0xFFFFFFFFu : 0u); }
+inline float1 operator&(float1 a, float1 b) { return float1::from_bits(a.bits() & b.bits()); }
+inline float1 operator|(float1 a, float1 b) { return float1::from_bits(a.bits() | b.bits()); }
+inline float1 andnot(float1 a, float1 b) { return float1::from_bits(~a.bits() & b.bits()); }
+inline float1 min(float1 a, float1 b) { return a.v < b.v ? a : b; }
+inline float1 max(float1 a, float1 b) { return a.v > b.v ? a : b; }
+inline float1 sqrt(float1 a) { return std::sqrt(a.v); }
+inline float1 abs(float1 a) { return std::fabs(a.v); }
+inline float1 select(float1 mask, float1 a, float1 b) { return mask.bits() ? a : b; }
+inline int movemask(float1 mask) { return mask.bits() >> 31; }
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+struct float4 {
+    static const int width = 4;
+    __m128 v;
+
+    float4() = default;
+    float4(__m128 x) : v(x) {}
+    float4(float x) : v(_mm_set1_ps(x)) {}
+
+    static float4 load(const float* p) { return _mm_loadu_ps(p); }
+    static float4 broadcast(float x) { return _mm_set1_ps(x); }
+    static float4 gather(const float* base, const uint32_t* offsets)
+    {
+        return _mm_setr_ps(base[offsets[0]], base[offsets[1]], base[offsets[2]], base[offsets[3]]);
+    }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+inline float4 operator<(float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline float4 operator<=(float4 a, float4 b) { return _mm_cmple_ps(a.v, b.v); }
+inline float4 operator>(float4 a, float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline float4 operator>=(float4 a, float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline float4 operator&(float4 a, float4 b) { return _mm_and_ps(a.v, b.v); }
+inline float4 operator|(float4 a, float4 b) { return _mm_or_ps(a.v, b.v); }
+inline float4 andnot(float4 a, float4 b) { return _mm_andnot_ps(a.v, b.v); }
+inline float4 min(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+inline float4 max(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+inline float4 sqrt(float4 a) { return _mm_sqrt_ps(a.v); }
+inline float4 abs(float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline float4 select(float4 mask, float4 a, float4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+inline int movemask(float4 mask) { return _mm_movemask_ps(mask.v); }
+#endif
+
+#if GLM_ARCH & GLM_ARCH_AVX2_BIT
+struct float8 {
+    static const int width = 8;
+    __m256 v;
+
+    float8() = default;
+    float8(__m256 x) : v(x) {}
+    float8(float x) : v(_mm256_set1_ps(x)) {}
+
+    static float8 load(const float* p) { return _mm256_loadu_ps(p); }
+    static float8 broadcast(float x) { return _mm256_set1_ps(x); }
+    static float8 gather(const float* base, const uint32_t* offsets)
+    {
+        return _mm256_i32gather_ps(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets)), 4);
+    }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline float8 operator+(float8 a, float8 b) { return _mm256_add_ps(a.v, b.v); }
+inline float8 operator-(float8 a, float8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline float8 operator*(float8 a, float8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline float8 operator/(float8 a, float8 b) { return _mm256_div_ps(a.v, b.v); }
+inline float8 operator<(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline float8 operator<=(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline float8 operator>(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline float8 operator>=(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline float8 operator&(float8 a, float8 b) { return _mm256_and_ps(a.v, b.v); }
+inline float8 operator|(float8 a, float8 b) { return _mm256_or_ps(a.v, b.v); }
+inline float8 andnot(float8 a, float8 b) { return _mm256_andnot_ps(a.v, b.v); }
+inline float8 min(float8 a, float8 b) { return _mm256_min_ps(a.v, b.v); }
+inline float8 max(float8 a, float8 b) { return _mm256_max_ps(a.v, b.v); }
+inline float8 sqrt(float8 a) { return _mm256_sqrt_ps(a.v); }
+inline float8 abs(float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline float8 select(float8 mask, float8 a, float8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline int movemask(float8 mask) { return _mm256_movemask_ps(mask.v); }
+#endif
+
+#if GLM_ARCH & GLM_ARCH_AVX2_BIT
+typedef float8 floatv;
+#elif GLM_ARCH & GLM_ARCH_SSE2_BIT
+typedef float4 floatv;
+#else
+typedef float1 floatv;
+#endif
+
+// helpers written once for every width
+
+template <class V> inline V dot3(V ax, V ay, V az, V bx, V by, V bz) { return ax * bx + ay * by + az * bz; }
+
+template <class V> inline V clamp(V x, V lo, V hi) { return min(max(x, lo), hi); }
+
+// acos for x in [-1, 1], max error ~7e-5 rad (Abramowitz & Stegun 4.4.45)
+template <class V> inline V acos_approx(V x)
+{
+    const V ax = min(abs(x), V(1.0f));
+    V p = V(-0.0187293f);
+    p = p * ax + V(0.0742610f);
+    p = p * ax - V(0.2121144f);
+    p = p * ax + V(1.5707288f);
+    const V r = sqrt(V(1.0f) - ax) * p;
+    return select(x < V(0.0f), V(3.14159265f) - r, r);
+}
+
+// SoA registers -> V::width consecutive AoS glm::vec3 records
+template <class V> inline void store_vec3(glm::vec3* out, V x, V y, V z)
+{
+    float tx[V::width], ty[V::width], tz[V::width];
+    x.store(tx);
+    y.store(ty);
+    z.store(tz);
+    for (int l = 0; l < V::width; ++l)
+        out[l] = glm::vec3(tx[l], ty[l], tz[l]);
+}
+
+inline const char* instruction_set(void)
+{
+    return floatv::width == 8 ? "AVX2" : (floatv::width == 4 ? "SSE2" : "scalar");
+}
+
+} // namespace simd
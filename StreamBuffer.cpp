@@ -0,0 +1,100 @@
+#include <stdexcept>
+#include <string>
+
+#include "StreamBuffer.h"
+#include "GLResources.h"
+#include "GLStateCache.h"
+
+StreamBuffer::StreamBuffer(size_t frame_size)
+    : section_size(frame_size)
+{
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    clear();
+}
+
+void StreamBuffer::init_gl(void)
+{
+    clear();
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment > 0)
+        uniform_offset_alignment = static_cast<size_t>(alignment);
+
+    const GLsizeiptr size = static_cast<GLsizeiptr>(FRAMES * section_size);
+    if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        buffer_ID = gl::create_buffer(size, NULL, flags);
+        mapped = static_cast<unsigned char*>(glMapNamedBufferRange(buffer_ID, 0, size, flags));
+    }
+    else {
+        // no immutable storage either
+        glCreateBuffers(1, &buffer_ID);
+        glNamedBufferData(buffer_ID, size, NULL, GL_STREAM_DRAW);
+        staging.resize(section_size);
+    }
+    head = 0;
+    section = 0;
+}
+
+void StreamBuffer::clear(void)
+{
+    for (GLsync& fence : fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = 0;
+    }
+    if (mapped) {
+        glUnmapNamedBuffer(buffer_ID);
+        mapped = NULL;
+    }
+    if (buffer_ID) {
+        glDeleteBuffers(1, &buffer_ID);
+        // the name may come back for another buffer
+        GLStateCache::global().invalidate();
+    }
+    buffer_ID = 0;
+    staging.clear();
+}
+
+void StreamBuffer::begin_frame(void)
+{
+    GLsync& fence = fences[section];
+    if (fence) {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(fence);
+        fence = 0;
+    }
+    head = 0;
+}
+
+StreamBuffer::Allocation StreamBuffer::allocate(size_t size, size_t alignment)
+{
+    // sections start at multiples of section_size, align the absolute offset
+    const size_t base = section * section_size;
+    const size_t offset = (base + head + alignment - 1) / alignment * alignment - base;
+    if (offset + size > section_size)
+        throw std::runtime_error("Stream buffer frame section full, " + std::to_string(offset + size) + " of " + std::to_string(section_size) + " bytes");
+    head = offset + size;
+
+    Allocation allocation;
+    allocation.offset = static_cast<GLintptr>(base + offset);
+    allocation.data = mapped ? mapped + base + offset : staging.data() + offset;
+    return allocation;
+}
+
+void StreamBuffer::flush(void)
+{
+    if (mapped || head == 0)
+        return;
+    glNamedBufferSubData(buffer_ID, static_cast<GLintptr>(section * section_size), static_cast<GLsizeiptr>(head), staging.data());
+}
+
+void StreamBuffer::end_frame(void)
+{
+    fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    section = (section + 1) % FRAMES;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Ring buffer for data written by the CPU once per frame (uniform blocks,
+// instance data), one GL buffer bindable to any target.
+//
+// The buffer is split into FRAMES sections, a frame allocates from its own
+// section only. begin_frame() waits on the fence of the frame that used the
+// section last, end_frame() fences it again, so the CPU never overwrites data
+// the GPU may still read. With ARB_buffer_storage the sections are
+// persistently mapped and written in place; otherwise allocations go to a
+// staging copy that flush() uploads with one glBufferSubData.
+class StreamBuffer {
+public:
+    static const int FRAMES = 3;
+
+    struct Allocation {
+        void* data = NULL;
+        GLintptr offset = 0;            // from the start of buffer()
+    };
+
+    explicit StreamBuffer(size_t frame_size = 4 << 20);
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    // must run while the context is current
+    void init_gl(void);
+    void clear(void);
+
+    GLuint buffer(void) const { return buffer_ID; }
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, for allocations bound as uniform blocks
+    size_t uniform_alignment(void) const { return uniform_offset_alignment; }
+
+    void begin_frame(void);
+    // 'alignment' need not be a power of two, instance data aligns to its stride;
+    // throws std::runtime_error when the frame section is full
+    Allocation allocate(size_t size, size_t alignment);
+    // makes this frame's allocations visible to the GPU, before the draws using them
+    void flush(void);
+    void end_frame(void);
+
+    size_t frame_size(void) const { return section_size; }
+    size_t used(void) const { return head; }
+
+private:
+    size_t section_size;
+    size_t head = 0;                    // bytes used in the current section
+    int section = 0;
+    size_t uniform_offset_alignment = 256;
+
+    GLuint buffer_ID = 0;
+    unsigned char* mapped = NULL;       // persistent mapping, NULL = staging fallback
+    std::vector<unsigned char> staging;
+    GLsync fences[FRAMES] = {};
+};
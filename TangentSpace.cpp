@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Simd.h"
+#include "TangentSpace.h"
+#include "ThreadPool.h"
+
+namespace {
+
+const float EPSILON = 1e-20f;
+
+struct FacePass {
+    const float* positions;
+    const float* uvs;
+    const uint32_t* indices;
+    glm::vec3* normal;
+    glm::vec3* tangent;
+    glm::vec3* bitangent;
+    float* angle;
+};
+
+// W triangles starting at t, W = V::width
+template <class V>
+void face_batch(const FacePass& pass, size_t t)
+{
+    const int W = V::width;
+    uint32_t o0[W], o1[W], o2[W];
+    for (int l = 0; l < W; ++l) {
+        o0[l] = pass.indices[3 * (t + l) + 0];
+        o1[l] = pass.indices[3 * (t + l) + 1];
+        o2[l] = pass.indices[3 * (t + l) + 2];
+    }
+
+    uint32_t p0[W], p1[W], p2[W];
+    for (int l = 0; l < W; ++l) {
+        p0[l] = o0[l] * 3;
+        p1[l] = o1[l] * 3;
+        p2[l] = o2[l] * 3;
+    }
+    const V ax = V::gather(pass.positions, p0), ay = V::gather(pass.positions + 1, p0), az = V::gather(pass.positions + 2, p0);
+    const V bx = V::gather(pass.positions, p1), by = V::gather(pass.positions + 1, p1), bz = V::gather(pass.positions + 2, p1);
+    const V cx = V::gather(pass.positions, p2), cy = V::gather(pass.positions + 1, p2), cz = V::gather(pass.positions + 2, p2);
+
+    // edges p0->p1, p0->p2, p1->p2
+    const V e1x = bx - ax, e1y = by - ay, e1z = bz - az;
+    const V e2x = cx - ax, e2y = cy - ay, e2z = cz - az;
+    const V e3x = cx - bx, e3y = cy - by, e3z = cz - bz;
+
+    // unit face normal, zero for degenerate triangles
+    V nx = e1y * e2z - e1z * e2y;
+    V ny = e1z * e2x - e1x * e2z;
+    V nz = e1x * e2y - e1y * e2x;
+    const V n_len2 = simd::dot3(nx, ny, nz, nx, ny, nz);
+    const V valid = n_len2 > V(EPSILON);
+    const V n_inv = select(valid, V(1.0f) / sqrt(select(valid, n_len2, V(1.0f))), V(0.0f));
+    nx = nx * n_inv;
+    ny = ny * n_inv;
+    nz = nz * n_inv;
+
+    // corner angles
+    const V l1 = sqrt(simd::dot3(e1x, e1y, e1z, e1x, e1y, e1z));
+    const V l2 = sqrt(simd::dot3(e2x, e2y, e2z, e2x, e2y, e2z));
+    const V l3 = sqrt(simd::dot3(e3x, e3y, e3z, e3x, e3y, e3z));
+    const V tiny(EPSILON);
+    const V cos0 = simd::dot3(e1x, e1y, e1z, e2x, e2y, e2z) / max(l1 * l2, tiny);
+    const V cos1 = (V(0.0f) - simd::dot3(e1x, e1y, e1z, e3x, e3y, e3z)) / max(l1 * l3, tiny);
+    const V cos2 = simd::dot3(e2x, e2y, e2z, e3x, e3y, e3z) / max(l2 * l3, tiny);
+    const V one(1.0f), minus_one(-1.0f);
+    float angles[3][W];
+    (valid & simd::acos_approx(simd::clamp(cos0, minus_one, one))).store(angles[0]);
+    (valid & simd::acos_approx(simd::clamp(cos1, minus_one, one))).store(angles[1]);
+    (valid & simd::acos_approx(simd::clamp(cos2, minus_one, one))).store(angles[2]);
+    for (int l = 0; l < W; ++l) {
+        pass.angle[3 * (t + l) + 0] = angles[0][l];
+        pass.angle[3 * (t + l) + 1] = angles[1][l];
+        pass.angle[3 * (t + l) + 2] = angles[2][l];
+    }
+
+    simd::store_vec3(pass.normal + t, nx, ny, nz);
+
+    if (!pass.uvs)
+        return;
+
+    for (int l = 0; l < W; ++l) {
+        p0[l] = o0[l] * 2;
+        p1[l] = o1[l] * 2;
+        p2[l] = o2[l] * 2;
+    }
+    const V au = V::gather(pass.uvs, p0), av = V::gather(pass.uvs + 1, p0);
+    const V du1 = V::gather(pass.uvs, p1) - au, dv1 = V::gather(pass.uvs + 1, p1) - av;
+    const V du2 = V::gather(pass.uvs, p2) - au, dv2 = V::gather(pass.uvs + 1, p2) - av;
+
+    // only the direction matters, scale by sign of the UV area instead of 1/det
+    const V det = du1 * dv2 - du2 * dv1;
+    const V uv_valid = abs(det) > V(EPSILON);
+    const V sign = uv_valid & select(det < V(0.0f), minus_one, one);
+
+    simd::store_vec3(pass.tangent + t, (e1x * dv2 - e2x * dv1) * sign, (e1y * dv2 - e2y * dv1) * sign, (e1z * dv2 - e2z * dv1) * sign);
+    simd::store_vec3(pass.bitangent + t, (e2x * du1 - e1x * du2) * sign, (e2y * du1 - e1y * du2) * sign, (e2z * du1 - e1z * du2) * sign);
+}
+
+struct CornerPass {
+    const uint32_t* indices;
+    const float* normals;
+    const float* face_tangent;
+    const float* face_bitangent;
+    const float* angle;
+    glm::vec3* tangent;
+    glm::vec3* bitangent;
+};
+
+// (x - n * dot(n, x)) normalized, zero when x is parallel to n
+template <class V>
+void project_normalize(V& x, V& y, V& z, V nx, V ny, V nz)
+{
+    const V d = simd::dot3(nx, ny, nz, x, y, z);
+    x = x - nx * d;
+    y = y - ny * d;
+    z = z - nz * d;
+    const V len2 = simd::dot3(x, y, z, x, y, z);
+    const V valid = len2 > V(EPSILON);
+    const V inv = valid & (V(1.0f) / sqrt(select(valid, len2, V(1.0f))));
+    x = x * inv;
+    y = y * inv;
+    z = z * inv;
+}
+
+// W corners starting at c: face tangent frame projected onto the vertex normal, angle weighted
+template <class V>
+void corner_batch(const CornerPass& pass, size_t c)
+{
+    const int W = V::width;
+    uint32_t vo[W], fo[W];
+    for (int l = 0; l < W; ++l) {
+        vo[l] = pass.indices[c + l] * 3;
+        fo[l] = static_cast<uint32_t>((c + l) / 3) * 3;
+    }
+    const V nx = V::gather(pass.normals, vo), ny = V::gather(pass.normals + 1, vo), nz = V::gather(pass.normals + 2, vo);
+    const V w = V::load(pass.angle + c);
+
+    V tx = V::gather(pass.face_tangent, fo), ty = V::gather(pass.face_tangent + 1, fo), tz = V::gather(pass.face_tangent + 2, fo);
+    project_normalize(tx, ty, tz, nx, ny, nz);
+    simd::store_vec3(pass.tangent + c, tx * w, ty * w, tz * w);
+
+    V bx = V::gather(pass.face_bitangent, fo), by = V::gather(pass.face_bitangent + 1, fo), bz = V::gather(pass.face_bitangent + 2, fo);
+    project_normalize(bx, by, bz, nx, ny, nz);
+    simd::store_vec3(pass.bitangent + c, bx * w, by * w, bz * w);
+}
+
+glm::vec3 any_perpendicular(const glm::vec3& n)
+{
+    const glm::vec3 axis = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    return glm::normalize(glm::cross(axis, n));
+}
+
+glm::vec3 project_normalized(const glm::vec3& v, const glm::vec3& n)
+{
+    const glm::vec3 p = v - n * glm::dot(n, v);
+    const float len2 = glm::dot(p, p);
+    return len2 > EPSILON ? p / std::sqrt(len2) : glm::vec3(0.0f);
+}
+
+float corner_angle_scalar(const glm::vec3& at, const glm::vec3& a, const glm::vec3& b)
+{
+    const glm::vec3 e1 = a - at, e2 = b - at;
+    const float d = std::sqrt(glm::dot(e1, e1) * glm::dot(e2, e2));
+    return d > EPSILON ? std::acos(glm::clamp(glm::dot(e1, e2) / d, -1.0f, 1.0f)) : 0.0f;
+}
+
+} // namespace
+
+void TangentSpaceGenerator::build_vertex_corners(const uint32_t* indices, size_t index_count, size_t vertex_count)
+{
+    // every thread owns a range of vertices and scans the whole index buffer:
+    // no atomics, and corner lists come out sorted, so sums are deterministic
+    ThreadPool& pool = ThreadPool::global();
+    const size_t parts = pool.size();
+    const size_t part_size = (vertex_count + parts - 1) / parts;
+
+    corner_offsets.assign(vertex_count + 1, 0);
+    pool.parallel_for(0, parts, 1, [&](size_t b, size_t e) {
+        const uint32_t lo = static_cast<uint32_t>(std::min(vertex_count, b * part_size));
+        const uint32_t hi = static_cast<uint32_t>(std::min(vertex_count, e * part_size));
+        for (size_t i = 0; i < index_count; ++i) {
+            const uint32_t v = indices[i];
+            if (v >= lo && v < hi)
+                ++corner_offsets[v + 1];
+        }
+    });
+    for (size_t v = 0; v < vertex_count; ++v)
+        corner_offsets[v + 1] += corner_offsets[v];
+
+    corners.resize(index_count);
+    pool.parallel_for(0, parts, 1, [&](size_t b, size_t e) {
+        const uint32_t lo = static_cast<uint32_t>(std::min(vertex_count, b * part_size));
+        const uint32_t hi = static_cast<uint32_t>(std::min(vertex_count, e * part_size));
+        std::vector<uint32_t> cursor(corner_offsets.begin() + lo, corner_offsets.begin() + hi);
+        for (size_t i = 0; i < index_count; ++i) {
+            const uint32_t v = indices[i];
+            if (v >= lo && v < hi)
+                corners[cursor[v - lo]++] = static_cast<uint32_t>(i);
+        }
+    });
+}
+
+void TangentSpaceGenerator::generate(const glm::vec3* positions, const glm::vec2* uvs, size_t vertex_count,
+                                     const uint32_t* indices, size_t index_count,
+                                     glm::vec3* normals, glm::vec4* tangents)
+{
+    const size_t triangle_count = index_count / 3;
+    const bool want_tangents = uvs != NULL && tangents != NULL;
+    ThreadPool& pool = ThreadPool::global();
+
+    face_normal.resize(triangle_count);
+    if (want_tangents) {
+        face_tangent.resize(triangle_count);
+        face_bitangent.resize(triangle_count);
+    }
+    corner_angle.resize(triangle_count * 3);
+
+    FacePass pass;
+    pass.positions = &positions[0].x;
+    pass.uvs = want_tangents ? &uvs[0].x : NULL;
+    pass.indices = indices;
+    pass.normal = face_normal.data();
+    pass.tangent = face_tangent.data();
+    pass.bitangent = face_bitangent.data();
+    pass.angle = corner_angle.data();
+
+    // pass 1: per triangle, chunks aligned to the SIMD width
+    const size_t W = simd::floatv::width;
+    const size_t batches = triangle_count / W;
+    pool.parallel_for(0, batches, 1024, [&](size_t b, size_t e) {
+        for (size_t batch = b; batch < e; ++batch)
+            face_batch<simd::floatv>(pass, batch * W);
+    });
+    for (size_t t = batches * W; t < triangle_count; ++t)
+        face_batch<simd::float1>(pass, t);
+
+    build_vertex_corners(indices, triangle_count * 3, vertex_count);
+
+    // pass 2: per vertex gather, no two threads write the same vertex
+    pool.parallel_for(0, vertex_count, 4096, [&](size_t b, size_t e) {
+        for (size_t v = b; v < e; ++v) {
+            glm::vec3 n(0.0f);
+            for (uint32_t i = corner_offsets[v]; i < corner_offsets[v + 1]; ++i) {
+                const uint32_t c = corners[i];
+                n += corner_angle[c] * face_normal[c / 3];
+            }
+            const float n_len2 = glm::dot(n, n);
+            normals[v] = n_len2 > EPSILON ? n / std::sqrt(n_len2) : glm::vec3(0.0f, 1.0f, 0.0f);
+        }
+    });
+
+    if (!want_tangents)
+        return;
+
+    // pass 3: per corner tangent frames, needs the final vertex normals
+    corner_tangent.resize(index_count);
+    corner_bitangent.resize(index_count);
+    CornerPass corner_pass;
+    corner_pass.indices = indices;
+    corner_pass.normals = &normals[0].x;
+    corner_pass.face_tangent = &face_tangent[0].x;
+    corner_pass.face_bitangent = &face_bitangent[0].x;
+    corner_pass.angle = corner_angle.data();
+    corner_pass.tangent = corner_tangent.data();
+    corner_pass.bitangent = corner_bitangent.data();
+
+    const size_t corner_count = triangle_count * 3;
+    const size_t corner_batches = corner_count / W;
+    pool.parallel_for(0, corner_batches, 1024, [&](size_t b, size_t e) {
+        for (size_t batch = b; batch < e; ++batch)
+            corner_batch<simd::floatv>(corner_pass, batch * W);
+    });
+    for (size_t c = corner_batches * W; c < corner_count; ++c)
+        corner_batch<simd::float1>(corner_pass, c);
+
+    // pass 4: per vertex tangent gather
+    pool.parallel_for(0, vertex_count, 4096, [&](size_t b, size_t e) {
+        for (size_t v = b; v < e; ++v) {
+            const glm::vec3 n = normals[v];
+            glm::vec3 t(0.0f), bt(0.0f);
+            for (uint32_t i = corner_offsets[v]; i < corner_offsets[v + 1]; ++i) {
+                t += corner_tangent[corners[i]];
+                bt += corner_bitangent[corners[i]];
+            }
+            t = project_normalized(t, n);
+            if (t == glm::vec3(0.0f))
+                t = any_perpendicular(n);
+            tangents[v] = glm::vec4(t, glm::dot(glm::cross(n, t), bt) < 0.0f ? -1.0f : 1.0f);
+        }
+    });
+}
+
+void TangentSpaceGenerator::generate_scalar(const glm::vec3* positions, const glm::vec2* uvs, size_t vertex_count,
+                                            const uint32_t* indices, size_t index_count,
+                                            glm::vec3* normals, glm::vec4* tangents)
+{
+    const bool want_tangents = uvs != NULL && tangents != NULL;
+
+    std::fill(normals, normals + vertex_count, glm::vec3(0.0f));
+    for (size_t i = 0; i + 2 < index_count; i += 3) {
+        const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        const glm::vec3 n = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+        if (glm::dot(n, n) <= EPSILON)
+            continue;
+        const glm::vec3 fn = glm::normalize(n);
+        normals[a] += fn * corner_angle_scalar(positions[a], positions[b], positions[c]);
+        normals[b] += fn * corner_angle_scalar(positions[b], positions[c], positions[a]);
+        normals[c] += fn * corner_angle_scalar(positions[c], positions[a], positions[b]);
+    }
+    for (size_t v = 0; v < vertex_count; ++v)
+        normals[v] = glm::dot(normals[v], normals[v]) > EPSILON ? glm::normalize(normals[v]) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+    if (!want_tangents)
+        return;
+
+    std::vector<glm::vec3> bitangents(vertex_count, glm::vec3(0.0f));
+    std::fill(tangents, tangents + vertex_count, glm::vec4(0.0f));
+    for (size_t i = 0; i + 2 < index_count; i += 3) {
+        const uint32_t idx[3] = { indices[i], indices[i + 1], indices[i + 2] };
+        const glm::vec3 e1 = positions[idx[1]] - positions[idx[0]];
+        const glm::vec3 e2 = positions[idx[2]] - positions[idx[0]];
+        if (glm::dot(glm::cross(e1, e2), glm::cross(e1, e2)) <= EPSILON)
+            continue;
+        const glm::vec2 d1 = uvs[idx[1]] - uvs[idx[0]];
+        const glm::vec2 d2 = uvs[idx[2]] - uvs[idx[0]];
+        const float det = d1.x * d2.y - d2.x * d1.y;
+        if (std::fabs(det) <= EPSILON)
+            continue;
+        const glm::vec3 ft = (e1 * d2.y - e2 * d1.y) / det;
+        const glm::vec3 fb = (e2 * d1.x - e1 * d2.x) / det;
+        for (int k = 0; k < 3; ++k) {
+            const uint32_t v = idx[k];
+            const float w = corner_angle_scalar(positions[v], positions[idx[(k + 1) % 3]], positions[idx[(k + 2) % 3]]);
+            tangents[v] += glm::vec4(w * project_normalized(ft, normals[v]), 0.0f);
+            bitangents[v] += w * project_normalized(fb, normals[v]);
+        }
+    }
+    for (size_t v = 0; v < vertex_count; ++v) {
+        glm::vec3 t = project_normalized(glm::vec3(tangents[v]), normals[v]);
+        if (t == glm::vec3(0.0f))
+            t = any_perpendicular(normals[v]);
+        tangents[v] = glm::vec4(t, glm::dot(glm::cross(normals[v], t), bitangents[v]) < 0.0f ? -1.0f : 1.0f);
+    }
+}
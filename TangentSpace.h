@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Normal and tangent generation for indexed triangle meshes.
+//
+// Normals are angle weighted. Tangents follow the MikkTSpace conventions:
+// per-corner tangents are projected onto the tangent plane of the vertex
+// normal, angle weighted, and the bitangent sign is stored in tangent.w
+// (bitangent = tangent.w * cross(normal, tangent.xyz)). Vertices are not
+// split, so results match MikkTSpace on meshes whose UV seams are already split.
+//
+// All passes are conflict-free: SIMD passes over triangle (corner) ranges
+// write per-face / per-corner values, passes over vertex ranges gather them
+// through a vertex -> corner table. Everything runs on ThreadPool::global().
+class TangentSpaceGenerator {
+public:
+    // uvs and tangents may be NULL when only normals are wanted
+    void generate(const glm::vec3* positions, const glm::vec2* uvs, size_t vertex_count,
+                  const uint32_t* indices, size_t index_count,
+                  glm::vec3* normals, glm::vec4* tangents);
+
+    // naive single threaded reference, scatters into vertices per triangle
+    static void generate_scalar(const glm::vec3* positions, const glm::vec2* uvs, size_t vertex_count,
+                                const uint32_t* indices, size_t index_count,
+                                glm::vec3* normals, glm::vec4* tangents);
+
+private:
+    void build_vertex_corners(const uint32_t* indices, size_t index_count, size_t vertex_count);
+
+    // scratch, kept between calls to avoid reallocation when loading many meshes
+    std::vector<glm::vec3> face_normal;
+    std::vector<glm::vec3> face_tangent;
+    std::vector<glm::vec3> face_bitangent;
+    std::vector<float> corner_angle;
+    std::vector<glm::vec3> corner_tangent;
+    std::vector<glm::vec3> corner_bitangent;
+    std::vector<uint32_t> corner_offsets;   // CSR: corners of vertex v are corners[offsets[v] .. offsets[v+1])
+    std::vector<uint32_t> corners;
+};
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include <opencv2/opencv.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Terrain.h"
+#include "GLStateCache.h"
+#include "ProgramCache.h"
+#include "ThreadPool.h"
+
+namespace {
+
+const char* terrain_vertex_shader =
+    "#version 330 core\n"
+    "layout (location = 0) in vec2 aGrid;\n"     // grid vertex in [0,1]
+    "layout (location = 1) in vec4 aNode;\n"     // chunk origin (texels), size (texels), LOD
+    "uniform mat4 uViewProj;\n"
+    "uniform vec3 uCameraPos;\n"
+    "uniform sampler2D uHeightmap;\n"
+    "uniform vec2 uHeightmapSize;\n"
+    "uniform vec4 uTerrain;\n"                   // origin x, origin z, texel size, height scale
+    "uniform float uGridSize;\n"
+    "uniform vec2 uMorph[16];\n"                 // per LOD: morph start, morph end
+    "out vec2 vTexel;\n"
+    "out vec3 vWorldPos;\n"
+    "float height(vec2 texel) {\n"
+    "  return textureLod(uHeightmap, (texel + 0.5) / uHeightmapSize, 0.0).r * uTerrain.w;\n"
+    "}\n"
+    "vec3 world(vec2 texel) {\n"
+    "  return vec3(uTerrain.x + texel.x * uTerrain.z, height(texel), uTerrain.y + texel.y * uTerrain.z);\n"
+    "}\n"
+    "void main() {\n"
+    "  vec2 texel = aNode.xy + aGrid * aNode.z;\n"
+    "  int lod = int(aNode.w);\n"
+    "  float dist = distance(world(texel), uCameraPos);\n"
+    "  float morph = clamp((dist - uMorph[lod].x) / (uMorph[lod].y - uMorph[lod].x), 0.0, 1.0);\n"
+    // odd vertices slide onto the edge of the twice coarser grid
+    "  vec2 odd = fract(aGrid * uGridSize * 0.5) * 2.0 / uGridSize;\n"
+    "  texel -= odd * aNode.z * morph;\n"
+    "  vTexel = texel;\n"
+    "  vWorldPos = world(texel);\n"
+    "  gl_Position = uViewProj * vec4(vWorldPos, 1.0);\n"
+    "}\n";
+
+const char* terrain_fragment_shader =
+    "#version 330 core\n"
+    "uniform sampler2D uHeightmap;\n"
+    "uniform vec2 uHeightmapSize;\n"
+    "uniform vec4 uTerrain;\n"
+    "in vec2 vTexel;\n"
+    "in vec3 vWorldPos;\n"
+    "out vec4 FragColor;\n"
+    "float height(vec2 texel) {\n"
+    "  return textureLod(uHeightmap, (texel + 0.5) / uHeightmapSize, 0.0).r * uTerrain.w;\n"
+    "}\n"
+    "void main() {\n"
+    "  float hl = height(vTexel - vec2(1.0, 0.0));\n"
+    "  float hr = height(vTexel + vec2(1.0, 0.0));\n"
+    "  float hd = height(vTexel - vec2(0.0, 1.0));\n"
+    "  float hu = height(vTexel + vec2(0.0, 1.0));\n"
+    "  vec3 n = normalize(vec3(hl - hr, 2.0 * uTerrain.z, hd - hu));\n"
+    "  vec3 sun = normalize(vec3(0.4, 0.8, 0.3));\n"
+    "  vec3 albedo = mix(vec3(0.30, 0.45, 0.20), vec3(0.55, 0.50, 0.45), smoothstep(0.6, 0.9, 1.0 - n.y));\n"
+    "  FragColor = vec4(albedo * (0.25 + 0.75 * max(dot(n, sun), 0.0)), 1.0);\n"
+    "}\n";
+
+bool sphere_intersects_aabb(const glm::vec3& center, float radius, const glm::vec3& box_min, const glm::vec3& box_max)
+{
+    const glm::vec3 d = center - glm::clamp(center, box_min, box_max);
+    return glm::dot(d, d) <= radius * radius;
+}
+
+int next_power_of_two(int v)
+{
+    int p = 1;
+    while (p < v)
+        p <<= 1;
+    return p;
+}
+
+} // namespace
+
+Terrain::~Terrain()
+{
+    clear();
+}
+
+void Terrain::clear(void)
+{
+    if (!is_loaded())
+        return;
+    glDeleteProgram(program_ID);
+    glDeleteTextures(1, &heightmap_ID);
+    glDeleteBuffers(1, &grid_VBO_ID);
+    glDeleteBuffers(1, &grid_EBO_ID);
+    glDeleteBuffers(1, &instance_VBO_ID);
+    format.clear();
+    // the names may come back for other objects
+    GLStateCache::global().invalidate();
+    program_ID = heightmap_ID = grid_VBO_ID = grid_EBO_ID = instance_VBO_ID = 0;
+    min_max.clear();
+    instances.clear();
+}
+
+void Terrain::load(const std::string& heightmap_path, const TerrainSettings& terrain_settings)
+{
+    settings = terrain_settings;
+    if (settings.grid_size < 2 || (settings.grid_size & (settings.grid_size - 1)) != 0)
+        throw std::runtime_error("Terrain grid size must be a power of two");
+
+    cv::Mat image = cv::imread(heightmap_path, cv::IMREAD_ANYDEPTH | cv::IMREAD_GRAYSCALE);
+    if (image.empty())
+        throw std::runtime_error("Terrain heightmap not loaded: " + heightmap_path);
+    if (image.depth() != CV_16U)
+        image.convertTo(image, CV_16U, image.depth() == CV_8U ? 257.0 : 1.0);
+    if (!image.isContinuous())
+        image = image.clone();
+
+    map_width = image.cols;
+    map_height = image.rows;
+    root_size = std::max(settings.grid_size, next_power_of_two(std::max(map_width, map_height) - 1));
+    lod_count = 1;
+    while ((settings.grid_size << (lod_count - 1)) < root_size && lod_count < MAX_LOD_LEVELS)
+        ++lod_count;
+    // root chunks are limited by MAX_LOD_LEVELS on very large maps
+    root_size = settings.grid_size << (lod_count - 1);
+
+    build_min_max(image.ptr<GLushort>(), image.step1(), map_width, map_height);
+
+    // LOD ranges double with each level, the coarsest level reaches the horizon
+    lod_ranges.resize(lod_count);
+    morph_ranges.resize(lod_count);
+    float previous = 0.0f;
+    for (int level = 0; level < lod_count; ++level) {
+        float range = settings.lod0_range * static_cast<float>(1 << level);
+        if (level == lod_count - 1)
+            range = std::max(range, settings.view_distance);
+        lod_ranges[level] = range;
+        morph_ranges[level] = glm::vec2(previous + (range - previous) * settings.morph_start_ratio, range);
+        previous = range;
+    }
+
+    // heightmap texture, sampled in the vertex shader
+    heightmap_ID = gl::create_texture_2d(GL_R16, map_width, map_height);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTextureSubImage2D(heightmap_ID, 0, 0, 0, map_width, map_height, GL_RED, GL_UNSIGNED_SHORT, image.data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTextureParameteri(heightmap_ID, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(heightmap_ID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(heightmap_ID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(heightmap_ID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    create_grid_mesh();
+    create_program();
+
+    std::cout << "Terrain " << map_width << 'x' << map_height << ", " << lod_count << " LOD levels\n";
+}
+
+void Terrain::build_min_max(const GLushort* heights, size_t step, int width, int height)
+{
+    const int grid = settings.grid_size;
+    const int leaves = root_size / grid;
+
+    min_max.assign(lod_count, std::vector<MinMax>());
+    min_max[0].resize(static_cast<size_t>(leaves) * leaves);
+
+    // leaf chunks include their shared border texels, rows of leaves in parallel
+    ThreadPool::global().parallel_for(0, leaves, 1, [&](size_t row_begin, size_t row_end) {
+        for (size_t ly = row_begin; ly < row_end; ++ly) {
+            const int y0 = std::min(static_cast<int>(ly) * grid, height - 1);
+            const int y1 = std::min(static_cast<int>(ly) * grid + grid, height - 1);
+            for (int lx = 0; lx < leaves; ++lx) {
+                const int x0 = std::min(lx * grid, width - 1);
+                const int x1 = std::min(lx * grid + grid, width - 1);
+                GLushort lo = 0xFFFF, hi = 0;
+                for (int y = y0; y <= y1; ++y) {
+                    const GLushort* row = heights + y * step;
+                    for (int x = x0; x <= x1; ++x) {
+                        lo = std::min(lo, row[x]);
+                        hi = std::max(hi, row[x]);
+                    }
+                }
+                min_max[0][ly * leaves + lx] = { lo, hi };
+            }
+        }
+    });
+
+    for (int level = 1; level < lod_count; ++level) {
+        const int dim = leaves >> level;
+        const int child_dim = dim * 2;
+        const auto& children = min_max[level - 1];
+        auto& nodes = min_max[level];
+        nodes.resize(static_cast<size_t>(dim) * dim);
+        for (int y = 0; y < dim; ++y) {
+            for (int x = 0; x < dim; ++x) {
+                const MinMax& a = children[(2 * y) * child_dim + 2 * x];
+                const MinMax& b = children[(2 * y) * child_dim + 2 * x + 1];
+                const MinMax& c = children[(2 * y + 1) * child_dim + 2 * x];
+                const MinMax& d = children[(2 * y + 1) * child_dim + 2 * x + 1];
+                nodes[y * dim + x] = { std::min(std::min(a.min, b.min), std::min(c.min, d.min)),
+                                       std::max(std::max(a.max, b.max), std::max(c.max, d.max)) };
+            }
+        }
+    }
+}
+
+void Terrain::create_grid_mesh(void)
+{
+    const int grid = settings.grid_size;
+
+    std::vector<glm::vec2> grid_vertices;
+    grid_vertices.reserve((grid + 1) * (grid + 1));
+    for (int y = 0; y <= grid; ++y)
+        for (int x = 0; x <= grid; ++x)
+            grid_vertices.emplace_back(static_cast<float>(x) / grid, static_cast<float>(y) / grid);
+
+    std::vector<GLuint> indices;
+    indices.reserve(grid * grid * 6);
+    for (int y = 0; y < grid; ++y) {
+        for (int x = 0; x < grid; ++x) {
+            const GLuint i = y * (grid + 1) + x;
+            indices.insert(indices.end(), { i, i + grid + 1, i + 1, i + 1, i + grid + 1, i + grid + 2 });
+        }
+    }
+    index_count = static_cast<GLsizei>(indices.size());
+
+    format.init_gl({ { 0, 2, GL_FLOAT, 0, 0 }, { 1, 4, GL_FLOAT, offsetof(ChunkInstance, node), 1 } }, { 0, 1 });
+
+    grid_VBO_ID = gl::create_buffer(grid_vertices.size() * sizeof(glm::vec2), grid_vertices.data());
+    grid_EBO_ID = gl::create_buffer(indices.size() * sizeof(GLuint), indices.data());
+    format.vertex_buffer(0, grid_VBO_ID, 0, sizeof(glm::vec2));
+    format.index_buffer(grid_EBO_ID);
+
+    // per chunk data, refilled every frame (mutable storage, orphaned)
+    glCreateBuffers(1, &instance_VBO_ID);
+    format.vertex_buffer(1, instance_VBO_ID, 0, sizeof(ChunkInstance));
+}
+
+void Terrain::create_program(void)
+{
+    program_ID = ProgramCache::global().get({ { GL_VERTEX_SHADER, terrain_vertex_shader }, { GL_FRAGMENT_SHADER, terrain_fragment_shader } }, "Terrain");
+    program.reflect(program_ID);
+    view_projection_uniform = program.uniform<glm::mat4>("uViewProj");
+    camera_position_uniform = program.uniform<glm::vec3>("uCameraPos");
+
+    // constant uniforms are set once
+    const float origin_x = -0.5f * (map_width - 1) * settings.texel_size;
+    const float origin_z = -0.5f * (map_height - 1) * settings.texel_size;
+    GLStateCache::global().use_program(program_ID);
+    glUniform1i(glGetUniformLocation(program_ID, "uHeightmap"), 0);
+    glUniform2f(glGetUniformLocation(program_ID, "uHeightmapSize"), static_cast<float>(map_width), static_cast<float>(map_height));
+    glUniform4f(glGetUniformLocation(program_ID, "uTerrain"), origin_x, origin_z, settings.texel_size, settings.height_scale);
+    glUniform1f(glGetUniformLocation(program_ID, "uGridSize"), static_cast<float>(settings.grid_size));
+    glUniform2fv(glGetUniformLocation(program_ID, "uMorph"), lod_count, glm::value_ptr(morph_ranges[0]));
+}
+
+void Terrain::node_bounds(int level, int x, int y, glm::vec3& box_min, glm::vec3& box_max) const
+{
+    const int size = settings.grid_size << level;
+    const int dim = (root_size / settings.grid_size) >> level;
+    const MinMax& mm = min_max[level][y * dim + x];
+
+    const float origin_x = -0.5f * (map_width - 1) * settings.texel_size;
+    const float origin_z = -0.5f * (map_height - 1) * settings.texel_size;
+    const float height_unit = settings.height_scale / 65535.0f;
+
+    box_min = glm::vec3(origin_x + x * size * settings.texel_size, mm.min * height_unit, origin_z + y * size * settings.texel_size);
+    box_max = glm::vec3(origin_x + (x + 1) * size * settings.texel_size, mm.max * height_unit, origin_z + (y + 1) * size * settings.texel_size);
+}
+
+void Terrain::add_chunk(int level, int x, int y)
+{
+    const float size = static_cast<float>(settings.grid_size << level);
+    instances.push_back({ glm::vec4(x * size, y * size, size, static_cast<float>(level)) });
+}
+
+bool Terrain::select_node(int level, int x, int y, const glm::vec3& camera_position, const Frustum& frustum)
+{
+    glm::vec3 box_min, box_max;
+    node_bounds(level, x, y, box_min, box_max);
+
+    // too far for this LOD, the parent covers the area
+    if (!sphere_intersects_aabb(camera_position, lod_ranges[level], box_min, box_max))
+        return false;
+
+    // invisible, but handled
+    if (!frustum.intersects_aabb(box_min, box_max))
+        return true;
+
+    if (level == 0 || !sphere_intersects_aabb(camera_position, lod_ranges[level - 1], box_min, box_max)) {
+        add_chunk(level, x, y);
+        return true;
+    }
+
+    const int child_size = settings.grid_size << (level - 1);
+    for (int j = 0; j < 2; ++j) {
+        for (int i = 0; i < 2; ++i) {
+            const int cx = 2 * x + i;
+            const int cy = 2 * y + j;
+            // skip the padding of non power-of-two maps
+            if (cx * child_size >= map_width - 1 || cy * child_size >= map_height - 1)
+                continue;
+            if (!select_node(level - 1, cx, cy, camera_position, frustum)) {
+                // child is beyond its own range: drawn fully morphed, i.e. at this node's resolution
+                glm::vec3 child_min, child_max;
+                node_bounds(level - 1, cx, cy, child_min, child_max);
+                if (frustum.intersects_aabb(child_min, child_max))
+                    add_chunk(level - 1, cx, cy);
+            }
+        }
+    }
+    return true;
+}
+
+void Terrain::select(const glm::vec3& camera_position, const glm::mat4& view_projection)
+{
+    instances.clear();
+    if (!is_loaded())
+        return;
+    select_node(lod_count - 1, 0, 0, camera_position, Frustum::from_matrix(view_projection));
+}
+
+void Terrain::draw(const glm::mat4& view_projection, const glm::vec3& camera_position)
+{
+    select(camera_position, view_projection);
+    if (instances.empty())
+        return;
+
+    // orphan last frame's instance data
+    glNamedBufferData(instance_VBO_ID, instances.size() * sizeof(ChunkInstance), instances.data(), GL_STREAM_DRAW);
+
+    GLStateCache& state = GLStateCache::global();
+    state.use_program(program_ID);
+    program.set(view_projection_uniform, view_projection);
+    program.set(camera_position_uniform, camera_position);
+
+    state.bind_texture(0, GL_TEXTURE_2D, heightmap_ID);
+    state.bind_vertex_array(format.vao());
+    glDrawElementsInstanced(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, NULL, static_cast<GLsizei>(instances.size()));
+}
+
+glm::vec3 Terrain::center(void) const
+{
+    if (!is_loaded())
+        return glm::vec3(0.0f);
+    glm::vec3 box_min, box_max;
+    node_bounds(lod_count - 1, 0, 0, box_min, box_max);
+    return glm::vec3(0.0f, box_max.y, 0.0f);
+}
+
+void Terrain::occluder_mesh(std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices) const
+{
+    vertices.clear();
+    indices.clear();
+    if (!is_loaded())
+        return;
+
+    // leaf chunks covering the map, a corner takes the lowest minimum of the chunks around it
+    const int grid = settings.grid_size;
+    const int leaves = root_size / grid;
+    const int chunks_x = std::min(leaves, (map_width - 2) / grid + 1);
+    const int chunks_z = std::min(leaves, (map_height - 2) / grid + 1);
+    const float origin_x = -0.5f * (map_width - 1) * settings.texel_size;
+    const float origin_z = -0.5f * (map_height - 1) * settings.texel_size;
+    const float height_unit = settings.height_scale / 65535.0f;
+    const float chunk_size = grid * settings.texel_size;
+
+    for (int z = 0; z <= chunks_z; ++z) {
+        for (int x = 0; x <= chunks_x; ++x) {
+            GLushort lowest = 0xFFFF;
+            for (int cz = std::max(0, z - 1); cz <= std::min(chunks_z - 1, z); ++cz)
+                for (int cx = std::max(0, x - 1); cx <= std::min(chunks_x - 1, x); ++cx)
+                    lowest = std::min(lowest, min_max[0][cz * leaves + cx].min);
+            vertices.emplace_back(origin_x + std::min(x * chunk_size, (map_width - 1) * settings.texel_size), lowest * height_unit,
+                                  origin_z + std::min(z * chunk_size, (map_height - 1) * settings.texel_size));
+        }
+    }
+    for (int z = 0; z < chunks_z; ++z) {
+        for (int x = 0; x < chunks_x; ++x) {
+            const uint32_t i = z * (chunks_x + 1) + x;
+            indices.insert(indices.end(), { i, i + chunks_x + 1, i + 1, i + 1, i + chunks_x + 1, i + chunks_x + 2 });
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "GLResources.h"
+#include "ProgramInterface.h"
+
+struct TerrainSettings {
+    float texel_size = 1.0f;        // world units between two heightmap samples
+    float height_scale = 512.0f;    // world height of the maximal 16-bit value
+    int grid_size = 64;             // quads per chunk edge (power of two)
+    float lod0_range = 96.0f;       // view distance covered by the finest LOD
+    float morph_start_ratio = 0.66f;
+    float view_distance = 100000.0f;
+};
+
+// Heightmap terrain rendered with CDLOD (Strugar, "Continuous Distance-Dependent
+// Level of Detail for Rendering Heightmaps").
+// A quadtree of chunks is selected on the CPU every frame; all chunks share one
+// grid mesh, drawn instanced, and the vertex shader samples heights and morphs
+// vertices towards the next coarser LOD, so there are no cracks nor popping.
+class Terrain {
+public:
+    Terrain() = default;
+    ~Terrain();
+
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    // loads 16-bit (or 8-bit) greyscale image, throws std::runtime_error on failure
+    void load(const std::string& heightmap_path, const TerrainSettings& settings = TerrainSettings());
+    bool is_loaded(void) const { return program_ID != 0; }
+    // releases GL objects, must run while the context is current
+    void clear(void);
+
+    // quadtree traversal, fills the per-chunk instance list
+    void select(const glm::vec3& camera_position, const glm::mat4& view_projection);
+    // select() + one instanced draw call
+    void draw(const glm::mat4& view_projection, const glm::vec3& camera_position);
+
+    size_t selected_chunks(void) const { return instances.size(); }
+    glm::vec3 center(void) const;
+
+    // coarse mesh lying below the surface everywhere (one quad per leaf chunk,
+    // corner heights from the chunk minima), usable as an occluder
+    void occluder_mesh(std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices) const;
+
+    static const int MAX_LOD_LEVELS = 16;
+
+private:
+    struct MinMax {
+        GLushort min, max;
+    };
+
+    // chunk instance: origin in texels, size in texels, LOD level
+    struct ChunkInstance {
+        glm::vec4 node;
+    };
+
+    void build_min_max(const GLushort* heights, size_t step, int width, int height);
+    void create_grid_mesh(void);
+    void create_program(void);
+    bool select_node(int level, int x, int y, const glm::vec3& camera_position, const Frustum& frustum);
+    void node_bounds(int level, int x, int y, glm::vec3& box_min, glm::vec3& box_max) const;
+    void add_chunk(int level, int x, int y);
+
+    TerrainSettings settings;
+    int map_width = 0;
+    int map_height = 0;
+    int root_size = 0;              // texels covered by the root node (power of two)
+    int lod_count = 0;
+
+    // min/max heights per node, level 0 = leaf chunks
+    std::vector<std::vector<MinMax>> min_max;
+    std::vector<float> lod_ranges;
+    std::vector<glm::vec2> morph_ranges;
+    std::vector<ChunkInstance> instances;
+
+    GLuint program_ID = 0;
+    ProgramInterface program;
+    Uniform<glm::mat4> view_projection_uniform;
+    Uniform<glm::vec3> camera_position_uniform;
+    GLuint heightmap_ID = 0;
+    VertexFormat format;                // grid vertices at binding 0, chunk instances at binding 1
+    GLuint grid_VBO_ID = 0;
+    GLuint grid_EBO_ID = 0;
+    GLuint instance_VBO_ID = 0;
+    GLsizei index_count = 0;
+};
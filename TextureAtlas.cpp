@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <numeric>
+
+#include "TextureAtlas.h"
+#include "GLResources.h"
+#include "GLStateCache.h"
+
+void RectPacker::reset(int width, int height)
+{
+    bin_width = width;
+    bin_height = height;
+    used_area = 0;
+    free_rects.clear();
+    if (width > 0 && height > 0)
+        free_rects.push_back({ 0, 0, width, height });
+}
+
+bool RectPacker::insert(int width, int height, glm::ivec2& position)
+{
+    const Rect* best = NULL;
+    int best_short = 0, best_long = 0;
+    for (const Rect& r : free_rects) {
+        if (width > r.width || height > r.height)
+            continue;
+        const int leftover_x = r.width - width, leftover_y = r.height - height;
+        const int short_side = std::min(leftover_x, leftover_y), long_side = std::max(leftover_x, leftover_y);
+        if (!best || short_side < best_short || (short_side == best_short && long_side < best_long)) {
+            best = &r;
+            best_short = short_side;
+            best_long = long_side;
+        }
+    }
+    if (!best)
+        return false;
+
+    const Rect used = { best->x, best->y, width, height };
+    position = glm::ivec2(used.x, used.y);
+    split(used);
+    prune();
+    used_area += static_cast<long long>(width) * height;
+    return true;
+}
+
+float RectPacker::occupancy(void) const
+{
+    const long long area = static_cast<long long>(bin_width) * bin_height;
+    return area > 0 ? static_cast<float>(used_area) / static_cast<float>(area) : 0.0f;
+}
+
+void RectPacker::split(const Rect& used)
+{
+    // every free rectangle the new one overlaps is replaced by its (up to
+    // four, overlapping) maximal parts around it
+    std::vector<Rect> result;
+    result.reserve(free_rects.size() + 4);
+    for (const Rect& r : free_rects) {
+        if (used.x >= r.x + r.width || used.x + used.width <= r.x || used.y >= r.y + r.height || used.y + used.height <= r.y) {
+            result.push_back(r);
+            continue;
+        }
+        if (used.x > r.x)
+            result.push_back({ r.x, r.y, used.x - r.x, r.height });
+        if (used.x + used.width < r.x + r.width)
+            result.push_back({ used.x + used.width, r.y, r.x + r.width - used.x - used.width, r.height });
+        if (used.y > r.y)
+            result.push_back({ r.x, r.y, r.width, used.y - r.y });
+        if (used.y + used.height < r.y + r.height)
+            result.push_back({ r.x, used.y + used.height, r.width, r.y + r.height - used.y - used.height });
+    }
+    free_rects.swap(result);
+}
+
+void RectPacker::prune(void)
+{
+    auto contains = [](const Rect& outer, const Rect& inner) {
+        return inner.x >= outer.x && inner.y >= outer.y
+            && inner.x + inner.width <= outer.x + outer.width && inner.y + inner.height <= outer.y + outer.height;
+    };
+    for (size_t i = 0; i < free_rects.size(); ++i) {
+        for (size_t j = i + 1; j < free_rects.size(); ) {
+            if (contains(free_rects[j], free_rects[i])) {
+                free_rects.erase(free_rects.begin() + i);
+                --i;
+                break;
+            }
+            if (contains(free_rects[i], free_rects[j]))
+                free_rects.erase(free_rects.begin() + j);
+            else
+                ++j;
+        }
+    }
+}
+
+TextureAtlas::TextureAtlas(int gutter, int alignment)
+    : gutter(std::max(0, gutter)),
+      alignment(std::max(1, alignment))
+{
+}
+
+uint32_t TextureAtlas::add(const unsigned char* rgba, int width, int height)
+{
+    images.push_back({ std::vector<unsigned char>(rgba, rgba + static_cast<size_t>(width) * height * 4), width, height });
+    rects.push_back(glm::vec4(0.0f));
+    return static_cast<uint32_t>(images.size() - 1);
+}
+
+int TextureAtlas::cell(int extent) const
+{
+    return (extent + 2 * gutter + alignment - 1) / alignment * alignment;
+}
+
+bool TextureAtlas::build(int max_size)
+{
+    // tall images first pack noticeably tighter
+    std::vector<uint32_t> order(images.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return images[a].height != images[b].height ? images[a].height > images[b].height : images[a].width > images[b].width;
+    });
+
+    long long area = 0;
+    for (const Image& image : images)
+        area += static_cast<long long>(cell(image.width)) * cell(image.height);
+    // 2:1, 1:1, 2:1 ... from the first size with enough area
+    glm::ivec2 extent(alignment);
+    while (static_cast<long long>(extent.x) * extent.y < area) {
+        if (extent.x == extent.y)
+            extent.x *= 2;
+        else
+            extent.y *= 2;
+    }
+
+    std::vector<glm::ivec2> positions(images.size());
+    for (; extent.x <= max_size; extent.x == extent.y ? extent.x *= 2 : extent.y *= 2) {
+        packer.reset(extent.x, extent.y);
+        bool packed = true;
+        for (uint32_t id : order)
+            if (!packer.insert(cell(images[id].width), cell(images[id].height), positions[id])) {
+                packed = false;
+                break;
+            }
+        if (!packed)
+            continue;
+
+        atlas_width = extent.x;
+        atlas_height = extent.y;
+        atlas.assign(static_cast<size_t>(atlas_width) * atlas_height * 4, 0);
+        const glm::vec4 scale(1.0f / atlas_width, 1.0f / atlas_height, 1.0f / atlas_width, 1.0f / atlas_height);
+        for (size_t id = 0; id < images.size(); ++id) {
+            blit(images[id], positions[id]);
+            rects[id] = glm::vec4(positions[id].x + gutter, positions[id].y + gutter, images[id].width, images[id].height) * scale;
+        }
+        return true;
+    }
+    packer.reset(0, 0);
+    return false;
+}
+
+void TextureAtlas::blit(const Image& image, glm::ivec2 position)
+{
+    // the image with its edge rows / columns repeated over the rest of its
+    // cell, the gutter and the alignment padding: the padding is averaged
+    // into the image's mips
+    const int cell_width = cell(image.width), cell_height = cell(image.height);
+    for (int y = -gutter; y < cell_height - gutter; ++y) {
+        const int source_y = std::clamp(y, 0, image.height - 1);
+        const unsigned char* src = &image.rgba[static_cast<size_t>(source_y) * image.width * 4];
+        unsigned char* dst = &atlas[(static_cast<size_t>(position.y + gutter + y) * atlas_width + position.x + gutter) * 4];
+        for (int x = -gutter; x < cell_width - gutter; ++x) {
+            const int source_x = std::clamp(x, 0, image.width - 1);
+            std::copy(src + source_x * 4, src + source_x * 4 + 4, dst + x * 4);
+        }
+    }
+}
+
+void TextureAtlas::remap_uvs(uint32_t id, float* vertices, size_t count, size_t stride, size_t offset) const
+{
+    const glm::vec4 rect = rects[id];
+    for (size_t i = 0; i < count; ++i) {
+        float* uv = vertices + i * stride + offset;
+        uv[0] = rect.x + uv[0] * rect.z;
+        uv[1] = rect.y + uv[1] * rect.w;
+    }
+}
+
+GLsizei TextureAtlas::mip_levels(void) const
+{
+    GLsizei levels = 1;
+    for (int a = alignment; a > 1; a /= 2)
+        ++levels;
+    return std::min(levels, gl::mip_levels(atlas_width, atlas_height));
+}
+
+GLuint TextureAtlas::upload(bool srgb) const
+{
+    const GLsizei levels = mip_levels();
+    const GLuint texture_ID = gl::create_texture_2d(srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, atlas_width, atlas_height, levels);
+    GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glTextureSubImage2D(texture_ID, 0, 0, 0, atlas_width, atlas_height, GL_RGBA, GL_UNSIGNED_BYTE, atlas.data());
+    if (levels > 1)
+        glGenerateTextureMipmap(texture_ID);
+    glTextureParameteri(texture_ID, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTextureParameteri(texture_ID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(texture_ID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture_ID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture_ID;
+}
+
+TextureArrayBuilder::Slot TextureArrayBuilder::add(const unsigned char* rgba, int width, int height, bool srgb)
+{
+    uint32_t index = 0;
+    for (; index < arrays.size(); ++index) {
+        const Array& a = arrays[index];
+        if (a.width == width && a.height == height && a.srgb == srgb && a.layer_count < MAX_LAYERS)
+            break;
+    }
+    if (index == arrays.size())
+        arrays.push_back({ width, height, srgb, {}, 0 });
+
+    Array& a = arrays[index];
+    a.layers.insert(a.layers.end(), rgba, rgba + static_cast<size_t>(width) * height * 4);
+    return { index, a.layer_count++ };
+}
+
+std::vector<GLuint> TextureArrayBuilder::upload(void) const
+{
+    std::vector<GLuint> textures(arrays.size());
+    GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    for (size_t i = 0; i < arrays.size(); ++i) {
+        const Array& a = arrays[i];
+        const GLsizei levels = gl::mip_levels(a.width, a.height);
+        glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &textures[i]);
+        glTextureStorage3D(textures[i], levels, a.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, a.width, a.height, a.layer_count);
+        glTextureSubImage3D(textures[i], 0, 0, 0, 0, a.width, a.height, a.layer_count, GL_RGBA, GL_UNSIGNED_BYTE, a.layers.data());
+        if (levels > 1)
+            glGenerateTextureMipmap(textures[i]);
+        glTextureParameteri(textures[i], GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTextureParameteri(textures[i], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    return textures;
+}
+
+void TextureArrayBuilder::write_layer(uint32_t layer, float* vertices, size_t count, size_t stride, size_t offset)
+{
+    for (size_t i = 0; i < count; ++i)
+        vertices[i * stride + offset] = static_cast<float>(layer);
+}
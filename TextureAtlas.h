@@ -0,0 +1,120 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// MaxRects bin packing: the free space is kept as the list of maximal free
+// rectangles (they overlap), a rectangle goes where the shorter leftover side
+// is smallest (best short side fit).
+class RectPacker {
+public:
+    RectPacker(int width = 0, int height = 0) { reset(width, height); }
+
+    void reset(int width, int height);
+    // false when no free rectangle holds width x height
+    bool insert(int width, int height, glm::ivec2& position);
+    // used area / total area
+    float occupancy(void) const;
+
+private:
+    struct Rect {
+        int x, y, width, height;
+    };
+
+    void split(const Rect& used);
+    void prune(void);
+
+    int bin_width = 0, bin_height = 0;
+    long long used_area = 0;
+    std::vector<Rect> free_rects;
+};
+
+// Many small RGBA8 images (UI, sprites, decals) packed into one texture, so
+// draws that used to bind one texture each share a single bind.
+//
+// Every image sits in a cell that starts and ends on multiples of
+// 'alignment' (a power of two), so the first log2(alignment) mip levels
+// average texels of one image only and the atlas gets exactly those levels.
+// Its edge texels are repeated over the rest of the cell, at least 'gutter'
+// times against bilinear bleeding; alignment / 2 keeps the coarsest level
+// clean as well, and the mips never average in anything but the image.
+// Atlas UVs cannot wrap: meshes that repeat a texture keep their own one.
+class TextureAtlas {
+public:
+    explicit TextureAtlas(int gutter = 4, int alignment = 8);
+
+    // rows in GL order, copied; the id indexes uv_rect()
+    uint32_t add(const unsigned char* rgba, int width, int height);
+    // smallest power of two size (square, or twice as wide as high) that holds
+    // every image, up to max_size; false (and nothing packed) when they do not fit
+    bool build(int max_size = 4096);
+
+    // xy offset, zw scale of the image inside the atlas: atlas uv = xy + uv * zw
+    glm::vec4 uv_rect(uint32_t id) const { return rects[id]; }
+    // rewrites the texture coordinates of 'count' vertices, 'stride' and 'offset' in floats
+    void remap_uvs(uint32_t id, float* vertices, size_t count, size_t stride, size_t offset) const;
+
+    // immutable texture with the levels that keep the images apart; owned by the caller
+    GLuint upload(bool srgb) const;
+
+    int width(void) const { return atlas_width; }
+    int height(void) const { return atlas_height; }
+    GLsizei mip_levels(void) const;
+    const std::vector<unsigned char>& pixels(void) const { return atlas; }
+    float occupancy(void) const { return packer.occupancy(); }
+    size_t image_count(void) const { return images.size(); }
+
+private:
+    struct Image {
+        std::vector<unsigned char> rgba;
+        int width, height;
+    };
+
+    int cell(int extent) const;
+    void blit(const Image& image, glm::ivec2 position);
+
+    int gutter, alignment;
+    std::vector<Image> images;
+    std::vector<glm::vec4> rects;
+    std::vector<unsigned char> atlas;
+    int atlas_width = 0, atlas_height = 0;
+    RectPacker packer;
+};
+
+// Same size, same color space RGBA8 images as layers of GL_TEXTURE_2D_ARRAY
+// textures: a draw selects its image by layer index (a vertex attribute or
+// instance data), one bind serves the whole group and UVs may wrap.
+class TextureArrayBuilder {
+public:
+    struct Slot {
+        uint32_t array;                 // index into upload()'s textures
+        uint32_t layer;
+    };
+
+    // layers per array, within every GL 4.5 implementation's GL_MAX_ARRAY_TEXTURE_LAYERS
+    static const uint32_t MAX_LAYERS = 256;
+
+    // rows in GL order, copied
+    Slot add(const unsigned char* rgba, int width, int height, bool srgb);
+    // one texture per array, full mip chains; owned by the caller
+    std::vector<GLuint> upload(void) const;
+    void clear(void) { arrays.clear(); }
+
+    size_t array_count(void) const { return arrays.size(); }
+
+    // writes 'layer' into the layer component of 'count' vertices, 'stride' and 'offset' in floats
+    static void write_layer(uint32_t layer, float* vertices, size_t count, size_t stride, size_t offset);
+
+private:
+    struct Array {
+        int width, height;
+        bool srgb;
+        std::vector<unsigned char> layers;      // width * height * 4 bytes each
+        uint32_t layer_count;
+    };
+
+    std::vector<Array> arrays;
+};
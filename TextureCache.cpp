@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+#include "TextureCache.h"
+#include "GLStateCache.h"
+#include "TextureLoader.h"
+
+namespace {
+
+const uint32_t FILE_MAGIC = 0x31544342;      // "BCT1"
+const uint32_t COOK_VERSION = 1;             // bump when the encoder or the mip filter changes
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t format;
+    uint64_t key;
+    int32_t width;
+    int32_t height;
+    uint32_t levels;
+    uint32_t srgb;
+};
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// sRGB <-> linear for filtering color mips
+struct SrgbTables {
+    float to_linear[256];
+    unsigned char to_srgb[4096];
+
+    SrgbTables()
+    {
+        for (int i = 0; i < 256; ++i) {
+            const float c = i / 255.0f;
+            to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < 4096; ++i) {
+            const float l = i / 4095.0f;
+            const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            to_srgb[i] = static_cast<unsigned char>(std::min(255.0f, c * 255.0f + 0.5f));
+        }
+    }
+};
+
+const SrgbTables& srgb_tables(void)
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+// next mip level, 2x2 box (the last row / column of odd sizes is dropped)
+std::vector<unsigned char> downsample(const std::vector<unsigned char>& src, int width, int height, bool srgb)
+{
+    const SrgbTables& tables = srgb_tables();
+    const int w = std::max(1, width / 2), h = std::max(1, height / 2);
+    std::vector<unsigned char> dst(static_cast<size_t>(w) * h * 4);
+    for (int y = 0; y < h; ++y) {
+        const unsigned char* row0 = &src[static_cast<size_t>(std::min(2 * y, height - 1)) * width * 4];
+        const unsigned char* row1 = &src[static_cast<size_t>(std::min(2 * y + 1, height - 1)) * width * 4];
+        unsigned char* out = &dst[static_cast<size_t>(y) * w * 4];
+        for (int x = 0; x < w; ++x, out += 4) {
+            const int x0 = std::min(2 * x, width - 1) * 4, x1 = std::min(2 * x + 1, width - 1) * 4;
+            for (int c = 0; c < 4; ++c) {
+                if (srgb && c < 3) {
+                    const float sum = tables.to_linear[row0[x0 + c]] + tables.to_linear[row0[x1 + c]]
+                                    + tables.to_linear[row1[x0 + c]] + tables.to_linear[row1[x1 + c]];
+                    out[c] = tables.to_srgb[static_cast<int>(sum * (4095.0f / 4.0f) + 0.5f)];
+                }
+                else {
+                    out[c] = static_cast<unsigned char>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                }
+            }
+        }
+    }
+    return dst;
+}
+
+std::vector<unsigned char> read_file(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+        throw std::runtime_error("Texture " + path + " cannot be opened");
+    std::vector<unsigned char> bytes(static_cast<size_t>(in.tellg()));
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+        throw std::runtime_error("Texture " + path + " cannot be read");
+    return bytes;
+}
+
+}
+
+size_t CompressedTexture::bytes(void) const
+{
+    size_t total = 0;
+    for (const auto& level : levels)
+        total += level.size();
+    return total;
+}
+
+TextureCache::TextureCache(const std::string& directory)
+    : directory(directory)
+{
+}
+
+TextureCache& TextureCache::global(void)
+{
+    static TextureCache cache;
+    return cache;
+}
+
+uint64_t TextureCache::hash(const std::vector<unsigned char>& encoded, BlockFormat format, bool srgb, bool flip)
+{
+    uint64_t h = fnv1a(0xCBF29CE484222325ull, encoded.data(), encoded.size());
+    const uint32_t settings[4] = { COOK_VERSION, static_cast<uint32_t>(format), srgb ? 1u : 0u, flip ? 1u : 0u };
+    return fnv1a(h, settings, sizeof(settings));
+}
+
+std::string TextureCache::path(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bct", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(directory) / name).string();
+}
+
+CompressedTexture TextureCache::get(const std::string& path, BlockFormat format, bool srgb, bool flip, ThreadPool* pool)
+{
+    return get_encoded(read_file(path), format, srgb, flip, pool);
+}
+
+CompressedTexture TextureCache::get_encoded(const std::vector<unsigned char>& encoded, BlockFormat format, bool srgb, bool flip, ThreadPool* pool)
+{
+    const uint64_t key = hash(encoded, format, srgb, flip);
+    CompressedTexture texture = load(key);
+    if (!texture.empty()) {
+        ++hit_count;
+        return texture;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const cv::Mat image = TextureLoader::normalize(cv::imdecode(encoded, cv::IMREAD_UNCHANGED));
+    if (image.empty())
+        throw std::runtime_error("Texture could not be decoded");
+    std::vector<unsigned char> rgba(static_cast<size_t>(image.cols) * image.rows * 4);
+    TextureLoader::convert_to_rgba(image, rgba.data(), flip);
+    texture = cook(rgba.data(), image.cols, image.rows, format, srgb, pool);
+    store(key, texture);
+
+    ++miss_count;
+    cook_time_us += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    return texture;
+}
+
+CompressedTexture TextureCache::cook(const unsigned char* rgba, int width, int height, BlockFormat format, bool srgb, ThreadPool* pool)
+{
+    CompressedTexture texture;
+    texture.format = format;
+    texture.srgb = srgb;
+    texture.width = width;
+    texture.height = height;
+
+    // the sRGB flag only means something for the color formats
+    const bool linear_mips = srgb && (format == BlockFormat::BC1 || format == BlockFormat::BC3);
+    std::vector<unsigned char> level(rgba, rgba + static_cast<size_t>(width) * height * 4);
+    int w = width, h = height;
+    while (true) {
+        texture.levels.emplace_back(bc::compressed_size(format, w, h));
+        bc::encode(format, level.data(), w, h, texture.levels.back().data(), pool);
+        if (w == 1 && h == 1)
+            break;
+        level = downsample(level, w, h, linear_mips);
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    return texture;
+}
+
+GLuint TextureCache::upload(const CompressedTexture& texture)
+{
+    const GLenum format = bc::gl_format(texture.format, texture.srgb);
+    const GLsizei levels = static_cast<GLsizei>(texture.levels.size());
+    GLuint texture_ID = 0;
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture_ID);
+    glTextureStorage2D(texture_ID, levels, format, texture.width, texture.height);
+    GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    for (GLsizei level = 0; level < levels; ++level) {
+        const GLsizei w = std::max(1, texture.width >> level), h = std::max(1, texture.height >> level);
+        glCompressedTextureSubImage2D(texture_ID, level, 0, 0, w, h, format,
+                                      static_cast<GLsizei>(texture.levels[level].size()), texture.levels[level].data());
+    }
+    glTextureParameteri(texture_ID, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTextureParameteri(texture_ID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return texture_ID;
+}
+
+CompressedTexture TextureCache::load(uint64_t key) const
+{
+    CompressedTexture texture;
+    const std::string file = path(key);
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+        return texture;
+
+    FileHeader header;
+    if (in.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.magic == FILE_MAGIC && header.key == key
+        && header.format <= static_cast<uint32_t>(BlockFormat::BC5) && header.width > 0 && header.height > 0 && header.levels <= 32) {
+        texture.format = static_cast<BlockFormat>(header.format);
+        texture.srgb = header.srgb != 0;
+        texture.width = header.width;
+        texture.height = header.height;
+        for (uint32_t level = 0; level < header.levels; ++level) {
+            const int w = std::max(1, header.width >> level), h = std::max(1, header.height >> level);
+            texture.levels.emplace_back(bc::compressed_size(texture.format, w, h));
+            if (!in.read(reinterpret_cast<char*>(texture.levels.back().data()), texture.levels.back().size())) {
+                texture.levels.clear();
+                break;
+            }
+        }
+    }
+    in.close();
+
+    // truncated or foreign: cooked and rewritten by the caller
+    if (texture.empty()) {
+        std::error_code error;
+        std::filesystem::remove(file, error);
+    }
+    return texture;
+}
+
+void TextureCache::store(uint64_t key, const CompressedTexture& texture) const
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    const FileHeader header = { FILE_MAGIC, static_cast<uint32_t>(texture.format), key, texture.width, texture.height,
+                                static_cast<uint32_t>(texture.levels.size()), texture.srgb ? 1u : 0u };
+
+    // written aside and renamed, a crash mid-write leaves no half file behind;
+    // the thread id keeps two threads cooking the same image apart
+    const std::string file = path(key);
+    const std::string temporary = file + '.' + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& level : texture.levels)
+            out.write(reinterpret_cast<const char*>(level.data()), level.size());
+        if (!out)
+            return;
+    }
+    std::filesystem::rename(temporary, file, error);
+    if (error)
+        std::filesystem::remove(temporary, error);
+}
+
+void TextureCache::purge(void)
+{
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+        if (entry.path().extension() == ".bct")
+            std::filesystem::remove(entry.path(), error);
+}
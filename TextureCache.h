@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "BlockCompression.h"
+#include "ThreadPool.h"
+
+struct CompressedTexture {
+    BlockFormat format = BlockFormat::BC1;
+    bool srgb = false;
+    int width = 0, height = 0;
+    std::vector<std::vector<unsigned char>> levels;     // mip 0 first, bc::compressed_size() bytes each
+
+    bool empty(void) const { return levels.empty(); }
+    size_t bytes(void) const;
+};
+
+// Block compressed mip chains cooked from image files, kept on disk.
+//
+// An entry is keyed by a 64-bit FNV-1a hash of the encoded image bytes and
+// the cook settings, so an edited image or another format misses. Mips are
+// 2x2 box filtered, in linear space for sRGB textures. A miss cooks on the
+// calling thread (block rows on 'pool') and writes the file aside before
+// renaming it; get() may run on several threads at once.
+class TextureCache {
+public:
+    explicit TextureCache(const std::string& directory = "cache/textures");
+
+    // throws std::runtime_error when the image cannot be read or decoded
+    CompressedTexture get(const std::string& path, BlockFormat format, bool srgb, bool flip = true,
+                          ThreadPool* pool = &ThreadPool::global());
+    CompressedTexture get_encoded(const std::vector<unsigned char>& encoded, BlockFormat format, bool srgb, bool flip = true,
+                                  ThreadPool* pool = &ThreadPool::global());
+
+    // RGBA8 rows in GL order -> compressed mip chain; 'pool' NULL = this thread only
+    static CompressedTexture cook(const unsigned char* rgba, int width, int height, BlockFormat format, bool srgb,
+                                  ThreadPool* pool = &ThreadPool::global());
+    // immutable texture with every level, through glCompressedTextureSubImage2D
+    static GLuint upload(const CompressedTexture& texture);
+
+    // deletes all stored textures
+    void purge(void);
+
+    uint32_t hits(void) const { return hit_count; }
+    uint32_t misses(void) const { return miss_count; }
+    double cook_ms(void) const { return cook_time_us / 1000.0; }
+
+    static uint64_t hash(const std::vector<unsigned char>& encoded, BlockFormat format, bool srgb, bool flip);
+
+    // cache shared by the texture loaders
+    static TextureCache& global(void);
+
+private:
+    std::string path(uint64_t key) const;
+    CompressedTexture load(uint64_t key) const;
+    void store(uint64_t key, const CompressedTexture& texture) const;
+
+    std::string directory;
+    std::atomic<uint32_t> hit_count{ 0 };
+    std::atomic<uint32_t> miss_count{ 0 };
+    std::atomic<uint64_t> cook_time_us{ 0 };
+};
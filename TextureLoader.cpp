@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "TextureLoader.h"
+#include "GLResources.h"
+#include "GLStateCache.h"
+
+namespace {
+
+void gray_row_scalar(const unsigned char* src, unsigned char* dst, int x, int width)
+{
+    for (; x < width; ++x) {
+        dst[4 * x + 0] = dst[4 * x + 1] = dst[4 * x + 2] = src[x];
+        dst[4 * x + 3] = 255;
+    }
+}
+
+void bgr_row_scalar(const unsigned char* src, unsigned char* dst, int x, int width)
+{
+    for (; x < width; ++x) {
+        dst[4 * x + 0] = src[3 * x + 2];
+        dst[4 * x + 1] = src[3 * x + 1];
+        dst[4 * x + 2] = src[3 * x + 0];
+        dst[4 * x + 3] = 255;
+    }
+}
+
+void bgra_row_scalar(const unsigned char* src, unsigned char* dst, int x, int width)
+{
+    for (; x < width; ++x) {
+        dst[4 * x + 0] = src[4 * x + 2];
+        dst[4 * x + 1] = src[4 * x + 1];
+        dst[4 * x + 2] = src[4 * x + 0];
+        dst[4 * x + 3] = src[4 * x + 3];
+    }
+}
+
+#if GLM_ARCH & GLM_ARCH_SSSE3_BIT
+// each returns the first pixel left for the scalar tail
+
+int gray_row_ssse3(const unsigned char* src, unsigned char* dst, int width)
+{
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        int32_t four;
+        std::memcpy(&four, src + x, 4);
+        const __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(_mm_cvtsi32_si128(four), spread), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), rgba);
+    }
+    return x;
+}
+
+int bgr_row_ssse3(const unsigned char* src, unsigned char* dst, int width)
+{
+    const __m128i swizzle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    int x = 0;
+    // a 16 byte load spans 5 1/3 pixels, it must not run past the row
+    for (; x + 6 <= width; x += 4) {
+        const __m128i bgr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), _mm_or_si128(_mm_shuffle_epi8(bgr, swizzle), alpha));
+    }
+    return x;
+}
+
+int bgra_row_ssse3(const unsigned char* src, unsigned char* dst, int width)
+{
+    const __m128i swizzle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), _mm_shuffle_epi8(bgra, swizzle));
+    }
+    return x;
+}
+#endif
+
+template <class Row>
+void convert_rows(const cv::Mat& image, unsigned char* rgba, bool flip, Row row)
+{
+    const size_t stride = static_cast<size_t>(image.cols) * 4;
+    for (int y = 0; y < image.rows; ++y) {
+        const int target = flip ? image.rows - 1 - y : y;
+        row(image.ptr(y), rgba + target * stride, image.cols);
+    }
+}
+
+bool is_ready(const std::future<void>& future)
+{
+    return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool is_ready(const std::future<cv::Mat>& future)
+{
+    return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool is_ready(const std::future<CompressedTexture>& future)
+{
+    return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+}
+
+TextureLoader::TextureLoader(size_t ring_size, unsigned int decode_threads)
+    : ring(ring_size),
+      workers(std::max(1u, decode_threads) + 1),    // ThreadPool counts a caller thread, which never decodes here
+      max_decodes(std::max(1u, decode_threads))
+{
+}
+
+TextureLoader::~TextureLoader()
+{
+    clear();
+}
+
+void TextureLoader::init_gl(void)
+{
+    clear();
+    ring.init_gl();
+
+    const unsigned char white[4] = { 255, 255, 255, 255 };
+    placeholder_ID = gl::create_texture_2d(GL_RGBA8, 1, 1);
+    GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glTextureSubImage2D(placeholder_ID, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white);
+}
+
+void TextureLoader::clear(void)
+{
+    // workers may still write into the ring
+    for (uint32_t id : active) {
+        Entry& e = entries[id];
+        if (e.decoded.valid())
+            e.decoded.wait();
+        if (e.cooked.valid())
+            e.cooked.wait();
+        if (e.converted.valid())
+            e.converted.wait();
+    }
+    ring.clear();
+
+    bool deleted = placeholder_ID != 0;
+    for (const Entry& e : entries)
+        if (e.texture) {
+            glDeleteTextures(1, &e.texture);
+            deleted = true;
+        }
+    if (placeholder_ID)
+        glDeleteTextures(1, &placeholder_ID);
+    // the names may come back for other objects
+    if (deleted)
+        GLStateCache::global().invalidate();
+    placeholder_ID = 0;
+
+    entries.clear();
+    queued.clear();
+    active.clear();
+    ready = 0;
+}
+
+uint32_t TextureLoader::load(const std::string& path, const TextureOptions& options)
+{
+    Entry entry;
+    entry.path = path;
+    entry.options = options;
+    return enqueue(std::move(entry));
+}
+
+uint32_t TextureLoader::load_encoded(std::vector<unsigned char> encoded, const TextureOptions& options)
+{
+    Entry entry;
+    entry.encoded = std::move(encoded);
+    entry.options = options;
+    return enqueue(std::move(entry));
+}
+
+uint32_t TextureLoader::enqueue(Entry entry)
+{
+    const uint32_t id = static_cast<uint32_t>(entries.size());
+    entries.push_back(std::move(entry));
+    queued.push_back(id);
+    return id;
+}
+
+GLuint TextureLoader::texture(uint32_t id) const
+{
+    if (id < entries.size() && entries[id].state == State::READY)
+        return entries[id].texture;
+    return placeholder_ID;
+}
+
+bool TextureLoader::is_ready(uint32_t id) const
+{
+    return id < entries.size() && entries[id].state == State::READY;
+}
+
+glm::ivec2 TextureLoader::size(uint32_t id) const
+{
+    if (id >= entries.size())
+        return glm::ivec2(0);
+    return glm::ivec2(entries[id].width, entries[id].height);
+}
+
+void TextureLoader::update(void)
+{
+    ring.retire();
+
+    // a few decodes in flight, oldest requests first
+    unsigned int decoding = 0;
+    for (uint32_t id : active)
+        if (entries[id].state == State::DECODING)
+            ++decoding;
+    for (; decoding < max_decodes && !queued.empty(); ++decoding) {
+        start_decode(queued.front());
+        queued.pop_front();
+    }
+
+    size_t uploaded = 0;
+    bool ring_full = false;
+    for (size_t i = 0; i < active.size(); ) {
+        const uint32_t id = active[i];
+        Entry& e = entries[id];
+        if (e.state == State::DECODING && e.cooked.valid() && ::is_ready(e.cooked)) {
+            try {
+                e.compressed = e.cooked.get();
+                if (!e.options.mipmaps)
+                    e.compressed.levels.resize(1);
+                e.state = State::DECODED;
+                e.width = e.compressed.width;
+                e.height = e.compressed.height;
+            }
+            catch (std::exception const& error) {
+                std::cerr << "Texture " << (e.path.empty() ? "<memory>" : e.path) << ": " << error.what() << '\n';
+                e.state = State::FAILED;
+            }
+        }
+        if (e.state == State::DECODING && e.decoded.valid() && ::is_ready(e.decoded)) {
+            try {
+                e.image = e.decoded.get();
+            }
+            catch (std::exception const& error) {
+                std::cerr << "Texture " << (e.path.empty() ? "<memory>" : e.path) << ": " << error.what() << '\n';
+                e.image = cv::Mat();
+            }
+            if (e.image.empty()) {
+                std::cerr << "Texture " << (e.path.empty() ? "<memory>" : e.path) << " could not be decoded\n";
+                e.state = State::FAILED;
+            }
+            else {
+                e.state = State::DECODED;
+                e.width = e.image.cols;
+                e.height = e.image.rows;
+            }
+        }
+        // ring space goes to the oldest images first
+        if (e.state == State::DECODED && !ring_full)
+            ring_full = !start_convert(id);
+        if (e.state == State::CONVERTING && ::is_ready(e.converted)) {
+            const size_t bytes = upload_size(e);
+            if (uploaded == 0 || uploaded + bytes <= frame_budget) {
+                upload(id);
+                uploaded += bytes;
+            }
+        }
+
+        if (e.state == State::READY || e.state == State::FAILED)
+            active.erase(active.begin() + i);
+        else
+            ++i;
+    }
+    // later client memory uploads (glTextureSubImage2D with a pointer) need the PBO unbound
+    if (uploaded > 0)
+        GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureLoader::start_decode(uint32_t id)
+{
+    Entry& e = entries[id];
+    e.state = State::DECODING;
+    active.push_back(id);
+    const TextureOptions options = e.options;
+    if (options.compress && !e.path.empty())
+        e.cooked = workers.submit([path = e.path, options]() { return TextureCache::global().get(path, options.format, options.srgb, options.flip, NULL); });
+    else if (options.compress)
+        e.cooked = workers.submit([encoded = std::move(e.encoded), options]() { return TextureCache::global().get_encoded(encoded, options.format, options.srgb, options.flip, NULL); });
+    else if (!e.path.empty())
+        e.decoded = workers.submit([path = e.path]() { return normalize(cv::imread(path, cv::IMREAD_UNCHANGED)); });
+    else
+        e.decoded = workers.submit([encoded = std::move(e.encoded)]() { return normalize(cv::imdecode(encoded, cv::IMREAD_UNCHANGED)); });
+}
+
+size_t TextureLoader::upload_size(const Entry& e)
+{
+    if (!e.compressed.empty()) {
+        size_t bytes = 0;
+        for (size_t level = 0; level < e.compressed.levels.size(); ++level)
+            bytes += bc::compressed_size(e.compressed.format, std::max(1, e.width >> level), std::max(1, e.height >> level));
+        return bytes;
+    }
+    return static_cast<size_t>(e.width) * e.height * 4;
+}
+
+bool TextureLoader::start_convert(uint32_t id)
+{
+    Entry& e = entries[id];
+    const size_t bytes = upload_size(e);
+    unsigned char* target;
+    if (bytes > ring.capacity()) {
+        // never fits the ring, uploaded from client memory instead
+        e.pixels.resize(bytes);
+        target = e.pixels.data();
+    }
+    else {
+        if (!ring.allocate(bytes, id, e.ring_offset))
+            return false;
+        target = ring.data(e.ring_offset);
+    }
+
+    e.state = State::CONVERTING;
+    if (!e.compressed.empty()) {
+        const GLsizei levels = static_cast<GLsizei>(e.compressed.levels.size());
+        e.texture = gl::create_texture_2d(bc::gl_format(e.compressed.format, e.compressed.srgb), e.width, e.height, levels);
+        glTextureParameteri(e.texture, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTextureParameteri(e.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // levels back to back, as upload() walks them; the data moves to the
+        // worker, the empty level vectors stay behind as the level count
+        std::vector<std::vector<unsigned char>> data(e.compressed.levels.size());
+        for (size_t level = 0; level < data.size(); ++level)
+            data[level].swap(e.compressed.levels[level]);
+        e.converted = workers.submit([data = std::move(data), target]() {
+            unsigned char* out = target;
+            for (const auto& level : data) {
+                std::memcpy(out, level.data(), level.size());
+                out += level.size();
+            }
+        });
+        return true;
+    }
+
+    const GLsizei levels = e.options.mipmaps ? gl::mip_levels(e.width, e.height) : 1;
+    e.texture = gl::create_texture_2d(e.options.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, e.width, e.height, levels);
+    glTextureParameteri(e.texture, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTextureParameteri(e.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    e.converted = workers.submit([image = e.image, target, flip = e.options.flip]() { convert_to_rgba(image, target, flip); });
+    e.image = cv::Mat();
+    return true;
+}
+
+void TextureLoader::upload(uint32_t id)
+{
+    Entry& e = entries[id];
+    e.converted.get();
+    GLStateCache& state = GLStateCache::global();
+    if (!e.compressed.empty()) {
+        const GLenum format = bc::gl_format(e.compressed.format, e.compressed.srgb);
+        const unsigned char* source = e.pixels.empty() ? reinterpret_cast<const unsigned char*>(e.ring_offset) : e.pixels.data();
+        state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, e.pixels.empty() ? ring.buffer() : 0);
+        for (size_t level = 0; level < e.compressed.levels.size(); ++level) {
+            const int w = std::max(1, e.width >> level), h = std::max(1, e.height >> level);
+            const GLsizei size = static_cast<GLsizei>(bc::compressed_size(e.compressed.format, w, h));
+            glCompressedTextureSubImage2D(e.texture, static_cast<GLint>(level), 0, 0, w, h, format, size, source);
+            source += size;
+        }
+        if (e.pixels.empty())
+            ring.fence(id);
+        std::vector<unsigned char>().swap(e.pixels);
+        e.compressed = CompressedTexture();
+        e.state = State::READY;
+        ++ready;
+        return;
+    }
+    if (e.pixels.empty()) {
+        // from the PBO: the pointer argument is an offset into it
+        state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, ring.buffer());
+        glTextureSubImage2D(e.texture, 0, 0, 0, e.width, e.height, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<const void*>(e.ring_offset));
+        ring.fence(id);
+    }
+    else {
+        state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTextureSubImage2D(e.texture, 0, 0, 0, e.width, e.height, GL_RGBA, GL_UNSIGNED_BYTE, e.pixels.data());
+        std::vector<unsigned char>().swap(e.pixels);
+    }
+    if (e.options.mipmaps)
+        glGenerateTextureMipmap(e.texture);
+    e.state = State::READY;
+    ++ready;
+}
+
+void TextureLoader::convert_to_rgba(const cv::Mat& image, unsigned char* rgba, bool flip)
+{
+#if GLM_ARCH & GLM_ARCH_SSSE3_BIT
+    switch (image.channels()) {
+    case 1:
+        convert_rows(image, rgba, flip, [](const unsigned char* src, unsigned char* dst, int width) { gray_row_scalar(src, dst, gray_row_ssse3(src, dst, width), width); });
+        break;
+    case 3:
+        convert_rows(image, rgba, flip, [](const unsigned char* src, unsigned char* dst, int width) { bgr_row_scalar(src, dst, bgr_row_ssse3(src, dst, width), width); });
+        break;
+    case 4:
+        convert_rows(image, rgba, flip, [](const unsigned char* src, unsigned char* dst, int width) { bgra_row_scalar(src, dst, bgra_row_ssse3(src, dst, width), width); });
+        break;
+    }
+#else
+    convert_to_rgba_scalar(image, rgba, flip);
+#endif
+}
+
+cv::Mat TextureLoader::normalize(cv::Mat image)
+{
+    if (image.empty())
+        return image;
+    if (image.depth() == CV_16U)
+        image.convertTo(image, CV_8U, 1.0 / 257.0);
+    else if (image.depth() != CV_8U)
+        image.convertTo(image, CV_8U, 255.0);
+    if (image.channels() == 2)
+        return cv::Mat();
+    return image;
+}
+
+void TextureLoader::convert_to_rgba_scalar(const cv::Mat& image, unsigned char* rgba, bool flip)
+{
+    switch (image.channels()) {
+    case 1:
+        convert_rows(image, rgba, flip, [](const unsigned char* src, unsigned char* dst, int width) { gray_row_scalar(src, dst, 0, width); });
+        break;
+    case 3:
+        convert_rows(image, rgba, flip, [](const unsigned char* src, unsigned char* dst, int width) { bgr_row_scalar(src, dst, 0, width); });
+        break;
+    case 4:
+        convert_rows(image, rgba, flip, [](const unsigned char* src, unsigned char* dst, int width) { bgra_row_scalar(src, dst, 0, width); });
+        break;
+    }
+}
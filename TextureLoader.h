@@ -0,0 +1,116 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "UploadRing.h"
+
+struct TextureOptions {
+    bool srgb = true;                   // color data; false for normal maps, masks ...
+    bool mipmaps = true;
+    bool flip = true;                   // image row 0 is the top, GL row 0 the bottom
+    bool compress = false;              // block compressed through TextureCache::global()
+    BlockFormat format = BlockFormat::BC1;
+};
+
+// Asynchronous image -> GL texture pipeline.
+//
+//   worker:  cv::imread / cv::imdecode, then BGR(A)/gray -> RGBA8 and the
+//            vertical flip in one SIMD pass, written straight into a
+//            persistently mapped pixel unpack buffer (PBO) ring
+//   render:  update() only polls, allocates ring space and issues
+//            glTextureSubImage2D from the PBO, which the driver copies
+//            asynchronously; a fence per upload frees its ring region
+//
+// The workers are a private ThreadPool: a decode takes tens of milliseconds
+// and must not queue ahead of frame work on ThreadPool::global() (whose
+// parallel_for callers also run queued tasks while they wait). update()
+// starts at most 'frame_budget' bytes of uploads per call, so a burst of
+// finished images spreads over frames instead of causing a spike.
+//
+// With 'compress' the worker takes the mip chain from the TextureCache (cooking
+// it on a miss, single threaded) and the levels go through the ring as they
+// are, uploaded with glCompressedTextureSubImage2D.
+//
+// Ids are valid from load() on; texture() gives a 1x1 white placeholder until
+// the image is resident (and for images that failed to load).
+class TextureLoader {
+public:
+    explicit TextureLoader(size_t ring_size = 64 << 20, unsigned int decode_threads = 2);
+    ~TextureLoader();
+
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    // must run while the context is current
+    void init_gl(void);
+    // waits for the workers, deletes all textures
+    void clear(void);
+
+    uint32_t load(const std::string& path, const TextureOptions& options = TextureOptions());
+    // an encoded image in memory (PNG, JPEG ... as read from a file or archive)
+    uint32_t load_encoded(std::vector<unsigned char> encoded, const TextureOptions& options = TextureOptions());
+
+    // render thread, once per frame
+    void update(void);
+
+    GLuint texture(uint32_t id) const;
+    bool is_ready(uint32_t id) const;
+    glm::ivec2 size(uint32_t id) const;
+
+    size_t pending(void) const { return active.size() + queued.size(); }
+    size_t ready_count(void) const { return ready; }
+    size_t ring_size(void) const { return ring.capacity(); }
+    size_t frame_budget = 16 << 20;     // upload bytes started per update()
+
+    // BGR, BGRA or gray 8-bit rows -> RGBA8, row order reversed when 'flip'
+    static void convert_to_rgba(const cv::Mat& image, unsigned char* rgba, bool flip);
+    static void convert_to_rgba_scalar(const cv::Mat& image, unsigned char* rgba, bool flip);
+    // 16-bit and float images -> 8-bit; 2 channel images come back empty
+    static cv::Mat normalize(cv::Mat image);
+
+private:
+    enum class State { QUEUED, DECODING, DECODED, CONVERTING, READY, FAILED };
+
+    struct Entry {
+        State state = State::QUEUED;
+        std::string path;                       // empty: decode 'encoded'
+        std::vector<unsigned char> encoded;
+        TextureOptions options;
+        std::future<cv::Mat> decoded;
+        std::future<CompressedTexture> cooked;
+        std::future<void> converted;
+        cv::Mat image;
+        CompressedTexture compressed;
+        size_t ring_offset = 0;
+        std::vector<unsigned char> pixels;      // images larger than the ring skip the PBO
+        GLuint texture = 0;
+        int width = 0, height = 0;
+    };
+
+    uint32_t enqueue(Entry entry);
+    // bytes the entry takes in the ring
+    static size_t upload_size(const Entry& e);
+    void start_decode(uint32_t id);
+    bool start_convert(uint32_t id);
+    void upload(uint32_t id);
+
+    UploadRing ring;
+    GLuint placeholder_ID = 0;
+
+    ThreadPool workers;
+    unsigned int max_decodes;
+    std::vector<Entry> entries;
+    std::deque<uint32_t> queued;
+    std::vector<uint32_t> active;               // decoding, decoded or converting
+    size_t ready = 0;
+};
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include "TextureStreamer.h"
+#include "GLResources.h"
+#include "GLStateCache.h"
+
+namespace {
+
+glm::ivec2 level_size(const CompressedTexture& chain, int level)
+{
+    return glm::ivec2(std::max(1, chain.width >> level), std::max(1, chain.height >> level));
+}
+
+bool is_ready(const std::future<CompressedTexture>& future)
+{
+    return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool is_ready(const std::future<void>& future)
+{
+    return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+}
+
+TextureStreamer::TextureStreamer(size_t budget, unsigned int load_threads, size_t staging_size)
+    : budget(budget),
+      staging(staging_size),
+      workers(std::max(1u, load_threads) + 1)       // ThreadPool counts a caller thread, which never loads here
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    clear();
+}
+
+void TextureStreamer::init_gl(void)
+{
+    clear();
+    staging.init_gl();
+    const unsigned char white[4] = { 255, 255, 255, 255 };
+    placeholder_ID = gl::create_texture_2d(GL_RGBA8, 1, 1);
+    GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glTextureSubImage2D(placeholder_ID, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white);
+}
+
+void TextureStreamer::clear(void)
+{
+    // workers may still write into the ring
+    bool deleted = placeholder_ID != 0;
+    for (Entry& e : entries) {
+        if (e.loaded.valid())
+            e.loaded.wait();
+        if (e.copied.valid())
+            e.copied.wait();
+        if (e.texture) {
+            glDeleteTextures(1, &e.texture);
+            deleted = true;
+        }
+    }
+    staging.clear();
+    if (placeholder_ID)
+        glDeleteTextures(1, &placeholder_ID);
+    // the names may come back for other objects
+    if (deleted)
+        GLStateCache::global().invalidate();
+    placeholder_ID = 0;
+
+    entries.clear();
+    frame = 0;
+    resident_total = 0;
+    loading = 0;
+    frame_uploads = frame_evictions = 0;
+}
+
+uint32_t TextureStreamer::add(const std::string& path, BlockFormat format, bool srgb)
+{
+    return add(path, [path, format, srgb]() { return TextureCache::global().get(path, format, srgb, true, NULL); });
+}
+
+uint32_t TextureStreamer::add(const std::string& name, std::function<CompressedTexture(void)> make)
+{
+    const uint32_t id = static_cast<uint32_t>(entries.size());
+    entries.emplace_back();
+    Entry& e = entries.back();
+    e.path = name;
+    e.loaded = workers.submit(std::move(make));
+    ++loading;
+    return id;
+}
+
+void TextureStreamer::request(uint32_t id, float screen_size)
+{
+    if (id < entries.size())
+        entries[id].footprint = std::max(entries[id].footprint, screen_size);
+}
+
+float TextureStreamer::screen_size(float radius, float distance, float projection_scale, int viewport_height)
+{
+    if (distance <= radius)
+        return static_cast<float>(viewport_height);
+    return radius / distance * projection_scale * static_cast<float>(viewport_height);
+}
+
+GLuint TextureStreamer::texture(uint32_t id) const
+{
+    if (id < entries.size() && entries[id].resident >= 0)
+        return entries[id].texture;
+    return placeholder_ID;
+}
+
+int TextureStreamer::resident_level(uint32_t id) const
+{
+    return id < entries.size() ? entries[id].resident : -1;
+}
+
+int TextureStreamer::wanted_level(uint32_t id) const
+{
+    return id < entries.size() ? entries[id].wanted : -1;
+}
+
+void TextureStreamer::update(void)
+{
+    ++frame;
+    frame_uploads = frame_evictions = 0;
+    if (placeholder_ID)
+        staging.retire();
+
+    std::vector<uint32_t> candidates;
+    for (uint32_t id = 0; id < entries.size(); ++id) {
+        Entry& e = entries[id];
+        if (e.loaded.valid() && is_ready(e.loaded))
+            finish_load(e);
+        // the tail waits for ring space like any level
+        if (e.resident < 0 && !e.chain.empty())
+            upload_tail(id);
+        if (e.resident < 0) {
+            e.footprint = 0.0f;
+            continue;
+        }
+        if (e.staged >= 0 && is_ready(e.copied))
+            upload_staged(id);
+
+        // the level whose size matches the footprint; unrequested textures
+        // keep what they wanted until eviction takes it
+        if (e.footprint > 0.0f) {
+            const float texels = static_cast<float>(std::max(e.chain.width, e.chain.height));
+            const int level = static_cast<int>(std::floor(std::log2(std::max(1.0f, texels / e.footprint))));
+            e.wanted = std::min(level, e.tail);
+            e.last_needed = frame;
+            e.footprint = 0.0f;
+        }
+        if (e.staged < 0 && e.resident > e.wanted)
+            candidates.push_back(id);
+    }
+
+    // the budget may have been lowered
+    make_room(0, NULL);
+
+    // most recently needed first, then the largest deficit; one level per
+    // texture and pass so that every texture sharpens step by step
+    std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b) {
+        const Entry& ea = entries[a];
+        const Entry& eb = entries[b];
+        if (ea.last_needed != eb.last_needed)
+            return ea.last_needed > eb.last_needed;
+        return ea.resident - ea.wanted > eb.resident - eb.wanted;
+    });
+    size_t uploaded = 0;
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (uint32_t id : candidates) {
+            Entry& e = entries[id];
+            // a texture has one level in flight at a time
+            if (e.staged >= 0 || e.resident <= e.wanted)
+                continue;
+            const size_t bytes = e.chain.levels[e.resident - 1].size();
+            if (uploaded > 0 && uploaded + bytes > frame_upload_budget)
+                break;
+            if (!make_room(bytes, &e))
+                continue;
+            if (!stage_level(id, e.resident - 1))
+                break;                  // the ring is full until the GPU catches up
+            uploaded += bytes;
+            progress = true;
+        }
+    }
+    // later client memory uploads need the PBO unbound
+    if (placeholder_ID)
+        GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureStreamer::finish_load(Entry& e)
+{
+    --loading;
+    try {
+        e.chain = e.loaded.get();
+    }
+    catch (std::exception const& error) {
+        std::cerr << "Texture " << e.path << ": " << error.what() << '\n';
+        return;
+    }
+
+    const int levels = static_cast<int>(e.chain.levels.size());
+    e.tail = levels - 1;
+    while (e.tail > 0) {
+        const glm::ivec2 size = level_size(e.chain, e.tail - 1);
+        if (std::max(size.x, size.y) > tail_size)
+            break;
+        --e.tail;
+    }
+    e.wanted = e.tail;
+
+    if (!placeholder_ID)
+        return;
+    glCreateTextures(GL_TEXTURE_2D, 1, &e.texture);
+    glTextureParameteri(e.texture, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTextureParameteri(e.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(e.texture, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+bool TextureStreamer::upload_tail(uint32_t id)
+{
+    // the tail is the floor of every texture and never evicted; a few
+    // kilobytes, copied on this thread
+    Entry& e = entries[id];
+    const int levels = static_cast<int>(e.chain.levels.size());
+    size_t bytes = 0;
+    for (int level = e.tail; level < levels; ++level)
+        bytes += e.chain.levels[level].size();
+    if (!placeholder_ID) {
+        e.resident = e.tail;
+        resident_total += bytes;
+        frame_uploads += static_cast<uint32_t>(levels - e.tail);
+        return true;
+    }
+
+    size_t offset;
+    if (!staging.allocate(bytes, id, offset))
+        return false;
+    GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer());
+    for (int level = levels - 1; level >= e.tail; --level) {
+        const std::vector<unsigned char>& data = e.chain.levels[level];
+        std::memcpy(staging.data(offset), data.data(), data.size());
+        define_level(e, level, reinterpret_cast<const void*>(offset));
+        offset += data.size();
+    }
+    staging.fence(id);
+    resident_total += bytes;
+    return true;
+}
+
+bool TextureStreamer::stage_level(uint32_t id, int level)
+{
+    Entry& e = entries[id];
+    const std::vector<unsigned char>& data = e.chain.levels[level];
+    if (!placeholder_ID) {
+        e.resident = level;
+        resident_total += data.size();
+        ++frame_uploads;
+        return true;
+    }
+    if (data.size() > staging.capacity()) {
+        // never fits the ring, defined from client memory instead
+        GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        define_level(e, level, data.data());
+        resident_total += data.size();
+        return true;
+    }
+
+    if (!staging.allocate(data.size(), id, e.staged_offset))
+        return false;
+    // the level's bytes stay put while it is staged, the chain is not touched
+    e.copied = workers.submit([source = data.data(), size = data.size(), target = staging.data(e.staged_offset)]() {
+        std::memcpy(target, source, size);
+    });
+    e.staged = level;
+    resident_total += data.size();
+    return true;
+}
+
+void TextureStreamer::upload_staged(uint32_t id)
+{
+    Entry& e = entries[id];
+    e.copied.get();
+    GLStateCache::global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer());
+    define_level(e, e.staged, reinterpret_cast<const void*>(e.staged_offset));
+    staging.fence(id);
+    e.staged = -1;
+}
+
+void TextureStreamer::define_level(Entry& e, int level, const void* pixels)
+{
+    // levels of mutable storage are only defined through a binding
+    GLStateCache::global().bind_texture(0, GL_TEXTURE_2D, e.texture);
+    const glm::ivec2 size = level_size(e.chain, level);
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, bc::gl_format(e.chain.format, e.chain.srgb), size.x, size.y, 0,
+                           static_cast<GLsizei>(e.chain.levels[level].size()), pixels);
+    glTextureParameteri(e.texture, GL_TEXTURE_BASE_LEVEL, level);
+    e.resident = level;
+    ++frame_uploads;
+}
+
+void TextureStreamer::evict_level(Entry& e)
+{
+    const int level = e.resident;
+    if (placeholder_ID) {
+        glTextureParameteri(e.texture, GL_TEXTURE_BASE_LEVEL, level + 1);
+        // outside [base, max] the level no longer has to be consistent, an empty one frees the memory
+        GLStateCache& state = GLStateCache::global();
+        state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        state.bind_texture(0, GL_TEXTURE_2D, e.texture);
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, bc::gl_format(e.chain.format, e.chain.srgb), 0, 0, 0, 0, NULL);
+    }
+    e.resident = level + 1;
+    resident_total -= e.chain.levels[level].size();
+    ++frame_evictions;
+}
+
+bool TextureStreamer::evicts_before(const Entry& a, const Entry& b) const
+{
+    const bool excess_a = a.resident < a.wanted, excess_b = b.resident < b.wanted;
+    if (excess_a != excess_b)
+        return excess_a;
+    return a.last_needed < b.last_needed;
+}
+
+bool TextureStreamer::make_room(size_t bytes, const Entry* requester)
+{
+    while (resident_total + bytes > budget) {
+        Entry* victim = NULL;
+        for (Entry& e : entries) {
+            // a staged level would land on top of the evicted one
+            if (&e == requester || e.resident < 0 || e.resident >= e.tail || e.staged >= 0)
+                continue;
+            // a texture needed as recently as the requester keeps what it needs
+            if (requester && e.resident >= e.wanted && e.last_needed >= requester->last_needed)
+                continue;
+            if (!victim || evicts_before(e, *victim))
+                victim = &e;
+        }
+        if (!victim)
+            return false;
+        evict_level(*victim);
+    }
+    return true;
+}
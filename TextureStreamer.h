@@ -0,0 +1,119 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "UploadRing.h"
+
+// Mip level streaming of block compressed textures under a VRAM budget.
+//
+// add() cooks / reads the mip chain through TextureCache::global() on a
+// private worker pool. Once it arrives, the small levels (the tail, up to
+// 'tail_size' texels) are uploaded and stay resident for good. Every frame
+// the renderer reports how large each texture appears on screen, request()
+// turns that into the finest level worth having, and update() streams the
+// missing levels one at a time, most recently needed textures first, within
+// 'frame_upload_budget'. A texture that failed to load stays the placeholder.
+//
+// A level is staged like a TextureLoader upload: update() allocates space in
+// a persistently mapped PBO ring, a worker copies the level into it, and a
+// later update() defines the level from the PBO and fences the region. Its
+// bytes count against the budget from the allocation on. Levels larger than
+// the ring are defined from client memory.
+//
+// Levels are defined individually (mutable storage), sampling is clamped to
+// the resident ones through GL_TEXTURE_BASE_LEVEL. When an upload would
+// exceed 'budget', levels of textures that were needed less recently (or
+// are finer than they are needed) are evicted: the base level is raised and
+// the level redefined empty, which releases its memory.
+//
+// Without init_gl() no GL call is made and levels are resident as soon as
+// they are staged, which keeps the bookkeeping testable without a context.
+class TextureStreamer {
+public:
+    explicit TextureStreamer(size_t budget = 256 << 20, unsigned int load_threads = 2, size_t staging_size = 32 << 20);
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // must run while the context is current
+    void init_gl(void);
+    // waits for the workers, deletes all textures
+    void clear(void);
+
+    uint32_t add(const std::string& path, BlockFormat format = BlockFormat::BC1, bool srgb = true);
+    // a chain made on a worker, generated textures; 'name' is for messages
+    uint32_t add(const std::string& name, std::function<CompressedTexture(void)> make);
+
+    // this frame's footprint: pixels covered by the texture's full UV range
+    // along its larger axis (the largest footprint of the frame counts)
+    void request(uint32_t id, float screen_size);
+    // on screen size of an object of 'radius' at 'distance', 'projection_scale' = projection[1][1]
+    static float screen_size(float radius, float distance, float projection_scale, int viewport_height);
+
+    // render thread, once per frame after the requests
+    void update(void);
+
+    // 1x1 white placeholder until the tail is resident
+    GLuint texture(uint32_t id) const;
+    // finest resident / wanted level, -1 while loading
+    int resident_level(uint32_t id) const;
+    int wanted_level(uint32_t id) const;
+
+    size_t resident_bytes(void) const { return resident_total; }
+    size_t pending(void) const { return loading; }         // loads, not staged levels
+    uint32_t uploads(void) const { return frame_uploads; }        // levels, last update()
+    uint32_t evictions(void) const { return frame_evictions; }
+
+    size_t budget;
+    size_t frame_upload_budget = 8 << 20;
+    int tail_size = 64;
+
+private:
+    struct Entry {
+        std::string path;
+        std::future<CompressedTexture> loaded;
+        CompressedTexture chain;
+        GLuint texture = 0;
+        int tail = 0;                   // first level of the always resident tail
+        int resident = -1;              // GL_TEXTURE_BASE_LEVEL
+        int wanted = -1;
+        float footprint = 0.0f;         // this frame's requests
+        uint64_t last_needed = 0;       // frame of the last request
+        int staged = -1;                // level on its way through the ring
+        size_t staged_offset = 0;
+        std::future<void> copied;
+    };
+
+    void finish_load(Entry& e);
+    // false while the ring has no room for the tail
+    bool upload_tail(uint32_t id);
+    // false while the ring has no room for the level
+    bool stage_level(uint32_t id, int level);
+    void upload_staged(uint32_t id);
+    // 'pixels' is an offset into the ring while it is bound
+    void define_level(Entry& e, int level, const void* pixels);
+    void evict_level(Entry& e);
+    // frees 'bytes' from entries ranked below 'requester', false if it cannot
+    bool make_room(size_t bytes, const Entry* requester);
+    // eviction order: levels finer than wanted first, then least recently needed
+    bool evicts_before(const Entry& a, const Entry& b) const;
+
+    std::vector<Entry> entries;
+    UploadRing staging;
+    GLuint placeholder_ID = 0;          // 0 without init_gl()
+    ThreadPool workers;
+    uint64_t frame = 0;
+    size_t resident_total = 0;
+    size_t loading = 0;
+    uint32_t frame_uploads = 0;
+    uint32_t frame_evictions = 0;
+};
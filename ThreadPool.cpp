@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <exception>
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    // caller thread is one of the participants, but submit() always
+    // needs at least one background thread
+    const unsigned int worker_count = std::max(1u, thread_count - 1);
+    for (unsigned int i = 0; i < worker_count; ++i)
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+ThreadPool& ThreadPool::global(void)
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::push(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+}
+
+bool ThreadPool::run_one(void)
+{
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty())
+            return false;
+        task = std::move(tasks.front());
+        tasks.pop_front();
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::worker_loop(void)
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+    if (end <= begin)
+        return;
+
+    const size_t count = end - begin;
+    grain = std::max<size_t>(grain, 1);
+    // a few chunks per thread keeps load balanced without flooding the queue
+    grain = std::max(grain, (count + size() * 4 - 1) / (size() * 4));
+    const size_t chunks = (count + grain - 1) / grain;
+
+    if (chunks == 1 || workers.empty()) {
+        body(begin, end);
+        return;
+    }
+
+    // shared with helper tasks, which may start after this call returned
+    struct State {
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> done{ 0 };
+        std::exception_ptr error;
+        std::mutex error_mutex;
+    };
+    auto state = std::make_shared<State>();
+    const auto* body_ptr = &body;
+
+    auto work = [state, body_ptr, begin, end, grain, chunks]() {
+        size_t chunk;
+        while ((chunk = state->next.fetch_add(1)) < chunks) {
+            const size_t b = begin + chunk * grain;
+            const size_t e = std::min(end, b + grain);
+            try {
+                (*body_ptr)(b, e);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(state->error_mutex);
+                if (!state->error)
+                    state->error = std::current_exception();
+            }
+            state->done.fetch_add(1);
+        }
+    };
+
+    const size_t helpers = std::min<size_t>(workers.size(), chunks - 1);
+    for (size_t i = 0; i < helpers; ++i)
+        push(work);
+
+    work();
+
+    // help with other queued work while the last chunks finish
+    while (state->done.load() < chunks) {
+        if (!run_one())
+            std::this_thread::yield();
+    }
+
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by the CPU side subsystems.
+// parallel_for() splits [begin, end) into chunks of at least 'grain' indices;
+// the calling thread works on chunks too, so nested calls do not deadlock.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // number of threads taking part in parallel_for (workers + caller)
+    unsigned int size(void) const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+    // body(chunk_begin, chunk_end) is called for disjoint sub-ranges
+    void parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+    template <class F>
+    auto submit(F&& f) -> std::future<decltype(f())>
+    {
+        using R = decltype(f());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        std::future<R> result = task->get_future();
+        push([task]() { (*task)(); });
+        return result;
+    }
+
+    // pool used by all subsystems, sized to the machine
+    static ThreadPool& global(void);
+
+private:
+    void push(std::function<void()> task);
+    bool run_one(void);
+    void worker_loop(void);
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+};
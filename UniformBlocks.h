@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "BufferLayout.h"
+
+// C++ mirrors of the uniform and storage blocks in resources/shaders, and
+// the binding points App assigns them to
+
+const GLuint FRAME_BLOCK_BINDING = 0;
+const GLuint MATERIAL_BLOCK_BINDING = 1;
+const GLuint LIGHTING_BLOCK_BINDING = 2;
+const GLuint SHADOW_BLOCK_BINDING = 3;
+
+// texture unit of the shadow cascades, no other pass binds it
+const GLuint SHADOW_MAP_UNIT = 3;
+
+// shader storage binding points (a separate namespace from uniform blocks)
+const GLuint LIGHT_BUFFER_BINDING = 0;
+const GLuint CLUSTER_BUFFER_BINDING = 1;
+const GLuint LIGHT_INDEX_BUFFER_BINDING = 2;
+const GLuint PALETTE_BUFFER_BINDING = 3;            // skinning.glsl, AnimationSystem::bind_palettes_ssbo()
+
+// frame.glsl: layout (std140) uniform Frame
+struct FrameBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 view_projection;
+    glm::vec3 camera_position;
+    float time;                         // seconds since start
+};
+
+static_assert(glsl::layout_matches<glsl::std140, glm::mat4, glm::mat4, glm::mat4, glm::vec3, float>({
+                  offsetof(FrameBlock, view), offsetof(FrameBlock, projection), offsetof(FrameBlock, view_projection),
+                  offsetof(FrameBlock, camera_position), offsetof(FrameBlock, time) }),
+              "FrameBlock does not follow std140");
+
+// material.glsl: layout (std140) uniform Material
+struct MaterialBlock {
+    glm::vec4 color;
+    glm::vec2 surface;                  // specular intensity, glossiness, both 0..1
+};
+
+static_assert(glsl::layout_matches<glsl::std140, glm::vec4, glm::vec2>({ offsetof(MaterialBlock, color), offsetof(MaterialBlock, surface) }),
+              "MaterialBlock does not follow std140");
+
+// lighting.glsl: layout (std140) uniform Lighting
+struct LightingBlock {
+    glm::uvec4 cluster_grid;            // tiles x, tiles y, depth slices, light count
+    glm::vec4 cluster_slicing;          // slice = log(view depth) * x + y, tile size in pixels zw
+    glm::vec4 ambient;
+};
+
+static_assert(glsl::layout_matches<glsl::std140, glm::uvec4, glm::vec4, glm::vec4>({
+                  offsetof(LightingBlock, cluster_grid), offsetof(LightingBlock, cluster_slicing), offsetof(LightingBlock, ambient) }),
+              "LightingBlock does not follow std140");
+
+// lighting.glsl: layout (std430) buffer Lights, one element
+struct GpuPointLight {
+    glm::vec4 position_radius;          // view space
+    glm::vec4 color;
+};
+
+static_assert(glsl::layout_matches<glsl::std430, glm::vec4, glm::vec4>({
+                  offsetof(GpuPointLight, position_radius), offsetof(GpuPointLight, color) }),
+              "GpuPointLight does not follow std430");
+
+// shadows.glsl: layout (std140) uniform Shadows
+const int SHADOW_CASCADES = 4;
+
+struct ShadowBlock {
+    glm::mat4 shadow_matrices[SHADOW_CASCADES];         // view space -> shadow map uv, depth
+    glm::vec4 cascade_splits;           // view depth where each cascade ends
+    glm::vec4 cascade_texels;           // world units per shadow map texel, per cascade
+    glm::vec4 sun_direction;            // view space, toward the light
+    glm::vec4 sun_color;
+};
+
+static_assert(glsl::layout_matches<glsl::std140, glm::mat4[SHADOW_CASCADES], glm::vec4, glm::vec4, glm::vec4, glm::vec4>({
+                  offsetof(ShadowBlock, shadow_matrices), offsetof(ShadowBlock, cascade_splits), offsetof(ShadowBlock, cascade_texels),
+                  offsetof(ShadowBlock, sun_direction), offsetof(ShadowBlock, sun_color) }),
+              "ShadowBlock does not follow std140");
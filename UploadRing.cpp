@@ -0,0 +1,86 @@
+#include "UploadRing.h"
+#include "GLResources.h"
+#include "GLStateCache.h"
+
+UploadRing::UploadRing(size_t capacity)
+    : ring_capacity(capacity / ALIGNMENT * ALIGNMENT)
+{
+}
+
+UploadRing::~UploadRing()
+{
+    clear();
+}
+
+void UploadRing::init_gl(void)
+{
+    clear();
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    buffer_ID = gl::create_buffer(static_cast<GLsizeiptr>(ring_capacity), NULL, flags);
+    mapped = static_cast<unsigned char*>(glMapNamedBufferRange(buffer_ID, 0, static_cast<GLsizeiptr>(ring_capacity), flags));
+}
+
+void UploadRing::clear(void)
+{
+    for (const Region& region : regions)
+        if (region.fence)
+            glDeleteSync(region.fence);
+    regions.clear();
+    head = 0;
+
+    if (mapped)
+        glUnmapNamedBuffer(buffer_ID);
+    if (buffer_ID) {
+        glDeleteBuffers(1, &buffer_ID);
+        // the name may come back for another object
+        GLStateCache::global().invalidate();
+    }
+    buffer_ID = 0;
+    mapped = NULL;
+}
+
+bool UploadRing::allocate(size_t size, uint64_t owner, size_t& offset)
+{
+    size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    if (regions.empty()) {
+        if (size > ring_capacity)
+            return false;
+        offset = 0;
+        head = size;
+        regions.push_back({ offset, size, owner, 0 });
+        return true;
+    }
+
+    // free space: [head, tail) when head < tail, else [head, end) and [0, tail);
+    // head == tail means full
+    const size_t tail = regions.front().offset;
+    if (head > tail && head + size <= ring_capacity)
+        offset = head;
+    else if (head > tail && size <= tail)
+        offset = 0;
+    else if (head < tail && head + size <= tail)
+        offset = head;
+    else
+        return false;
+    head = offset + size;
+    regions.push_back({ offset, size, owner, 0 });
+    return true;
+}
+
+void UploadRing::fence(uint64_t owner)
+{
+    for (Region& region : regions)
+        if (region.owner == owner && !region.fence)
+            region.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void UploadRing::retire(void)
+{
+    while (!regions.empty() && regions.front().fence) {
+        const GLenum status = glClientWaitSync(regions.front().fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(regions.front().fence);
+        regions.pop_front();
+    }
+}
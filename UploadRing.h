@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+#include <GL/glew.h>
+
+// Persistently mapped pixel unpack buffer (PBO) handed out as a ring, the
+// staging memory of texture uploads.
+//
+// Space is allocated on the render thread and may be written from any
+// thread (the mapping is coherent). Once the uploads reading it are issued,
+// fence() marks them, and retire() frees regions, oldest first, as the GPU
+// passes their fences. allocate() never waits: it fails while the GPU still
+// reads the space it would need. Regions are freed in allocation order, so
+// one that is never fenced holds back all later ones.
+class UploadRing {
+public:
+    static const size_t ALIGNMENT = 256;
+
+    explicit UploadRing(size_t capacity);
+    ~UploadRing();
+
+    UploadRing(const UploadRing&) = delete;
+    UploadRing& operator=(const UploadRing&) = delete;
+
+    // must run while the context is current
+    void init_gl(void);
+    // forgets all regions, the GPU must be done with them
+    void clear(void);
+
+    // 'size' bytes for the uploads of 'owner'; false when the space is still in use
+    bool allocate(size_t size, uint64_t owner, size_t& offset);
+    unsigned char* data(size_t offset) const { return mapped + offset; }
+    // the uploads from 'owner's regions are issued
+    void fence(uint64_t owner);
+    void retire(void);
+
+    GLuint buffer(void) const { return buffer_ID; }
+    size_t capacity(void) const { return ring_capacity; }
+
+private:
+    struct Region {
+        size_t offset;
+        size_t size;
+        uint64_t owner;
+        GLsync fence;                   // 0 until the uploads are issued
+    };
+
+    size_t ring_capacity;
+    size_t head = 0;
+    std::deque<Region> regions;         // in allocation order
+    GLuint buffer_ID = 0;
+    unsigned char* mapped = NULL;
+};
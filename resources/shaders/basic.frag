@@ -0,0 +1,41 @@
+#version 430
+#include "material.glsl"
+#ifdef GBUFFER
+#include "gbuffer.glsl"
+#else
+#include "lighting.glsl"
+#include "shadows.glsl"
+#endif
+
+in vec4 vColor;
+in vec3 vViewPosition;
+in vec3 vViewNormal;
+#ifdef TEXTURED
+in vec2 vTexCoord;
+uniform sampler2D uAlbedoMap;       // unit 0, a streamed texture
+#endif
+layout (location = 0) out vec4 FragColor;
+#ifdef GBUFFER
+layout (location = 1) out vec2 FragNormal;
+#endif
+
+void main() {
+    vec4 albedo = uColor * vColor;
+#ifdef TEXTURED
+    albedo *= texture(uAlbedoMap, vTexCoord);
+#endif
+    vec3 normal = normalize(gl_FrontFacing ? vViewNormal : -vViewNormal);
+#ifdef GBUFFER
+    // lit later by deferred_lighting.comp
+    FragColor = vec4(albedo.rgb, pack_surface(uSurface.x, uSurface.y));
+    FragNormal = octahedral_encode(normal);
+#else
+    Surface surface = Surface(albedo.rgb, uSurface.x, uSurface.y);
+    vec3 color = clustered_lighting(gl_FragCoord.xy, vViewPosition, normal, surface) + sun_light(vViewPosition, normal, surface);
+    FragColor = vec4(color, albedo.a);
+#ifndef TRANSLUCENT
+    // opaque objects cover the pixel whatever their color alpha
+    FragColor.a = 1.0;
+#endif
+#endif
+}
@@ -0,0 +1,41 @@
+#version 430
+#include "frame.glsl"
+#ifdef SKINNED
+#include "skinning.glsl"
+#endif
+
+layout (location = 0) in vec3 aPosition;
+layout (location = 1) in mat4 aModel;
+layout (location = 5) in vec4 aColor;
+#ifdef SKINNED
+layout (location = 6) in vec3 aNormal;
+layout (location = 7) in vec4 aJoints;      // unsigned bytes, not normalized
+layout (location = 8) in vec4 aWeights;
+#endif
+
+out vec4 vColor;
+out vec3 vViewPosition;
+out vec3 vViewNormal;
+#ifdef TEXTURED
+out vec2 vTexCoord;
+#endif
+
+void main() {
+    vColor = aColor;
+#ifdef SKINNED
+    mat4 model = aModel * skin_matrix(aJoints, aWeights);
+    vec3 normal = aNormal;
+#else
+    mat4 model = aModel;
+    // the mesh is a flat triangle facing +Z in object space
+    vec3 normal = vec3(0.0, 0.0, 1.0);
+#endif
+#ifdef TEXTURED
+    // the triangle spans -0.5..0.5 in x and y, the whole texture
+    vTexCoord = aPosition.xy + 0.5;
+#endif
+    vec4 view_position = uView * model * vec4(aPosition, 1.0);
+    vViewPosition = view_position.xyz;
+    vViewNormal = mat3(uView) * mat3(model) * normal;
+    gl_Position = uProjection * view_position;
+}
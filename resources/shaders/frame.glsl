@@ -0,0 +1,8 @@
+// per frame constants, mirrored by FrameBlock in UniformBlocks.h
+layout (std140) uniform Frame {
+    mat4 uView;
+    mat4 uProjection;
+    mat4 uViewProjection;
+    vec3 uCameraPosition;
+    float uTime;
+};
@@ -0,0 +1,9 @@
+#version 330
+
+out vec2 vTexCoord;
+
+void main() {
+    // one triangle over the whole target, no vertex buffer: ids 0, 1, 2 -> (0,0), (2,0), (0,2)
+    vTexCoord = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(vTexCoord * 2.0 - 1.0, 0.0, 1.0);
+}
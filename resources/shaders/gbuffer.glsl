@@ -0,0 +1,26 @@
+// G-buffer encoding, mirrored by the gbuffer:: helpers in DeferredRenderer.h
+//   target 0, RGBA8: albedo, specular intensity and glossiness in 4 bits each
+//   target 1, RG16:  octahedral normal
+
+vec2 octahedral_encode(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return (n.z >= 0.0 ? n.xy : folded) * 0.5 + 0.5;
+}
+
+vec3 octahedral_decode(vec2 encoded) {
+    vec2 e = encoded * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+float pack_surface(float specular, float glossiness) {
+    return (round(clamp(specular, 0.0, 1.0) * 15.0) * 16.0 + round(clamp(glossiness, 0.0, 1.0) * 15.0)) / 255.0;
+}
+
+vec2 unpack_surface(float packed) {
+    float bits = round(packed * 255.0);
+    return vec2(floor(bits / 16.0), mod(bits, 16.0)) / 15.0;
+}
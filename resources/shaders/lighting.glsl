@@ -0,0 +1,61 @@
+// clustered point lights, mirrored by LightingBlock / GpuPointLight in UniformBlocks.h
+// and filled by ClusteredLighting::upload()
+layout (std140) uniform Lighting {
+    uvec4 uClusterGrid;         // tiles x, tiles y, depth slices, light count
+    vec4 uClusterSlicing;       // slice = log(view depth) * x + y, tile size in pixels zw
+    vec4 uAmbient;
+};
+
+struct PointLight {
+    vec4 position_radius;       // view space
+    vec4 color;
+};
+
+layout (std430) readonly buffer Lights {
+    PointLight lights[];
+};
+
+// per cluster: offset into lightIndices, count
+layout (std430) readonly buffer Clusters {
+    uvec2 clusters[];
+};
+
+layout (std430) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
+// what the lighting needs to know about a surface point
+struct Surface {
+    vec3 albedo;
+    float specular;             // intensity 0..1
+    float glossiness;           // 0..1, Blinn-Phong exponent 2..256
+};
+
+// Lambert diffuse and Blinn-Phong specular for light arriving from 'direction'
+vec3 blinn_phong(vec3 direction, vec3 view_position, vec3 view_normal, Surface surface) {
+    float diffuse = max(dot(view_normal, direction), 0.0);
+    vec3 halfway = normalize(direction - normalize(view_position));
+    float specular = diffuse > 0.0 ? surface.specular * pow(max(dot(view_normal, halfway), 0.0), exp2(1.0 + 7.0 * surface.glossiness)) : 0.0;
+    return surface.albedo * diffuse + specular;
+}
+
+// one point light, quadratic falloff to zero at its radius
+vec3 point_light(PointLight light, vec3 view_position, vec3 view_normal, Surface surface) {
+    vec3 to_light = light.position_radius.xyz - view_position;
+    float distance = length(to_light);
+    float falloff = max(1.0 - distance / light.position_radius.w, 0.0);
+    return light.color.rgb * blinn_phong(to_light / max(distance, 1e-4), view_position, view_normal, surface) * falloff * falloff;
+}
+
+// all lights of the cluster at a window position (gl_FragCoord.xy)
+vec3 clustered_lighting(vec2 frag_coord, vec3 view_position, vec3 view_normal, Surface surface) {
+    uvec2 tile = min(uvec2(frag_coord / uClusterSlicing.zw), uClusterGrid.xy - 1u);
+    float slice = log(max(-view_position.z, 1e-4)) * uClusterSlicing.x + uClusterSlicing.y;
+    uint z = uint(clamp(slice, 0.0, float(uClusterGrid.z - 1u)));
+    uvec2 cluster = clusters[(z * uClusterGrid.y + tile.y) * uClusterGrid.x + tile.x];
+
+    vec3 color = uAmbient.rgb * surface.albedo;
+    for (uint i = 0u; i < cluster.y; ++i)
+        color += point_light(lights[lightIndices[cluster.x + i]], view_position, view_normal, surface);
+    return color;
+}
@@ -0,0 +1,5 @@
+// per material constants, mirrored by MaterialBlock in UniformBlocks.h
+layout (std140) uniform Material {
+    vec4 uColor;
+    vec2 uSurface;              // specular intensity, glossiness, both 0..1
+};
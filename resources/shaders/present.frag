@@ -0,0 +1,10 @@
+#version 330
+
+uniform sampler2D uSource;
+
+in vec2 vTexCoord;
+out vec4 FragColor;
+
+void main() {
+    FragColor = texture(uSource, vTexCoord);
+}
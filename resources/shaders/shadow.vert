@@ -0,0 +1,11 @@
+#version 430
+
+// shadow casters: depth only, from the scene's vertex format
+layout (location = 0) in vec3 aPosition;
+layout (location = 1) in mat4 aModel;
+
+uniform mat4 uLightViewProjection;
+
+void main() {
+    gl_Position = uLightViewProjection * aModel * vec4(aPosition, 1.0);
+}
@@ -0,0 +1,32 @@
+// the sun and its cascaded shadow maps, mirrored by ShadowBlock in UniformBlocks.h
+// and filled by CascadedShadows::block(); include after lighting.glsl
+layout (std140) uniform Shadows {
+    mat4 uShadowMatrices[4];    // view space -> shadow map uv, depth
+    vec4 uCascadeSplits;        // view depth where each cascade ends
+    vec4 uCascadeTexels;        // world units per shadow map texel, per cascade
+    vec4 uSunDirection;         // view space, toward the light
+    vec4 uSunColor;
+};
+
+uniform sampler2DArrayShadow uShadowMap;
+
+// 0 in shadow .. 1 lit, four hardware filtered taps
+float sun_shadow(vec3 view_position, vec3 view_normal) {
+    float depth = -view_position.z;
+    if (depth > uCascadeSplits.w)
+        return 1.0;
+    int cascade = depth > uCascadeSplits.x ? (depth > uCascadeSplits.y ? (depth > uCascadeSplits.z ? 3 : 2) : 1) : 0;
+    // pushed out along the normal by the cascade's texel size against acne
+    vec3 position = view_position + view_normal * uCascadeTexels[cascade] * 1.5;
+    vec4 shadow = uShadowMatrices[cascade] * vec4(position, 1.0);
+    vec2 texel = 1.0 / vec2(textureSize(uShadowMap, 0).xy);
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y += 2)
+        for (int x = -1; x <= 1; x += 2)
+            lit += texture(uShadowMap, vec4(shadow.xy + vec2(x, y) * 0.5 * texel, float(cascade), shadow.z));
+    return lit * 0.25;
+}
+
+vec3 sun_light(vec3 view_position, vec3 view_normal, Surface surface) {
+    return uSunColor.rgb * blinn_phong(uSunDirection.xyz, view_position, view_normal, surface) * sun_shadow(view_position, view_normal);
+}
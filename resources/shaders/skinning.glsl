@@ -0,0 +1,16 @@
+// skinning palettes of AnimationSystem::upload_palettes(); the instances of a
+// draw have consecutive palettes, instance i uses the uJointCount matrices
+// starting at uPaletteOffset + i * uJointCount
+layout (std430) readonly buffer Palettes {
+    mat4 uBones[];
+};
+
+uniform uint uPaletteOffset;
+uniform uint uJointCount;
+
+// linear blend of up to 4 joints, 'joints' holds whole numbers
+mat4 skin_matrix(vec4 joints, vec4 weights) {
+    uint first = uPaletteOffset + uint(gl_InstanceID) * uJointCount;
+    return weights.x * uBones[first + uint(joints.x)] + weights.y * uBones[first + uint(joints.y)]
+         + weights.z * uBones[first + uint(joints.z)] + weights.w * uBones[first + uint(joints.w)];
+}